@@ -0,0 +1,156 @@
+#include "aliassampler.h"
+
+#include <vector>
+#include <algorithm>
+
+// Vose's algorithm. Columns scaled to an average of 1 are split into small
+// (< 1) and large (>= 1) work lists; each small column is topped up from a
+// large one, which then goes back to whichever list it now belongs to.
+template <class T>
+static void buildAliasTable(const T *weights, int len, unsigned int *prob, int *alias)
+{
+	double sum_weights = 0;
+	for (int i = 0; i < len; ++i)
+		sum_weights += weights[i];
+
+	// work space is kept per thread since rows are built from several threads
+	static thread_local std::vector<double> scaled_buf;
+	static thread_local std::vector<int> small_buf, large_buf;
+	if ((int)scaled_buf.size() < len)
+	{
+		scaled_buf.resize(len);
+		small_buf.resize(len);
+		large_buf.resize(len);
+	}
+	double *scaled = scaled_buf.data();
+	int *small = small_buf.data();
+	int *large = large_buf.data();
+	int num_small = 0, num_large = 0;
+	for (int i = 0; i < len; ++i)
+	{
+		scaled[i] = sum_weights > 0 ? weights[i] * (double)len / sum_weights : 1.0;
+		if (scaled[i] < 1.0)
+			small[num_small++] = i;
+		else
+			large[num_large++] = i;
+	}
+
+	const double kScale = 4294967296.0;
+	while (num_small > 0 && num_large > 0)
+	{
+		int s = small[--num_small], l = large[--num_large];
+		prob[s] = (unsigned int)(scaled[s] * kScale);
+		alias[s] = l;
+
+		scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+		if (scaled[l] < 1.0)
+			small[num_small++] = l;
+		else
+			large[num_large++] = l;
+	}
+
+	// whatever is left is full up to rounding error
+	while (num_large > 0)
+	{
+		int l = large[--num_large];
+		prob[l] = 0xffffffffu;
+		alias[l] = l;
+	}
+	while (num_small > 0)
+	{
+		int s = small[--num_small];
+		prob[s] = 0xffffffffu;
+		alias[s] = s;
+	}
+}
+
+void AliasSampler::BuildTable(const int *weights, int len, unsigned int *prob, int *alias)
+{
+	buildAliasTable(weights, len, prob, alias);
+}
+
+void AliasSampler::BuildTable(const unsigned short *weights, int len, unsigned int *prob, int *alias)
+{
+	buildAliasTable(weights, len, prob, alias);
+}
+
+void AliasSampler::BuildTable(const float *weights, int len, unsigned int *prob, int *alias)
+{
+	buildAliasTable(weights, len, prob, alias);
+}
+
+AliasSampler::AliasSampler(const int *weights, int len)
+{
+	Init(weights, len);
+}
+
+AliasSampler::~AliasSampler()
+{
+	release();
+}
+
+void AliasSampler::Init(const int *weights, int len)
+{
+	allocate(len);
+	BuildTable(weights, len, (unsigned int*)prob_, (int*)alias_);
+}
+
+void AliasSampler::Init(const float *weights, int len)
+{
+	allocate(len);
+	BuildTable(weights, len, (unsigned int*)prob_, (int*)alias_);
+}
+
+void AliasSampler::Init(const unsigned int *prob, const int *alias, int len)
+{
+	allocate(len);
+	std::copy(prob, prob + len, (unsigned int*)prob_);
+	std::copy(alias, alias + len, (int*)alias_);
+}
+
+void AliasSampler::Attach(const unsigned int *prob, const int *alias, int len)
+{
+	release();
+
+	len_ = len;
+	prob_ = prob;
+	alias_ = alias;
+}
+
+void AliasSampler::SampleBatch(FastRng &rng, int *dst, int n)
+{
+	// two words per draw, taken from the generator a chunk at a time
+	const int kChunk = FastRng::kBufferSize / 2;
+	unsigned int rands[2 * kChunk];
+	while (n > 0)
+	{
+		int m = std::min(n, kChunk);
+		rng.Fill(rands, 2 * m);
+		for (int i = 0; i < m; ++i)
+			dst[i] = Sample(prob_, alias_, len_, rands[2 * i], rands[2 * i + 1]);
+		dst += m;
+		n -= m;
+	}
+}
+
+void AliasSampler::allocate(int len)
+{
+	release();
+
+	len_ = len;
+	prob_ = new unsigned int[len];
+	alias_ = new int[len];
+	own_table_ = true;
+}
+
+void AliasSampler::release()
+{
+	if (own_table_)
+	{
+		delete[] prob_;
+		delete[] alias_;
+	}
+	prob_ = 0;
+	alias_ = 0;
+	own_table_ = false;
+}
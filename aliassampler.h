@@ -0,0 +1,77 @@
+#ifndef ALIASSAMPLER_H_
+#define ALIASSAMPLER_H_
+
+#include "fastrng.h"
+
+// Walker/Vose alias method: O(1) draws from a fixed discrete distribution.
+// A table of len columns is kept in two flat arrays; column i is kept with
+// probability prob[i] / 2^32 and otherwise replaced by alias[i].
+class AliasSampler
+{
+public:
+	// prob and alias must have room for len entries
+	static void BuildTable(const int *weights, int len, unsigned int *prob, int *alias);
+	static void BuildTable(const unsigned short *weights, int len, unsigned int *prob, int *alias);
+	static void BuildTable(const float *weights, int len, unsigned int *prob, int *alias);
+
+	static int Sample(const unsigned int *prob, const int *alias, int len,
+		unsigned int col_rand, unsigned int coin_rand)
+	{
+		int col = (int)(((unsigned long long)col_rand * (unsigned int)len) >> 32);
+		return coin_rand < prob[col] ? col : alias[col];
+	}
+
+public:
+	AliasSampler() {}
+	AliasSampler(const int *weights, int len);
+	~AliasSampler();
+
+	void Init(const int *weights, int len);
+	void Init(const float *weights, int len);
+
+	// an owned copy of another table, e.g. one mapped from a file
+	void Init(const unsigned int *prob, const int *alias, int len);
+
+	// uses a table that lives elsewhere, e.g. in a mapped file, without owning it
+	void Attach(const unsigned int *prob, const int *alias, int len);
+
+	int Sample(FastRng &rng)
+	{
+		unsigned int col_rand = rng.NextUInt();
+		return Sample(prob_, alias_, len_, col_rand, rng.NextUInt());
+	}
+
+	// n draws, the same as n calls of Sample(rng)
+	void SampleBatch(FastRng &rng, int *dst, int n);
+
+	int len()
+	{
+		return len_;
+	}
+
+	const unsigned int *prob()
+	{
+		return prob_;
+	}
+
+	const int *alias()
+	{
+		return alias_;
+	}
+
+private:
+	// the table may be owned, so copies would free it twice
+	AliasSampler(const AliasSampler &);
+	AliasSampler &operator=(const AliasSampler &);
+
+	void allocate(int len);
+	void release();
+
+private:
+	int len_ = 0;
+	const unsigned int *prob_ = 0;
+	const int *alias_ = 0;
+	bool own_table_ = false;
+};
+
+#endif
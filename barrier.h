@@ -0,0 +1,37 @@
+#ifndef BARRIER_H_
+#define BARRIER_H_
+
+#include <mutex>
+#include <condition_variable>
+
+// Reusable barrier for a fixed number of threads.
+class Barrier
+{
+public:
+	Barrier(int num_threads) : num_threads_(num_threads) {}
+
+	void Wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		int generation = generation_;
+		if (++num_waiting_ == num_threads_)
+		{
+			num_waiting_ = 0;
+			++generation_;
+			cond_.notify_all();
+		}
+		else
+		{
+			cond_.wait(lock, [&] { return generation != generation_; });
+		}
+	}
+
+private:
+	int num_threads_;
+	int num_waiting_ = 0;
+	int generation_ = 0;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "benchmark.h"
+
+#include <cstdio>
+#include <ctime>
+#include <thread>
+#include <algorithm>
+
+#include "simdkernels.h"
+
+Benchmark::Benchmark(float min_secs) : min_secs_(min_secs)
+{
+}
+
+void Benchmark::SetFilter(const char *filter)
+{
+	filter_ = filter != 0 ? filter : "";
+}
+
+void Benchmark::Run(const std::string &name, const CaseFn &fn, long long fixed_iters)
+{
+	if (!Enabled(name))
+		return;
+
+	State state;
+	state.num_iters = fixed_iters > 0 ? fixed_iters : 1;
+	while (true)
+	{
+		state.num_items = state.num_bytes = 0;
+		state.secs = 0;
+		fn(state);
+		if (fixed_iters > 0 || state.secs >= min_secs_)
+			break;
+		// aim a bit past min_secs, at most 10x per step as the first runs are noisy
+		double scale = state.secs > 0 ? 1.4 * min_secs_ / state.secs : 10;
+		state.num_iters = (long long)(state.num_iters * std::min(10.0, std::max(2.0, scale)));
+	}
+
+	Result result;
+	result.name = name;
+	result.num_iters = state.num_iters;
+	result.ns_per_iter = state.secs / state.num_iters * 1e9;
+	result.items_per_sec = state.num_items / state.secs;
+	result.bytes_per_sec = state.num_bytes / state.secs;
+	results_.push_back(result);
+
+	printf("%-56s %12lld iters %14.1f ns", name.c_str(), result.num_iters, result.ns_per_iter);
+	if (state.num_items > 0)
+		printf(" %12.3f M items/s", result.items_per_sec / 1e6);
+	if (state.num_bytes > 0)
+		printf(" %10.1f MB/s", result.bytes_per_sec / 1048576.0);
+	if (state.checksum != 0)
+		printf("  (%g)", state.checksum);
+	printf("\n");
+	fflush(stdout);
+}
+
+bool Benchmark::SaveJson(const char *dst_file_name)
+{
+	FILE *fp = fopen(dst_file_name, "w");
+	if (fp == 0)
+	{
+		printf("cannot open %s\n", dst_file_name);
+		return false;
+	}
+
+	char date[64];
+	time_t now = time(0);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	fprintf(fp, "{\n  \"context\": {\"date\": \"%s\", \"num_cpus\": %u, \"isa\": \"%s\", \"min_secs\": %.2f},\n",
+		date, std::thread::hardware_concurrency(), SimdKernels::GetIsaName(SimdKernels::GetIsa()), min_secs_);
+	fprintf(fp, "  \"benchmarks\": [");
+	for (size_t i = 0; i < results_.size(); ++i)
+	{
+		const Result &result = results_[i];
+		fprintf(fp, "%s\n    {\"name\": \"%s\", \"iterations\": %lld, \"real_time\": %.3f, \"time_unit\": \"ns\"",
+			i == 0 ? "" : ",", result.name.c_str(), result.num_iters, result.ns_per_iter);
+		if (result.items_per_sec > 0)
+			fprintf(fp, ", \"items_per_second\": %.1f", result.items_per_sec);
+		if (result.bytes_per_sec > 0)
+			fprintf(fp, ", \"bytes_per_second\": %.1f", result.bytes_per_sec);
+		fprintf(fp, "}");
+	}
+	fprintf(fp, "\n  ]\n}\n");
+	fclose(fp);
+	return true;
+}
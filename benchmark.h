@@ -0,0 +1,83 @@
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+// A small benchmark runner in the manner of Google Benchmark. A case is a
+// function of a State that does its setup, then runs the measured work
+// state.num_iters times between StartTiming and StopTiming. The runner
+// starts at one iteration and scales the count up until a run takes at
+// least min_secs, and keeps the last run. Results are printed as they come
+// and can be saved as JSON:
+//
+//   {"context": {"date": "...", "num_cpus": 8, "isa": "avx2", "min_secs": 0.5},
+//    "benchmarks": [{"name": "NegTrain::TrainPair/100", "iterations": 2097152,
+//      "real_time": 402.3, "time_unit": "ns", "items_per_second": 2485712.0}, ...]}
+//
+// real_time is per iteration; items_per_second and bytes_per_second are
+// there for the cases that set num_items or num_bytes.
+class Benchmark
+{
+public:
+	struct State
+	{
+		void StartTiming()
+		{
+			beg_time = std::chrono::steady_clock::now();
+		}
+
+		void StopTiming()
+		{
+			secs += std::chrono::duration<double>(std::chrono::steady_clock::now() - beg_time).count();
+		}
+
+		long long num_iters = 1;
+		// items and bytes of all num_iters iterations, 0 for none
+		long long num_items = 0;
+		long long num_bytes = 0;
+		// fold results in here so the compiler cannot drop the work
+		double checksum = 0;
+
+		double secs = 0;
+		std::chrono::steady_clock::time_point beg_time;
+	};
+
+	typedef std::function<void(State &)> CaseFn;
+
+public:
+	Benchmark(float min_secs = 0.5f);
+
+	// Only the cases whose name contains filter run; 0 runs all.
+	void SetFilter(const char *filter);
+
+	// whether the filter lets case name run, to skip its setup if not
+	bool Enabled(const std::string &name)
+	{
+		return filter_.empty() || name.find(filter_) != std::string::npos;
+	}
+
+	// Runs fn as case name, unless the filter skips it. fixed_iters > 0
+	// runs it once with that many iterations, for cases too slow to repeat.
+	void Run(const std::string &name, const CaseFn &fn, long long fixed_iters = 0);
+
+	bool SaveJson(const char *dst_file_name);
+
+private:
+	struct Result
+	{
+		std::string name;
+		long long num_iters;
+		double ns_per_iter;
+		double items_per_sec;
+		double bytes_per_sec;
+	};
+
+	float min_secs_;
+	std::string filter_;
+	std::vector<Result> results_;
+};
+
+#endif
@@ -0,0 +1,491 @@
+#include "checkpointer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+#include <csignal>
+
+#ifdef _WIN32
+#include <io.h>
+#include <direct.h>
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+static const char kCheckpointMagic[8] = { 'E', 'M', 'A', 'D', 'R', 'C', 'K', 'P' };
+static const int kCheckpointVersion = 2;
+static const int kTableNameLen = 16;
+
+static volatile std::sig_atomic_t stop_requested = 0;
+
+static void OnTerminate(int)
+{
+	stop_requested = 1;
+}
+
+// FNV-1a over the bits of the row
+static unsigned long long HashRow(const float *row, int dim)
+{
+	const unsigned int *words = (const unsigned int*)row;
+	unsigned long long hash = 14695981039346656037ULL;
+	for (int i = 0; i < dim; ++i)
+	{
+		hash ^= words[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// data and metadata reach the disk before the file is renamed into place
+static bool SyncFile(FILE *fp)
+{
+	if (fflush(fp) != 0)
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(fp)) == 0;
+#else
+	return fsync(fileno(fp)) == 0;
+#endif
+}
+
+static bool ReplaceFile(const char *src, const char *dst)
+{
+#ifdef _WIN32
+	// rename does not overwrite on Windows
+	remove(dst);
+#endif
+	if (rename(src, dst) != 0)
+	{
+		printf("\ncannot rename %s to %s: %s\n", src, dst, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+void Checkpointer::InstallSignalHandler()
+{
+	signal(SIGTERM, OnTerminate);
+}
+
+bool Checkpointer::StopRequested()
+{
+	return stop_requested != 0;
+}
+
+Checkpointer::Checkpointer(const char *dir, int num_threads, int every_rounds, float every_minutes)
+	: dir_(dir), num_threads_(num_threads), every_rounds_(every_rounds), every_minutes_(every_minutes),
+	barrier_(num_threads), thread_states_(num_threads)
+{
+#ifdef _WIN32
+	_mkdir(dir);
+#else
+	mkdir(dir, 0755);
+#endif
+	last_time_ = std::chrono::steady_clock::now();
+	writer_ = std::thread([this] { writerLoop(); });
+}
+
+Checkpointer::~Checkpointer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		exit_ = true;
+	}
+	cond_.notify_all();
+	writer_.join();
+
+	for (float *table : snapshot_.tables)
+		delete[] table;
+	for (unsigned long long *hashes : row_hashes_)
+		delete[] hashes;
+}
+
+void Checkpointer::AddTable(const char *name, EmbeddingTable *table)
+{
+	assert(strlen(name) < kTableNameLen);
+	table_names_.push_back(name);
+	tables_.push_back(table);
+	unsigned long long *hashes = new unsigned long long[table->num_rows()];
+	memset(hashes, 0, table->num_rows() * sizeof(unsigned long long));
+	row_hashes_.push_back(hashes);
+}
+
+Checkpointer::ResumeStatus Checkpointer::Resume()
+{
+	std::string manifest_name = dir_ + "/checkpoint.txt";
+	FILE *fp = fopen(manifest_name.c_str(), "r");
+	if (fp == 0)
+		return kNoCheckpoint;
+
+	chain_.clear();
+	char line[256];
+	while (fgets(line, sizeof(line), fp) != 0)
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] != '\0')
+			chain_.push_back(line);
+	}
+	fclose(fp);
+	if (chain_.empty())
+		return kNoCheckpoint;
+
+	for (const std::string &file_name : chain_)
+	{
+		if (!loadCheckpointFile((dir_ + "/" + file_name).c_str()))
+			return kBadCheckpoint;
+	}
+
+	for (size_t t = 0; t < tables_.size(); ++t)
+	{
+		EmbeddingTable *table = tables_[t];
+		float *row = new float[table->dim()];
+		for (int r = 0; r < table->num_rows(); ++r)
+		{
+			table->LoadRow(r, row);
+			row_hashes_[t][r] = HashRow(row, table->dim());
+		}
+		delete[] row;
+	}
+	num_since_full_ = (int)chain_.size() - 1;
+	resumed_ = true;
+	printf("resumed from %s at round %d, sample %lld, alpha %f\n", chain_.back().c_str(),
+		resume_round_, resume_next_sample_, resume_alpha_);
+	return kResumed;
+}
+
+void Checkpointer::RestoreThreadState(int thread_idx, int &round, long long &next_sample, float &alpha,
+	FastRng &rng)
+{
+	round = 0;
+	next_sample = 0;
+	if (!resumed_)
+		return;
+
+	round = resume_round_;
+	next_sample = resume_next_sample_;
+	alpha = resume_alpha_;
+	rng = thread_states_[thread_idx].rng;
+}
+
+bool Checkpointer::SyncPoint(int thread_idx, int round, long long next_sample, float alpha, bool end_of_round,
+	FastRng &rng)
+{
+	thread_states_[thread_idx].rng = rng;
+
+	barrier_.Wait();
+	if (thread_idx == 0)
+	{
+		take_ = checkpointDue(end_of_round, round);
+		if (take_)
+		{
+			// the snapshot buffer is reused, so the previous one has to be on disk
+			std::unique_lock<std::mutex> lock(mutex_);
+			cond_.wait(lock, [this] { return !pending_; });
+			lock.unlock();
+
+			if (snapshot_.tables.empty())
+			{
+				for (EmbeddingTable *table : tables_)
+					snapshot_.tables.push_back(new float[(long long)table->num_rows() * table->dim()]);
+			}
+			snapshot_.seq = next_seq_++;
+			snapshot_.round = round;
+			snapshot_.next_sample = next_sample;
+			snapshot_.alpha = alpha;
+			snapshot_.thread_states = thread_states_;
+			stopped_ = StopRequested();
+		}
+	}
+	barrier_.Wait();
+	if (!take_)
+		return true;
+
+	copyStripe(thread_idx);
+	bool stopped = stopped_;
+	barrier_.Wait();
+	if (thread_idx == 0)
+	{
+		last_time_ = std::chrono::steady_clock::now();
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			pending_ = true;
+		}
+		cond_.notify_all();
+	}
+	return !stopped;
+}
+
+void Checkpointer::Flush()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	cond_.wait(lock, [this] { return !pending_; });
+}
+
+bool Checkpointer::checkpointDue(bool end_of_round, int round)
+{
+	if (StopRequested())
+		return true;
+	if (end_of_round && every_rounds_ > 0 && round % every_rounds_ == 0)
+		return true;
+	if (every_minutes_ > 0)
+	{
+		double minutes = std::chrono::duration<double>(std::chrono::steady_clock::now() - last_time_).count() / 60;
+		if (minutes >= every_minutes_)
+			return true;
+	}
+	return false;
+}
+
+void Checkpointer::copyStripe(int thread_idx)
+{
+	for (size_t t = 0; t < tables_.size(); ++t)
+	{
+		EmbeddingTable *table = tables_[t];
+		int dim = table->dim();
+		int beg = (int)((long long)table->num_rows() * thread_idx / num_threads_);
+		int end = (int)((long long)table->num_rows() * (thread_idx + 1) / num_threads_);
+		for (int r = beg; r < end; ++r)
+			table->LoadRow(r, snapshot_.tables[t] + (long long)r * dim);
+	}
+}
+
+void Checkpointer::writerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true)
+	{
+		cond_.wait(lock, [this] { return pending_ || exit_; });
+		if (!pending_)
+			return;
+
+		lock.unlock();
+		writeSnapshot();
+		lock.lock();
+		pending_ = false;
+		cond_.notify_all();
+	}
+}
+
+void Checkpointer::writeSnapshot()
+{
+	auto beg_time = std::chrono::steady_clock::now();
+	bool full = chain_.empty() || force_full_ || num_since_full_ + 1 >= kFullInterval;
+
+	char file_name[64];
+	sprintf(file_name, "ckpt-%06d.bin", snapshot_.seq);
+	std::string path = dir_ + "/" + file_name;
+	std::string tmp_path = path + ".tmp";
+	FILE *fp = fopen(tmp_path.c_str(), "wb");
+	if (fp == 0)
+	{
+		printf("\ncannot write %s: %s, checkpoint %d skipped\n", tmp_path.c_str(), strerror(errno), snapshot_.seq);
+		return;
+	}
+
+	int header[] = { kCheckpointVersion, snapshot_.seq, full ? 1 : 0, num_threads_, snapshot_.round };
+	fwrite(kCheckpointMagic, 1, sizeof(kCheckpointMagic), fp);
+	fwrite(header, 4, 5, fp);
+	fwrite(&snapshot_.next_sample, 8, 1, fp);
+	fwrite(&snapshot_.alpha, 4, 1, fp);
+	fwrite(&snapshot_.thread_states[0], sizeof(ThreadState), num_threads_, fp);
+	int num_tables = (int)tables_.size();
+	fwrite(&num_tables, 4, 1, fp);
+
+	long long num_rows_written = 0, num_rows_total = 0;
+	std::vector<int> dirty_rows;
+	for (int t = 0; t < num_tables; ++t)
+	{
+		int num_rows = tables_[t]->num_rows(), dim = tables_[t]->dim();
+		const float *rows = snapshot_.tables[t];
+		dirty_rows.clear();
+		for (int r = 0; r < num_rows; ++r)
+		{
+			unsigned long long hash = HashRow(rows + (long long)r * dim, dim);
+			if (full || hash != row_hashes_[t][r])
+				dirty_rows.push_back(r);
+			row_hashes_[t][r] = hash;
+		}
+
+		char name[kTableNameLen] = { 0 };
+		strcpy(name, table_names_[t].c_str());
+		int num_dirty = (int)dirty_rows.size();
+		fwrite(name, 1, kTableNameLen, fp);
+		fwrite(&num_rows, 4, 1, fp);
+		fwrite(&dim, 4, 1, fp);
+		fwrite(&num_dirty, 4, 1, fp);
+		if (full)
+		{
+			fwrite(rows, sizeof(float), (long long)num_rows * dim, fp);
+		}
+		else
+		{
+			for (int r : dirty_rows)
+			{
+				fwrite(&r, 4, 1, fp);
+				fwrite(rows + (long long)r * dim, sizeof(float), dim, fp);
+			}
+		}
+		num_rows_written += num_dirty;
+		num_rows_total += num_rows;
+	}
+	// the hashes now count the rows of this snapshot as written, so after a
+	// failure only a full snapshot is complete again
+	bool written = !ferror(fp);
+	written = SyncFile(fp) && written;
+	written = fclose(fp) == 0 && written;
+	if (!written || !ReplaceFile(tmp_path.c_str(), path.c_str()))
+	{
+		printf("\ncannot write %s, checkpoint %d skipped\n", path.c_str(), snapshot_.seq);
+		remove(tmp_path.c_str());
+		force_full_ = true;
+		return;
+	}
+
+	std::vector<std::string> prev_chain = chain_;
+	if (full)
+		chain_.clear();
+	chain_.push_back(file_name);
+	if (!writeManifest())
+	{
+		// the manifest on disk still lists the previous chain, which stays
+		printf("checkpoint %d skipped\n", snapshot_.seq);
+		chain_.swap(prev_chain);
+		remove(path.c_str());
+		force_full_ = true;
+		return;
+	}
+	num_since_full_ = full ? 0 : num_since_full_ + 1;
+	force_full_ = false;
+	if (full)
+	{
+		for (const std::string &old_file : prev_chain)
+			remove((dir_ + "/" + old_file).c_str());
+	}
+
+	printf("\ncheckpoint %d (%s): %lld of %lld rows, %.2f s\n", snapshot_.seq, full ? "full" : "delta",
+		num_rows_written, num_rows_total,
+		std::chrono::duration<double>(std::chrono::steady_clock::now() - beg_time).count());
+}
+
+bool Checkpointer::writeManifest()
+{
+	std::string path = dir_ + "/checkpoint.txt";
+	std::string tmp_path = path + ".tmp";
+	FILE *fp = fopen(tmp_path.c_str(), "w");
+	if (fp == 0)
+	{
+		printf("\ncannot write %s: %s\n", tmp_path.c_str(), strerror(errno));
+		return false;
+	}
+	for (const std::string &file_name : chain_)
+		fprintf(fp, "%s\n", file_name.c_str());
+	bool written = !ferror(fp);
+	written = SyncFile(fp) && written;
+	written = fclose(fp) == 0 && written;
+	if (!written || !ReplaceFile(tmp_path.c_str(), path.c_str()))
+	{
+		printf("\ncannot write %s\n", path.c_str());
+		remove(tmp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Every field is checked against the run before it is used, and a row
+// index before it is stored, so a damaged file cannot write out of bounds.
+bool Checkpointer::loadCheckpointFile(const char *file_name)
+{
+	FILE *fp = fopen(file_name, "rb");
+	if (fp == 0)
+	{
+		printf("cannot open %s\n", file_name);
+		return false;
+	}
+
+	bool ok = false;
+	char magic[sizeof(kCheckpointMagic)];
+	int header[5];
+	long long next_sample = 0;
+	float alpha = 0;
+	int num_tables = 0;
+	std::vector<ThreadState> thread_states(num_threads_);
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || fread(header, 4, 5, fp) != 5
+		|| memcmp(magic, kCheckpointMagic, sizeof(magic)) != 0 || header[0] != kCheckpointVersion)
+	{
+		printf("%s is not a checkpoint of this version\n", file_name);
+	}
+	else if (header[3] != num_threads_)
+	{
+		printf("%s was written with %d threads, not %d\n", file_name, header[3], num_threads_);
+	}
+	else if (fread(&next_sample, 8, 1, fp) != 1 || fread(&alpha, 4, 1, fp) != 1
+		|| fread(&thread_states[0], sizeof(ThreadState), num_threads_, fp) != (size_t)num_threads_
+		|| fread(&num_tables, 4, 1, fp) != 1)
+	{
+		printf("%s is truncated\n", file_name);
+	}
+	else if (num_tables != (int)tables_.size())
+	{
+		printf("%s has %d tables, not %d\n", file_name, num_tables, (int)tables_.size());
+	}
+	else
+	{
+		// values of a 16-bit table were converted exactly, so storing them back does not round
+		bool full = header[2] != 0;
+		ok = true;
+		for (int t = 0; ok && t < num_tables; ++t)
+		{
+			char name[kTableNameLen];
+			int num_rows = 0, dim = 0, num_written = 0;
+			EmbeddingTable *table = tables_[t];
+			if (fread(name, 1, kTableNameLen, fp) != (size_t)kTableNameLen || fread(&num_rows, 4, 1, fp) != 1
+				|| fread(&dim, 4, 1, fp) != 1 || fread(&num_written, 4, 1, fp) != 1)
+			{
+				printf("%s is truncated\n", file_name);
+				ok = false;
+				break;
+			}
+			name[kTableNameLen - 1] = '\0';
+			if (table_names_[t] != name || num_rows != table->num_rows() || dim != table->dim()
+				|| num_written < 0 || num_written > num_rows || (full && num_written != num_rows))
+			{
+				printf("%s: table %s %d x %d does not match %s %d x %d\n", file_name, name, num_rows, dim,
+					table_names_[t].c_str(), table->num_rows(), table->dim());
+				ok = false;
+				break;
+			}
+
+			float *row = new float[dim];
+			for (int i = 0; i < num_written; ++i)
+			{
+				int r = i;
+				if ((!full && fread(&r, 4, 1, fp) != 1) || fread(row, sizeof(float), dim, fp) != (size_t)dim)
+				{
+					printf("%s is truncated\n", file_name);
+					ok = false;
+					break;
+				}
+				if (r < 0 || r >= num_rows)
+				{
+					printf("%s: row %d out of range in table %s\n", file_name, r, name);
+					ok = false;
+					break;
+				}
+				table->StoreRow(r, row, 0);
+			}
+			delete[] row;
+		}
+	}
+	fclose(fp);
+	if (!ok)
+		return false;
+
+	next_seq_ = header[1] + 1;
+	resume_round_ = header[4];
+	resume_next_sample_ = next_sample;
+	resume_alpha_ = alpha;
+	thread_states_ = thread_states;
+	return true;
+}
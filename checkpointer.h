@@ -0,0 +1,141 @@
+#ifndef CHECKPOINTER_H_
+#define CHECKPOINTER_H_
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "fastrng.h"
+#include "barrier.h"
+#include "embeddingtable.h"
+
+// Periodic snapshots of a Hogwild training run, and resuming from them.
+//
+// All training threads call SyncPoint at the same sample positions. Usually
+// that is two barrier waits. When a checkpoint is due (every N rounds, every
+// T minutes, or after SIGTERM), the threads copy the tables into a snapshot
+// buffer, each thread doing a stripe of rows, and then keep training. A
+// writer thread puts the snapshot on disk.
+//
+// A snapshot is either a full file or a delta that holds only the rows whose
+// hash changed since the previous snapshot. A full snapshot is written every
+// kFullInterval checkpoints. Every file is written under a temporary name
+// and renamed when complete. The manifest checkpoint.txt is replaced the
+// same way and lists the full file and the deltas to apply on top of it, so
+// it always describes a complete checkpoint. A snapshot that cannot be
+// written is skipped with a message, and the next one is a full file.
+class Checkpointer
+{
+public:
+	// samples per thread between sync points inside a round
+	static const long long kSyncInterval = 1 << 20;
+	static const int kFullInterval = 8;
+
+	// makes SIGTERM request a final checkpoint instead of killing the process
+	static void InstallSignalHandler();
+	static bool StopRequested();
+
+public:
+	// every_rounds <= 0 and every_minutes <= 0 disable the respective trigger
+	Checkpointer(const char *dir, int num_threads, int every_rounds, float every_minutes);
+	~Checkpointer();
+
+	// tables must be added in the same order when writing and resuming
+	void AddTable(const char *name, EmbeddingTable *table);
+
+	enum ResumeStatus
+	{
+		kResumed,
+		kNoCheckpoint,
+		// a file of the checkpoint is damaged or from another run; the
+		// tables may be partly overwritten and training should not go on
+		kBadCheckpoint
+	};
+
+	// Loads the last complete checkpoint in dir into the added tables.
+	ResumeStatus Resume();
+
+	// where thread thread_idx continues, (0, 0) with rng untouched
+	// unless Resume succeeded
+	void RestoreThreadState(int thread_idx, int &round, long long &next_sample, float &alpha,
+		FastRng &rng);
+
+	// Called by every training thread at the same positions, with the
+	// position of the next sample to train. Returns false when training
+	// should stop.
+	bool SyncPoint(int thread_idx, int round, long long next_sample, float alpha, bool end_of_round,
+		FastRng &rng);
+
+	// waits until the writer thread is idle
+	void Flush();
+
+	bool stopped()
+	{
+		return stopped_;
+	}
+
+private:
+	struct ThreadState
+	{
+		FastRng rng;
+	};
+
+	struct Snapshot
+	{
+		int seq;
+		int round;
+		long long next_sample;
+		float alpha;
+		std::vector<ThreadState> thread_states;
+		std::vector<float*> tables;
+	};
+
+	bool checkpointDue(bool end_of_round, int round);
+	void copyStripe(int thread_idx);
+
+	void writerLoop();
+	void writeSnapshot();
+	bool writeManifest();
+
+	bool loadCheckpointFile(const char *file_name);
+
+private:
+	std::string dir_;
+	int num_threads_;
+	int every_rounds_;
+	float every_minutes_;
+
+	std::vector<std::string> table_names_;
+	std::vector<EmbeddingTable*> tables_;
+	// hash of every row as of the last written snapshot
+	std::vector<unsigned long long*> row_hashes_;
+
+	Barrier barrier_;
+	std::chrono::steady_clock::time_point last_time_;
+	bool take_ = false;
+	bool stopped_ = false;
+
+	std::vector<ThreadState> thread_states_;
+	int resume_round_ = 0;
+	long long resume_next_sample_ = 0;
+	float resume_alpha_ = 0;
+	bool resumed_ = false;
+
+	Snapshot snapshot_;
+	int next_seq_ = 0;
+	int num_since_full_ = 0;
+	// set after a failed write, whose rows the hashes already count as written
+	bool force_full_ = false;
+	std::vector<std::string> chain_;
+
+	std::thread writer_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	bool pending_ = false;
+	bool exit_ = false;
+};
+
+#endif
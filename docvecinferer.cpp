@@ -0,0 +1,171 @@
+#include "docvecinferer.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+static void SeekFile(FILE *fp, long long offset)
+{
+#ifdef _WIN32
+	_fseeki64(fp, offset, SEEK_SET);
+#else
+	fseeko(fp, offset, SEEK_SET);
+#endif
+}
+
+DocVecInferer::DocVecInferer(int num_threads, int num_negative_samples, float starting_alpha, float min_alpha,
+	int max_epochs, float tol) : num_threads_(num_threads), num_negative_samples_(num_negative_samples),
+	starting_alpha_(starting_alpha), min_alpha_(min_alpha), max_epochs_(max_epochs), tol_(tol)
+{
+}
+
+DocVecInferer::~DocVecInferer()
+{
+	for (Relation &relation : relations_)
+		delete relation.trainer;
+}
+
+void DocVecInferer::AddRelation(PairSampler *sampler, EmbeddingTable *obj_vecs, AliasSampler *obj_neg_table)
+{
+	assert(relations_.size() < 2);
+	assert(relations_.empty() || sampler->num_vertex_left() == num_docs_);
+	num_docs_ = sampler->num_vertex_left();
+
+	Relation relation;
+	relation.sampler = sampler;
+	relation.obj_vecs = obj_vecs;
+	relation.trainer = new NegTrain(&exp_table_, num_negative_samples_, obj_neg_table);
+	relation.offset = 0;
+	relations_.push_back(relation);
+}
+
+void DocVecInferer::Infer(bool shared, const char *dst_file_name)
+{
+	assert(!relations_.empty());
+	int vec_dim = 0;
+	for (Relation &relation : relations_)
+	{
+		if (shared)
+		{
+			assert(vec_dim == 0 || vec_dim == relation.obj_vecs->dim());
+			vec_dim = relation.obj_vecs->dim();
+		}
+		else
+		{
+			relation.offset = vec_dim;
+			vec_dim += relation.obj_vecs->dim();
+		}
+	}
+
+	FILE *fp = fopen(dst_file_name, "wb");
+	assert(fp != 0);
+	fwrite(&num_docs_, 4, 1, fp);
+	fwrite(&vec_dim, 4, 1, fp);
+
+	auto beg_time = std::chrono::steady_clock::now();
+	next_chunk_ = 0;
+	num_epochs_ = 0;
+	num_converged_ = 0;
+	std::thread *threads = new std::thread[num_threads_];
+	for (int i = 0; i < num_threads_; ++i)
+		threads[i] = std::thread([&] { inferThread(fp, vec_dim); });
+	for (int i = 0; i < num_threads_; ++i)
+		threads[i].join();
+	delete[] threads;
+	fclose(fp);
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg_time).count();
+	printf("\n%d docs in %.2f s, %.0f docs/s, %.2f epochs per doc, %d converged\n", num_docs_, seconds,
+		num_docs_ / seconds, (double)num_epochs_ / num_docs_, (int)num_converged_);
+}
+
+void DocVecInferer::inferThread(FILE *fp, int vec_dim)
+{
+	FastRng rng;
+
+	int max_obj_dim = 0;
+	for (Relation &relation : relations_)
+		max_obj_dim = std::max(max_obj_dim, relation.obj_vecs->dim());
+	float *chunk_vecs = new float[(long long)kDocsPerChunk * vec_dim];
+	float *prev_vec = new float[vec_dim];
+	float *tmp_neu1e = new float[max_obj_dim];
+
+	int num_chunks = (num_docs_ + kDocsPerChunk - 1) / kDocsPerChunk;
+	long long num_epochs = 0;
+	int num_converged = 0;
+	int chunk = 0;
+	while ((chunk = next_chunk_++) < num_chunks)
+	{
+		int beg = chunk * kDocsPerChunk, end = std::min(beg + kDocsPerChunk, num_docs_);
+		for (int doc = beg; doc < end; ++doc)
+		{
+			// seeded by doc so that the result does not depend on the thread
+			rng.Seed(doc + 1);
+			bool converged = false;
+			num_epochs += inferDoc(doc, vec_dim, chunk_vecs + (long long)(doc - beg) * vec_dim, prev_vec,
+				tmp_neu1e, rng, converged);
+			if (converged)
+				++num_converged;
+		}
+
+		std::lock_guard<std::mutex> lock(file_mutex_);
+		SeekFile(fp, 8 + (long long)beg * vec_dim * sizeof(float));
+		fwrite(chunk_vecs, sizeof(float), (long long)(end - beg) * vec_dim, fp);
+		if (chunk % 64 == 0)
+		{
+			printf("\r%d/%d docs", end, num_docs_);
+			fflush(stdout);
+		}
+	}
+	num_epochs_ += num_epochs;
+	num_converged_ += num_converged;
+
+	delete[] chunk_vecs;
+	delete[] prev_vec;
+	delete[] tmp_neu1e;
+}
+
+int DocVecInferer::inferDoc(int doc, int vec_dim, float *vec, float *prev_vec, float *tmp_neu1e,
+	FastRng &rng, bool &converged)
+{
+	std::fill(vec, vec + vec_dim, 0.0f);
+
+	int weights[2] = { 0, 0 };
+	int num_relations = (int)relations_.size();
+	for (int r = 0; r < num_relations; ++r)
+		weights[r] = relations_[r].sampler->LeftWeight(doc);
+	int epoch_len = weights[0] + weights[1];
+	if (epoch_len == 0)
+		return 0;
+
+	for (int epoch = 0; epoch < max_epochs_; ++epoch)
+	{
+		float alpha = starting_alpha_ + (min_alpha_ - starting_alpha_) * epoch / max_epochs_;
+		memcpy(prev_vec, vec, vec_dim * sizeof(float));
+		for (int i = 0; i < epoch_len; ++i)
+		{
+			// the relation of each pair is picked in proportion to the doc's weight in it
+			int pick = (int)(((unsigned long long)rng.NextUInt() * epoch_len) >> 32);
+			Relation &relation = relations_[pick < weights[0] ? 0 : 1];
+			int obj = relation.sampler->SampleRight(doc, rng);
+			relation.trainer->TrainPair(relation.obj_vecs->dim(), vec + relation.offset, obj,
+				*relation.obj_vecs, alpha, tmp_neu1e, rng, 1, true, false);
+		}
+
+		float diff = 0, norm = 0;
+		for (int j = 0; j < vec_dim; ++j)
+		{
+			diff += (vec[j] - prev_vec[j]) * (vec[j] - prev_vec[j]);
+			norm += vec[j] * vec[j];
+		}
+		if (diff <= tol_ * tol_ * norm)
+		{
+			converged = true;
+			return epoch + 1;
+		}
+	}
+	return max_epochs_;
+}
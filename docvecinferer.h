@@ -0,0 +1,77 @@
+#ifndef DOCVECINFERER_H_
+#define DOCVECINFERER_H_
+
+#include <cstdio>
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+#include "fastrng.h"
+#include "exptable.h"
+#include "pairsampler.h"
+#include "negtrain.h"
+
+// Fold-in inference of vectors for new docs with the word/entity vectors fixed.
+//
+// Docs don't interact once the object vectors are frozen. So instead of
+// global Hogwild sampling, each thread takes runs of kDocsPerChunk docs and
+// trains them one at a time on their own edges. One epoch of a doc draws as
+// many pairs as its edge weights add up to. A doc is done when an epoch
+// changes its vector by less than tol relative to its norm, or after
+// max_epochs epochs; alpha decays linearly over those max_epochs. Finished
+// runs are written straight to their place in the output file.
+class DocVecInferer
+{
+public:
+	static const int kDocsPerChunk = 256;
+
+public:
+	DocVecInferer(int num_threads, int num_negative_samples, float starting_alpha, float min_alpha,
+		int max_epochs, float tol);
+	~DocVecInferer();
+
+	// Adds a doc -> object relation, e.g. doc -> word, at most two. obj_vecs is not
+	// updated, obj_neg_table is shared, not owned. All relations need the
+	// same docs on the left.
+	void AddRelation(PairSampler *sampler, EmbeddingTable *obj_vecs, AliasSampler *obj_neg_table);
+
+	// With shared, every relation trains the same doc vector. Otherwise each
+	// relation trains its own part, and the parts are concatenated in
+	// AddRelation order.
+	void Infer(bool shared, const char *dst_file_name);
+
+private:
+	struct Relation
+	{
+		PairSampler *sampler;
+		EmbeddingTable *obj_vecs;
+		NegTrain *trainer;
+		// offset of the part of the doc vector trained by the relation
+		int offset;
+	};
+
+	void inferThread(FILE *fp, int vec_dim);
+
+	// returns the number of epochs used
+	int inferDoc(int doc, int vec_dim, float *vec, float *prev_vec, float *tmp_neu1e,
+		FastRng &rng, bool &converged);
+
+private:
+	int num_threads_;
+	int num_negative_samples_;
+	float starting_alpha_;
+	float min_alpha_;
+	int max_epochs_;
+	float tol_;
+
+	ExpTable exp_table_;
+	std::vector<Relation> relations_;
+	int num_docs_ = 0;
+
+	std::atomic<int> next_chunk_;
+	std::atomic<long long> num_epochs_;
+	std::atomic<int> num_converged_;
+	std::mutex file_mutex_;
+};
+
+#endif
@@ -2,9 +2,24 @@
 
 #include <cassert>
 #include <thread>
+#include <chrono>
+#include <algorithm>
 
 #include "negtrain.h"
 #include "ioutils.h"
+#include "docvecinferer.h"
+
+// the seeds of the original trainer, for up to 10 threads
+static const unsigned int kDefaultSeeds[] = { 317, 7, 31, 297, 1238, 23487, 238593, 92384, 129380, 23848 };
+
+// splitmix64 finalizer, so that nearby seeds and indices give unrelated streams
+static unsigned int mixSeed(unsigned long long seed, unsigned long long idx)
+{
+	unsigned long long z = seed * 0x9e3779b97f4a7c15ull + idx + 1;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return (unsigned int)(z ^ (z >> 31)) | 1;
+}
 
 EADocVecTrainer::EADocVecTrainer(int num_rounds, int num_threads, int num_negative_samples, 
 	float starting_alpha, float min_alpha) : num_rounds_(num_rounds), num_threads_(num_threads),
@@ -12,41 +27,105 @@ EADocVecTrainer::EADocVecTrainer(int num_rounds, int num_threads, int num_negati
 {
 }
 
-void EADocVecTrainer::AllJointThreaded(const char *ee_file, const char *de_file,
+bool EADocVecTrainer::AllJointThreaded(const char *ee_file, const char *de_file,
 	const char *dw_file, const char *entity_cnts_file, const char *word_cnts_file, 
 	int vec_dim, bool shared, float weight_ee, float weight_de, float weight_dw, const char *dst_dedw_vec_file_name, 
 	const char *dst_word_vecs_file_name, const char *dst_entity_vecs_file_name)
 {
-	initDocEntityList(de_file);
-	initDocWordList(dw_file);
-	initEntityEntityList(ee_file);
+	auto beg_time = std::chrono::steady_clock::now();
+	AliasSampler *entity_neg_table = 0, *word_neg_table = 0;
+	loadAllJointInputs(ee_file, de_file, dw_file, entity_cnts_file, word_cnts_file,
+		entity_neg_table, word_neg_table);
+	auto load_time = std::chrono::steady_clock::now();
 
 	entity_vec_dim_ = word_vec_dim_ = vec_dim;
+	if (sample_stats_)
+	{
+		dw_sampler_->EnableSampleStats(num_threads_);
+		de_sampler_->EnableSampleStats(num_threads_);
+		ee_sampler_->EnableSampleStats(num_threads_);
+	}
+	if (epochs_)
+	{
+		dw_sampler_->InitEpochBlocks(mixSeed(seed_ + 0xe90c5u, 0));
+		de_sampler_->InitEpochBlocks(mixSeed(seed_ + 0xe90c5u, 1));
+		ee_sampler_->InitEpochBlocks(mixSeed(seed_ + 0xe90c5u, 2));
+	}
 
 	printf("initing model....\n");
-	word_vecs_ = NegTrain::GetInitedVecs0(num_words_, word_vec_dim_);
-	dw_vecs_ = NegTrain::GetInitedVecs0(num_docs_, word_vec_dim_);
+	// with hierarchical softmax dw predicts the inner nodes of the word tree,
+	// and nothing would train the word vectors
+	if (!hs_dw_)
+		word_vecs_ = NegTrain::GetInitedVecs0(num_words_, word_vec_dim_, word_precision_, tableSeed(0));
+	dw_vecs_ = NegTrain::GetInitedVecs0(num_docs_, word_vec_dim_, dw_precision_, tableSeed(1));
 
-	ee_vecs0_ = NegTrain::GetInitedVecs0(num_entities_, entity_vec_dim_);
-	ee_vecs1_ = NegTrain::GetInitedVecs1(num_entities_, entity_vec_dim_);
+	ee_vecs0_ = NegTrain::GetInitedVecs0(num_entities_, entity_vec_dim_, ee0_precision_, tableSeed(2));
+	ee_vecs1_ = NegTrain::GetInitedVecs1(num_entities_, entity_vec_dim_, ee1_precision_);
 
 	if (shared)
 		de_vecs_ = dw_vecs_;
 	else
-		de_vecs_ = NegTrain::GetInitedVecs0(num_docs_, entity_vec_dim_);
+		de_vecs_ = NegTrain::GetInitedVecs0(num_docs_, entity_vec_dim_, de_precision_, tableSeed(3));
+
+	long long num_table_bytes = (word_vecs_ != 0 ? word_vecs_->num_bytes() : 0) + dw_vecs_->num_bytes()
+		+ ee_vecs0_->num_bytes() + ee_vecs1_->num_bytes() + (shared ? 0 : de_vecs_->num_bytes());
+	printf("tables: word %s, dw %s, de %s, ee0 %s, ee1 %s, %.1f MB\n",
+		word_vecs_ != 0 ? EmbeddingTable::GetPrecisionName(word_vecs_->precision()) : "none",
+		EmbeddingTable::GetPrecisionName(dw_vecs_->precision()),
+		EmbeddingTable::GetPrecisionName(de_vecs_->precision()),
+		EmbeddingTable::GetPrecisionName(ee_vecs0_->precision()),
+		EmbeddingTable::GetPrecisionName(ee_vecs1_->precision()), num_table_bytes / 1048576.0);
+	if (!initHierarchicalSoftmax(entity_cnts_file, word_cnts_file))
+	{
+		releaseHierarchicalSoftmax();
+		delete entity_neg_table;
+		delete word_neg_table;
+		return false;
+	}
 
 	ExpTable exp_table;
-	NegTrain entity_ns_trainer(&exp_table, num_negative_samples_,
-		entity_cnts_file);
-	NegTrain word_ns_trainer(&exp_table, num_negative_samples_,
-		word_cnts_file);
+	initNodeInputs(&exp_table, word_neg_table, entity_neg_table, false, false);
 	printf("inited.\n");
 
-	int sum_ee_weights = ee_sampler_->sum_weights();
+	if (checkpoint_dir_ != 0 && deterministic_)
+		printf("checkpoints are not supported in deterministic mode, ignoring -ckpt\n");
+	else if (checkpoint_dir_ != 0)
+	{
+		checkpointer_ = new Checkpointer(checkpoint_dir_, num_threads_, checkpoint_rounds_, checkpoint_minutes_);
+		if (word_vecs_ != 0)
+			checkpointer_->AddTable("word", word_vecs_);
+		checkpointer_->AddTable("dw", dw_vecs_);
+		if (!shared)
+			checkpointer_->AddTable("de", de_vecs_);
+		checkpointer_->AddTable("ee0", ee_vecs0_);
+		checkpointer_->AddTable("ee1", ee_vecs1_);
+		if (de_inner_vecs_ != 0)
+			checkpointer_->AddTable("de_inner", de_inner_vecs_);
+		if (dw_inner_vecs_ != 0)
+			checkpointer_->AddTable("dw_inner", dw_inner_vecs_);
+		Checkpointer::ResumeStatus status = resume_ ? checkpointer_->Resume() : Checkpointer::kNoCheckpoint;
+		if (status == Checkpointer::kBadCheckpoint)
+		{
+			printf("cannot resume from the checkpoint in %s, stopping\n", checkpoint_dir_);
+			delete checkpointer_;
+			checkpointer_ = 0;
+			releaseNodeInputs();
+			releaseHierarchicalSoftmax();
+			delete entity_neg_table;
+			delete word_neg_table;
+			return false;
+		}
+		if (resume_ && status == Checkpointer::kNoCheckpoint)
+			printf("no checkpoint in %s, starting from scratch\n", checkpoint_dir_);
+		Checkpointer::InstallSignalHandler();
+	}
+	auto init_time = std::chrono::steady_clock::now();
+
+	long long sum_ee_weights = ee_sampler_->sum_weights();
 	//sum_ee_weights = 0;
-	int sum_de_weights = de_sampler_->sum_weights();
+	long long sum_de_weights = de_sampler_->sum_weights();
 	//int sum_de_weights = 0;
-	int sum_dw_weights = dw_sampler_->sum_weights();
+	long long sum_dw_weights = dw_sampler_->sum_weights();
 	//sum_dw_weights /= 10;
 	//sum_dw_weights = 0;
 	long long sum_weights = sum_ee_weights + sum_de_weights + sum_dw_weights;
@@ -54,42 +133,188 @@ void EADocVecTrainer::AllJointThreaded(const char *ee_file, const char *de_file,
 	//long long num_samples_per_round = sum_dw_weights;
 	//int num_samples_per_round = sum_ee_weights + sum_de_weights;
 
-	printf("list_samples: %d %d %d\n", sum_ee_weights, sum_de_weights, sum_dw_weights);
+	printf("list_samples: %lld %lld %lld\n", sum_ee_weights, sum_de_weights, sum_dw_weights);
 	printf("%lld samples per round\n", num_samples_per_round);
 
 	float weight_portions[] = { (float)sum_ee_weights / sum_weights,
 		(float)sum_de_weights / sum_weights, (float)sum_dw_weights / sum_weights };
 	printf("list distribution: %f %f %f\n", weight_portions[0], weight_portions[1],
 		weight_portions[2]);
-	std::discrete_distribution<int> list_sample_dist(weight_portions, weight_portions + 3);
-	//std::discrete_distribution<int> list_sample_dist{ 0, 0, 1 };
+	AliasSampler list_sampler;
+	list_sampler.Init(weight_portions, 3);
 
-	int seeds[] = { 317, 7, 31, 297, 1238, 23487, 238593, 92384, 129380, 23848 };
-	std::thread *threads = new std::thread[num_threads_];
-	for (int i = 0; i < num_threads_; ++i)
+	if (deterministic_)
 	{
-		int cur_seed = seeds[i];
-		threads[i] = std::thread([&, cur_seed, num_samples_per_round, weight_ee, weight_de, weight_dw]
+		if (early_stop_gain_ > 0)
+			printf("early stopping is not supported in deterministic mode, ignoring -es\n");
+		GradBuffer **grads = new GradBuffer*[num_threads_];
+		for (int i = 0; i < num_threads_; ++i)
+			grads[i] = new GradBuffer(num_threads_);
+		Barrier barrier(num_threads_);
+		std::vector<double> merge_secs(num_threads_, 0);
+		runThreads(num_rounds_ * num_samples_per_round, [&](int i, NodeInputs &inputs)
 		{
-			allJoint(cur_seed, num_samples_per_round, weight_ee, weight_de, weight_dw,
-				list_sample_dist, entity_ns_trainer, word_ns_trainer);
+			allJointDeterministic(i, num_samples_per_round, weight_ee, weight_de, weight_dw, list_sampler,
+				inputs, grads, barrier, merge_secs[i]);
 		});
+		printf("deterministic: %d samples per step, barriers and merging %.2f s per thread\n",
+			deterministic_step_, *std::max_element(merge_secs.begin(), merge_secs.end()));
+		for (int i = 0; i < num_threads_; ++i)
+			delete grads[i];
+		delete[] grads;
 	}
-	for (int i = 0; i < num_threads_; ++i)
-		threads[i].join();
-	printf("\n");
+	else
+	{
+		if (early_stop_gain_ > 0 && checkpointer_ != 0)
+			printf("early stopping is not supported with checkpoints, ignoring -es\n");
+		else if (early_stop_gain_ > 0 && (hs_ee_ || hs_de_ || hs_dw_))
+			printf("early stopping is not supported with hierarchical softmax, ignoring -es\n");
+		else if (initEarlyStopper())
+		{
+			early_stopper_->AddRelation("ee", ee_sampler_, ee_vecs0_, ee_vecs1_, entity_neg_table,
+				num_negative_samples_, weight_portions[0], early_stop_pairs_, mixSeed(seed_, 0));
+			early_stopper_->AddRelation("de", de_sampler_, de_vecs_, ee_vecs0_, entity_neg_table,
+				num_negative_samples_, weight_portions[1], early_stop_pairs_, mixSeed(seed_, 1));
+			early_stopper_->AddRelation("dw", dw_sampler_, dw_vecs_, word_vecs_, word_neg_table,
+				num_negative_samples_, weight_portions[2], early_stop_pairs_, mixSeed(seed_, 2));
+			early_stopper_->Start();
+		}
+		runThreads(num_rounds_ * num_samples_per_round, [&](int i, NodeInputs &inputs)
+		{
+			if (batch_size_ > 1)
+				allJointBatched(i, threadSeed(i), num_samples_per_round, weight_ee, weight_de, weight_dw,
+					list_sampler, inputs);
+			else
+				allJoint(i, threadSeed(i), num_samples_per_round, weight_ee, weight_de, weight_dw,
+					list_sampler, inputs);
+		});
+		releaseEarlyStopper();
+	}
+	releaseNodeInputs();
+	auto train_time = std::chrono::steady_clock::now();
 
-	//printf("dw0: %d\n", dw_sampler_->CountZeros());
-	//printf("de0: %d\n", de_sampler_->CountZeros());
-	//printf("ee0: %d\n", ee_sampler_->CountZeros());
+	if (checkpointer_ != 0)
+	{
+		checkpointer_->Flush();
+		bool stopped = checkpointer_->stopped();
+		delete checkpointer_;
+		checkpointer_ = 0;
+		if (stopped)
+		{
+			printf("stopped, resume from the checkpoint in %s\n", checkpoint_dir_);
+			releaseHierarchicalSoftmax();
+			delete entity_neg_table;
+			delete word_neg_table;
+			return true;
+		}
+	}
+
+	if (sample_stats_)
+	{
+		printf("dw0: %d\n", dw_sampler_->CountZeros());
+		printf("de0: %d\n", de_sampler_->CountZeros());
+		printf("ee0: %d\n", ee_sampler_->CountZeros());
+	}
 
 	if (shared)
-		IOUtils::SaveVectors(dw_vecs_, word_vec_dim_, num_docs_, dst_dedw_vec_file_name);
+		IOUtils::SaveVectors(dw_vecs_, dst_dedw_vec_file_name);
+	else
+		saveConcatnatedVectors(de_vecs_, dw_vecs_, dst_dedw_vec_file_name);
+
+	if (word_vecs_ == 0)
+		printf("the word vectors are not trained with hierarchical softmax for dw, %s not written\n",
+			dst_word_vecs_file_name);
 	else
-		saveConcatnatedVectors(de_vecs_, dw_vecs_, num_docs_, entity_vec_dim_, dst_dedw_vec_file_name);
+		IOUtils::SaveVectors(word_vecs_, dst_word_vecs_file_name);
+	IOUtils::SaveVectors(ee_vecs0_, dst_entity_vecs_file_name);
+	auto save_time = std::chrono::steady_clock::now();
+
+	printf("load %.2f s, init %.2f s, train %.2f s, save %.2f s\n",
+		std::chrono::duration<double>(load_time - beg_time).count(),
+		std::chrono::duration<double>(init_time - load_time).count(),
+		std::chrono::duration<double>(train_time - init_time).count(),
+		std::chrono::duration<double>(save_time - train_time).count());
+
+	releaseHierarchicalSoftmax();
+	delete entity_neg_table;
+	delete word_neg_table;
+	return true;
+}
+
+bool EADocVecTrainer::initHierarchicalSoftmax(const char *entity_cnts_file, const char *word_cnts_file)
+{
+	if (hs_ee_ || hs_de_)
+	{
+		entity_tree_ = NegSamplingBase::LoadHuffmanTree(entity_cnts_file);
+		// the leaves are the objs1 of the pairs, and the inner nodes of ee
+		// are rows of ee1
+		if (entity_tree_->num_objs() != num_entities_)
+		{
+			printf("%d entities in %s, %d in the ee file\n", entity_tree_->num_objs(), entity_cnts_file,
+				num_entities_);
+			return false;
+		}
+		printf("entity tree: mean path %.1f, max path %d, for %s%s\n", entity_tree_->MeanPathLen(),
+			entity_tree_->max_path_len(), hs_ee_ ? "ee " : "", hs_de_ ? "de" : "");
+	}
+	if (hs_de_)
+		de_inner_vecs_ = NegTrain::GetInitedVecs1(entity_tree_->num_inner(), entity_vec_dim_, ee1_precision_);
+	if (hs_dw_)
+	{
+		word_tree_ = NegSamplingBase::LoadHuffmanTree(word_cnts_file);
+		if (word_tree_->num_objs() != num_words_)
+		{
+			printf("%d words in %s, %d in the dw file\n", word_tree_->num_objs(), word_cnts_file, num_words_);
+			return false;
+		}
+		printf("word tree: mean path %.1f, max path %d, for dw; the word vectors are not trained\n",
+			word_tree_->MeanPathLen(), word_tree_->max_path_len());
+		dw_inner_vecs_ = NegTrain::GetInitedVecs1(word_tree_->num_inner(), word_vec_dim_, word_precision_);
+	}
+	return true;
+}
+
+void EADocVecTrainer::releaseHierarchicalSoftmax()
+{
+	delete entity_tree_;
+	delete word_tree_;
+	delete de_inner_vecs_;
+	delete dw_inner_vecs_;
+	entity_tree_ = word_tree_ = 0;
+	de_inner_vecs_ = dw_inner_vecs_ = 0;
+}
+
+bool EADocVecTrainer::initEarlyStopper()
+{
+	if (early_stop_gain_ <= 0)
+		return false;
+	early_stopper_ = new EarlyStopper(num_rounds_, num_threads_, early_stop_gain_, early_stop_patience_);
+	return true;
+}
+
+void EADocVecTrainer::releaseEarlyStopper()
+{
+	if (early_stopper_ == 0)
+		return;
+	early_stopper_->Stop();
+	delete early_stopper_;
+	early_stopper_ = 0;
+}
+
+unsigned int EADocVecTrainer::threadSeed(int thread_idx)
+{
+	if (seed_ == 0 && thread_idx < (int)(sizeof(kDefaultSeeds) / sizeof(kDefaultSeeds[0])))
+		return kDefaultSeeds[thread_idx];
+	return mixSeed(seed_, thread_idx);
+}
 
-	IOUtils::SaveVectors(word_vecs_, word_vec_dim_, num_words_, dst_word_vecs_file_name);
-	IOUtils::SaveVectors(ee_vecs0_, entity_vec_dim_, num_entities_, dst_entity_vecs_file_name);
+unsigned int EADocVecTrainer::tableSeed(int table_idx)
+{
+	// rand() is seeded the same on every run, but anything else calling it
+	// shifts the values
+	if (seed_ == 0 && !deterministic_)
+		return 0;
+	return mixSeed(seed_ + 0x51ed27u, table_idx);
 }
 
 void EADocVecTrainer::TrainWEFixed(const char *doc_words_file, const char *doc_entities_file, const char *word_cnts_file,
@@ -142,7 +367,7 @@ void EADocVecTrainer::TrainDocWord(const char *doc_words_file_name, const char *
 	trainDocWordMT(word_cnts_file, true, dst_doc_vecs_file_name);
 
 	if (dst_word_vecs_file_name != 0)
-		IOUtils::SaveVectors(word_vecs_, word_vec_dim_, num_words_, dst_word_vecs_file_name);
+		IOUtils::SaveVectors(word_vecs_, dst_word_vecs_file_name);
 }
 
 void EADocVecTrainer::TrainEmadrNewDocs2(const char * doc_words_file, const char * doc_entities_file, const char * word_cnts_file, 
@@ -159,12 +384,12 @@ void EADocVecTrainer::TrainEmadrNewDocs2(const char * doc_words_file, const char
 	//	printf("\n");
 	//}
 
-	float **tmpvecs = dw_vecs_;
+	EmbeddingTable *tmpvecs = dw_vecs_;
 	dw_vecs_ = de_vecs_;
 	de_vecs_ = tmpvecs;
 	TrainDocWordFixedWordVecs(doc_words_file, word_cnts_file, word_vecs_file_name,
 		vec_dim, 0);
-	saveConcatnatedVectors(de_vecs_, dw_vecs_, num_docs_, vec_dim, dst_doc_vecs_file);
+	saveConcatnatedVectors(de_vecs_, dw_vecs_, dst_doc_vecs_file);
 }
 
 void EADocVecTrainer::TrainDocWordFixedWordVecs(const char *doc_words_file_name, const char *word_cnts_file,
@@ -172,11 +397,12 @@ void EADocVecTrainer::TrainDocWordFixedWordVecs(const char *doc_words_file_name,
 {
 	initDocWordList(doc_words_file_name);
 
-	word_vec_dim_ = vec_dim;
-
 	printf("initing model....\n");
 	int tmp_num = 0, tmp_dim = 0;
 	IOUtils::LoadVectors(word_vecs_file_name, tmp_num, tmp_dim, word_vecs_);
+	if (vec_dim == 0)
+		vec_dim = tmp_dim;
+	word_vec_dim_ = vec_dim;
 	if (tmp_num != num_words_ || tmp_dim != vec_dim)
 	{
 		printf("num words: %d %d\n", num_words_, tmp_num);
@@ -197,218 +423,799 @@ void EADocVecTrainer::TrainDocWordFixedWordVecs(const char *doc_words_file_name,
 	//}
 }
 
-void EADocVecTrainer::saveConcatnatedVectors(float **vecs0, float **vecs1, int num_vecs, int vec_dim,
+void EADocVecTrainer::InferDocVecs(const char *doc_words_file, const char *doc_entities_file,
+	const char *word_cnts_file, const char *entity_cnts_file, const char *word_vecs_file_name,
+	const char *entity_vecs_file_name, bool shared, float tol, const char *dst_doc_vecs_file)
+{
+	initDocWordList(doc_words_file);
+	int tmp_num = 0, tmp_dim = 0;
+	IOUtils::LoadVectors(word_vecs_file_name, tmp_num, tmp_dim, word_vecs_);
+	if (tmp_num != num_words_)
+	{
+		printf("num words: %d %d\n", num_words_, tmp_num);
+		return;
+	}
+	AliasSampler *word_neg_table = NegSamplingBase::LoadNegSamplingTable(word_cnts_file);
+	AliasSampler *entity_neg_table = 0;
+
+	DocVecInferer inferer(num_threads_, num_negative_samples_, starting_alpha_, min_alpha_, num_rounds_, tol);
+	if (doc_entities_file != 0)
+	{
+		initDocEntityList(doc_entities_file);
+		IOUtils::LoadVectors(entity_vecs_file_name, tmp_num, tmp_dim, ee_vecs0_);
+		if (tmp_num != num_entities_)
+		{
+			printf("num entities: %d %d\n", num_entities_, tmp_num);
+			delete word_neg_table;
+			return;
+		}
+		entity_neg_table = NegSamplingBase::LoadNegSamplingTable(entity_cnts_file);
+		inferer.AddRelation(de_sampler_, ee_vecs0_, entity_neg_table);
+	}
+	inferer.AddRelation(dw_sampler_, word_vecs_, word_neg_table);
+	inferer.Infer(shared, dst_doc_vecs_file);
+
+	delete word_neg_table;
+	delete entity_neg_table;
+}
+
+void EADocVecTrainer::loadAllJointInputs(const char *ee_file, const char *de_file, const char *dw_file,
+	const char *entity_cnts_file, const char *word_cnts_file, AliasSampler *&entity_neg_table,
+	AliasSampler *&word_neg_table)
+{
+	auto beg_time = std::chrono::steady_clock::now();
+	std::thread loaders[] = {
+		std::thread([&] { de_sampler_ = new PairSampler(de_file, num_threads_); }),
+		std::thread([&] { dw_sampler_ = new PairSampler(dw_file, num_threads_); }),
+		std::thread([&] { ee_sampler_ = new PairSampler(ee_file, num_threads_); }),
+		std::thread([&] { entity_neg_table = NegSamplingBase::LoadNegSamplingTable(entity_cnts_file); }),
+		std::thread([&] { word_neg_table = NegSamplingBase::LoadNegSamplingTable(word_cnts_file); })
+	};
+	for (std::thread &loader : loaders)
+		loader.join();
+
+	num_docs_ = dw_sampler_->num_vertex_left();
+	num_words_ = dw_sampler_->num_vertex_right();
+	num_entities_ = ee_sampler_->num_vertex_left();
+	printf("%d docs, %d words, %d entities.\n", num_docs_, num_words_, num_entities_);
+	printf("inputs loaded in %.2f s\n", std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - beg_time).count());
+}
+
+void EADocVecTrainer::initNodeInputs(ExpTable *exp_table, AliasSampler *word_neg_table,
+	AliasSampler *entity_neg_table, bool fixed_word_vecs, bool fixed_entity_vecs)
+{
+	int num_nodes = numa_ ? NumaUtils::NumNodes() : 1;
+	node_inputs_.assign(num_nodes, NodeInputs());
+	for (int node = 0; node < num_nodes; ++node)
+	{
+		NodeInputs &inputs = node_inputs_[node];
+		inputs.dw_sampler = dw_sampler_;
+		inputs.de_sampler = de_sampler_;
+		inputs.ee_sampler = ee_sampler_;
+		inputs.word_neg_table = word_neg_table;
+		inputs.entity_neg_table = entity_neg_table;
+		inputs.word_vecs = word_vecs_;
+		inputs.entity_vecs = ee_vecs0_;
+		if (numa_replicas_)
+		{
+			NumaUtils::RunOnNode(node, [&]
+			{
+				// the stats counters live in the shared samplers
+				if (!sample_stats_)
+				{
+					inputs.dw_sampler = dw_sampler_ ? dw_sampler_->Clone() : 0;
+					inputs.de_sampler = de_sampler_ ? de_sampler_->Clone() : 0;
+					inputs.ee_sampler = ee_sampler_ ? ee_sampler_->Clone() : 0;
+				}
+				if (word_neg_table != 0)
+				{
+					inputs.word_neg_table = new AliasSampler();
+					inputs.word_neg_table->Init(word_neg_table->prob(), word_neg_table->alias(),
+						word_neg_table->len());
+				}
+				if (entity_neg_table != 0)
+				{
+					inputs.entity_neg_table = new AliasSampler();
+					inputs.entity_neg_table->Init(entity_neg_table->prob(), entity_neg_table->alias(),
+						entity_neg_table->len());
+				}
+				if (fixed_word_vecs && word_vecs_ != 0)
+					inputs.word_vecs = word_vecs_->Clone();
+				if (fixed_entity_vecs && ee_vecs0_ != 0)
+					inputs.entity_vecs = ee_vecs0_->Clone();
+			});
+		}
+		if (inputs.word_neg_table != 0)
+			inputs.word_trainer = new NegTrain(exp_table, num_negative_samples_, inputs.word_neg_table);
+		if (inputs.entity_neg_table != 0)
+			inputs.entity_trainer = new NegTrain(exp_table, num_negative_samples_, inputs.entity_neg_table);
+		if (word_tree_ != 0)
+			inputs.word_tree_trainer = new NegTrain(exp_table, word_tree_);
+		if (entity_tree_ != 0)
+			inputs.entity_tree_trainer = new NegTrain(exp_table, entity_tree_);
+	}
+	if (numa_)
+		printf("numa: %d nodes%s\n", num_nodes, numa_replicas_ ? ", inputs replicated per node" : "");
+}
+
+void EADocVecTrainer::releaseNodeInputs()
+{
+	for (NodeInputs &inputs : node_inputs_)
+	{
+		delete inputs.word_trainer;
+		delete inputs.entity_trainer;
+		delete inputs.word_tree_trainer;
+		delete inputs.entity_tree_trainer;
+		if (!numa_replicas_)
+			continue;
+		if (inputs.dw_sampler != dw_sampler_)
+			delete inputs.dw_sampler;
+		if (inputs.de_sampler != de_sampler_)
+			delete inputs.de_sampler;
+		if (inputs.ee_sampler != ee_sampler_)
+			delete inputs.ee_sampler;
+		delete inputs.word_neg_table;
+		delete inputs.entity_neg_table;
+		if (inputs.word_vecs != word_vecs_)
+			delete inputs.word_vecs;
+		if (inputs.entity_vecs != ee_vecs0_)
+			delete inputs.entity_vecs;
+	}
+	node_inputs_.clear();
+}
+
+void EADocVecTrainer::runThreads(long long num_samples_per_thread,
+	const std::function<void(int, NodeInputs &)> &fn)
+{
+	std::vector<double> thread_secs(num_threads_, 0);
+	TrainMetrics *metrics = 0;
+	if (metrics_file_ != 0)
+	{
+		metrics = new TrainMetrics(num_threads_);
+		// the trees only exist while AllJointThreaded trains with them
+		bool entity_tree = entity_tree_ != 0, word_tree = word_tree_ != 0;
+		metrics->SetNumNegatives(TrainMetrics::kEESamples, hs_ee_ && entity_tree ? 0 : num_negative_samples_);
+		metrics->SetNumNegatives(TrainMetrics::kDESamples, hs_de_ && entity_tree ? 0 : num_negative_samples_);
+		metrics->SetNumNegatives(TrainMetrics::kDWSamples, hs_dw_ && word_tree ? 0 : num_negative_samples_);
+		metrics->Start(metrics_file_, metrics_secs_, num_samples_per_thread * num_threads_);
+	}
+	std::thread *threads = new std::thread[num_threads_];
+	for (int i = 0; i < num_threads_; ++i)
+	{
+		threads[i] = std::thread([&, i]
+		{
+			int node = 0;
+			if (numa_)
+			{
+				NumaUtils::PinThread(i, num_threads_);
+				node = NumaUtils::NodeOfThread(i, num_threads_);
+			}
+			PairSampler::SetStatsShard(i);
+			TrainMetrics::SetThread(metrics, i);
+			auto beg_time = std::chrono::steady_clock::now();
+			fn(i, node_inputs_[node]);
+			thread_secs[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg_time).count();
+		});
+	}
+	for (int i = 0; i < num_threads_; ++i)
+		threads[i].join();
+	delete[] threads;
+	printf("\n");
+	delete metrics;
+	samples_per_sec_ = num_samples_per_thread * num_threads_
+		/ std::max(1e-9, *std::max_element(thread_secs.begin(), thread_secs.end()));
+
+	if (!numa_)
+		return;
+	// a node is done when its slowest thread is; resumed runs count full rounds
+	for (int node = 0; node < (int)node_inputs_.size(); ++node)
+	{
+		int num_node_threads = 0;
+		double secs = 0;
+		for (int i = 0; i < num_threads_; ++i)
+		{
+			if (NumaUtils::NodeOfThread(i, num_threads_) != node)
+				continue;
+			++num_node_threads;
+			secs = std::max(secs, thread_secs[i]);
+		}
+		if (num_node_threads > 0)
+			printf("node %d: %d threads, %.2f M samples/s\n", node, num_node_threads,
+				num_node_threads * num_samples_per_thread / secs / 1e6);
+	}
+}
+
+void EADocVecTrainer::saveConcatnatedVectors(EmbeddingTable *vecs0, EmbeddingTable *vecs1,
 	const char *dst_file_name)
 {
 	FILE *fp = fopen(dst_file_name, "wb");
 	assert(fp != 0);
 
+	int num_vecs = vecs0->num_rows(), vec_dim = vecs0->dim();
 	fwrite(&num_vecs, 4, 1, fp);
 	int full_vec_dim = vec_dim << 1;
 	fwrite(&full_vec_dim, 4, 1, fp);
 
 	for (int i = 0; i < num_vecs; ++i)
 	{
-		fwrite(vecs0[i], 4, vec_dim, fp);
-		fwrite(vecs1[i], 4, vec_dim, fp);
+		fwrite(vecs0->Row(i), 4, vec_dim, fp);
+		fwrite(vecs1->Row(i), 4, vec_dim, fp);
 	}
 
 	fclose(fp);
 }
 
-void EADocVecTrainer::allJoint(int seed, long long num_samples_per_round, float weight_ee, float weight_de, float weight_dw,
-	std::discrete_distribution<int> &list_sample_dist,
-	NegTrain &entity_ns_trainer, NegTrain &word_ns_trainer)
+void EADocVecTrainer::allJoint(int thread_idx, int seed, long long num_samples_per_round, float weight_ee, float weight_de, float weight_dw,
+	AliasSampler &list_sampler, NodeInputs &inputs)
 {
 	//printf("seed %d samples_per_round %d. training...\n", seed, num_samples_per_round);
-	std::default_random_engine generator(seed);
-
-	RandGen rand_gen(seed);
+	FastRng rng(seed);
+	PairSampler::EdgeStream ee_pairs(inputs.ee_sampler, epochs_), de_pairs(inputs.de_sampler, epochs_),
+		dw_pairs(inputs.dw_sampler, epochs_);
+	TrainMetrics::Slot *metrics = TrainMetrics::ThreadSlot();
 
 	//const float min_alpha = starting_alpha_ * 0.001;
 	long long total_num_samples = num_rounds_ * num_samples_per_round;
+	AlphaSchedule schedule(starting_alpha_, min_alpha_, total_num_samples);
 
 	float *tmp_neu1e = new float[entity_vec_dim_];
 
 	float alpha = starting_alpha_;
-	for (int i = 0; i < num_rounds_; ++i)
+	int start_round = 0;
+	long long start_sample = 0;
+	if (checkpointer_ != 0)
+		checkpointer_->RestoreThreadState(thread_idx, start_round, start_sample, alpha, rng);
+
+	bool stop = false;
+	int end_round = endRound();
+	for (int i = start_round; i < end_round && !stop; ++i)
 	{
 		printf("\rround %d, alpha %f", i, alpha);
 		fflush(stdout);
-		for (int j = 0; j < num_samples_per_round; ++j)
+		metrics->SetProgress(i, alpha);
+		for (long long j = i == start_round ? start_sample : 0; j < num_samples_per_round && !stop; ++j)
 		{
 			long long cur_num_samples = (i * num_samples_per_round) + j;
 			if (cur_num_samples % 10000 == 10000 - 1)
-				alpha = starting_alpha_ + (min_alpha_ - starting_alpha_) * cur_num_samples / total_num_samples;
+			{
+				end_round = endRound();
+				if (i >= end_round)
+					break;
+				alpha = schedule.At(cur_num_samples, end_round * num_samples_per_round);
+				metrics->SetProgress(i, alpha);
+			}
 
-			int list_idx = list_sample_dist(generator);
+			float loss = 0, *sample_loss = sampleLoss(cur_num_samples, loss);
+			int list_idx = list_sampler.Sample(rng);
 			int va = 0, vb = 0;
 			if (list_idx == 0)
 			{
-				ee_sampler_->SamplePair(va, vb, generator, rand_gen);
-				entity_ns_trainer.TrainPair(entity_vec_dim_, ee_vecs0_[va], vb, ee_vecs1_,
-					alpha, tmp_neu1e, generator, weight_ee);
-				entity_ns_trainer.TrainPair(entity_vec_dim_, ee_vecs0_[vb], va, ee_vecs1_,
-					alpha, tmp_neu1e, generator, weight_ee);
+				ee_pairs.Next(va, vb, rng);
+				metrics->Add(TrainMetrics::kEESamples);
+				relationTrainer(0, inputs)->TrainPair(entity_vec_dim_, *ee_vecs0_, va, vb, *ee_vecs1_,
+					alpha, tmp_neu1e, rng, weight_ee, true, true, sample_loss);
+				relationTrainer(0, inputs)->TrainPair(entity_vec_dim_, *ee_vecs0_, vb, va, *ee_vecs1_,
+					alpha, tmp_neu1e, rng, weight_ee, true, true, sample_loss);
+				if (sample_loss != 0)
+					metrics->AddLoss(TrainMetrics::kEESamples, loss);
 			}
 			else if (list_idx == 1)
 			{
-				de_sampler_->SamplePair(va, vb, generator, rand_gen);
-				entity_ns_trainer.TrainPair(entity_vec_dim_, de_vecs_[va], vb, ee_vecs0_,
-					alpha, tmp_neu1e, generator, weight_de);
+				de_pairs.Next(va, vb, rng);
+				metrics->Add(TrainMetrics::kDESamples);
+				relationTrainer(1, inputs)->TrainPair(entity_vec_dim_, *de_vecs_, va, vb, *relationVecs1(1),
+					alpha, tmp_neu1e, rng, weight_de, true, true, sample_loss);
+				if (sample_loss != 0)
+					metrics->AddLoss(TrainMetrics::kDESamples, loss);
 			}
 			else if (list_idx == 2)
 			{
-				dw_sampler_->SamplePair(va, vb, generator, rand_gen);
-				word_ns_trainer.TrainPair(word_vec_dim_, dw_vecs_[va], vb, word_vecs_,
-					alpha, tmp_neu1e, generator, weight_dw);
+				dw_pairs.Next(va, vb, rng);
+				metrics->Add(TrainMetrics::kDWSamples);
+				relationTrainer(2, inputs)->TrainPair(word_vec_dim_, *dw_vecs_, va, vb, *relationVecs1(2),
+					alpha, tmp_neu1e, rng, weight_dw, true, true, sample_loss);
+				if (sample_loss != 0)
+					metrics->AddLoss(TrainMetrics::kDWSamples, loss);
 			}
+
+			stop = !syncCheckpoint(thread_idx, i, j, j + 1, num_samples_per_round, alpha, rng);
 		}
+		flushSampleStats();
+		if (!stop && checkpointer_ != 0 && i + 1 < num_rounds_)
+			stop = !checkpointer_->SyncPoint(thread_idx, i + 1, 0, alpha, true, rng);
+		end_round = roundDone(i);
 	}
 
 	delete[] tmp_neu1e;
 }
 
+void EADocVecTrainer::allJointBatched(int thread_idx, int seed, long long num_samples_per_round, float weight_ee, float weight_de,
+	float weight_dw, AliasSampler &list_sampler, NodeInputs &inputs)
+{
+	FastRng rng(seed);
+	PairSampler::EdgeStream ee_pairs(inputs.ee_sampler, epochs_), de_pairs(inputs.de_sampler, epochs_),
+		dw_pairs(inputs.dw_sampler, epochs_);
+	TrainMetrics::Slot *metrics = TrainMetrics::ThreadSlot();
+
+	long long total_num_samples = num_rounds_ * num_samples_per_round;
+	AlphaSchedule schedule(starting_alpha_, min_alpha_, total_num_samples);
+
+	// ee pairs are trained in both directions, so a batch can hold twice as many rows
+	const int max_batch_rows = batch_size_ * 2;
+	NegBatchBuffer batch_buf(max_batch_rows, num_negative_samples_, std::max(entity_vec_dim_, word_vec_dim_));
+	int *objs0 = new int[max_batch_rows];
+	int *objs1 = new int[max_batch_rows];
+
+	float alpha = starting_alpha_;
+	int start_round = 0;
+	long long start_sample = 0;
+	if (checkpointer_ != 0)
+		checkpointer_->RestoreThreadState(thread_idx, start_round, start_sample, alpha, rng);
+
+	bool stop = false;
+	int end_round = endRound();
+	for (int i = start_round; i < end_round && !stop; ++i)
+	{
+		printf("\rround %d, alpha %f", i, alpha);
+		fflush(stdout);
+		metrics->SetProgress(i, alpha);
+		for (long long j = i == start_round ? start_sample : 0; j < num_samples_per_round && !stop; j += batch_size_)
+		{
+			long long cur_num_samples = (i * num_samples_per_round) + j;
+			end_round = endRound();
+			if (i >= end_round)
+				break;
+			alpha = schedule.At(cur_num_samples, end_round * num_samples_per_round);
+			metrics->SetProgress(i, alpha);
+
+			float loss = 0, *batch_loss = sampleLoss(cur_num_samples / batch_size_, loss);
+			int list_idx = list_sampler.Sample(rng);
+			int va = 0, vb = 0;
+			if (list_idx == 0)
+			{
+				for (int b = 0; b < batch_size_; ++b)
+				{
+					ee_pairs.Next(va, vb, rng);
+					metrics->Add(TrainMetrics::kEESamples);
+					objs0[b << 1] = va;
+					objs1[b << 1] = vb;
+					objs0[(b << 1) + 1] = vb;
+					objs1[(b << 1) + 1] = va;
+				}
+				relationTrainer(0, inputs)->TrainBatch(entity_vec_dim_, *ee_vecs0_, objs0, objs1, max_batch_rows,
+					*ee_vecs1_, alpha, weight_ee, batch_buf, rng, true, true, batch_loss);
+				if (batch_loss != 0)
+					metrics->AddLoss(TrainMetrics::kEESamples, loss, batch_size_);
+			}
+			else if (list_idx == 1)
+			{
+				for (int b = 0; b < batch_size_; ++b)
+				{
+					de_pairs.Next(va, vb, rng);
+					metrics->Add(TrainMetrics::kDESamples);
+					objs0[b] = va;
+					objs1[b] = vb;
+				}
+				relationTrainer(1, inputs)->TrainBatch(entity_vec_dim_, *de_vecs_, objs0, objs1, batch_size_,
+					*relationVecs1(1), alpha, weight_de, batch_buf, rng, true, true, batch_loss);
+				if (batch_loss != 0)
+					metrics->AddLoss(TrainMetrics::kDESamples, loss, batch_size_);
+			}
+			else if (list_idx == 2)
+			{
+				for (int b = 0; b < batch_size_; ++b)
+				{
+					dw_pairs.Next(va, vb, rng);
+					metrics->Add(TrainMetrics::kDWSamples);
+					objs0[b] = va;
+					objs1[b] = vb;
+				}
+				relationTrainer(2, inputs)->TrainBatch(word_vec_dim_, *dw_vecs_, objs0, objs1, batch_size_,
+					*relationVecs1(2), alpha, weight_dw, batch_buf, rng, true, true, batch_loss);
+				if (batch_loss != 0)
+					metrics->AddLoss(TrainMetrics::kDWSamples, loss, batch_size_);
+			}
+
+			stop = !syncCheckpoint(thread_idx, i, j, j + batch_size_, num_samples_per_round, alpha,
+				rng);
+		}
+		flushSampleStats();
+		if (!stop && checkpointer_ != 0 && i + 1 < num_rounds_)
+			stop = !checkpointer_->SyncPoint(thread_idx, i + 1, 0, alpha, true, rng);
+		end_round = roundDone(i);
+	}
+
+	delete[] objs0;
+	delete[] objs1;
+}
+
+void EADocVecTrainer::allJointDeterministic(int thread_idx, long long num_samples_per_round, float weight_ee,
+	float weight_de, float weight_dw, AliasSampler &list_sampler, NodeInputs &inputs,
+	GradBuffer **grads, Barrier &barrier, double &merge_secs)
+{
+	unsigned int seed = threadSeed(thread_idx);
+	FastRng rng(seed);
+	// each thread walks its own share of every epoch, whatever the timing
+	PairSampler::EdgeStream ee_pairs(inputs.ee_sampler, epochs_, thread_idx, num_threads_),
+		de_pairs(inputs.de_sampler, epochs_, thread_idx, num_threads_),
+		dw_pairs(inputs.dw_sampler, epochs_, thread_idx, num_threads_);
+	TrainMetrics::Slot *metrics = TrainMetrics::ThreadSlot();
+
+	long long total_num_samples = num_rounds_ * num_samples_per_round;
+
+	float *tmp = new float[3 * std::max(entity_vec_dim_, word_vec_dim_)];
+	unsigned int step = 0;
+
+	float alpha = starting_alpha_;
+	for (int i = 0; i < num_rounds_; ++i)
+	{
+		printf("\rround %d, alpha %f", i, alpha);
+		fflush(stdout);
+		metrics->SetProgress(i, alpha);
+		for (long long j = 0; j < num_samples_per_round; j += deterministic_step_)
+		{
+			long long cur_num_samples = (i * num_samples_per_round) + j;
+			alpha = starting_alpha_ + (min_alpha_ - starting_alpha_) * cur_num_samples / total_num_samples;
+			metrics->SetProgress(i, alpha);
+
+			long long end_sample = std::min(num_samples_per_round, j + deterministic_step_);
+			for (long long k = j; k < end_sample; ++k)
+			{
+				int list_idx = list_sampler.Sample(rng);
+				int va = 0, vb = 0;
+				if (list_idx == 0)
+				{
+					ee_pairs.Next(va, vb, rng);
+					metrics->Add(TrainMetrics::kEESamples);
+					relationTrainer(0, inputs)->AccumPairGrads(entity_vec_dim_, *ee_vecs0_, va, vb, *ee_vecs1_,
+						alpha, weight_ee, tmp, *grads[thread_idx], rng);
+					relationTrainer(0, inputs)->AccumPairGrads(entity_vec_dim_, *ee_vecs0_, vb, va, *ee_vecs1_,
+						alpha, weight_ee, tmp, *grads[thread_idx], rng);
+				}
+				else if (list_idx == 1)
+				{
+					de_pairs.Next(va, vb, rng);
+					metrics->Add(TrainMetrics::kDESamples);
+					relationTrainer(1, inputs)->AccumPairGrads(entity_vec_dim_, *de_vecs_, va, vb, *relationVecs1(1),
+						alpha, weight_de, tmp, *grads[thread_idx], rng);
+				}
+				else if (list_idx == 2)
+				{
+					dw_pairs.Next(va, vb, rng);
+					metrics->Add(TrainMetrics::kDWSamples);
+					relationTrainer(2, inputs)->AccumPairGrads(word_vec_dim_, *dw_vecs_, va, vb, *relationVecs1(2),
+						alpha, weight_dw, tmp, *grads[thread_idx], rng);
+				}
+			}
+
+			// every thread adds its rows from all buffers, then the buffers are
+			// free for the next step
+			auto beg_time = std::chrono::steady_clock::now();
+			barrier.Wait();
+			for (int t = 0; t < num_threads_; ++t)
+				grads[t]->Apply(thread_idx, step);
+			barrier.Wait();
+			grads[thread_idx]->Clear();
+			merge_secs += std::chrono::duration<double>(std::chrono::steady_clock::now() - beg_time).count();
+			++step;
+		}
+		flushSampleStats();
+	}
+
+	delete[] tmp;
+}
+
 void EADocVecTrainer::trainDocWordMT(const char *word_cnts_file, bool update_word_vecs, const char *dst_doc_vecs_file_name)
 {
 	ExpTable exp_table;
-	NegTrain word_ns_trainer(&exp_table, num_negative_samples_, word_cnts_file);
+	AliasSampler *word_neg_table = NegSamplingBase::LoadNegSamplingTable(word_cnts_file);
+	// the doc-major scheduler draws its own pairs, without EdgeStream
+	if (epochs_ && doc_major_words_ <= 1)
+		dw_sampler_->InitEpochBlocks(mixSeed(seed_ + 0xe90c5u, 0));
+	initNodeInputs(&exp_table, word_neg_table, 0, !update_word_vecs, false);
 
-	int sum_dw_weights = dw_sampler_->sum_weights();
+	long long sum_dw_weights = dw_sampler_->sum_weights();
 	long long num_samples_per_round = sum_dw_weights / 2;
+	if (sample_stats_)
+		dw_sampler_->EnableSampleStats(num_threads_);
 
 	printf("%lld samples per round\n", num_samples_per_round);
 
-	int seeds[] = { 317, 7, 31, 297, 1238, 23487, 238593, 92384, 129380, 23848 };
-	std::thread *threads = new std::thread[num_threads_];
-	for (int i = 0; i < num_threads_; ++i)
+	if (initEarlyStopper())
 	{
-		int cur_seed = seeds[i];
-		threads[i] = std::thread([&, cur_seed, num_samples_per_round, update_word_vecs]
-		{
-			trainDocWordList(cur_seed, num_samples_per_round, update_word_vecs, word_ns_trainer);
-		});
+		early_stopper_->AddRelation("dw", dw_sampler_, dw_vecs_, word_vecs_, word_neg_table,
+			num_negative_samples_, 1, early_stop_pairs_, mixSeed(seed_, 2));
+		early_stopper_->Start();
 	}
-	for (int i = 0; i < num_threads_; ++i)
-		threads[i].join();
-	printf("\n");
+	runThreads(num_rounds_ * num_samples_per_round, [&](int i, NodeInputs &inputs)
+	{
+		if (doc_major_words_ > 1)
+			trainDocWordListDocMajor(threadSeed(i), num_samples_per_round, update_word_vecs, inputs);
+		else if (batch_size_ > 1)
+			trainDocWordListBatched(threadSeed(i), num_samples_per_round, update_word_vecs, inputs);
+		else
+			trainDocWordList(threadSeed(i), num_samples_per_round, update_word_vecs, inputs);
+	});
+	releaseEarlyStopper();
+	releaseNodeInputs();
+	delete word_neg_table;
 
 	if (dst_doc_vecs_file_name)
-		IOUtils::SaveVectors(dw_vecs_, word_vec_dim_, num_docs_, dst_doc_vecs_file_name);
+		IOUtils::SaveVectors(dw_vecs_, dst_doc_vecs_file_name);
 }
 
 void EADocVecTrainer::trainDocWordList(int seed, long long num_samples_per_round, bool update_word_vecs, 
-	NegTrain &word_ns_trainer)
+	NodeInputs &inputs)
 {
 	//printf("seed %d samples_per_round %d. training...\n", seed, num_samples_per_round);
-	std::default_random_engine generator(seed);
-
-	RandGen rand_gen(seed);
+	FastRng rng(seed);
+	PairSampler::EdgeStream dw_pairs(inputs.dw_sampler, epochs_);
+	TrainMetrics::Slot *metrics = TrainMetrics::ThreadSlot();
 
 	//const float min_alpha = starting_alpha_ * 0.001;
 	long long total_num_samples = num_rounds_ * num_samples_per_round;
+	AlphaSchedule schedule(starting_alpha_, min_alpha_, total_num_samples);
 
 	float *tmp_neu1e = new float[word_vec_dim_];
 
 	float alpha = starting_alpha_;
 	int va = 0, vb = 0;
-	for (int i = 0; i < num_rounds_; ++i)
+	int end_round = endRound();
+	for (int i = 0; i < end_round; ++i)
 	{
 		printf("\rround %d, alpha %f", i, alpha);
 		fflush(stdout);
-		for (int j = 0; j < num_samples_per_round; ++j)
+		metrics->SetProgress(i, alpha);
+		for (long long j = 0; j < num_samples_per_round; ++j)
 		{
 			long long cur_num_samples = (i * num_samples_per_round) + j;
 			if (cur_num_samples % 10000 == 10000 - 1)
-				alpha = starting_alpha_ + (min_alpha_ - starting_alpha_) * cur_num_samples / total_num_samples;
+			{
+				end_round = endRound();
+				if (i >= end_round)
+					break;
+				alpha = schedule.At(cur_num_samples, end_round * num_samples_per_round);
+				metrics->SetProgress(i, alpha);
+			}
+
+			float loss = 0, *sample_loss = sampleLoss(cur_num_samples, loss);
 
-			dw_sampler_->SamplePair(va, vb, generator, rand_gen);
+			dw_pairs.Next(va, vb, rng);
+			metrics->Add(TrainMetrics::kDWSamples);
 			//if (va == 0)
 			//	printf("%d %d\n", va, vb);
-			word_ns_trainer.TrainPair(word_vec_dim_, dw_vecs_[va], vb, word_vecs_,
-				alpha, tmp_neu1e, generator, 1, true, update_word_vecs);
+			inputs.word_trainer->TrainPair(word_vec_dim_, dw_vecs_->Row(va), vb, *inputs.word_vecs,
+				alpha, tmp_neu1e, rng, 1, true, update_word_vecs, sample_loss);
+			if (sample_loss != 0)
+				metrics->AddLoss(TrainMetrics::kDWSamples, loss);
 		}
+		flushSampleStats();
+		end_round = roundDone(i);
 	}
 
 	delete[] tmp_neu1e;
 }
 
+void EADocVecTrainer::trainDocWordListBatched(int seed, long long num_samples_per_round, bool update_word_vecs,
+	NodeInputs &inputs)
+{
+	FastRng rng(seed);
+	PairSampler::EdgeStream dw_pairs(inputs.dw_sampler, epochs_);
+	TrainMetrics::Slot *metrics = TrainMetrics::ThreadSlot();
+
+	long long total_num_samples = num_rounds_ * num_samples_per_round;
+	AlphaSchedule schedule(starting_alpha_, min_alpha_, total_num_samples);
+
+	NegBatchBuffer batch_buf(batch_size_, num_negative_samples_, word_vec_dim_);
+	float **vecs0 = new float*[batch_size_];
+	int *objs1 = new int[batch_size_];
+
+	float alpha = starting_alpha_;
+	int va = 0, vb = 0;
+	int end_round = endRound();
+	for (int i = 0; i < end_round; ++i)
+	{
+		printf("\rround %d, alpha %f", i, alpha);
+		fflush(stdout);
+		metrics->SetProgress(i, alpha);
+		for (long long j = 0; j < num_samples_per_round; j += batch_size_)
+		{
+			long long cur_num_samples = (i * num_samples_per_round) + j;
+			end_round = endRound();
+			if (i >= end_round)
+				break;
+			alpha = schedule.At(cur_num_samples, end_round * num_samples_per_round);
+			metrics->SetProgress(i, alpha);
+
+			for (int b = 0; b < batch_size_; ++b)
+			{
+				dw_pairs.Next(va, vb, rng);
+				metrics->Add(TrainMetrics::kDWSamples);
+				vecs0[b] = dw_vecs_->Row(va);
+				objs1[b] = vb;
+			}
+			float loss = 0, *batch_loss = sampleLoss(cur_num_samples / batch_size_, loss);
+			inputs.word_trainer->TrainBatch(word_vec_dim_, vecs0, objs1, batch_size_, *inputs.word_vecs,
+				alpha, 1, batch_buf, rng, true, update_word_vecs, batch_loss);
+			if (batch_loss != 0)
+				metrics->AddLoss(TrainMetrics::kDWSamples, loss, batch_size_);
+		}
+		flushSampleStats();
+		end_round = roundDone(i);
+	}
+
+	delete[] vecs0;
+	delete[] objs1;
+}
+
+void EADocVecTrainer::trainDocWordListDocMajor(int seed, long long num_samples_per_round, bool update_word_vecs,
+	NodeInputs &inputs)
+{
+	FastRng rng(seed);
+	TrainMetrics::Slot *metrics = TrainMetrics::ThreadSlot();
+
+	long long total_num_samples = num_rounds_ * num_samples_per_round;
+	AlphaSchedule schedule(starting_alpha_, min_alpha_, total_num_samples);
+
+	// a copy of the doc row and the summed gradient of its words, which stay
+	// in the cache of the thread while the group trains
+	const int num_words = doc_major_words_;
+	float *doc_vec = new float[word_vec_dim_];
+	float *doc_neu1e = new float[word_vec_dim_];
+
+	float alpha = starting_alpha_;
+	int end_round = endRound();
+	for (int i = 0; i < end_round; ++i)
+	{
+		printf("\rround %d, alpha %f", i, alpha);
+		fflush(stdout);
+		metrics->SetProgress(i, alpha);
+		for (long long j = 0; j < num_samples_per_round; j += num_words)
+		{
+			long long cur_num_samples = (i * num_samples_per_round) + j;
+			end_round = endRound();
+			if (i >= end_round)
+				break;
+			alpha = schedule.At(cur_num_samples, end_round * num_samples_per_round);
+			metrics->SetProgress(i, alpha);
+
+			int doc = inputs.dw_sampler->SampleLeft(rng);
+			float *doc_row = dw_vecs_->Row(doc);
+			std::copy(doc_row, doc_row + word_vec_dim_, doc_vec);
+			std::fill(doc_neu1e, doc_neu1e + word_vec_dim_, 0.0f);
+			float loss = 0, *group_loss = sampleLoss(cur_num_samples / num_words, loss);
+			for (int k = 0; k < num_words; ++k)
+			{
+				int word = inputs.dw_sampler->SampleRight(doc, rng);
+				inputs.word_trainer->AccumPair(word_vec_dim_, doc_vec, word, *inputs.word_vecs, alpha, doc_neu1e,
+					rng, 1, update_word_vecs, group_loss);
+			}
+			metrics->Add(TrainMetrics::kDWSamples, num_words);
+			if (group_loss != 0)
+				metrics->AddLoss(TrainMetrics::kDWSamples, loss, num_words);
+
+			// one write of the row, with the decay of num_words pairs
+			SimdKernels::AxpyDecay(1.0f, doc_neu1e, num_words * alpha * 0.01f, doc_row, word_vec_dim_);
+		}
+		flushSampleStats();
+		end_round = roundDone(i);
+	}
+
+	delete[] doc_vec;
+	delete[] doc_neu1e;
+}
+
 void EADocVecTrainer::trainDWEMT(const char *word_cnts_file, const char *entity_cnts_file, bool update_word_vecs, 
 	bool update_entity_vecs, const char *dst_doc_vecs_file_name)
 {
 	ExpTable exp_table;
-	NegTrain word_ns_trainer(&exp_table, num_negative_samples_, word_cnts_file);
-	NegTrain entity_ns_trainer(&exp_table, num_negative_samples_, entity_cnts_file);
+	AliasSampler *word_neg_table = NegSamplingBase::LoadNegSamplingTable(word_cnts_file);
+	AliasSampler *entity_neg_table = NegSamplingBase::LoadNegSamplingTable(entity_cnts_file);
+	if (epochs_)
+	{
+		dw_sampler_->InitEpochBlocks(mixSeed(seed_ + 0xe90c5u, 0));
+		de_sampler_->InitEpochBlocks(mixSeed(seed_ + 0xe90c5u, 1));
+	}
+	initNodeInputs(&exp_table, word_neg_table, entity_neg_table, !update_word_vecs, !update_entity_vecs);
 
-	int sum_dw_weights = dw_sampler_->sum_weights();
-	int sum_de_weights = de_sampler_->sum_weights();
+	long long sum_dw_weights = dw_sampler_->sum_weights();
+	long long sum_de_weights = de_sampler_->sum_weights();
 	long long sum_weights = sum_dw_weights + sum_de_weights;
+	if (sample_stats_)
+	{
+		dw_sampler_->EnableSampleStats(num_threads_);
+		de_sampler_->EnableSampleStats(num_threads_);
+	}
 	long long num_samples_per_round = sum_weights / 2;
 
 	float weight_portions[] = { (float)sum_de_weights / sum_weights, (float)sum_dw_weights / sum_weights };
 	printf("list distribution: %f %f\n", weight_portions[0], weight_portions[1]);
-	std::discrete_distribution<int> list_sample_dist(weight_portions, weight_portions + 2);
+	AliasSampler list_sampler;
+	list_sampler.Init(weight_portions, 2);
 
 	printf("%lld samples per round\n", num_samples_per_round);
 
-	int seeds[] = { 317, 7, 31, 297, 1238, 23487, 238593, 92384, 129380, 23848 };
-	std::thread *threads = new std::thread[num_threads_];
-	for (int i = 0; i < num_threads_; ++i)
+	if (initEarlyStopper())
 	{
-		int cur_seed = seeds[i];
-		threads[i] = std::thread([&, cur_seed, num_samples_per_round, update_word_vecs, update_entity_vecs]
-		{
-			trainDWETh(cur_seed, num_samples_per_round, update_word_vecs, update_entity_vecs, list_sample_dist,
-				word_ns_trainer, entity_ns_trainer);
-		});
+		early_stopper_->AddRelation("de", de_sampler_, de_vecs_, ee_vecs0_, entity_neg_table,
+			num_negative_samples_, weight_portions[0], early_stop_pairs_, mixSeed(seed_, 1));
+		early_stopper_->AddRelation("dw", dw_sampler_, dw_vecs_, word_vecs_, word_neg_table,
+			num_negative_samples_, weight_portions[1], early_stop_pairs_, mixSeed(seed_, 2));
+		early_stopper_->Start();
 	}
-	for (int i = 0; i < num_threads_; ++i)
-		threads[i].join();
-	printf("\n");
-
-	IOUtils::SaveVectors(dw_vecs_, word_vec_dim_, num_docs_, dst_doc_vecs_file_name);
+	runThreads(num_rounds_ * num_samples_per_round, [&](int i, NodeInputs &inputs)
+	{
+		trainDWETh(threadSeed(i), num_samples_per_round, update_word_vecs, update_entity_vecs, list_sampler,
+			inputs);
+	});
+	releaseEarlyStopper();
+	releaseNodeInputs();
+	delete word_neg_table;
+	delete entity_neg_table;
+
+	IOUtils::SaveVectors(dw_vecs_, dst_doc_vecs_file_name);
 }
 
-void EADocVecTrainer::trainDWETh(int seed, long long num_samples_per_round, bool update_word_vecs, bool update_entity_vecs, std::discrete_distribution<int> &list_sample_dist,
-	NegTrain &word_ns_trainer, NegTrain &entity_ns_trainer)
+void EADocVecTrainer::trainDWETh(int seed, long long num_samples_per_round, bool update_word_vecs, bool update_entity_vecs, AliasSampler &list_sampler,
+	NodeInputs &inputs)
 {
 	//printf("seed %d samples_per_round %d. training...\n", seed, num_samples_per_round);
-	std::default_random_engine generator(seed);
-
-	RandGen rand_gen(seed);
+	FastRng rng(seed);
+	PairSampler::EdgeStream de_pairs(inputs.de_sampler, epochs_), dw_pairs(inputs.dw_sampler, epochs_);
+	TrainMetrics::Slot *metrics = TrainMetrics::ThreadSlot();
 
 	//const float min_alpha = starting_alpha_ * 0.001;
 	long long total_num_samples = num_rounds_ * num_samples_per_round;
+	AlphaSchedule schedule(starting_alpha_, min_alpha_, total_num_samples);
 
 	float *tmp_neu1e = new float[word_vec_dim_];
 
 	float alpha = starting_alpha_;
 	int va = 0, vb = 0;
-	for (int i = 0; i < num_rounds_; ++i)
+	int end_round = endRound();
+	for (int i = 0; i < end_round; ++i)
 	{
 		printf("\rround %d, alpha %f", i, alpha);
 		fflush(stdout);
-		for (int j = 0; j < num_samples_per_round; ++j)
+		metrics->SetProgress(i, alpha);
+		for (long long j = 0; j < num_samples_per_round; ++j)
 		{
 			long long cur_num_samples = (i * num_samples_per_round) + j;
 			if (cur_num_samples % 10000 == 10000 - 1)
-				alpha = starting_alpha_ + (min_alpha_ - starting_alpha_) * cur_num_samples / total_num_samples;
+			{
+				end_round = endRound();
+				if (i >= end_round)
+					break;
+				alpha = schedule.At(cur_num_samples, end_round * num_samples_per_round);
+				metrics->SetProgress(i, alpha);
+			}
+
+			float loss = 0, *sample_loss = sampleLoss(cur_num_samples, loss);
 
-			int list_idx = list_sample_dist(generator);
+			int list_idx = list_sampler.Sample(rng);
 			int va = 0, vb = 0;
 			if (list_idx == 0)
 			{
-				de_sampler_->SamplePair(va, vb, generator, rand_gen);
-				entity_ns_trainer.TrainPair(entity_vec_dim_, de_vecs_[va], vb, ee_vecs0_,
-					alpha, tmp_neu1e, generator, 1, true, update_entity_vecs);
+				de_pairs.Next(va, vb, rng);
+				metrics->Add(TrainMetrics::kDESamples);
+				inputs.entity_trainer->TrainPair(entity_vec_dim_, de_vecs_->Row(va), vb, *inputs.entity_vecs,
+					alpha, tmp_neu1e, rng, 1, true, update_entity_vecs, sample_loss);
+				if (sample_loss != 0)
+					metrics->AddLoss(TrainMetrics::kDESamples, loss);
 			}
 			else if (list_idx == 1)
 			{
-				dw_sampler_->SamplePair(va, vb, generator, rand_gen);
-				word_ns_trainer.TrainPair(word_vec_dim_, dw_vecs_[va], vb, word_vecs_,
-					alpha, tmp_neu1e, generator, 1, true, update_word_vecs);
+				dw_pairs.Next(va, vb, rng);
+				metrics->Add(TrainMetrics::kDWSamples);
+				inputs.word_trainer->TrainPair(word_vec_dim_, dw_vecs_->Row(va), vb, *inputs.word_vecs,
+					alpha, tmp_neu1e, rng, 1, true, update_word_vecs, sample_loss);
+				if (sample_loss != 0)
+					metrics->AddLoss(TrainMetrics::kDWSamples, loss);
 			}
 		}
+		flushSampleStats();
+		end_round = roundDone(i);
 	}
 
 	delete[] tmp_neu1e;
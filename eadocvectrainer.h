@@ -2,10 +2,18 @@
 #define EADOCVECTRAINER_H_
 
 #include <random>
+#include <vector>
+#include <functional>
 
 #include "pairsampler.h"
 #include "negtrain.h"
 #include "negsamplingdoubleobj.h"
+#include "checkpointer.h"
+#include "numautils.h"
+#include "gradbuffer.h"
+#include "barrier.h"
+#include "trainmetrics.h"
+#include "earlystopper.h"
 
 class EADocVecTrainer
 {
@@ -13,7 +21,9 @@ public:
 	EADocVecTrainer(int num_rounds, int num_threads, int num_negative_samples, float starting_alpha,
 		float min_alpha = 0.0001f);
 
-	void AllJointThreaded(const char *ee_file, const char *doc_entity_file,
+	// false if a checkpoint was to be resumed and could not be, or if a counts
+	// file of hierarchical softmax does not fit its relation
+	bool AllJointThreaded(const char *ee_file, const char *doc_entity_file,
 		const char *doc_words_file_name, const char *entity_cnts_file, const char *word_cnts_file,
 		int vec_dim, bool shared, float weight_ee, float weight_de, float weight_dw, const char *dst_dedw_vec_file_name, 
 		const char *dst_word_vecs_file_name,
@@ -30,13 +40,218 @@ public:
 		const char *entity_cnts_file, const char *word_vecs_file_name, const char *entity_vecs_file_name,
 		int vec_dim, const char *dst_doc_vecs_file);
 
+	// vec_dim 0 takes the dimension of the word vectors
 	void TrainDocWordFixedWordVecs(const char *doc_words_file_name, const char *word_cnts_file, 
 		const char *word_vecs_file_name, int vec_dim, const char *dst_doc_vecs_file_name);
 
+	// Fold-in inference with DocVecInferer, with num_rounds as the epoch cap:
+	// vectors for the docs of doc_words_file, and of doc_entities_file unless
+	// it is 0, with the word and entity vectors fixed. Without shared, the
+	// output is the doc-entity part followed by the doc-word part, like
+	// TrainEmadrNewDocs2.
+	void InferDocVecs(const char *doc_words_file, const char *doc_entities_file, const char *word_cnts_file,
+		const char *entity_cnts_file, const char *word_vecs_file_name, const char *entity_vecs_file_name,
+		bool shared, float tol, const char *dst_doc_vecs_file);
+
+	// batch_size > 1 switches allJoint and trainDocWordList to mini-batches
+	// of pairs from one relation that share their negative samples
+	void SetBatchSize(int batch_size)
+	{
+		batch_size_ = batch_size;
+	}
+
+	// words_per_doc > 1 switches trainDocWordList to doc-major groups: a doc
+	// is drawn, then words_per_doc of its words, and the doc row is written
+	// once per group with the summed gradient taken at its value before the
+	// group. The word rows are updated per pair as before. Takes precedence
+	// over batches and epochs.
+	void SetDocMajor(int words_per_doc)
+	{
+		doc_major_words_ = words_per_doc;
+	}
+
+	// count how often each edge is sampled, see PairSampler::EnableSampleStats
+	void SetSampleStats(bool sample_stats)
+	{
+		sample_stats_ = sample_stats;
+	}
+
+	// Storage precision of each AllJointThreaded table, see EmbeddingTable;
+	// all fp32 by default. Training math stays fp32.
+	void SetPrecisions(EmbeddingTable::Precision word, EmbeddingTable::Precision dw, EmbeddingTable::Precision de,
+		EmbeddingTable::Precision ee0, EmbeddingTable::Precision ee1)
+	{
+		word_precision_ = word;
+		dw_precision_ = dw;
+		de_precision_ = de;
+		ee0_precision_ = ee0;
+		ee1_precision_ = ee1;
+	}
+
+	// Snapshot AllJointThreaded into dir every every_rounds rounds and/or every
+	// every_minutes minutes, see Checkpointer. With resume, training continues
+	// from the last complete checkpoint in dir if there is one.
+	void SetCheckpoint(const char *dir, int every_rounds, float every_minutes, bool resume)
+	{
+		checkpoint_dir_ = dir;
+		checkpoint_rounds_ = every_rounds;
+		checkpoint_minutes_ = every_minutes;
+		resume_ = resume;
+	}
+
+	// With epochs, the threads walk the edges of every relation in
+	// block-shuffled epochs instead of drawing them i.i.d., see
+	// PairSampler::EdgeStream. Rounds keep their number of samples, half the
+	// summed weight per thread, so the training budget does not change; an
+	// epoch is sum_weights() samples over all threads and spans rounds
+	// accordingly: two rounds with one thread, one with two. The relation of
+	// each sample is still drawn. A resumed checkpoint starts the epochs over.
+	void SetEpochs(bool epochs)
+	{
+		epochs_ = epochs;
+	}
+
+	// Seeds the initial vectors and the sample streams of the threads; 0, the
+	// default, keeps rand() and the fixed seeds of the original trainer.
+	void SetSeed(unsigned int seed)
+	{
+		seed_ = seed;
+	}
+
+	// Deterministic AllJointThreaded: the same seed and number of threads
+	// give bit-identical vectors. Every thread trains its own seeded stream
+	// of samples, step_samples at a time. The updates of a step are taken at
+	// the values before the step and kept in a GradBuffer per thread; at the
+	// end of the step the threads meet at a barrier and add the buffers to
+	// the tables, each thread a fixed subset of the rows, in thread order.
+	// Checkpoints and mini-batches are not supported in this mode.
+	void SetDeterministic(bool deterministic, int step_samples)
+	{
+		deterministic_ = deterministic;
+		deterministic_step_ = step_samples;
+	}
+
+	// Pin the training threads to the NUMA nodes and spread the tables they
+	// share over the nodes, see NumaUtils. With replicas, each node also gets
+	// its own copy of what the threads only read: the pair samplers, the
+	// negative sampling tables and the fixed vectors of TrainWEFixed and
+	// TrainDocWordFixedWordVecs. The samplers are not replicated when
+	// sample stats are on.
+	void SetNuma(bool numa, bool replicas)
+	{
+		numa_ = numa;
+		numa_replicas_ = numa && replicas;
+		NumaUtils::SetPlacement(numa ? num_threads_ : 0);
+	}
+
+	// Append a JSON line of live training metrics to file_name every
+	// every_secs seconds while the threads train, see TrainMetrics.
+	void SetMetrics(const char *file_name, float every_secs)
+	{
+		metrics_file_ = file_name;
+		metrics_secs_ = every_secs;
+	}
+
+	// Stop the Hogwild trainers early when the log-likelihood of
+	// num_eval_pairs pairs per relation gains less than min_gain of its
+	// magnitude for patience rounds, see EarlyStopper; min_gain 0 keeps all
+	// num_rounds. The learning rate then decays to min_alpha by the new end.
+	// Not supported with checkpoints or in deterministic mode.
+	void SetEarlyStop(float min_gain, int patience, int num_eval_pairs)
+	{
+		early_stop_gain_ = min_gain;
+		early_stop_patience_ = patience;
+		early_stop_pairs_ = num_eval_pairs;
+	}
+
+	// Hierarchical softmax instead of negative sampling for the relations of
+	// AllJointThreaded that are set: the objs1 of a pair are predicted along
+	// their paths in a Huffman tree of the entity or word counts file, see
+	// HuffmanTree, at about log2 of the number of objects inner products per
+	// pair, fewer for frequent ones, where negative sampling takes
+	// num_negative_samples + 1. The inner nodes of ee are the rows of ee1; de
+	// and dw get inner node tables of their own, so the entity vectors then
+	// come from ee alone, and with dw there are no word vectors to train,
+	// checkpoint or save. The counts files must have as many objects as the
+	// relations. Not supported with early stopping.
+	void SetHierarchicalSoftmax(bool ee, bool de, bool dw)
+	{
+		hs_ee_ = ee;
+		hs_de_ = de;
+		hs_dw_ = dw;
+	}
+
+	// Samples per second of the last training run, from the planned number
+	// of samples and the time of the slowest thread; for benchmarks.
+	double samples_per_sec()
+	{
+		return samples_per_sec_;
+	}
+
 private:
+	// Linear decay of alpha to min_alpha at end_sample. When the end moves,
+	// the decay goes on from the current alpha to min_alpha at the new end.
+	struct AlphaSchedule
+	{
+		AlphaSchedule(float starting_alpha, float min_alpha, long long end_sample)
+			: beg_alpha_(starting_alpha), min_alpha_(min_alpha), end_(end_sample), alpha_(starting_alpha)
+		{
+		}
+
+		float At(long long sample, long long end_sample)
+		{
+			if (end_sample != end_)
+			{
+				beg_ = sample;
+				beg_alpha_ = alpha_;
+				end_ = end_sample;
+			}
+			alpha_ = beg_alpha_ + (min_alpha_ - beg_alpha_) * (sample - beg_) / (end_ - beg_);
+			return alpha_;
+		}
+
+		long long beg_ = 0;
+		float beg_alpha_;
+		float min_alpha_;
+		long long end_;
+		float alpha_;
+	};
+
+	// what the threads of one node read
+	struct NodeInputs
+	{
+		PairSampler *dw_sampler = 0;
+		PairSampler *de_sampler = 0;
+		PairSampler *ee_sampler = 0;
+		AliasSampler *word_neg_table = 0;
+		AliasSampler *entity_neg_table = 0;
+		// the objs1 tables of trainDocWordList and trainDWETh
+		EmbeddingTable *word_vecs = 0;
+		EmbeddingTable *entity_vecs = 0;
+		NegTrain *word_trainer = 0;
+		NegTrain *entity_trainer = 0;
+		// hierarchical softmax over word_tree_ and entity_tree_
+		NegTrain *word_tree_trainer = 0;
+		NegTrain *entity_tree_trainer = 0;
+	};
+
+	// One NodeInputs per node with NUMA on, otherwise one; the tables are
+	// replicated only if they are not trained.
+	void initNodeInputs(ExpTable *exp_table, AliasSampler *word_neg_table, AliasSampler *entity_neg_table,
+		bool fixed_word_vecs, bool fixed_entity_vecs);
+	void releaseNodeInputs();
+
+	// Runs fn(thread_idx, inputs of its node) on num_threads_ threads, pinned
+	// with NUMA on, and then reports the throughput of each node.
+	void runThreads(long long num_samples_per_thread, const std::function<void(int, NodeInputs &)> &fn);
+
+	unsigned int threadSeed(int thread_idx);
+	// seed of the initial values of table table_idx, 0 for rand()
+	unsigned int tableSeed(int table_idx);
+
 	void initDocWordList(const char *doc_words_file_name)
 	{
-		dw_sampler_ = new PairSampler(doc_words_file_name);
+		dw_sampler_ = new PairSampler(doc_words_file_name, num_threads_);
 		num_words_ = dw_sampler_->num_vertex_right();
 		num_docs_ = dw_sampler_->num_vertex_left();
 		printf("%d docs, %d words.\n", num_docs_, num_words_);
@@ -44,7 +259,7 @@ private:
 
 	void initDocEntityList(const char *de_file)
 	{
-		de_sampler_ = new PairSampler(de_file);
+		de_sampler_ = new PairSampler(de_file, num_threads_);
 		num_docs_ = de_sampler_->num_vertex_left();
 		num_entities_ = de_sampler_->num_vertex_right();
 		printf("%d docs, %d entities.\n", num_docs_, num_entities_);
@@ -52,31 +267,149 @@ private:
 
 	void initEntityEntityList(const char *ee_file)
 	{
-		ee_sampler_ = new PairSampler(ee_file);
+		ee_sampler_ = new PairSampler(ee_file, num_threads_);
 		num_entities_ = ee_sampler_->num_vertex_left();
 		printf("%d entities.\n", num_entities_);
 	}
 
-	void saveConcatnatedVectors(float **vecs0, float **vecs1, int num_vecs, int vec_dim,
+	// Loads the three adjacency files and the two counts files at the same
+	// time, one thread each.
+	void loadAllJointInputs(const char *ee_file, const char *de_file, const char *dw_file,
+		const char *entity_cnts_file, const char *word_cnts_file, AliasSampler *&entity_neg_table,
+		AliasSampler *&word_neg_table);
+
+	void flushSampleStats()
+	{
+		PairSampler *samplers[] = { dw_sampler_, de_sampler_, ee_sampler_ };
+		for (PairSampler *sampler : samplers)
+			if (sampler != 0)
+				sampler->FlushSampleStats();
+	}
+
+	// Sync point inside a round, when training of [beg_sample, end_sample)
+	// crosses a multiple of Checkpointer::kSyncInterval. Returns false when
+	// training should stop.
+	bool syncCheckpoint(int thread_idx, int round, long long beg_sample, long long end_sample,
+		long long num_samples_per_round, float alpha, FastRng &rng)
+	{
+		if (checkpointer_ == 0 || end_sample >= num_samples_per_round
+			|| beg_sample / Checkpointer::kSyncInterval == end_sample / Checkpointer::kSyncInterval)
+			return true;
+		return checkpointer_->SyncPoint(thread_idx, round, end_sample, alpha, false, rng);
+	}
+
+	// the round training ends before, which early stopping may move up
+	int endRound()
+	{
+		return early_stopper_ != 0 ? early_stopper_->end_round() : num_rounds_;
+	}
+
+	// called by every thread at the end of each round; returns endRound()
+	int roundDone(int round)
+	{
+		if (early_stopper_ != 0)
+			early_stopper_->RoundDone(round);
+		return endRound();
+	}
+
+	// Where the trainer adds the loss of sample step, with loss reset, or 0
+	// when it is not computed: every kLossSampling-th sample, with metrics on.
+	float *sampleLoss(long long step, float &loss)
+	{
+		if (metrics_file_ == 0 || step % kLossSampling != 0)
+			return 0;
+		loss = 0;
+		return &loss;
+	}
+
+	// Initializes early_stopper_ if early stopping is on and supported.
+	// Relations are added by the caller.
+	bool initEarlyStopper();
+	void releaseEarlyStopper();
+
+	// the trees and inner node tables of the relations set by SetHierarchicalSoftmax;
+	// false if a counts file does not match the objects of the relation
+	bool initHierarchicalSoftmax(const char *entity_cnts_file, const char *word_cnts_file);
+	void releaseHierarchicalSoftmax();
+
+	// The trainer and the objs1 table of relation list_idx of
+	// AllJointThreaded, 0 for ee, 1 for de and 2 for dw.
+	NegTrain *relationTrainer(int list_idx, NodeInputs &inputs)
+	{
+		if (list_idx == 2)
+			return hs_dw_ ? inputs.word_tree_trainer : inputs.word_trainer;
+		return (list_idx == 0 ? hs_ee_ : hs_de_) ? inputs.entity_tree_trainer : inputs.entity_trainer;
+	}
+
+	EmbeddingTable *relationVecs1(int list_idx)
+	{
+		if (list_idx == 0)
+			return ee_vecs1_;
+		if (list_idx == 1)
+			return hs_de_ ? de_inner_vecs_ : ee_vecs0_;
+		return hs_dw_ ? dw_inner_vecs_ : word_vecs_;
+	}
+
+	void saveConcatnatedVectors(EmbeddingTable *vecs0, EmbeddingTable *vecs1,
 		const char *dst_file_name);
 
-	void allJoint(int seed, long long num_samples_per_round, float weight_ee, float weight_de, float weight_dw,
-		std::discrete_distribution<int> &list_sample_dist,
-		NegTrain &entity_ns_trainer, NegTrain &word_ns_trainer);
+	void allJoint(int thread_idx, int seed, long long num_samples_per_round, float weight_ee, float weight_de, float weight_dw,
+		AliasSampler &list_sampler, NodeInputs &inputs);
+	void allJointBatched(int thread_idx, int seed, long long num_samples_per_round, float weight_ee, float weight_de, float weight_dw,
+		AliasSampler &list_sampler, NodeInputs &inputs);
+
+	void allJointDeterministic(int thread_idx, long long num_samples_per_round, float weight_ee, float weight_de,
+		float weight_dw, AliasSampler &list_sampler, NodeInputs &inputs,
+		GradBuffer **grads, Barrier &barrier, double &merge_secs);
 
 	void trainDocWordMT(const char *word_cnts_file, bool update_word_vecs, const char *dst_doc_vecs_file_name);
 	void trainDocWordList(int seed, long long num_samples_per_round, bool update_word_vecs, 
-		NegTrain &word_ns_trainer);
+		NodeInputs &inputs);
+	void trainDocWordListBatched(int seed, long long num_samples_per_round, bool update_word_vecs,
+		NodeInputs &inputs);
+	void trainDocWordListDocMajor(int seed, long long num_samples_per_round, bool update_word_vecs,
+		NodeInputs &inputs);
 
 	void trainDWEMT(const char *word_cnts_file, const char *entity_cnts_file, bool update_word_vecs, 
 		bool update_entity_vecs, const char *dst_doc_vecs_file_name);
-	void trainDWETh(int seed, long long num_samples_per_round, bool update_word_vecs, bool update_entity_vecs, std::discrete_distribution<int> &list_sample_dist,
-		NegTrain &word_ns_trainer, NegTrain &entity_ns_trainer);
+	void trainDWETh(int seed, long long num_samples_per_round, bool update_word_vecs, bool update_entity_vecs, AliasSampler &list_sampler,
+		NodeInputs &inputs);
 
 private:
 	int num_rounds_ = 10;
 	int num_threads_ = 1;
 	int num_negative_samples_ = 10;
+	int batch_size_ = 1;
+	int doc_major_words_ = 0;
+	bool sample_stats_ = false;
+	bool epochs_ = false;
+	unsigned int seed_ = 0;
+	bool deterministic_ = false;
+	int deterministic_step_ = 256;
+	bool numa_ = false;
+	bool numa_replicas_ = false;
+	std::vector<NodeInputs> node_inputs_;
+	const char *metrics_file_ = 0;
+	float metrics_secs_ = 10;
+	static const int kLossSampling = 16;
+
+	float early_stop_gain_ = 0;
+	int early_stop_patience_ = 1;
+	int early_stop_pairs_ = 10000;
+	EarlyStopper *early_stopper_ = 0;
+	double samples_per_sec_ = 0;
+
+	const char *checkpoint_dir_ = 0;
+	int checkpoint_rounds_ = 0;
+	float checkpoint_minutes_ = 0;
+	bool resume_ = false;
+	Checkpointer *checkpointer_ = 0;
+
+	EmbeddingTable::Precision word_precision_ = EmbeddingTable::kFloat32;
+	EmbeddingTable::Precision dw_precision_ = EmbeddingTable::kFloat32;
+	EmbeddingTable::Precision de_precision_ = EmbeddingTable::kFloat32;
+	EmbeddingTable::Precision ee0_precision_ = EmbeddingTable::kFloat32;
+	EmbeddingTable::Precision ee1_precision_ = EmbeddingTable::kFloat32;
 
 	float starting_alpha_;
 	float min_alpha_;
@@ -89,13 +422,21 @@ private:
 	int num_docs_ = 0;
 	int num_entities_ = 0;
 
-	float **word_vecs_ = 0;
-	float **ee_vecs0_ = 0;
-	float **ee_vecs1_ = 0;
-	float **dw_vecs_ = 0;
-	float **de_vecs_ = 0;
+	EmbeddingTable *word_vecs_ = 0;
+	EmbeddingTable *ee_vecs0_ = 0;
+	EmbeddingTable *ee_vecs1_ = 0;
+	EmbeddingTable *dw_vecs_ = 0;
+	EmbeddingTable *de_vecs_ = 0;
+
+	EmbeddingTable *doc_vecs_ = 0;
 
-	float **doc_vecs_ = 0;
+	bool hs_ee_ = false;
+	bool hs_de_ = false;
+	bool hs_dw_ = false;
+	HuffmanTree *entity_tree_ = 0;
+	HuffmanTree *word_tree_ = 0;
+	EmbeddingTable *de_inner_vecs_ = 0;
+	EmbeddingTable *dw_inner_vecs_ = 0;
 
 	int entity_vec_dim_ = 0;
 	int word_vec_dim_ = 0;
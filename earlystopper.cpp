@@ -0,0 +1,148 @@
+#include "earlystopper.h"
+
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+#include "fastrng.h"
+#include "simdkernels.h"
+
+// log(sigma(x)) without overflow for large |x|
+static double logSigma(double x)
+{
+	return x >= 0 ? -log1p(exp(-x)) : x - log1p(exp(x));
+}
+
+EarlyStopper::EarlyStopper(int num_rounds, int num_threads, float min_gain, int patience)
+	: num_rounds_(num_rounds), num_threads_(num_threads), min_gain_(min_gain), patience_(patience),
+	end_round_(num_rounds), num_done_(num_rounds, 0)
+{
+}
+
+EarlyStopper::~EarlyStopper()
+{
+	Stop();
+}
+
+void EarlyStopper::AddRelation(const char *name, PairSampler *sampler, EmbeddingTable *vecs0,
+	EmbeddingTable *vecs1, AliasSampler *neg_table, int num_negs, float share, int num_pairs,
+	unsigned long long seed)
+{
+	Relation relation;
+	relation.name = name;
+	relation.vecs0 = vecs0;
+	relation.vecs1 = vecs1;
+	relation.share = share;
+	relation.num_negs = num_negs;
+	relation.pairs.resize((size_t)num_pairs * (2 + num_negs));
+
+	FastRng rng(seed);
+	int *pair = relation.pairs.data();
+	for (int i = 0; i < num_pairs; ++i, pair += 2 + num_negs)
+	{
+		sampler->SamplePair(pair[0], pair[1], rng);
+		neg_table->SampleBatch(rng, pair + 2, num_negs);
+	}
+	relations_.push_back(relation);
+}
+
+void EarlyStopper::Start()
+{
+	evaluator_ = std::thread([this] { evalLoop(); });
+}
+
+void EarlyStopper::RoundDone(int round)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (++num_done_[round] == num_threads_)
+	{
+		pending_.push_back(round);
+		cond_.notify_all();
+	}
+}
+
+void EarlyStopper::Stop()
+{
+	if (!evaluator_.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	cond_.notify_all();
+	evaluator_.join();
+}
+
+void EarlyStopper::evalLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true)
+	{
+		cond_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+		if (pending_.empty())
+			break;
+		// only the latest round is worth scoring when training got ahead
+		int round = pending_.back();
+		pending_.clear();
+		lock.unlock();
+		evalRound(round);
+		lock.lock();
+	}
+}
+
+void EarlyStopper::evalRound(int round)
+{
+	double ll = 0;
+	double sum_shares = 0;
+	// printed in one go, the training threads print their progress meanwhile
+	std::string line;
+	char buf[64];
+	for (const Relation &relation : relations_)
+	{
+		double relation_ll = logLikelihood(relation);
+		snprintf(buf, sizeof(buf), " %s %.4f", relation.name.c_str(), relation_ll);
+		line += buf;
+		ll += relation.share * relation_ll;
+		sum_shares += relation.share;
+	}
+	ll /= sum_shares;
+	printf("\nround %d log-likelihood per pair:%s, all %.4f\n", round, line.c_str(), ll);
+
+	if (num_evals_++ > 0 && ll - best_ll_ < min_gain_ * fabs(best_ll_))
+		++num_strikes_;
+	else
+		num_strikes_ = 0;
+	best_ll_ = num_evals_ == 1 ? ll : std::max(best_ll_, ll);
+
+	// the threads are in round + 1 by now, which becomes the last one
+	if (num_strikes_ >= patience_ && round + 2 < end_round())
+	{
+		end_round_ = round + 2;
+		printf("early stop: training ends after round %d of %d\n", round + 1, num_rounds_);
+	}
+	fflush(stdout);
+}
+
+double EarlyStopper::logLikelihood(const Relation &relation)
+{
+	int dim = relation.vecs1->dim();
+	std::vector<float> vec0(dim), vec1(dim);
+	int stride = 2 + relation.num_negs;
+	int num_pairs = (int)(relation.pairs.size() / stride);
+	double sum = 0;
+	for (const int *pair = relation.pairs.data(); pair < relation.pairs.data() + relation.pairs.size(); pair += stride)
+	{
+		relation.vecs0->LoadRow(pair[0], vec0.data());
+		relation.vecs1->LoadRow(pair[1], vec1.data());
+		sum += logSigma(SimdKernels::DotProduct(vec0.data(), vec1.data(), dim));
+		for (int k = 0; k < relation.num_negs; ++k)
+		{
+			// skipped in training as well
+			if (pair[2 + k] == pair[1])
+				continue;
+			relation.vecs1->LoadRow(pair[2 + k], vec1.data());
+			sum += logSigma(-SimdKernels::DotProduct(vec0.data(), vec1.data(), dim));
+		}
+	}
+	return num_pairs > 0 ? sum / num_pairs : 0;
+}
@@ -0,0 +1,94 @@
+#ifndef EARLYSTOPPER_H_
+#define EARLYSTOPPER_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "pairsampler.h"
+#include "embeddingtable.h"
+
+// Early stopping for the Hogwild trainers. A fixed sample of pairs of each
+// relation, with fixed negatives, is drawn from the graph before training;
+// the pairs stay in the training data, so their log-likelihood measures how
+// far the vectors still move rather than generalization. Whenever all
+// threads are done with a round a background thread scores the pairs
+// against the tables, while training goes on with the next round.
+//
+// Training stops when the log-likelihood per pair, averaged over the
+// relations by their share of the samples, gained less than min_gain of its
+// magnitude over the best earlier round for patience rounds in a row. The
+// end then moves to the end of the round being trained, see end_round.
+class EarlyStopper
+{
+public:
+	EarlyStopper(int num_rounds, int num_threads, float min_gain, int patience);
+	~EarlyStopper();
+
+	// num_pairs pairs of sampler scored as vecs0[left] . vecs1[right] against
+	// num_negs negatives from neg_table; share is the weight of the relation.
+	// With sample stats on, the pairs count as samples of shard 0.
+	void AddRelation(const char *name, PairSampler *sampler, EmbeddingTable *vecs0, EmbeddingTable *vecs1,
+		AliasSampler *neg_table, int num_negs, float share, int num_pairs, unsigned long long seed);
+
+	void Start();
+
+	// called by every training thread at the end of each round it trains
+	void RoundDone(int round);
+
+	// scores the last round and stops the background thread
+	void Stop();
+
+	// the round training ends before; num_rounds until the rule fires
+	int end_round()
+	{
+		return end_round_.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Relation
+	{
+		std::string name;
+		EmbeddingTable *vecs0;
+		EmbeddingTable *vecs1;
+		float share;
+		int num_negs;
+		// left, right and num_negs negatives per pair
+		std::vector<int> pairs;
+	};
+
+	// mean log-likelihood per pair of relation
+	double logLikelihood(const Relation &relation);
+	void evalLoop();
+	void evalRound(int round);
+
+	EarlyStopper(const EarlyStopper &);
+	EarlyStopper &operator=(const EarlyStopper &);
+
+private:
+	int num_rounds_;
+	int num_threads_;
+	float min_gain_;
+	int patience_;
+	std::vector<Relation> relations_;
+
+	std::atomic<int> end_round_;
+
+	// threads done with each round, and the rounds waiting to be scored
+	std::vector<int> num_done_;
+	std::vector<int> pending_;
+	bool stop_ = false;
+	std::thread evaluator_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+
+	// owned by the evaluator
+	double best_ll_ = 0;
+	int num_evals_ = 0;
+	int num_strikes_ = 0;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include "embeddingtable.h"
+
+#include <cstring>
+#include <algorithm>
+
+#include "memutils.h"
+#include "numautils.h"
+
+const char *EmbeddingTable::GetPrecisionName(Precision precision)
+{
+	switch (precision)
+	{
+	case kBFloat16:
+		return "bf16";
+	case kFloat16:
+		return "fp16";
+	default:
+		return "fp32";
+	}
+}
+
+bool EmbeddingTable::ParsePrecision(const char *name, Precision &precision)
+{
+	Precision all[] = { kFloat32, kBFloat16, kFloat16 };
+	for (Precision cur : all)
+	{
+		if (strcmp(name, GetPrecisionName(cur)) == 0)
+		{
+			precision = cur;
+			return true;
+		}
+	}
+	return false;
+}
+
+EmbeddingTable::EmbeddingTable(int num_rows, int dim, Precision precision) : num_rows_(num_rows), dim_(dim),
+	stride_(GetStride(dim, GetElemSize(precision))), precision_(precision)
+{
+	void *data = MemUtils::AlignedAlloc(num_bytes(), kAlignment);
+	NumaUtils::Place(data, num_bytes());
+	if (precision == kFloat32)
+		data_ = (float*)data;
+	else
+		half_data_ = (unsigned short*)data;
+}
+
+EmbeddingTable::~EmbeddingTable()
+{
+	MemUtils::AlignedFree(data_ != 0 ? (void*)data_ : (void*)half_data_);
+}
+
+EmbeddingTable *EmbeddingTable::Clone()
+{
+	EmbeddingTable *copy = new EmbeddingTable(num_rows_, dim_, precision_);
+	const void *src = data_ != 0 ? (const void*)data_ : (const void*)half_data_;
+	void *dst = copy->data_ != 0 ? (void*)copy->data_ : (void*)copy->half_data_;
+	memcpy(dst, src, num_bytes());
+	return copy;
+}
+
+void EmbeddingTable::Fill(float val)
+{
+	if (precision_ == kFloat32)
+	{
+		std::fill(data_, data_ + size(), val);
+		return;
+	}
+
+	// val is rounded the same way in every row and the padding is zeroed
+	float *row = new float[stride_];
+	std::fill(row, row + dim_, val);
+	std::fill(row + dim_, row + stride_, 0.0f);
+	unsigned short *half_row = new unsigned short[stride_];
+	if (precision_ == kBFloat16)
+		SimdKernels::FloatToBf16(row, half_row, stride_, 0);
+	else
+		SimdKernels::FloatToFp16(row, half_row, stride_, 0);
+	for (int i = 0; i < num_rows_; ++i)
+		memcpy(HalfRow(i), half_row, stride_ * sizeof(unsigned short));
+	delete[] row;
+	delete[] half_row;
+}
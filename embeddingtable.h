@@ -0,0 +1,163 @@
+#ifndef EMBEDDINGTABLE_H_
+#define EMBEDDINGTABLE_H_
+
+#include <algorithm>
+
+#include "simdkernels.h"
+
+// A num_rows x dim matrix in one 64-byte aligned slab. Rows are padded
+// to a multiple of the cache line size so that no two rows share a line,
+// which keeps Hogwild threads updating different rows from false sharing.
+//
+// The values are fp32, or bf16/fp16 to halve the memory and bandwidth of a
+// table. Row and operator[] give the fp32 rows in place. A 16-bit table is
+// only accessed through LoadRow/StoreRow, which convert a row to fp32
+// scratch space and back, rounding stochastically on the way back.
+class EmbeddingTable
+{
+public:
+	enum Precision
+	{
+		kFloat32,
+		kBFloat16,
+		kFloat16
+	};
+
+	static const int kAlignment = 64;
+	static const int kFloatsPerLine = kAlignment / sizeof(float);
+
+	static int GetStride(int dim, int elem_size = sizeof(float))
+	{
+		int elems_per_line = kAlignment / elem_size;
+		return (dim + elems_per_line - 1) / elems_per_line * elems_per_line;
+	}
+
+	static int GetElemSize(Precision precision)
+	{
+		return precision == kFloat32 ? 4 : 2;
+	}
+
+	static const char *GetPrecisionName(Precision precision);
+	// "fp32", "bf16" or "fp16"; returns false for anything else
+	static bool ParsePrecision(const char *name, Precision &precision);
+
+public:
+	// rows are left uninitialized; large tables are spread over the NUMA
+	// nodes when NumaUtils placement is on
+	EmbeddingTable(int num_rows, int dim, Precision precision = kFloat32);
+	~EmbeddingTable();
+
+	// a copy in memory first touched by the calling thread, e.g. a per-node
+	// replica of a frozen table made from NumaUtils::RunOnNode
+	EmbeddingTable *Clone();
+
+	// fp32 tables only
+	float *operator[](int idx)
+	{
+		return data_ + (long long)idx * stride_;
+	}
+
+	// fp32 tables only
+	float *Row(int idx)
+	{
+		return data_ + (long long)idx * stride_;
+	}
+
+	// 16-bit tables only
+	unsigned short *HalfRow(int idx)
+	{
+		return half_data_ + (long long)idx * stride_;
+	}
+
+	void LoadRow(int idx, float *dst)
+	{
+		switch (precision_)
+		{
+		case kBFloat16:
+			SimdKernels::Bf16ToFloat(HalfRow(idx), dst, dim_);
+			break;
+		case kFloat16:
+			SimdKernels::Fp16ToFloat(HalfRow(idx), dst, dim_);
+			break;
+		default:
+			std::copy(Row(idx), Row(idx) + dim_, dst);
+			break;
+		}
+	}
+
+	// seed picks the random bits of the stochastic rounding
+	void StoreRow(int idx, const float *src, unsigned int seed)
+	{
+		switch (precision_)
+		{
+		case kBFloat16:
+			SimdKernels::FloatToBf16(src, HalfRow(idx), dim_, seed);
+			break;
+		case kFloat16:
+			SimdKernels::FloatToFp16(src, HalfRow(idx), dim_, seed);
+			break;
+		default:
+			std::copy(src, src + dim_, Row(idx));
+			break;
+		}
+	}
+
+	void Fill(float val);
+
+	// fp32 tables only
+	float *data()
+	{
+		return data_;
+	}
+
+	Precision precision()
+	{
+		return precision_;
+	}
+
+	bool is_fp32()
+	{
+		return precision_ == kFloat32;
+	}
+
+	int num_rows()
+	{
+		return num_rows_;
+	}
+
+	int dim()
+	{
+		return dim_;
+	}
+
+	// in elements
+	int stride()
+	{
+		return stride_;
+	}
+
+	// in elements
+	long long size()
+	{
+		return (long long)num_rows_ * stride_;
+	}
+
+	long long num_bytes()
+	{
+		return size() * GetElemSize(precision_);
+	}
+
+private:
+	EmbeddingTable(const EmbeddingTable &);
+	EmbeddingTable &operator=(const EmbeddingTable &);
+
+private:
+	int num_rows_ = 0;
+	int dim_ = 0;
+	int stride_ = 0;
+	Precision precision_ = kFloat32;
+	float *data_ = 0;
+	unsigned short *half_data_ = 0;
+};
+
+#endif
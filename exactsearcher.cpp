@@ -0,0 +1,207 @@
+#include "exactsearcher.h"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "simdkernels.h"
+
+// std::min takes them by reference
+const int ExactSearcher::kQueryTile;
+const int ExactSearcher::kRowTile;
+
+// higher similarity first, then lower row; as a heap comparator it keeps
+// the worst neighbour on top
+static bool betterNeighbor(const std::pair<float, int> &a, const std::pair<float, int> &b)
+{
+	return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+static void normalize(float *vec, int dim)
+{
+	float norm = sqrtf(SimdKernels::DotProduct(vec, vec, dim));
+	if (norm > 0)
+	{
+		for (int i = 0; i < dim; ++i)
+			vec[i] /= norm;
+	}
+}
+
+ExactSearcher::ExactSearcher(EmbeddingTable &vecs) : num_rows_(vecs.num_rows()), dim_(vecs.dim())
+{
+	int num_tiles = (num_rows_ + kRowTile - 1) / kRowTile;
+	long long size = (long long)num_tiles * dim_ * kRowTile;
+	packed_ = new float[size];
+	std::fill(packed_, packed_ + size, 0.0f);
+	std::vector<float> row(dim_);
+	for (int j = 0; j < num_rows_; ++j)
+	{
+		vecs.LoadRow(j, row.data());
+		normalize(row.data(), dim_);
+		float *dst = packed_ + (long long)(j / kRowTile) * dim_ * kRowTile + j % kRowTile;
+		for (int i = 0; i < dim_; ++i)
+			dst[i * kRowTile] = row[i];
+	}
+}
+
+ExactSearcher::~ExactSearcher()
+{
+	delete[] packed_;
+}
+
+void ExactSearcher::GetRow(int idx, float *dst)
+{
+	const float *src = packed_ + (long long)(idx / kRowTile) * dim_ * kRowTile + idx % kRowTile;
+	for (int i = 0; i < dim_; ++i)
+		dst[i] = src[i * kRowTile];
+}
+
+void ExactSearcher::SearchRows(const int *query_rows, int num_queries, int k, bool exclude_self, int num_threads,
+	int *indices, float *sims)
+{
+	EmbeddingTable rows(num_queries, dim_);
+	std::vector<const float*> queries(num_queries);
+	for (int q = 0; q < num_queries; ++q)
+	{
+		GetRow(query_rows[q], rows.Row(q));
+		queries[q] = rows.Row(q);
+	}
+	search(queries.data(), exclude_self ? query_rows : 0, num_queries, k, num_threads, indices, sims);
+}
+
+void ExactSearcher::SearchVectors(const float *queries, int num_queries, int k, int num_threads, int *indices,
+	float *sims)
+{
+	EmbeddingTable normed(num_queries, dim_);
+	std::vector<const float*> query_rows(num_queries);
+	for (int q = 0; q < num_queries; ++q)
+	{
+		std::copy(queries + (long long)q * dim_, queries + (long long)(q + 1) * dim_, normed.Row(q));
+		normalize(normed.Row(q), dim_);
+		query_rows[q] = normed.Row(q);
+	}
+	search(query_rows.data(), 0, num_queries, k, num_threads, indices, sims);
+}
+
+void ExactSearcher::SearchAll(int k, bool exclude_self, int num_threads, int *indices, float *sims)
+{
+	std::vector<int> rows(num_rows());
+	for (int i = 0; i < num_rows(); ++i)
+		rows[i] = i;
+	SearchRows(rows.data(), num_rows(), k, exclude_self, num_threads, indices, sims);
+}
+
+void ExactSearcher::search(const float *const *queries, const int *query_ids, int num_queries, int k,
+	int num_threads, int *indices, float *sims)
+{
+	int num_table_rows = num_rows_;
+	int num_query_tiles = (num_queries + kQueryTile - 1) / kQueryTile;
+	int num_row_tiles = (num_table_rows + kRowTile - 1) / kRowTile;
+	// split the table only when there are too few query tiles for the threads
+	int num_parts = std::min(std::max(1, (num_threads + num_query_tiles - 1) / num_query_tiles),
+		std::max(1, num_row_tiles));
+	int tiles_per_part = (num_row_tiles + num_parts - 1) / num_parts;
+
+	// heaps[(part * num_queries + q) * k ...], worst neighbour first
+	std::vector<Neighbor> heaps((long long)num_parts * num_queries * k);
+	std::vector<int> heap_sizes((long long)num_parts * num_queries, 0);
+
+	std::atomic<int> next_item(0);
+	int num_items = num_query_tiles * num_parts;
+	auto work = [&]
+	{
+		std::vector<float> tile_sims(kQueryTile * kRowTile);
+		int item = 0;
+		while ((item = next_item++) < num_items)
+		{
+			int part = item % num_parts, query_tile = item / num_parts;
+			int beg_query = query_tile * kQueryTile;
+			int num_tile_queries = std::min(kQueryTile, num_queries - beg_query);
+			int end_row = std::min(num_table_rows, (part + 1) * tiles_per_part * kRowTile);
+			for (int beg_row = part * tiles_per_part * kRowTile; beg_row < end_row; beg_row += kRowTile)
+			{
+				int num_tile_rows = std::min(kRowTile, end_row - beg_row);
+				SimdKernels::DotPacked(queries + beg_query, num_tile_queries,
+					packed_ + (long long)beg_row * dim_, kRowTile, dim_, tile_sims.data());
+
+				for (int q = 0; q < num_tile_queries; ++q)
+				{
+					long long heap_idx = (long long)part * num_queries + beg_query + q;
+					Neighbor *heap = &heaps[heap_idx * k];
+					int &heap_size = heap_sizes[heap_idx];
+					int self = query_ids ? query_ids[beg_query + q] : -1;
+					const float *row_sims = &tile_sims[q * kRowTile];
+					// anything below the worst kept neighbour is out
+					float threshold = heap_size < k ? -FLT_MAX : heap[0].first;
+					for (int j = 0; j < num_tile_rows; ++j)
+					{
+						// most runs of 16 hold nothing above the threshold
+						if ((j & 15) == 0 && j + 16 <= num_tile_rows)
+						{
+							// four independent chains rather than one long one
+							float m0 = row_sims[j], m1 = row_sims[j + 1], m2 = row_sims[j + 2], m3 = row_sims[j + 3];
+							for (int t = 4; t < 16; t += 4)
+							{
+								m0 = std::max(m0, row_sims[j + t]);
+								m1 = std::max(m1, row_sims[j + t + 1]);
+								m2 = std::max(m2, row_sims[j + t + 2]);
+								m3 = std::max(m3, row_sims[j + t + 3]);
+							}
+							if (std::max(std::max(m0, m1), std::max(m2, m3)) < threshold)
+							{
+								j += 15;
+								continue;
+							}
+						}
+						if (row_sims[j] < threshold)
+							continue;
+						Neighbor cur(row_sims[j], beg_row + j);
+						if (cur.second == self)
+							continue;
+						if (heap_size < k)
+						{
+							heap[heap_size++] = cur;
+							std::push_heap(heap, heap + heap_size, betterNeighbor);
+						}
+						else if (betterNeighbor(cur, heap[0]))
+						{
+							std::pop_heap(heap, heap + k, betterNeighbor);
+							heap[k - 1] = cur;
+							std::push_heap(heap, heap + k, betterNeighbor);
+						}
+						if (heap_size == k)
+							threshold = heap[0].first;
+					}
+				}
+			}
+		}
+	};
+
+	std::thread *threads = new std::thread[num_threads];
+	for (int i = 0; i < num_threads; ++i)
+		threads[i] = std::thread(work);
+	for (int i = 0; i < num_threads; ++i)
+		threads[i].join();
+	delete[] threads;
+
+	std::vector<Neighbor> merged;
+	for (int q = 0; q < num_queries; ++q)
+	{
+		merged.clear();
+		for (int part = 0; part < num_parts; ++part)
+		{
+			long long heap_idx = (long long)part * num_queries + q;
+			merged.insert(merged.end(), heaps.begin() + heap_idx * k, heaps.begin() + heap_idx * k + heap_sizes[heap_idx]);
+		}
+		std::sort(merged.begin(), merged.end(), betterNeighbor);
+		for (int i = 0; i < k; ++i)
+		{
+			bool found = i < (int)merged.size();
+			indices[(long long)q * k + i] = found ? merged[i].second : -1;
+			sims[(long long)q * k + i] = found ? merged[i].first : 0.0f;
+		}
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef EXACTSEARCHER_H_
+#define EXACTSEARCHER_H_
+
+#include <utility>
+
+#include "embeddingtable.h"
+
+// Exact k nearest neighbours by cosine for batches of queries, e.g. the
+// neighbours of every doc for evaluation.
+//
+// The rows are normalized once into a copy, so a similarity is a plain dot
+// product. The copy is stored in tiles of kRowTile rows, each element major,
+// so that SimdKernels::DotPacked computes a kQueryTile x kRowTile tile of
+// similarities GEMM style, from L1/L2 resident data and without horizontal
+// sums. Every query keeps a heap of its best k. The work items are (query tile, part of the table)
+// pairs, with the table split into as many parts as it takes to keep all
+// threads busy when there are few queries; the heaps of the parts are
+// merged at the end.
+//
+// Results are sorted by decreasing similarity, ties by increasing row, so
+// they don't depend on the number of threads. Slots beyond the number of
+// candidates get row -1.
+class ExactSearcher
+{
+public:
+	static const int kQueryTile = 64;
+	static const int kRowTile = 256;
+
+public:
+	// vecs may be of any precision and is not kept
+	ExactSearcher(EmbeddingTable &vecs);
+	~ExactSearcher();
+
+	// queries are rows of the table; with exclude_self a row is not its own
+	// neighbour. indices and sims get k slots per query.
+	void SearchRows(const int *query_rows, int num_queries, int k, bool exclude_self, int num_threads,
+		int *indices, float *sims);
+	// queries holds num_queries vectors of dim() floats, not necessarily normalized
+	void SearchVectors(const float *queries, int num_queries, int k, int num_threads, int *indices, float *sims);
+	// every row of the table as a query, num_rows() x k results
+	void SearchAll(int k, bool exclude_self, int num_threads, int *indices, float *sims);
+
+	// the normalized row
+	void GetRow(int idx, float *dst);
+
+	int num_rows()
+	{
+		return num_rows_;
+	}
+
+	int dim()
+	{
+		return dim_;
+	}
+
+private:
+	// (similarity, row)
+	typedef std::pair<float, int> Neighbor;
+
+	ExactSearcher(const ExactSearcher &);
+	ExactSearcher &operator=(const ExactSearcher &);
+
+	// query_ids are the table rows to skip per query, or null
+	void search(const float *const *queries, const int *query_ids, int num_queries, int k, int num_threads,
+		int *indices, float *sims);
+
+private:
+	int num_rows_ = 0;
+	int dim_ = 0;
+	// row j of tile t, element i at packed_[(t * dim_ + i) * kRowTile + j],
+	// the last tile padded with zeros
+	float *packed_ = 0;
+};
+
+#endif
@@ -5,14 +5,20 @@
 ExpTable::ExpTable(int table_size, float max_exp): table_size_(table_size), max_exp_(max_exp)
 {
 	exp_table_ = new float[table_size + 1];
+	log_table_ = new float[table_size + 1];
 	for (int i = 0; i < table_size; ++i)
 	{
 		exp_table_[i] = exp((i / (float)table_size * 2 - 1) * max_exp);
 		exp_table_[i] = exp_table_[i] / (exp_table_[i] + 1);
+		log_table_[i] = log(exp_table_[i]);
 	}
+	// x == max_exp lands one past the last entry
+	log_table_[table_size] = log_table_[table_size - 1];
+	max_sigma_ = (float)(1 / (1 + exp(-(double)max_exp)));
 }
 
 ExpTable::~ExpTable()
 {
 	delete[] exp_table_;
+	delete[] log_table_;
 }
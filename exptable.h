@@ -16,10 +16,40 @@ public:
 		return exp_table_[(int)((x + max_exp_) * (table_size_ / max_exp_ / 2))];
 	}
 
+	// log(sigma(x)), for the loss of a pair; outside the table log(sigma(x))
+	// is taken as 0 above it and as x below it
+	float getLogSigmaValue(float x)
+	{
+		if (x > max_exp_)
+			return 0;
+		else if (x < -max_exp_)
+			return x;
+		return log_table_[(int)((x + max_exp_) * (table_size_ / max_exp_ / 2))];
+	}
+
+	// Sigmoids taken exactly, e.g. by SimdKernels::Sigmoid, saturated past
+	// the ends of the table as getSigmaValue does: to 1 for x > max_exp and
+	// to 0 for x < -max_exp. A confident target then gets no gradient and a
+	// badly wrong one all of it, as with the lookup. Works in place on the
+	// sigmoids alone, since sigma is monotonic.
+	void SaturateSigmas(float *sigmas, int len)
+	{
+		for (int i = 0; i < len; ++i)
+		{
+			if (sigmas[i] > max_sigma_)
+				sigmas[i] = 1;
+			else if (sigmas[i] < 1 - max_sigma_)
+				sigmas[i] = 0;
+		}
+	}
+
 private:
 	int table_size_;
 	float max_exp_;
+	// sigma(max_exp)
+	float max_sigma_;
 	float *exp_table_ = 0;
+	float *log_table_ = 0;
 };
 
 #endif
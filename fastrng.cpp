@@ -0,0 +1,39 @@
+#include "fastrng.h"
+
+#include <algorithm>
+
+#include "simdkernels.h"
+
+void FastRng::Seed(unsigned long long seed)
+{
+	unsigned long long x = seed;
+	for (int i = 0; i < 4 * kLanes; ++i)
+	{
+		// splitmix64, which never gives an all zero lane in practice
+		unsigned long long z = (x += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		state_[i] = z ^ (z >> 31);
+	}
+	pos_ = kBufferSize;
+}
+
+void FastRng::Fill(unsigned int *dst, int len)
+{
+	while (len > 0)
+	{
+		if (pos_ == kBufferSize)
+			refill();
+		int n = std::min(len, kBufferSize - pos_);
+		std::copy(buf_ + pos_, buf_ + pos_ + n, dst);
+		pos_ += n;
+		dst += n;
+		len -= n;
+	}
+}
+
+void FastRng::refill()
+{
+	SimdKernels::Xoshiro(state_, buf_, kBufferSize / (2 * kLanes));
+	pos_ = 0;
+}
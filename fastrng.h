@@ -0,0 +1,61 @@
+#ifndef FASTRNG_H_
+#define FASTRNG_H_
+
+// The random number generator of the sampling path: xoshiro256++ (Blackman
+// and Vigna) run as kLanes independent streams, so that SimdKernels::Xoshiro
+// makes kLanes outputs per step with vector instructions. The outputs are
+// buffered kBufferSize 32-bit words at a time, making a draw a load and an
+// increment. Every word is uniform over all 32 bits, so there is no modulo
+// and no rejection as with std::default_random_engine (minstd_rand0).
+//
+// The streams and the buffer are plain data: a FastRng can be copied to
+// save its state, e.g. into a checkpoint, and the same seed gives the same
+// numbers under every instruction set.
+class FastRng
+{
+public:
+	static const int kLanes = 8;
+	static const int kBufferSize = 256;
+
+public:
+	FastRng(unsigned long long seed = 1)
+	{
+		Seed(seed);
+	}
+
+	// the states of the lanes are splitmix64 outputs from seed
+	void Seed(unsigned long long seed);
+
+	unsigned int NextUInt()
+	{
+		if (pos_ == kBufferSize)
+			refill();
+		return buf_[pos_++];
+	}
+
+	// [0, n), by a multiply and shift instead of a modulo
+	int NextInt(int n)
+	{
+		return (int)(((unsigned long long)NextUInt() * (unsigned int)n) >> 32);
+	}
+
+	// [0, 1) with 24 random bits
+	float NextFloat()
+	{
+		return (NextUInt() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// the next len words, in the same order as len calls of NextUInt
+	void Fill(unsigned int *dst, int len);
+
+private:
+	void refill();
+
+private:
+	// word w of lane l at state_[w * kLanes + l]
+	unsigned long long state_[4 * kLanes];
+	unsigned int buf_[kBufferSize];
+	int pos_ = kBufferSize;
+};
+
+#endif
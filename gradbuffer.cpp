@@ -0,0 +1,57 @@
+#include "gradbuffer.h"
+
+#include <algorithm>
+
+#include "simdkernels.h"
+
+GradBuffer::GradBuffer(int num_buckets) : num_buckets_(num_buckets), entries_(num_buckets),
+	grads_(num_buckets), grad_sizes_(num_buckets, 0)
+{
+}
+
+float *GradBuffer::Add(EmbeddingTable *table, int idx)
+{
+	int bucket = idx % num_buckets_;
+	Entry entry = { table, idx };
+	entries_[bucket].push_back(entry);
+	std::vector<float> &grads = grads_[bucket];
+	size_t beg = grad_sizes_[bucket];
+	grad_sizes_[bucket] += table->dim();
+	if (grad_sizes_[bucket] > grads.size())
+		grads.resize(std::max(grads.size() * 2, grad_sizes_[bucket]));
+	return grads.data() + beg;
+}
+
+void GradBuffer::Apply(int bucket, unsigned int seed)
+{
+	// fp32 copy of a 16-bit row; the buckets of one buffer are applied by
+	// different threads at the same time
+	static thread_local std::vector<float> row;
+	const float *grad = grads_[bucket].data();
+	for (const Entry &entry : entries_[bucket])
+	{
+		EmbeddingTable *table = entry.table;
+		int dim = table->dim();
+		if (table->is_fp32())
+		{
+			SimdKernels::Axpy(1.0f, grad, table->Row(entry.idx), dim);
+		}
+		else
+		{
+			row.resize(dim);
+			table->LoadRow(entry.idx, row.data());
+			SimdKernels::Axpy(1.0f, grad, row.data(), dim);
+			table->StoreRow(entry.idx, row.data(), seed ^ ((unsigned int)entry.idx * 2654435761u));
+		}
+		grad += dim;
+	}
+}
+
+void GradBuffer::Clear()
+{
+	for (int i = 0; i < num_buckets_; ++i)
+	{
+		entries_[i].clear();
+		grad_sizes_[i] = 0;
+	}
+}
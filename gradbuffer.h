@@ -0,0 +1,54 @@
+#ifndef GRADBUFFER_H_
+#define GRADBUFFER_H_
+
+#include <vector>
+
+#include "embeddingtable.h"
+
+// Row updates of one training thread in deterministic mode, kept aside until
+// the threads meet at a barrier instead of being written into the shared
+// tables. The updates are split into num_buckets buckets by row, bucket b
+// holding the rows with idx % num_buckets == b. After the barrier merging
+// thread b applies bucket b of every thread's buffer, in thread order, so
+// every row gets its updates in the same order on every run.
+class GradBuffer
+{
+public:
+	GradBuffer(int num_buckets);
+
+	// Room for the table->dim() floats that the next Apply adds to row idx of
+	// table, to be filled in before the next call.
+	float *Add(EmbeddingTable *table, int idx);
+
+	// Adds the updates of bucket to their rows in the order they were added.
+	// The rows of 16-bit tables are rounded with a seed derived from seed and
+	// the row.
+	void Apply(int bucket, unsigned int seed);
+
+	void Clear();
+
+	int num_buckets()
+	{
+		return num_buckets_;
+	}
+
+private:
+	struct Entry
+	{
+		EmbeddingTable *table;
+		int idx;
+	};
+
+	GradBuffer(const GradBuffer &);
+	GradBuffer &operator=(const GradBuffer &);
+
+private:
+	int num_buckets_ = 0;
+	std::vector<std::vector<Entry> > entries_;
+	// the dims of the entries, back to back; only the first grad_sizes_
+	// floats are used, the rest is kept for the next steps
+	std::vector<std::vector<float> > grads_;
+	std::vector<size_t> grad_sizes_;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include "graphgen.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#include <climits>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+#include "aliassampler.h"
+#include "fastrng.h"
+
+// rows per chunk, the unit of work of a thread and of the ordered writes
+static const int kChunkRows = 4096;
+
+// a length in [min_len, max_len] with P(len) ~ len^-len_exponent, from the
+// inverse of the continuous distribution over [min_len, max_len + 1)
+static int sampleLen(const GraphGenerator::Relation &relation, FastRng &rng)
+{
+	if (relation.max_len <= relation.min_len)
+		return relation.min_len;
+	double u = rng.NextUInt() / 4294967296.0;
+	double lo = relation.min_len, hi = relation.max_len + 1.0;
+	double a = 1.0 - relation.len_exponent;
+	double len = fabs(a) < 1e-6 ? lo * pow(hi / lo, u) : pow(pow(lo, a) + u * (pow(hi, a) - pow(lo, a)), 1.0 / a);
+	return std::max(relation.min_len, std::min(relation.max_len, (int)len));
+}
+
+template <class T>
+static void appendValues(std::vector<char> &buf, const T *values, size_t num)
+{
+	size_t pos = buf.size();
+	buf.resize(pos + num * sizeof(T));
+	memcpy(buf.data() + pos, values, num * sizeof(T));
+}
+
+bool GraphGenerator::ParseSpec(const char *spec, Relation &relation)
+{
+	int min_len = 0, max_len = 0;
+	float len_exponent = 0, freq_exponent = 0;
+	if (sscanf(spec, "%d:%d:%f:%f", &min_len, &max_len, &len_exponent, &freq_exponent) != 4
+		|| min_len < 1 || max_len < min_len || len_exponent < 0 || freq_exponent < 0)
+		return false;
+	relation.min_len = min_len;
+	relation.max_len = max_len;
+	relation.len_exponent = len_exponent;
+	relation.freq_exponent = freq_exponent;
+	return true;
+}
+
+GraphGenerator::GraphGenerator(int num_threads, unsigned long long seed)
+	: num_threads_(num_threads < 1 ? 1 : num_threads), seed_(seed)
+{
+}
+
+long long GraphGenerator::Generate(const Relation &relation, const char *dst_file, const char *dst_cnts_file)
+{
+	assert(relation.num_left > 0 && relation.num_right > 0);
+	auto beg_time = std::chrono::steady_clock::now();
+
+	AliasSampler token_sampler;
+	{
+		std::vector<float> freq_weights(relation.num_right);
+		for (int i = 0; i < relation.num_right; ++i)
+			freq_weights[i] = (float)(1.0 / pow(i + 1.0, relation.freq_exponent));
+		token_sampler.Init(freq_weights.data(), relation.num_right);
+	}
+
+	FILE *fp = fopen(dst_file, "wb");
+	assert(fp != 0);
+	fwrite(&relation.num_left, sizeof(int), 1, fp);
+	fwrite(&relation.num_right, sizeof(int), 1, fp);
+
+	const int num_chunks = (int)(((long long)relation.num_left + kChunkRows - 1) / kChunkRows);
+	const unsigned long long relation_seed = seed_ + 0x9e3779b97f4a7c15ull * (unsigned long long)++num_generated_;
+	std::atomic<int> next_chunk(0);
+	int next_write = 0;
+	std::mutex mutex;
+	std::condition_variable cond;
+	// the summed weights of the right vertices, per thread
+	std::vector<std::vector<long long> > cnts(dst_cnts_file != 0 ? num_threads_ : 0);
+	std::vector<long long> num_edges(num_threads_, 0);
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < num_threads_; ++t)
+	{
+		threads.push_back(std::thread([&, t]
+		{
+			long long *thread_cnts = 0;
+			if (dst_cnts_file != 0)
+			{
+				cnts[t].assign(relation.num_right, 0);
+				thread_cnts = cnts[t].data();
+			}
+			std::vector<int> tokens, ids;
+			std::vector<unsigned short> weights;
+			std::vector<char> buf;
+			for (int chunk = next_chunk++; chunk < num_chunks; chunk = next_chunk++)
+			{
+				FastRng rng(relation_seed + chunk);
+				buf.clear();
+				int end_row = (int)std::min((long long)relation.num_left, (chunk + 1LL) * kChunkRows);
+				for (int row = chunk * kChunkRows; row < end_row; ++row)
+				{
+					int len = sampleLen(relation, rng);
+					tokens.resize(len);
+					token_sampler.SampleBatch(rng, tokens.data(), len);
+					std::sort(tokens.begin(), tokens.end());
+
+					// runs of a token become one edge, split at the weight limit
+					ids.clear();
+					weights.clear();
+					for (int i = 0; i < len; ++i)
+					{
+						if (i > 0 && tokens[i] == tokens[i - 1] && weights.back() < USHRT_MAX)
+						{
+							++weights.back();
+						}
+						else
+						{
+							ids.push_back(tokens[i]);
+							weights.push_back(1);
+						}
+						if (thread_cnts != 0)
+							++thread_cnts[tokens[i]];
+					}
+					int degree = (int)ids.size();
+					appendValues(buf, &degree, 1);
+					appendValues(buf, ids.data(), ids.size());
+					appendValues(buf, weights.data(), weights.size());
+					num_edges[t] += degree;
+				}
+
+				std::unique_lock<std::mutex> lock(mutex);
+				cond.wait(lock, [&] { return next_write == chunk; });
+				fwrite(buf.data(), 1, buf.size(), fp);
+				++next_write;
+				if (num_chunks >= 100 && next_write % (num_chunks / 100) == 0)
+				{
+					printf("\r%s: %d%%", dst_file, (int)(100LL * next_write / num_chunks));
+					fflush(stdout);
+				}
+				cond.notify_all();
+			}
+		}));
+	}
+	for (std::thread &thread : threads)
+		thread.join();
+	fclose(fp);
+
+	long long total_edges = 0;
+	for (long long n : num_edges)
+		total_edges += n;
+
+	if (dst_cnts_file != 0)
+	{
+		std::vector<int> total_cnts(relation.num_right);
+		int num_capped = 0;
+		for (int i = 0; i < relation.num_right; ++i)
+		{
+			long long cnt = 0;
+			for (int t = 0; t < num_threads_; ++t)
+				cnt += cnts[t][i];
+			num_capped += cnt > INT_MAX;
+			total_cnts[i] = (int)std::min(cnt, (long long)INT_MAX);
+		}
+		FILE *cnts_fp = fopen(dst_cnts_file, "wb");
+		assert(cnts_fp != 0);
+		fwrite(&relation.num_right, sizeof(int), 1, cnts_fp);
+		fwrite(total_cnts.data(), sizeof(int), relation.num_right, cnts_fp);
+		fclose(cnts_fp);
+		if (num_capped > 0)
+			printf("\n%s: %d counts capped at INT_MAX", dst_cnts_file, num_capped);
+	}
+
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg_time).count();
+	printf("\r%s: %d x %d, %lld edges, %.1f s, %.1f M edges/s\n", dst_file, relation.num_left, relation.num_right,
+		total_edges, secs, total_edges / secs / 1e6);
+	return total_edges;
+}
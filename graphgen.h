@@ -0,0 +1,50 @@
+#ifndef GRAPHGEN_H_
+#define GRAPHGEN_H_
+
+// Synthetic inputs for the trainer at any scale. Each left vertex, a doc or
+// an entity, is a bag of tokens: the number of tokens follows a power law
+// over [min_len, max_len], and each token is a right vertex drawn from a
+// Zipfian distribution, rank r with weight 1 / (r + 1)^freq_exponent, so the
+// low ids are the frequent ones. A row holds the distinct right vertices of
+// the bag with their multiplicities as weights, in the binary adjacency list
+// layout PairSampler reads: the left and right counts, then per row the
+// degree, the int ids and the unsigned short weights.
+//
+// The rows are made in chunks by num_threads threads, each chunk from its
+// own seed, and written in order as they are done. The output depends only
+// on the seed, not on the number of threads.
+class GraphGenerator
+{
+public:
+	struct Relation
+	{
+		int num_left = 0;
+		int num_right = 0;
+		int min_len = 1;
+		int max_len = 100;
+		// P(len) ~ len^-len_exponent
+		float len_exponent = 2;
+		float freq_exponent = 1;
+	};
+
+	// "min_len:max_len:len_exponent:freq_exponent", e.g. "20:2000:1.5:1";
+	// leaves relation as it is and returns false for a bad spec
+	static bool ParseSpec(const char *spec, Relation &relation);
+
+public:
+	GraphGenerator(int num_threads, unsigned long long seed);
+
+	// Writes relation to dst_file, and the summed weights of the right
+	// vertices to dst_cnts_file unless it is 0, in the counts file layout of
+	// NegSamplingBase::LoadNegSamplingTable: the number of vertices, then an
+	// int per vertex, capped at INT_MAX. Returns the number of edges.
+	long long Generate(const Relation &relation, const char *dst_file, const char *dst_cnts_file = 0);
+
+private:
+	int num_threads_;
+	unsigned long long seed_;
+	// relations generated so far, so every one gets its own streams
+	int num_generated_ = 0;
+};
+
+#endif
@@ -0,0 +1,511 @@
+#include "hnswindex.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "simdkernels.h"
+
+// std::min takes it by reference
+const int HnswIndex::kMaxLevel;
+
+static const char kHnswMagic[8] = { 'E', 'M', 'A', 'D', 'R', 'H', 'N', 'W' };
+static const int kHnswVersion = 1;
+
+// Marks of the rows visited by the current search of this thread. A search
+// takes a new tag instead of clearing the marks.
+static unsigned int *visitedTags(int num_rows, unsigned int &tag)
+{
+	static thread_local std::vector<unsigned int> tags;
+	static thread_local unsigned int cur_tag = 0;
+	if ((int)tags.size() < num_rows)
+	{
+		tags.assign(num_rows, 0);
+		cur_tag = 0;
+	}
+	if (++cur_tag == 0)
+	{
+		std::fill(tags.begin(), tags.end(), 0);
+		cur_tag = 1;
+	}
+	tag = cur_tag;
+	return &tags[0];
+}
+
+static void normalize(float *vec, int dim)
+{
+	float norm = sqrtf(SimdKernels::DotProduct(vec, vec, dim));
+	if (norm > 0)
+	{
+		for (int i = 0; i < dim; ++i)
+			vec[i] /= norm;
+	}
+}
+
+HnswIndex *HnswIndex::Load(const char *file_name)
+{
+	FILE *fp = fopen(file_name, "rb");
+	assert(fp != 0);
+
+	char magic[8];
+	int version = 0, m = 0;
+	fread(magic, 1, 8, fp);
+	fread(&version, 4, 1, fp);
+	assert(memcmp(magic, kHnswMagic, 8) == 0 && version == kHnswVersion);
+
+	HnswIndex *index = new HnswIndex;
+	fread(&index->num_rows_, 4, 1, fp);
+	fread(&index->dim_, 4, 1, fp);
+	fread(&m, 4, 1, fp);
+	fread(&index->entry_point_, 4, 1, fp);
+	fread(&index->max_level_, 4, 1, fp);
+	index->m_ = m;
+	index->max_m0_ = 2 * m;
+	index->level_mult_ = 1 / log((double)m);
+
+	int num_rows = index->num_rows_;
+	index->levels_ = new int[num_rows];
+	fread(index->levels_, 4, num_rows, fp);
+	index->allocLinks();
+	fread(index->links0_, 4, (long long)num_rows * (index->max_m0_ + 1), fp);
+	for (int i = 0; i < num_rows; ++i)
+	{
+		if (index->levels_[i] > 0)
+			fread(index->upper_links_[i], 4, index->levels_[i] * (m + 1), fp);
+	}
+
+	index->vecs_ = new EmbeddingTable(num_rows, index->dim_);
+	index->vecs_->Fill(0);
+	for (int i = 0; i < num_rows; ++i)
+		fread(index->vecs_->Row(i), 4, index->dim_, fp);
+
+	fclose(fp);
+	return index;
+}
+
+HnswIndex::HnswIndex(int m, int ef_construction) : m_(m), max_m0_(2 * m), ef_construction_(ef_construction),
+	level_mult_(1 / log((double)m))
+{
+}
+
+HnswIndex::~HnswIndex()
+{
+	if (upper_links_ != 0)
+	{
+		for (int i = 0; i < num_rows_; ++i)
+			delete[] upper_links_[i];
+	}
+	delete[] upper_links_;
+	delete[] links0_;
+	delete[] levels_;
+	delete vecs_;
+}
+
+void HnswIndex::Build(EmbeddingTable &vecs, int num_threads)
+{
+	assert(vecs_ == 0);
+	auto beg_time = std::chrono::steady_clock::now();
+
+	num_rows_ = vecs.num_rows();
+	dim_ = vecs.dim();
+	vecs_ = new EmbeddingTable(num_rows_, dim_);
+	vecs_->Fill(0);
+	for (int i = 0; i < num_rows_; ++i)
+	{
+		vecs.LoadRow(i, vecs_->Row(i));
+		normalize(vecs_->Row(i), dim_);
+	}
+
+	// the levels come from a fixed seed so they don't depend on the threads
+	std::default_random_engine generator(num_rows_);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	levels_ = new int[num_rows_];
+	for (int i = 0; i < num_rows_; ++i)
+		levels_[i] = std::min((int)(-log(1.0 - uniform(generator)) * level_mult_), kMaxLevel);
+	allocLinks();
+
+	if (num_rows_ > 0)
+	{
+		entry_point_ = 0;
+		max_level_ = levels_[0];
+	}
+	row_mutexes_ = new std::mutex[num_rows_];
+	std::atomic<int> next_row(1);
+	std::thread *threads = new std::thread[num_threads];
+	for (int i = 0; i < num_threads; ++i)
+	{
+		threads[i] = std::thread([&]
+		{
+			int idx = 0;
+			while ((idx = next_row++) < num_rows_)
+			{
+				insert(idx);
+				if (idx % 100000 == 0)
+				{
+					printf("\r%d/%d rows indexed", idx, num_rows_);
+					fflush(stdout);
+				}
+			}
+		});
+	}
+	for (int i = 0; i < num_threads; ++i)
+		threads[i].join();
+	delete[] threads;
+	delete[] row_mutexes_;
+	row_mutexes_ = 0;
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg_time).count();
+	printf("\rindexed %d rows in %.2f s, %d levels, %.1f MB\n", num_rows_, seconds, max_level_ + 1,
+		num_bytes() / 1048576.0);
+}
+
+void HnswIndex::Save(const char *file_name)
+{
+	FILE *fp = fopen(file_name, "wb");
+	assert(fp != 0);
+
+	fwrite(kHnswMagic, 1, 8, fp);
+	fwrite(&kHnswVersion, 4, 1, fp);
+	fwrite(&num_rows_, 4, 1, fp);
+	fwrite(&dim_, 4, 1, fp);
+	fwrite(&m_, 4, 1, fp);
+	fwrite(&entry_point_, 4, 1, fp);
+	fwrite(&max_level_, 4, 1, fp);
+	fwrite(levels_, 4, num_rows_, fp);
+	fwrite(links0_, 4, (long long)num_rows_ * (max_m0_ + 1), fp);
+	for (int i = 0; i < num_rows_; ++i)
+	{
+		if (levels_[i] > 0)
+			fwrite(upper_links_[i], 4, levels_[i] * (m_ + 1), fp);
+	}
+	for (int i = 0; i < num_rows_; ++i)
+		fwrite(vecs_->Row(i), 4, dim_, fp);
+
+	fclose(fp);
+}
+
+int HnswIndex::Search(const float *query, int k, int ef, int *indices, float *sims)
+{
+	if (num_rows_ == 0)
+		return 0;
+
+	static thread_local std::vector<float> normed;
+	static thread_local std::vector<Candidate> results;
+	normed.assign(query, query + dim_);
+	normalize(&normed[0], dim_);
+
+	int entry = greedyDescent(&normed[0], entry_point_, max_level_, 0, false);
+	searchLevel(&normed[0], entry, std::max(ef, k), 0, false, results);
+	int num_found = std::min(k, (int)results.size());
+	for (int i = 0; i < num_found; ++i)
+	{
+		indices[i] = results[i].second;
+		sims[i] = results[i].first;
+	}
+	return num_found;
+}
+
+void HnswIndex::SearchBatch(const float *queries, int num_queries, int k, int ef, int num_threads,
+	int *indices, float *sims)
+{
+	const int kQueriesPerChunk = 16;
+	std::atomic<int> next_chunk(0);
+	std::thread *threads = new std::thread[num_threads];
+	for (int i = 0; i < num_threads; ++i)
+	{
+		threads[i] = std::thread([&]
+		{
+			int chunk = 0;
+			while ((chunk = next_chunk++) * kQueriesPerChunk < num_queries)
+			{
+				int end = std::min((chunk + 1) * kQueriesPerChunk, num_queries);
+				for (int q = chunk * kQueriesPerChunk; q < end; ++q)
+				{
+					long long offset = (long long)q * k;
+					int num_found = Search(queries + (long long)q * dim_, k, ef, indices + offset, sims + offset);
+					std::fill(indices + offset + num_found, indices + offset + k, -1);
+					std::fill(sims + offset + num_found, sims + offset + k, 0.0f);
+				}
+			}
+		});
+	}
+	for (int i = 0; i < num_threads; ++i)
+		threads[i].join();
+	delete[] threads;
+}
+
+int HnswIndex::ExactSearch(const float *query, int k, int *indices, float *sims)
+{
+	std::vector<float> normed(query, query + dim_);
+	normalize(&normed[0], dim_);
+
+	// min-heap of the best k so far
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > best;
+	for (int i = 0; i < num_rows_; ++i)
+	{
+		float sim = SimdKernels::DotProduct(&normed[0], Row(i), dim_);
+		if ((int)best.size() < k)
+			best.push(Candidate(sim, i));
+		else if (sim > best.top().first)
+		{
+			best.pop();
+			best.push(Candidate(sim, i));
+		}
+	}
+
+	int num_found = (int)best.size();
+	for (int i = num_found - 1; i > -1; --i)
+	{
+		indices[i] = best.top().second;
+		sims[i] = best.top().first;
+		best.pop();
+	}
+	return num_found;
+}
+
+long long HnswIndex::num_bytes()
+{
+	long long num_bytes = (vecs_ ? vecs_->num_bytes() : 0) + 4LL * num_rows_ * (max_m0_ + 2);
+	for (int i = 0; i < num_rows_; ++i)
+		num_bytes += 4LL * levels_[i] * (m_ + 1);
+	return num_bytes;
+}
+
+void HnswIndex::allocLinks()
+{
+	links0_ = new int[(long long)num_rows_ * (max_m0_ + 1)];
+	std::fill(links0_, links0_ + (long long)num_rows_ * (max_m0_ + 1), 0);
+	upper_links_ = new int*[num_rows_];
+	for (int i = 0; i < num_rows_; ++i)
+	{
+		upper_links_[i] = 0;
+		if (levels_[i] > 0)
+		{
+			upper_links_[i] = new int[levels_[i] * (m_ + 1)];
+			std::fill(upper_links_[i], upper_links_[i] + levels_[i] * (m_ + 1), 0);
+		}
+	}
+}
+
+void HnswIndex::insert(int idx)
+{
+	int level = levels_[idx];
+	// a row that becomes the new top holds the lock until it is the entry point
+	std::unique_lock<std::mutex> entry_lock(entry_mutex_);
+	int entry = entry_point_, max_level = max_level_;
+	if (level <= max_level)
+		entry_lock.unlock();
+
+	const float *vec = Row(idx);
+	entry = greedyDescent(vec, entry, max_level, level, true);
+	std::vector<Candidate> candidates;
+	for (int l = std::min(level, max_level); l > -1; --l)
+	{
+		searchLevel(vec, entry, ef_construction_, l, true, candidates);
+		candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+			[idx](const Candidate &c) { return c.second == idx; }), candidates.end());
+		if (candidates.empty())
+			continue;
+		entry = candidates[0].second;
+		selectNeighbors(candidates, m_);
+
+		{
+			// Another thread may have linked to idx on this level already, when
+			// its descent ended at idx, and idx may be its only way in. Those
+			// links are kept along with the new ones.
+			std::lock_guard<std::mutex> lock(row_mutexes_[idx]);
+			int *row_links = links(idx, l);
+			std::vector<Candidate> row_candidates(candidates);
+			for (int i = 1; i <= row_links[0]; ++i)
+			{
+				if (std::find_if(candidates.begin(), candidates.end(),
+					[&](const Candidate &c) { return c.second == row_links[i]; }) == candidates.end())
+					row_candidates.push_back(Candidate(SimdKernels::DotProduct(vec, Row(row_links[i]), dim_), row_links[i]));
+			}
+			int max_links = l == 0 ? max_m0_ : m_;
+			if ((int)row_candidates.size() > max_links)
+			{
+				std::sort(row_candidates.begin(), row_candidates.end(), std::greater<Candidate>());
+				selectNeighbors(row_candidates, max_links);
+			}
+			row_links[0] = (int)row_candidates.size();
+			for (int i = 0; i < (int)row_candidates.size(); ++i)
+				row_links[i + 1] = row_candidates[i].second;
+		}
+		for (const Candidate &c : candidates)
+			connect(c.second, idx, l);
+	}
+
+	if (level > max_level)
+	{
+		entry_point_ = idx;
+		max_level_ = level;
+	}
+}
+
+int HnswIndex::greedyDescent(const float *query, int entry, int top_level, int bottom_level, bool locked)
+{
+	float sim = SimdKernels::DotProduct(query, Row(entry), dim_);
+	std::vector<int> neighbors;
+	for (int l = top_level; l > bottom_level; --l)
+	{
+		bool moved = true;
+		while (moved)
+		{
+			moved = false;
+			int *row_links = links(entry, l);
+			if (locked)
+			{
+				std::lock_guard<std::mutex> lock(row_mutexes_[entry]);
+				neighbors.assign(row_links + 1, row_links + 1 + row_links[0]);
+			}
+			else
+			{
+				neighbors.assign(row_links + 1, row_links + 1 + row_links[0]);
+			}
+			for (int neighbor : neighbors)
+			{
+				float neighbor_sim = SimdKernels::DotProduct(query, Row(neighbor), dim_);
+				if (neighbor_sim > sim)
+				{
+					sim = neighbor_sim;
+					entry = neighbor;
+					moved = true;
+				}
+			}
+		}
+	}
+	return entry;
+}
+
+void HnswIndex::searchLevel(const float *query, int entry, int ef, int level, bool locked,
+	std::vector<Candidate> &results)
+{
+	unsigned int tag = 0;
+	unsigned int *visited = visitedTags(num_rows_, tag);
+
+	// candidates to expand, best first, and the best ef found, worst first
+	std::priority_queue<Candidate> to_expand;
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > found;
+	float sim = SimdKernels::DotProduct(query, Row(entry), dim_);
+	to_expand.push(Candidate(sim, entry));
+	found.push(Candidate(sim, entry));
+	visited[entry] = tag;
+
+	static thread_local std::vector<int> neighbor_buf;
+	neighbor_buf.resize(max_m0_);
+	int *neighbors = &neighbor_buf[0];
+	while (!to_expand.empty())
+	{
+		Candidate cur = to_expand.top();
+		if (cur.first < found.top().first && (int)found.size() == ef)
+			break;
+		to_expand.pop();
+
+		int *row_links = links(cur.second, level);
+		int num_neighbors = 0;
+		if (locked)
+		{
+			std::lock_guard<std::mutex> lock(row_mutexes_[cur.second]);
+			num_neighbors = row_links[0];
+			memcpy(neighbors, row_links + 1, num_neighbors * sizeof(int));
+		}
+		else
+		{
+			num_neighbors = row_links[0];
+			memcpy(neighbors, row_links + 1, num_neighbors * sizeof(int));
+		}
+
+		for (int i = 0; i < num_neighbors; ++i)
+		{
+			int neighbor = neighbors[i];
+			if (visited[neighbor] == tag)
+				continue;
+			visited[neighbor] = tag;
+
+			float neighbor_sim = SimdKernels::DotProduct(query, Row(neighbor), dim_);
+			if ((int)found.size() < ef || neighbor_sim > found.top().first)
+			{
+				to_expand.push(Candidate(neighbor_sim, neighbor));
+				found.push(Candidate(neighbor_sim, neighbor));
+				if ((int)found.size() > ef)
+					found.pop();
+			}
+		}
+	}
+
+	results.resize(found.size());
+	for (int i = (int)found.size() - 1; i > -1; --i)
+	{
+		results[i] = found.top();
+		found.pop();
+	}
+}
+
+void HnswIndex::selectNeighbors(std::vector<Candidate> &candidates, int max_links)
+{
+	if ((int)candidates.size() <= max_links)
+		return;
+
+	int num_kept = 0;
+	for (int i = 0; i < (int)candidates.size() && num_kept < max_links; ++i)
+	{
+		const float *vec = Row(candidates[i].second);
+		bool keep = true;
+		for (int j = 0; j < num_kept && keep; ++j)
+			keep = SimdKernels::DotProduct(vec, Row(candidates[j].second), dim_) < candidates[i].first;
+		if (keep)
+			candidates[num_kept++] = candidates[i];
+	}
+	candidates.resize(num_kept);
+}
+
+void HnswIndex::connect(int idx, int neighbor, int level)
+{
+	int max_links = level == 0 ? max_m0_ : m_;
+	std::lock_guard<std::mutex> lock(row_mutexes_[idx]);
+	int *row_links = links(idx, level);
+	int num_links = row_links[0];
+	if (num_links < max_links)
+	{
+		row_links[num_links + 1] = neighbor;
+		row_links[0] = num_links + 1;
+		return;
+	}
+
+	// full: pick the links anew from the old ones and the new one
+	std::vector<Candidate> candidates;
+	const float *vec = Row(idx);
+	candidates.push_back(Candidate(SimdKernels::DotProduct(vec, Row(neighbor), dim_), neighbor));
+	for (int i = 1; i <= num_links; ++i)
+		candidates.push_back(Candidate(SimdKernels::DotProduct(vec, Row(row_links[i]), dim_), row_links[i]));
+	std::sort(candidates.begin(), candidates.end(), std::greater<Candidate>());
+	selectNeighbors(candidates, max_links);
+	row_links[0] = (int)candidates.size();
+	for (int i = 0; i < (int)candidates.size(); ++i)
+		row_links[i + 1] = candidates[i].second;
+}
+
+void HnswIndex::CloseVectors(int idx)
+{
+	const int k = 10, ef = 64;
+	int top_indices[k + 1];
+	float vals[k + 1];
+	int num_found = Search(Row(idx), k + 1, ef, top_indices, vals);
+
+	for (int i = 0, num_printed = 0; i < num_found && num_printed < k; ++i)
+	{
+		if (top_indices[i] == idx)
+			continue;
+		printf("%d\t%f\n", top_indices[i], vals[i]);
+		++num_printed;
+	}
+}
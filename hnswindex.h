@@ -0,0 +1,119 @@
+#ifndef HNSWINDEX_H_
+#define HNSWINDEX_H_
+
+#include <vector>
+#include <mutex>
+#include <utility>
+
+#include "embeddingtable.h"
+
+// Approximate k nearest neighbours by cosine over a table of vectors, with a
+// hierarchical navigable small world graph (Malkov and Yashunin).
+//
+// The index keeps its own normalized fp32 copy of the rows, so a similarity
+// is one dot product instead of MathUtils::Cosine's three. Every row has a
+// random level; on level l > 0 it links to at most m rows, on level 0 to at
+// most 2m. A search descends greedily from the top level and then runs a
+// best-first search with a candidate list of ef rows on level 0; a larger ef
+// trades speed for recall.
+//
+// Build inserts rows from several threads with a lock per row, so the graph
+// depends on the thread timing; it is read only afterwards and any number of
+// threads may search it.
+class HnswIndex
+{
+public:
+	static const int kMaxLevel = 16;
+
+	// file format: magic, version, num_rows, dim, m, entry point, max level,
+	// the levels of the rows, the level 0 links, the links of the higher
+	// levels row by row, then the normalized rows without padding
+	static HnswIndex *Load(const char *file_name);
+
+public:
+	HnswIndex(int m = 16, int ef_construction = 200);
+	~HnswIndex();
+
+	// vecs may be of any precision and is not kept
+	void Build(EmbeddingTable &vecs, int num_threads);
+	void Save(const char *file_name);
+
+	// Writes the k rows most similar to query into indices and sims, most
+	// similar first, searching with max(ef, k) candidates. Returns the number
+	// found, less than k only if the index has fewer rows.
+	int Search(const float *query, int k, int ef, int *indices, float *sims);
+	// queries holds num_queries vectors of dim() floats, the results k slots
+	// per query; unused slots get index -1
+	void SearchBatch(const float *queries, int num_queries, int k, int ef, int num_threads,
+		int *indices, float *sims);
+	// the same by a scan over all rows, for measuring recall
+	int ExactSearch(const float *query, int k, int *indices, float *sims);
+
+	// prints the 10 rows closest to row idx by Search, an approximate
+	// NegTrain::CloseVectors
+	void CloseVectors(int idx);
+
+	// normalized
+	float *Row(int idx)
+	{
+		return vecs_->Row(idx);
+	}
+
+	int num_rows()
+	{
+		return num_rows_;
+	}
+
+	int dim()
+	{
+		return dim_;
+	}
+
+	long long num_bytes();
+
+private:
+	// (similarity, row)
+	typedef std::pair<float, int> Candidate;
+
+	HnswIndex(const HnswIndex &);
+	HnswIndex &operator=(const HnswIndex &);
+
+	void allocLinks();
+
+	// [0] is the number of links, the links follow
+	int *links(int idx, int level)
+	{
+		return level == 0 ? links0_ + (long long)idx * (max_m0_ + 1) : upper_links_[idx] + (level - 1) * (m_ + 1);
+	}
+
+	void insert(int idx);
+	int greedyDescent(const float *query, int entry, int top_level, int bottom_level, bool locked);
+	// best ef rows found on level, sorted by decreasing similarity
+	void searchLevel(const float *query, int entry, int ef, int level, bool locked,
+		std::vector<Candidate> &results);
+	// keeps the candidates (sorted by decreasing similarity to the row they
+	// are for) that are closer to that row than to any candidate kept before
+	void selectNeighbors(std::vector<Candidate> &candidates, int max_links);
+	void connect(int idx, int neighbor, int level);
+
+private:
+	int m_;
+	int max_m0_;
+	int ef_construction_;
+	double level_mult_;
+
+	int num_rows_ = 0;
+	int dim_ = 0;
+	EmbeddingTable *vecs_ = 0;
+	int *levels_ = 0;
+	int *links0_ = 0;
+	int **upper_links_ = 0;
+
+	int entry_point_ = -1;
+	int max_level_ = -1;
+	std::mutex entry_mutex_;
+	// one per row, during Build only
+	std::mutex *row_mutexes_ = 0;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include "huffmantree.h"
+
+#include <cassert>
+#include <algorithm>
+
+HuffmanTree::HuffmanTree(const int *cnts, int num_objs) : num_objs_(num_objs)
+{
+	assert(num_objs >= 2);
+
+	// Nodes 0 to num_objs - 1 are the leaves, num_objs + k is inner node k.
+	// The inner nodes come out in the order of their weights, so merging the
+	// leaves sorted by count with the inner nodes made so far always finds
+	// the two lightest nodes at the fronts of the two runs.
+	const int num_nodes = 2 * num_objs - 1;
+	std::vector<int> leaves(num_objs);
+	for (int i = 0; i < num_objs; ++i)
+		leaves[i] = i;
+	std::stable_sort(leaves.begin(), leaves.end(), [cnts](int a, int b) { return cnts[a] < cnts[b]; });
+
+	std::vector<long long> weights(num_nodes);
+	std::vector<int> parents(num_nodes, -1);
+	std::vector<unsigned char> branches(num_nodes, 0);
+	for (int i = 0; i < num_objs; ++i)
+		weights[i] = cnts[i];
+	int next_leaf = 0, next_inner = num_objs;
+	for (int node = num_objs; node < num_nodes; ++node)
+	{
+		int children[2];
+		for (int c = 0; c < 2; ++c)
+		{
+			if (next_leaf < num_objs && (next_inner == node || weights[leaves[next_leaf]] <= weights[next_inner]))
+				children[c] = leaves[next_leaf++];
+			else
+				children[c] = next_inner++;
+		}
+		weights[node] = weights[children[0]] + weights[children[1]];
+		parents[children[0]] = parents[children[1]] = node;
+		branches[children[1]] = 1;
+	}
+
+	// depths of the inner nodes from the root down; a parent comes after its children
+	const int root = num_nodes - 1;
+	std::vector<int> depths(num_nodes, 0);
+	for (int node = root - 1; node >= num_objs; --node)
+		depths[node] = depths[parents[node]] + 1;
+
+	offsets_.assign(num_objs + 1, 0);
+	long long sum_cnts = 0, sum_lens = 0;
+	for (int i = 0; i < num_objs; ++i)
+	{
+		int len = depths[parents[i]] + 1;
+		offsets_[i + 1] = offsets_[i] + len;
+		max_path_len_ = std::max(max_path_len_, len);
+		sum_cnts += cnts[i];
+		sum_lens += (long long)cnts[i] * len;
+	}
+	mean_path_len_ = sum_cnts > 0 ? (double)sum_lens / sum_cnts : 0;
+
+	points_.resize(offsets_[num_objs]);
+	codes_.resize(offsets_[num_objs]);
+	for (int i = 0; i < num_objs; ++i)
+	{
+		long long pos = offsets_[i + 1];
+		for (int node = i; node != root; node = parents[node])
+		{
+			--pos;
+			points_[pos] = parents[node] - num_objs;
+			codes_[pos] = branches[node];
+		}
+	}
+}
@@ -0,0 +1,67 @@
+#ifndef HUFFMANTREE_H_
+#define HUFFMANTREE_H_
+
+#include <vector>
+
+// A Huffman tree over the objects of a counts file, for the hierarchical
+// softmax of NegTrain. The objects are the leaves; the num_objs - 1 inner
+// nodes are numbered from 0 with the root last, and each owns a row of the
+// table that takes the place of the objs1 vectors. An object is predicted by
+// the branches on its path from the root, each a logistic regression on the
+// row of the inner node, so a pair costs one inner product per node of the
+// path. The mean path length, weighted by the counts, is within one of the
+// entropy of the counts in bits, below log2(num_objs) for skewed counts.
+class HuffmanTree
+{
+public:
+	// num_objs >= 2; objects with a count of 0 get the longest paths
+	HuffmanTree(const int *cnts, int num_objs);
+
+	int num_objs() const
+	{
+		return num_objs_;
+	}
+
+	int num_inner() const
+	{
+		return num_objs_ - 1;
+	}
+
+	int path_len(int obj) const
+	{
+		return (int)(offsets_[obj + 1] - offsets_[obj]);
+	}
+
+	int max_path_len() const
+	{
+		return max_path_len_;
+	}
+
+	// the inner nodes on the path of obj, root first
+	const int *Path(int obj) const
+	{
+		return points_.data() + offsets_[obj];
+	}
+
+	// the branch taken at each node of Path(obj), 0 or 1
+	const unsigned char *Code(int obj) const
+	{
+		return codes_.data() + offsets_[obj];
+	}
+
+	// path length per object weighted by the counts
+	double MeanPathLen() const
+	{
+		return mean_path_len_;
+	}
+
+private:
+	int num_objs_;
+	int max_path_len_ = 0;
+	double mean_path_len_ = 0;
+	std::vector<long long> offsets_;
+	std::vector<int> points_;
+	std::vector<unsigned char> codes_;
+};
+
+#endif
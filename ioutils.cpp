@@ -1,25 +1,40 @@
 #include "ioutils.h"
 
 #include <cstdio>
+#include <cstring>
 #include <cassert>
+#include <algorithm>
 
-void IOUtils::SaveVectors(float **vecs, int vec_dim, int num_vecs,
-	const char *dst_file_name)
+void IOUtils::SaveVectors(EmbeddingTable *vecs, const char *dst_file_name)
 {
 	FILE *fp = fopen(dst_file_name, "wb");
 	assert(fp != 0);
 
+	int num_vecs = vecs->num_rows(), vec_dim = vecs->dim();
 	fwrite(&num_vecs, 4, 1, fp);
 	fwrite(&vec_dim, 4, 1, fp);
 
-	for (int i = 0; i < num_vecs; ++i)
-		fwrite(vecs[i], 4, vec_dim, fp);
+	if (!vecs->is_fp32())
+	{
+		float *vec = new float[vec_dim];
+		for (int i = 0; i < num_vecs; ++i)
+		{
+			vecs->LoadRow(i, vec);
+			fwrite(vec, 4, vec_dim, fp);
+		}
+		delete[] vec;
+	}
+	else if (vecs->stride() == vec_dim)
+		fwrite(vecs->data(), 4, (long long)num_vecs * vec_dim, fp);
+	else
+		for (int i = 0; i < num_vecs; ++i)
+			fwrite(vecs->Row(i), 4, vec_dim, fp);
 
 	fclose(fp);
 }
 
 void IOUtils::LoadVectors(const char *file_name, int &num_vecs, int &vec_dim, 
-	float **&vecs)
+	EmbeddingTable *&vecs)
 {
 	FILE *fp = fopen(file_name, "rb");
 	assert(fp != 0);
@@ -27,16 +42,66 @@ void IOUtils::LoadVectors(const char *file_name, int &num_vecs, int &vec_dim,
 	fread(&num_vecs, 4, 1, fp);
 	fread(&vec_dim, 4, 1, fp);
 
-	vecs = new float*[num_vecs];
-	for (int i = 0; i < num_vecs; ++i)
+	// read the packed rows in one go, then move them out to their padded
+	// positions starting from the last one so nothing is overwritten early
+	vecs = new EmbeddingTable(num_vecs, vec_dim);
+	float *data = vecs->data();
+	fread(data, 4, (long long)num_vecs * vec_dim, fp);
+	int stride = vecs->stride();
+	if (stride != vec_dim)
 	{
-		vecs[i] = new float[vec_dim];
-		fread(vecs[i], 4, vec_dim, fp);
+		for (int i = num_vecs - 1; i > -1; --i)
+		{
+			memmove(data + (long long)i * stride, data + (long long)i * vec_dim, vec_dim * sizeof(float));
+			std::fill(data + (long long)i * stride + vec_dim, data + (long long)(i + 1) * stride, 0.0f);
+		}
 	}
 
 	fclose(fp);
 }
 
+static const char kQuantizedMagic[8] = { 'E', 'M', 'A', 'D', 'R', 'Q', '8', 'V' };
+static const int kQuantizedVersion = 1;
+
+void IOUtils::SaveQuantizedVectors(QuantizedTable *vecs, const char *dst_file_name)
+{
+	FILE *fp = fopen(dst_file_name, "wb");
+	assert(fp != 0);
+
+	int num_vecs = vecs->num_rows(), vec_dim = vecs->dim();
+	fwrite(kQuantizedMagic, 1, sizeof(kQuantizedMagic), fp);
+	fwrite(&kQuantizedVersion, 4, 1, fp);
+	fwrite(&num_vecs, 4, 1, fp);
+	fwrite(&vec_dim, 4, 1, fp);
+	fwrite(vecs->scales(), 4, num_vecs, fp);
+	for (int i = 0; i < num_vecs; ++i)
+		fwrite(vecs->Row(i), 1, vec_dim, fp);
+
+	fclose(fp);
+}
+
+void IOUtils::LoadQuantizedVectors(const char *file_name, QuantizedTable *&vecs)
+{
+	FILE *fp = fopen(file_name, "rb");
+	assert(fp != 0);
+
+	char magic[sizeof(kQuantizedMagic)];
+	int version = 0, num_vecs = 0, vec_dim = 0;
+	fread(magic, 1, sizeof(magic), fp);
+	fread(&version, 4, 1, fp);
+	assert(memcmp(magic, kQuantizedMagic, sizeof(magic)) == 0 && version == kQuantizedVersion);
+	fread(&num_vecs, 4, 1, fp);
+	fread(&vec_dim, 4, 1, fp);
+
+	vecs = new QuantizedTable(num_vecs, vec_dim);
+	fread(vecs->scales(), 4, num_vecs, fp);
+	for (int i = 0; i < num_vecs; ++i)
+		fread(vecs->Row(i), 1, vec_dim, fp);
+	vecs->ComputeNorms();
+
+	fclose(fp);
+}
+
 void IOUtils::LoadCountsFile(const char *file_name, int &num, int *&cnts)
 {
 	FILE *fp = fopen(file_name, "rb");
@@ -1,13 +1,20 @@
 #ifndef IOUTILS_H_
 #define IOUTILS_H_
 
+#include "embeddingtable.h"
+#include "quantizedtable.h"
+
 class IOUtils
 {
 public:
-	static void SaveVectors(float **vecs, int vec_dim, int num_vecs,
-		const char *dst_file_name);
+	static void SaveVectors(EmbeddingTable *vecs, const char *dst_file_name);
 	static void LoadVectors(const char *file_name, int &num_vecs,
-		int &vec_dim, float **&vecs);
+		int &vec_dim, EmbeddingTable *&vecs);
+
+	// int8 format: magic, version, num_vecs, vec_dim, the row scales, then
+	// the int8 rows without padding
+	static void SaveQuantizedVectors(QuantizedTable *vecs, const char *dst_file_name);
+	static void LoadQuantizedVectors(const char *file_name, QuantizedTable *&vecs);
 
 	static void LoadCountsFile(const char *file_name, int &num, int *&cnts);
 
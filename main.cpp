@@ -7,11 +7,21 @@
 #include <iostream>
 #include <cstring>
 #include <map>
+#include <vector>
+#include <chrono>
+#include <algorithm>
 
 #include "ioutils.h"
 #include "mathutils.h"
 #include "pairsampler.h"
+#include "multinomialsampler.h"
+#include "negsamplingbase.h"
+#include "simdkernels.h"
 #include "eadocvectrainer.h"
+#include "hnswindex.h"
+#include "exactsearcher.h"
+#include "benchmark.h"
+#include "graphgen.h"
 
 enum DataSet {
 	NYT_ARTS,
@@ -28,6 +38,9 @@ void TrainDocWordVectors()
 	int num_rounds = 5;
 	int num_negative_samples = 5;
 	float starting_alpha = 0.06f;
+	bool numa = false;
+	// > 1 for doc-major groups of that many words
+	int words_per_doc = 0;
 
 	const char *doc_words_file_name = "e:/data/emadr/el/tac/2010/eval/dw.bin";
 	const char *word_cnts_file = "e:/data/emadr/el/wiki/word_cnts.bin";
@@ -35,6 +48,8 @@ void TrainDocWordVectors()
 	const char *dst_vec_file_name = "e:/data/emadr/el/tac/2010/eval/train_3_dw_vecs.bin";
 
 	EADocVecTrainer trainer(num_rounds, num_threads, num_negative_samples, starting_alpha);
+	trainer.SetNuma(numa, numa);
+	trainer.SetDocMajor(words_per_doc);
 	trainer.TrainDocWordFixedWordVecs(doc_words_file_name, word_cnts_file, word_vecs_file_name, 
 		vec_dim, dst_vec_file_name);
 }
@@ -74,11 +89,13 @@ void EATrainDWEFixed()
 	float min_alpha = 0.0001f;
 	bool share_vecs = false;
 	//bool share_vecs = true;
+	bool numa = false;
 
 	printf("vec_dim: %d\nnum_rounds: %d\nnum_threads: %d\nnum_neg_samples: %d\nstarting_alpha: %f\nmin_alpha: %f\n",
 		doc_vec_dim, num_rounds, num_threads, num_negative_samples, starting_alpha, min_alpha);
 
 	EADocVecTrainer eatrain(num_rounds, num_threads, num_negative_samples, starting_alpha, min_alpha);
+	eatrain.SetNuma(numa, numa);
 	if (share_vecs)
 		eatrain.TrainWEFixed(doc_words_file_name, de_file_name, word_cnts_file, entity_cnts_file,
 			word_vecs_file_name, entity_vecs_file_name, doc_vec_dim, dst_doc_vecs_file_name);
@@ -172,6 +189,16 @@ void configFiles(DataSet data_set, char *&ee_file, char *&de_file, char *&dw_fil
 	sprintf(dst_entity_vecs_file, "%s/vecs/entity-vecs.bin", datadir);
 }
 
+bool HasArg(int argc, char **argv, const char *arg)
+{
+	for (int i = 0; i < argc; ++i)
+	{
+		if (strcmp(argv[i], arg) == 0)
+			return true;
+	}
+	return false;
+}
+
 char *GetArgValue(int argc, char **argv, const char *arg)
 {
 	for (int i = 0; i < argc - 1; ++i)
@@ -198,7 +225,61 @@ float GetFloatArgValue(int argc, char **argv, const char *arg, float def_val)
 	return def_val;
 }
 
-void EATrain(int argc, char **argv)
+// spec: comma separated <table>:<precision>, e.g. "word:bf16,ee0:bf16,ee1:fp16";
+// tables are word, dw, de, ee0, ee1 and all, precisions fp32, bf16 and fp16
+bool ParsePrecisions(const char *spec, EmbeddingTable::Precision *precisions)
+{
+	const char *table_names[] = { "word", "dw", "de", "ee0", "ee1" };
+	char buf[256];
+	strncpy(buf, spec, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = '\0';
+	for (char *item = strtok(buf, ","); item != 0; item = strtok(0, ","))
+	{
+		char *sep = strchr(item, ':');
+		EmbeddingTable::Precision precision;
+		if (sep == 0 || !EmbeddingTable::ParsePrecision(sep + 1, precision))
+			return false;
+		*sep = '\0';
+		bool found = false;
+		for (int i = 0; i < 5; ++i)
+		{
+			if (strcmp(item, "all") == 0 || strcmp(item, table_names[i]) == 0)
+			{
+				precisions[i] = precision;
+				found = true;
+			}
+		}
+		if (!found)
+			return false;
+	}
+	return true;
+}
+
+// spec: comma separated relations out of ee, de, dw and all, e.g. "ee,de"
+bool ParseRelations(const char *spec, bool *relations)
+{
+	const char *relation_names[] = { "ee", "de", "dw" };
+	char buf[256];
+	strncpy(buf, spec, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = '\0';
+	for (char *item = strtok(buf, ","); item != 0; item = strtok(0, ","))
+	{
+		bool found = false;
+		for (int i = 0; i < 3; ++i)
+		{
+			if (strcmp(item, "all") == 0 || strcmp(item, relation_names[i]) == 0)
+			{
+				relations[i] = true;
+				found = true;
+			}
+		}
+		if (!found)
+			return false;
+	}
+	return true;
+}
+
+bool EATrain(int argc, char **argv)
 {
 	char *ee_file, *de_file, *dw_file, *entity_cnts_file, *word_cnts_file, 
 		*dst_doc_vecs_file, *dst_word_vecs_file,
@@ -215,6 +296,39 @@ void EATrain(int argc, char **argv)
 	float weight_de = GetFloatArgValue(argc, argv, "-wde", 1);
 	float weight_dw = GetFloatArgValue(argc, argv, "-wdw", 1);
 	float min_alpha = GetFloatArgValue(argc, argv, "-ma", 0.0001f);
+	int batch_size = GetIntArgValue(argc, argv, "-b", 1);
+	bool sample_stats = GetIntArgValue(argc, argv, "-stats", 0) != 0;
+	bool epochs = HasArg(argc, argv, "--epochs");
+	char *checkpoint_dir = GetArgValue(argc, argv, "-ckpt");
+	int checkpoint_rounds = GetIntArgValue(argc, argv, "-ckptr", 1);
+	float checkpoint_minutes = GetFloatArgValue(argc, argv, "-ckptm", 0);
+	bool resume = HasArg(argc, argv, "--resume");
+	bool numa = HasArg(argc, argv, "--numa");
+	unsigned int seed = (unsigned int)GetIntArgValue(argc, argv, "-seed", 0);
+	bool deterministic = HasArg(argc, argv, "--det");
+	int det_step = GetIntArgValue(argc, argv, "-detstep", 256);
+	bool numa_replicas = HasArg(argc, argv, "--numa-replicas");
+	char *metrics_file = GetArgValue(argc, argv, "-metrics");
+	float metrics_secs = GetFloatArgValue(argc, argv, "-metricsint", 10);
+	float early_stop_gain = GetFloatArgValue(argc, argv, "-es", 0);
+	int early_stop_patience = GetIntArgValue(argc, argv, "-espat", 1);
+	int early_stop_pairs = GetIntArgValue(argc, argv, "-espairs", 10000);
+	int words_per_doc = GetIntArgValue(argc, argv, "-docmajor", 0);
+	char *hs_spec = GetArgValue(argc, argv, "-hs");
+	bool hs_relations[3] = { false, false, false };
+	if (hs_spec && !ParseRelations(hs_spec, hs_relations))
+	{
+		printf("bad -hs %s\n", hs_spec);
+		return false;
+	}
+	char *precision_spec = GetArgValue(argc, argv, "-prec");
+	EmbeddingTable::Precision precisions[5] = { EmbeddingTable::kFloat32, EmbeddingTable::kFloat32,
+		EmbeddingTable::kFloat32, EmbeddingTable::kFloat32, EmbeddingTable::kFloat32 };
+	if (precision_spec && !ParsePrecisions(precision_spec, precisions))
+	{
+		printf("bad -prec %s\n", precision_spec);
+		return false;
+	}
 
 	ee_file = GetArgValue(argc, argv, "-ee");
 	de_file = GetArgValue(argc, argv, "-de");
@@ -242,15 +356,306 @@ void EATrain(int argc, char **argv)
 	printf("vec_dim: %d\nnum_rounds: %d\nnum_threads: %d\nnum_neg_samples: %d\nstarting_alpha: %f\nmin_alpha: %f\n",
 		doc_vec_dim, num_rounds, num_threads, num_negative_samples, starting_alpha, min_alpha);
 	printf("wee: %f\twde: %f\twdw: %f\n", weight_ee, weight_de, weight_dw);
+	printf("batch_size: %d\n", batch_size);
 	printf("ee_file: %s\nde_file: %s\ndw_file: %s\n", ee_file, de_file, dw_file);
 	printf("dst_doc_vec_file: %s\n", dst_doc_vecs_file);
 
 	EADocVecTrainer eatrain(num_rounds, num_threads, num_negative_samples, starting_alpha, min_alpha);
-	eatrain.AllJointThreaded(ee_file, de_file, dw_file, entity_cnts_file, word_cnts_file, doc_vec_dim, share_doc_vec, 
+	eatrain.SetBatchSize(batch_size);
+	eatrain.SetSampleStats(sample_stats);
+	if (epochs)
+	{
+		printf("edges walked in block-shuffled epochs\n");
+		eatrain.SetEpochs(true);
+	}
+	eatrain.SetNuma(numa || numa_replicas, numa_replicas);
+	eatrain.SetSeed(seed);
+	if (deterministic)
+	{
+		printf("deterministic, seed %u, %d samples per step\n", seed, det_step);
+		eatrain.SetDeterministic(true, det_step);
+	}
+	eatrain.SetPrecisions(precisions[0], precisions[1], precisions[2], precisions[3], precisions[4]);
+	if (hs_spec)
+	{
+		printf("hierarchical softmax: %s\n", hs_spec);
+		eatrain.SetHierarchicalSoftmax(hs_relations[0], hs_relations[1], hs_relations[2]);
+	}
+	if (metrics_file)
+	{
+		printf("metrics: %s, every %.1f s\n", metrics_file, metrics_secs);
+		eatrain.SetMetrics(metrics_file, metrics_secs);
+	}
+	if (early_stop_gain > 0)
+	{
+		printf("early_stop: min gain %g, patience %d, %d eval pairs\n", early_stop_gain, early_stop_patience,
+			early_stop_pairs);
+		eatrain.SetEarlyStop(early_stop_gain, early_stop_patience, early_stop_pairs);
+	}
+	if (checkpoint_dir)
+	{
+		printf("checkpoint_dir: %s, every %d rounds / %.1f minutes\n", checkpoint_dir, checkpoint_rounds,
+			checkpoint_minutes);
+		eatrain.SetCheckpoint(checkpoint_dir, checkpoint_rounds, checkpoint_minutes, resume);
+	}
+	if (words_per_doc > 1)
+	{
+		// the doc-major scheduler only exists for dw alone
+		if (ee_file || de_file)
+		{
+			printf("-docmajor trains the dw relation alone, without -ee and -de\n");
+			return false;
+		}
+		printf("dw only, doc-major groups of %d words\n", words_per_doc);
+		eatrain.SetDocMajor(words_per_doc);
+		eatrain.TrainDocWord(dw_file, word_cnts_file, doc_vec_dim, dst_doc_vecs_file, dst_word_vecs_file);
+		return true;
+	}
+	return eatrain.AllJointThreaded(ee_file, de_file, dw_file, entity_cnts_file, word_cnts_file, doc_vec_dim, share_doc_vec, 
 		weight_ee, weight_de, weight_dw, dst_doc_vecs_file, dst_word_vecs_file,
 		dst_entity_vecs_file);
 }
 
+// emadr -tocsr <adj list file> <dst csr file>
+// one-time conversion of a dw/de/ee file to the mappable CSR format
+bool ConvertToCSR(int argc, char **argv)
+{
+	char *src_file = GetArgValue(argc, argv, "-tocsr");
+	char *dst_file = GetArgValue(argc, argv, src_file);
+	if (!dst_file)
+	{
+		printf("usage: -tocsr <adj list file> <dst csr file>\n");
+		return false;
+	}
+	return PairSampler::ConvertToCSR(src_file, dst_file);
+}
+
+// emadr -gen <dst dir> [-gdocs <n>] [-gwords <n>] [-gentities <n>] [-gdw <spec>] [-gde <spec>]
+//	[-gee <spec>] [-t <threads>] [-seed <seed>]
+// synthetic dw.bin, de.bin, ee.bin, word-cnts.bin and entity-cnts.bin, see
+// GraphGenerator; a spec is min_len:max_len:len_exponent:freq_exponent
+void GenerateGraph(int argc, char **argv)
+{
+	char *dst_dir = GetArgValue(argc, argv, "-gen");
+	int num_threads = GetIntArgValue(argc, argv, "-t", std::max(1, (int)std::thread::hardware_concurrency()));
+	unsigned int seed = (unsigned int)GetIntArgValue(argc, argv, "-seed", 1);
+
+	GraphGenerator::Relation dw, de, ee;
+	dw.num_left = de.num_left = GetIntArgValue(argc, argv, "-gdocs", 100000);
+	dw.num_right = GetIntArgValue(argc, argv, "-gwords", 100000);
+	de.num_right = ee.num_left = ee.num_right = GetIntArgValue(argc, argv, "-gentities", 20000);
+	const char *specs[] = { GetArgValue(argc, argv, "-gdw"), GetArgValue(argc, argv, "-gde"),
+		GetArgValue(argc, argv, "-gee") };
+	const char *def_specs[] = { "20:2000:1.5:1", "1:100:2:1", "1:200:2:1" };
+	GraphGenerator::Relation *relations[] = { &dw, &de, &ee };
+	for (int i = 0; i < 3; ++i)
+	{
+		if (!GraphGenerator::ParseSpec(specs[i] ? specs[i] : def_specs[i], *relations[i]))
+		{
+			printf("bad spec %s, expected min_len:max_len:len_exponent:freq_exponent\n", specs[i]);
+			return;
+		}
+	}
+
+	printf("%d docs, %d words, %d entities, %d threads, seed %u\n", dw.num_left, dw.num_right, de.num_right,
+		num_threads, seed);
+	std::string dir(dst_dir);
+	GraphGenerator generator(num_threads, seed);
+	long long num_edges = generator.Generate(dw, (dir + "/dw.bin").c_str(), (dir + "/word-cnts.bin").c_str());
+	num_edges += generator.Generate(de, (dir + "/de.bin").c_str(), (dir + "/entity-cnts.bin").c_str());
+	num_edges += generator.Generate(ee, (dir + "/ee.bin").c_str());
+	printf("%lld edges in all\n", num_edges);
+}
+
+// emadr -infer <dst doc vecs file> -dw <dw file> -wcnt <word cnts> -wordvec <word vecs>
+//	[-de <de file> -ecnt <entity cnts> -entityvec <entity vecs>] [-share 0/1] [-r <max epochs>] [-tol <tol>]
+//	[-docmajor <words per doc>]
+// fold-in inference of vectors for new docs with fixed word/entity vectors. With
+// -docmajor, a dw-only fold-in runs -r rounds of the doc-major scheduler of
+// EADocVecTrainer instead, with no tolerance.
+void InferDocs(int argc, char **argv)
+{
+	char *dst_doc_vecs_file = GetArgValue(argc, argv, "-infer");
+	char *dw_file = GetArgValue(argc, argv, "-dw");
+	char *de_file = GetArgValue(argc, argv, "-de");
+	char *word_cnts_file = GetArgValue(argc, argv, "-wcnt");
+	char *entity_cnts_file = GetArgValue(argc, argv, "-ecnt");
+	char *word_vecs_file = GetArgValue(argc, argv, "-wordvec");
+	char *entity_vecs_file = GetArgValue(argc, argv, "-entityvec");
+	if (!dw_file || !word_cnts_file || !word_vecs_file || (de_file && (!entity_cnts_file || !entity_vecs_file)))
+	{
+		printf("usage: -infer <dst doc vecs file> -dw <dw file> -wcnt <word cnts> -wordvec <word vecs> "
+			"[-de <de file> -ecnt <entity cnts> -entityvec <entity vecs>]\n");
+		return;
+	}
+
+	int max_epochs = GetIntArgValue(argc, argv, "-r", 20);
+	int num_threads = GetIntArgValue(argc, argv, "-t", 4);
+	int num_negative_samples = GetIntArgValue(argc, argv, "-n", 10);
+	float starting_alpha = GetFloatArgValue(argc, argv, "-sa", 0.06f);
+	float min_alpha = GetFloatArgValue(argc, argv, "-ma", 0.0001f);
+	float tol = GetFloatArgValue(argc, argv, "-tol", 0.01f);
+	bool shared = GetIntArgValue(argc, argv, "-share", 1) != 0;
+	int words_per_doc = GetIntArgValue(argc, argv, "-docmajor", 0);
+	if (words_per_doc > 1 && de_file)
+	{
+		printf("-docmajor folds in dw alone, without -de\n");
+		return;
+	}
+
+	printf("max_epochs: %d\nnum_threads: %d\nnum_neg_samples: %d\nstarting_alpha: %f\nmin_alpha: %f\ntol: %f\n",
+		max_epochs, num_threads, num_negative_samples, starting_alpha, min_alpha, tol);
+
+	EADocVecTrainer trainer(max_epochs, num_threads, num_negative_samples, starting_alpha, min_alpha);
+	if (words_per_doc > 1)
+	{
+		printf("doc-major groups of %d words\n", words_per_doc);
+		trainer.SetDocMajor(words_per_doc);
+		trainer.TrainDocWordFixedWordVecs(dw_file, word_cnts_file, word_vecs_file, 0, dst_doc_vecs_file);
+		return;
+	}
+	trainer.InferDocVecs(dw_file, de_file, word_cnts_file, entity_cnts_file, word_vecs_file,
+		entity_vecs_file, shared, tol, dst_doc_vecs_file);
+}
+
+// emadr -quantize <vecs file> <dst int8 vecs file>
+// int8 export of vectors written by SaveVectors, for similarity lookups
+void QuantizeVectors(int argc, char **argv)
+{
+	char *src_file = GetArgValue(argc, argv, "-quantize");
+	char *dst_file = GetArgValue(argc, argv, src_file);
+	if (!dst_file)
+	{
+		printf("usage: -quantize <vecs file> <dst int8 vecs file>\n");
+		return;
+	}
+
+	int num_vecs = 0, vec_dim = 0;
+	EmbeddingTable *vecs = 0;
+	IOUtils::LoadVectors(src_file, num_vecs, vec_dim, vecs);
+	QuantizedTable *qvecs = QuantizedTable::FromTable(*vecs);
+	IOUtils::SaveQuantizedVectors(qvecs, dst_file);
+	printf("%d x %d vectors, %lld -> %lld bytes\n", num_vecs, vec_dim, 8 + 4LL * num_vecs * vec_dim,
+		20 + 4LL * num_vecs + (long long)num_vecs * vec_dim);
+	delete vecs;
+	delete qvecs;
+}
+
+// Recall of the index against exact search, with rows of the index as the
+// queries, and the time per query of batched searches for several ef.
+void ReportHnswRecall(HnswIndex &index, ExactSearcher &exact_searcher, int num_queries, int k, int num_threads)
+{
+	int num_rows = index.num_rows(), dim = index.dim();
+	num_queries = std::min(num_queries, num_rows);
+	std::default_random_engine generator(num_rows);
+	std::vector<float> queries((long long)num_queries * dim);
+	for (int q = 0; q < num_queries; ++q)
+	{
+		float *row = index.Row(generator() % num_rows);
+		std::copy(row, row + dim, &queries[(long long)q * dim]);
+	}
+
+	std::vector<int> exact_indices((long long)num_queries * k);
+	std::vector<float> sims((long long)num_queries * k);
+	auto beg = std::chrono::steady_clock::now();
+	exact_searcher.SearchVectors(&queries[0], num_queries, k, num_threads, &exact_indices[0], &sims[0]);
+	double exact_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+	printf("exact: %.0f queries/s with %d threads\n", num_queries / exact_secs, num_threads);
+
+	std::vector<int> indices((long long)num_queries * k);
+	const int efs[] = { 10, 20, 40, 80, 160, 320 };
+	for (int ef : efs)
+	{
+		beg = std::chrono::steady_clock::now();
+		index.SearchBatch(&queries[0], num_queries, k, ef, 1, &indices[0], &sims[0]);
+		double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+		beg = std::chrono::steady_clock::now();
+		index.SearchBatch(&queries[0], num_queries, k, ef, num_threads, &indices[0], &sims[0]);
+		double batch_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+
+		long long num_hits = 0;
+		for (int q = 0; q < num_queries; ++q)
+		{
+			int *exact = &exact_indices[(long long)q * k];
+			for (int i = 0; i < k; ++i)
+				num_hits += std::find(exact, exact + k, indices[(long long)q * k + i]) != exact + k;
+		}
+		printf("ef %3d: recall@%d %.4f, %.1f us/query, %.0f queries/s with %d threads\n", std::max(ef, k), k,
+			(double)num_hits / ((long long)num_queries * k), secs / num_queries * 1e6, num_queries / batch_secs,
+			num_threads);
+	}
+}
+
+// emadr -hnsw <vecs file> <dst index file> [-m <links per level>] [-efc <ef of the build>] [-t <threads>]
+// builds an HNSW index over vectors written by SaveVectors, then reports its recall
+void BuildHnswIndex(int argc, char **argv)
+{
+	char *src_file = GetArgValue(argc, argv, "-hnsw");
+	char *dst_file = GetArgValue(argc, argv, src_file);
+	if (!dst_file)
+	{
+		printf("usage: -hnsw <vecs file> <dst index file> [-m <links per level>] [-efc <ef of the build>]\n");
+		return;
+	}
+	int m = GetIntArgValue(argc, argv, "-m", 16);
+	int ef_construction = GetIntArgValue(argc, argv, "-efc", 200);
+	int num_threads = GetIntArgValue(argc, argv, "-t", 4);
+
+	int num_vecs = 0, vec_dim = 0;
+	EmbeddingTable *vecs = 0;
+	IOUtils::LoadVectors(src_file, num_vecs, vec_dim, vecs);
+	HnswIndex index(m, ef_construction);
+	index.Build(*vecs, num_threads);
+	index.Save(dst_file);
+
+	ExactSearcher exact_searcher(*vecs);
+	delete vecs;
+	HnswIndex *loaded = HnswIndex::Load(dst_file);
+	ReportHnswRecall(*loaded, exact_searcher, 1000, 10, num_threads);
+	delete loaded;
+}
+
+// emadr -knn <vecs file> <dst file> [-k <k>] [-t <threads>]
+// exact k nearest neighbours of every vector but itself. The file has
+// num_vecs and k, then the num_vecs x k neighbour indices, then their cosines.
+void FindNeighbors(int argc, char **argv)
+{
+	char *src_file = GetArgValue(argc, argv, "-knn");
+	char *dst_file = GetArgValue(argc, argv, src_file);
+	if (!dst_file)
+	{
+		printf("usage: -knn <vecs file> <dst file> [-k <k>]\n");
+		return;
+	}
+	int k = GetIntArgValue(argc, argv, "-k", 10);
+	int num_threads = GetIntArgValue(argc, argv, "-t", 4);
+
+	int num_vecs = 0, vec_dim = 0;
+	EmbeddingTable *vecs = 0;
+	IOUtils::LoadVectors(src_file, num_vecs, vec_dim, vecs);
+	ExactSearcher searcher(*vecs);
+	delete vecs;
+
+	int *indices = new int[(long long)num_vecs * k];
+	float *sims = new float[(long long)num_vecs * k];
+	auto beg = std::chrono::steady_clock::now();
+	searcher.SearchAll(k, true, num_threads, indices, sims);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+	printf("%d x %d vectors, top %d in %.2f s, %.2f GFLOP/s\n", num_vecs, vec_dim, k, seconds,
+		2.0 * num_vecs * num_vecs * vec_dim / seconds / 1e9);
+
+	FILE *fp = fopen(dst_file, "wb");
+	assert(fp != 0);
+	fwrite(&num_vecs, 4, 1, fp);
+	fwrite(&k, 4, 1, fp);
+	fwrite(indices, 4, (long long)num_vecs * k, fp);
+	fwrite(sims, 4, (long long)num_vecs * k, fp);
+	fclose(fp);
+
+	delete[] indices;
+	delete[] sims;
+}
+
 void Test()
 {
 	std::default_random_engine generator(43);
@@ -268,6 +673,931 @@ void Test()
 	//delete[] weights;
 }
 
+// Sampled pairs per second of the old discrete_distribution + binary search
+// path against the alias tables in PairSampler, on a synthetic adjacency file.
+void BenchPairSampler(const char *tmp_adj_file = "bench_pairs.bin")
+{
+	const int num_left = 200000, num_right = 50000, max_degree = 400;
+	const long long num_samples = 20000000;
+
+	std::default_random_engine generator(317);
+	std::uniform_int_distribution<int> right_dist(0, num_right - 1);
+	std::uniform_int_distribution<int> weight_dist(1, 20);
+	std::uniform_real_distribution<double> real_dist(0, 1);
+
+	MultinomialSampler *right_samplers = new MultinomialSampler[num_left];
+	int *left_weights = new int[num_left];
+	int **adj_list = new int*[num_left];
+	unsigned short *weights = new unsigned short[max_degree];
+
+	FILE *fp = fopen(tmp_adj_file, "wb");
+	assert(fp != 0);
+	fwrite(&num_left, sizeof(int), 1, fp);
+	fwrite(&num_right, sizeof(int), 1, fp);
+	for (int i = 0; i < num_left; ++i)
+	{
+		// skewed degrees, most rows short and a few long ones
+		int degree = 1 + (int)(max_degree * pow(real_dist(generator), 3));
+		adj_list[i] = new int[degree];
+		left_weights[i] = 0;
+		for (int j = 0; j < degree; ++j)
+		{
+			adj_list[i][j] = right_dist(generator);
+			weights[j] = (unsigned short)weight_dist(generator);
+			left_weights[i] += weights[j];
+		}
+		right_samplers[i].Init(weights, degree);
+
+		fwrite(&degree, sizeof(int), 1, fp);
+		fwrite(adj_list[i], sizeof(int), degree, fp);
+		fwrite(weights, sizeof(unsigned short), degree, fp);
+	}
+	fclose(fp);
+	delete[] weights;
+
+	std::discrete_distribution<int> left_dist(left_weights, left_weights + num_left);
+	RandGen rand_gen(317);
+	long long checksum = 0;
+	auto beg = std::chrono::steady_clock::now();
+	for (long long i = 0; i < num_samples; ++i)
+	{
+		int lidx = left_dist(generator);
+		checksum += adj_list[lidx][right_samplers[lidx].Sample(rand_gen)];
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+	printf("discrete_distribution + binary search: %.0f pairs/s (%lld)\n", num_samples / secs, checksum);
+
+	PairSampler pair_sampler(tmp_adj_file);
+	FastRng rng(317);
+	checksum = 0;
+	beg = std::chrono::steady_clock::now();
+	for (long long i = 0; i < num_samples; ++i)
+	{
+		int lidx = 0, ridx = 0;
+		pair_sampler.SamplePair(lidx, ridx, rng);
+		checksum += ridx;
+	}
+	secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+	printf("alias tables: %.0f pairs/s (%lld)\n", num_samples / secs, checksum);
+
+	for (int i = 0; i < num_left; ++i)
+		delete[] adj_list[i];
+	delete[] adj_list;
+	delete[] left_weights;
+	delete[] right_samplers;
+	remove(tmp_adj_file);
+}
+
+// 32-bit words per second of the generators the sampling path has used,
+// and of FastRng under each instruction set.
+void BenchFastRng()
+{
+	const long long num_words = 400000000;
+
+	std::default_random_engine generator(317);
+	unsigned int checksum = 0;
+	auto beg = std::chrono::steady_clock::now();
+	for (long long i = 0; i < num_words; ++i)
+		checksum += (unsigned int)generator();
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+	printf("default_random_engine: %.1f M words/s (%u)\n", num_words / secs / 1e6, checksum);
+
+	RandGen rand_gen(317);
+	checksum = 0;
+	beg = std::chrono::steady_clock::now();
+	for (long long i = 0; i < num_words; ++i)
+		checksum += rand_gen.NextUInt();
+	secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+	printf("RandGen: %.1f M words/s (%u)\n", num_words / secs / 1e6, checksum);
+
+	SimdKernels::Isa isas[] = { SimdKernels::kScalar, SimdKernels::kAvx2, SimdKernels::kAvx512 };
+	SimdKernels::Isa def_isa = SimdKernels::GetIsa();
+	for (SimdKernels::Isa isa : isas)
+	{
+		if (!SimdKernels::SetIsa(isa))
+			continue;
+		FastRng rng(317);
+		checksum = 0;
+		beg = std::chrono::steady_clock::now();
+		for (long long i = 0; i < num_words; ++i)
+			checksum += rng.NextUInt();
+		secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+		printf("FastRng %s: %.1f M words/s (%u)", SimdKernels::GetIsaName(isa), num_words / secs / 1e6, checksum);
+
+		unsigned int words[FastRng::kBufferSize];
+		checksum = 0;
+		beg = std::chrono::steady_clock::now();
+		for (long long i = 0; i < num_words; i += FastRng::kBufferSize)
+		{
+			rng.Fill(words, FastRng::kBufferSize);
+			checksum += words[0];
+		}
+		secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+		printf(", Fill %.1f M words/s (%u)\n", num_words / secs / 1e6, checksum);
+	}
+	SimdKernels::SetIsa(def_isa);
+}
+
+// Cost per training sample of the TrainMetrics counting: what allJoint adds
+// for one sample, with a reporter thread running; NegTrain only counts the
+// rare negatives that hit the positive.
+// A thread trains on the order of a million samples per second, so the
+// budget for the counting is about 10 ns per sample.
+void BenchTrainMetrics(const char *tmp_stats_file = "bench_metrics.jsonl")
+{
+	const long long num_samples = 200000000;
+
+	TrainMetrics metrics(1);
+	metrics.Start(tmp_stats_file, 0.5f, num_samples);
+	TrainMetrics::SetThread(&metrics, 0);
+	TrainMetrics::Slot *slot = TrainMetrics::ThreadSlot();
+	auto beg = std::chrono::steady_clock::now();
+	for (long long i = 0; i < num_samples; ++i)
+	{
+		slot->Add((TrainMetrics::Counter)(i % 3));
+		if (i % 10000 == 10000 - 1)
+			slot->SetProgress(0, 0.025f);
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+	TrainMetrics::SetThread(0, 0);
+	metrics.Stop();
+	printf("metrics: %.2f ns per sample\n", secs / num_samples * 1e9);
+	remove(tmp_stats_file);
+}
+
+// Negative draws per second, std::discrete_distribution against the alias
+// table NegTrain now uses, on a Zipfian vocabulary.
+void BenchNegSampling()
+{
+	const int num_objs = 2000000;
+	const long long num_samples = 50000000;
+
+	int *cnts = new int[num_objs];
+	for (int i = 0; i < num_objs; ++i)
+		cnts[i] = 1 + 10000000 / (i + 1);
+
+	std::default_random_engine generator(317);
+	float *weights = NegSamplingBase::GetDefNegativeSamplingWeights(cnts, num_objs);
+	std::discrete_distribution<int> neg_dist(weights, weights + num_objs);
+	delete[] weights;
+	long long checksum = 0;
+	auto beg = std::chrono::steady_clock::now();
+	for (long long i = 0; i < num_samples; ++i)
+		checksum += neg_dist(generator);
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+	printf("discrete_distribution: %.0f draws/s (%lld)\n", num_samples / secs, checksum);
+
+	AliasSampler *neg_sampler = NegSamplingBase::GetNegSamplingTable(cnts, num_objs);
+	FastRng rng(317);
+	checksum = 0;
+	beg = std::chrono::steady_clock::now();
+	for (long long i = 0; i < num_samples; ++i)
+		checksum += neg_sampler->Sample(rng);
+	secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+	printf("alias table: %.0f draws/s (%lld)\n", num_samples / secs, checksum);
+
+	// in batches of the size of a TrainBatch negative set
+	const int batch_size = 16;
+	int batch[batch_size];
+	checksum = 0;
+	beg = std::chrono::steady_clock::now();
+	for (long long i = 0; i < num_samples; i += batch_size)
+	{
+		neg_sampler->SampleBatch(rng, batch, batch_size);
+		for (int j = 0; j < batch_size; ++j)
+			checksum += batch[j];
+	}
+	secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+	printf("alias table, batches of %d: %.0f draws/s (%lld)\n", batch_size, num_samples / secs, checksum);
+
+	delete neg_sampler;
+	delete[] cnts;
+}
+
+// Agreement of every SIMD kernel set the CPU supports with the scalar one,
+// as the largest error relative to the magnitude of the result; false if
+// any of them is off.
+bool CheckSimdKernels()
+{
+	const int max_len = 320;
+	const float kTolerance = 1e-5f;
+	// a little over the 6e-8 bound of SimdKernels::Sigmoid
+	const float kSigmoidTolerance = 1e-7f;
+	// in units of the gap between the neighbours of a value; the mean of
+	// the trials has a standard error of about 0.002 of it
+	const double kBiasTolerance = 0.01;
+	std::default_random_engine generator(317);
+	std::uniform_real_distribution<float> dist(-1, 1);
+
+	float vec0[max_len], vec1[max_len], neu1e[max_len];
+	float ref_vec1[max_len], ref_neu1e[max_len];
+	float delta1[max_len], ref_delta1[max_len], delta_neu1e[max_len], ref_delta_neu1e[max_len];
+	// the scalar set against itself only checks the sigmoid
+	SimdKernels::Isa isas[] = { SimdKernels::kScalar, SimdKernels::kAvx2, SimdKernels::kAvx512 };
+	SimdKernels::Isa def_isa = SimdKernels::GetIsa();
+	bool ok = true;
+	for (SimdKernels::Isa isa : isas)
+	{
+		if (!SimdKernels::IsaSupported(isa))
+		{
+			printf("%s: not supported\n", SimdKernels::GetIsaName(isa));
+			continue;
+		}
+
+		float max_err = 0;
+		for (int len = 1; len <= max_len; ++len)
+		{
+			for (int i = 0; i < len; ++i)
+			{
+				vec0[i] = dist(generator);
+				ref_vec1[i] = vec1[i] = dist(generator);
+				ref_neu1e[i] = neu1e[i] = dist(generator);
+				ref_delta_neu1e[i] = delta_neu1e[i] = neu1e[i];
+			}
+			float g = dist(generator), lambda = 0.0006f;
+
+			SimdKernels::SetIsa(SimdKernels::kScalar);
+			SimdKernels::PairDelta(g, lambda, vec0, vec1, ref_delta_neu1e, ref_delta1, len);
+			float ref_dp = SimdKernels::DotProduct(vec0, vec1, len);
+			SimdKernels::UpdatePair(g, lambda, vec0, ref_vec1, ref_neu1e, len);
+			SimdKernels::AxpyDecay(1.0f, ref_neu1e, lambda, ref_vec1, len);
+
+			SimdKernels::SetIsa(isa);
+			SimdKernels::PairDelta(g, lambda, vec0, vec1, delta_neu1e, delta1, len);
+			float dp = SimdKernels::DotProduct(vec0, vec1, len);
+			SimdKernels::UpdatePair(g, lambda, vec0, vec1, neu1e, len);
+			SimdKernels::AxpyDecay(1.0f, neu1e, lambda, vec1, len);
+
+			max_err = std::max(max_err, fabsf(dp - ref_dp) / std::max(1.0f, fabsf(ref_dp)));
+			for (int i = 0; i < len; ++i)
+			{
+				max_err = std::max(max_err, fabsf(vec1[i] - ref_vec1[i]) / std::max(1.0f, fabsf(ref_vec1[i])));
+				max_err = std::max(max_err, fabsf(neu1e[i] - ref_neu1e[i]) / std::max(1.0f, fabsf(ref_neu1e[i])));
+				max_err = std::max(max_err, fabsf(delta1[i] - ref_delta1[i]) / std::max(1.0f, fabsf(ref_delta1[i])));
+				max_err = std::max(max_err, fabsf(delta_neu1e[i] - ref_delta_neu1e[i])
+					/ std::max(1.0f, fabsf(ref_delta_neu1e[i])));
+			}
+		}
+
+		// the blocked kernels, with row counts that leave partial tiles
+		const int num_rows = 7;
+		float *rows0[num_rows], *rows1[num_rows], *dst_rows[num_rows], *ref_dst_rows[num_rows];
+		float coefs[num_rows * num_rows], dots[num_rows * num_rows], ref_dots[num_rows * num_rows];
+		for (int i = 0; i < num_rows; ++i)
+		{
+			rows0[i] = new float[max_len];
+			rows1[i] = new float[max_len];
+			dst_rows[i] = new float[max_len];
+			ref_dst_rows[i] = new float[max_len];
+			for (int j = 0; j < max_len; ++j)
+			{
+				rows0[i][j] = dist(generator);
+				rows1[i][j] = dist(generator);
+				ref_dst_rows[i][j] = dst_rows[i][j] = dist(generator);
+			}
+			for (int j = 0; j < num_rows; ++j)
+				coefs[i * num_rows + j] = dist(generator);
+		}
+		for (int len = 1; len <= max_len; len += 13)
+		{
+			for (int m = 1; m <= num_rows; m += 3)
+			{
+				int n = num_rows + 1 - m;
+				SimdKernels::SetIsa(SimdKernels::kScalar);
+				SimdKernels::DotBlock(rows0, m, rows1, n, len, ref_dots);
+				SimdKernels::AccumBlock(coefs, m, rows1, n, len, ref_dst_rows);
+				SimdKernels::SetIsa(isa);
+				SimdKernels::DotBlock(rows0, m, rows1, n, len, dots);
+				SimdKernels::AccumBlock(coefs, m, rows1, n, len, dst_rows);
+
+				for (int i = 0; i < m * n; ++i)
+					max_err = std::max(max_err, fabsf(dots[i] - ref_dots[i]) / std::max(1.0f, fabsf(ref_dots[i])));
+				for (int i = 0; i < m; ++i)
+					for (int j = 0; j < len; ++j)
+						max_err = std::max(max_err, fabsf(dst_rows[i][j] - ref_dst_rows[i][j])
+							/ std::max(1.0f, fabsf(ref_dst_rows[i][j])));
+			}
+		}
+		// DotPacked with a stride that takes both the 64 and the 16 wide paths
+		const int packed_stride = 80;
+		float *packed = new float[max_len * packed_stride];
+		float *packed_dots = new float[num_rows * packed_stride], *ref_packed_dots = new float[num_rows * packed_stride];
+		for (int i = 0; i < max_len * packed_stride; ++i)
+			packed[i] = dist(generator);
+		for (int len = 1; len <= max_len; len += 13)
+		{
+			for (int m = 1; m <= num_rows; m += 3)
+			{
+				SimdKernels::SetIsa(SimdKernels::kScalar);
+				SimdKernels::DotPacked(rows0, m, packed, packed_stride, len, ref_packed_dots);
+				SimdKernels::SetIsa(isa);
+				SimdKernels::DotPacked(rows0, m, packed, packed_stride, len, packed_dots);
+				for (int i = 0; i < m * packed_stride; ++i)
+					max_err = std::max(max_err, fabsf(packed_dots[i] - ref_packed_dots[i])
+						/ std::max(1.0f, fabsf(ref_packed_dots[i])));
+			}
+		}
+		delete[] packed;
+		delete[] packed_dots;
+		delete[] ref_packed_dots;
+
+		// the sigmoid against MathUtils::Sigma, out into the range where it
+		// saturates and over lengths that leave partial vectors
+		float sigmoid_err = 0;
+		for (int len = 1; len <= max_len; len += 11)
+		{
+			for (int i = 0; i < len; ++i)
+				vec0[i] = dist(generator) * (i % 2 == 0 ? 10.0f : 100.0f);
+			SimdKernels::Sigmoid(vec0, vec1, len);
+			for (int i = 0; i < len; ++i)
+				sigmoid_err = std::max(sigmoid_err, fabsf(vec1[i] - MathUtils::Sigma(vec0[i])));
+		}
+
+		for (int i = 0; i < num_rows; ++i)
+		{
+			delete[] rows0[i];
+			delete[] rows1[i];
+			delete[] dst_rows[i];
+			delete[] ref_dst_rows[i];
+		}
+
+		// the 16-bit conversions have to match the scalar ones bit for bit,
+		// including fp16 subnormals
+		int num_mismatches = 0;
+		unsigned short half[max_len], ref_half[max_len];
+		float decoded[max_len], ref_decoded[max_len];
+		for (int len = 1; len <= max_len; len += 7)
+		{
+			for (int i = 0; i < len; ++i)
+				vec0[i] = dist(generator) * (i % 3 == 0 ? 1e-6f : 1.0f);
+			unsigned int seed = (unsigned int)generator();
+			for (int fp16 = 0; fp16 < 2; ++fp16)
+			{
+				void (*to_half[2])(const float*, unsigned short*, int, unsigned int);
+				void (*from_half[2])(const unsigned short*, float*, int);
+				SimdKernels::SetIsa(SimdKernels::kScalar);
+				to_half[0] = fp16 ? SimdKernels::FloatToFp16 : SimdKernels::FloatToBf16;
+				from_half[0] = fp16 ? SimdKernels::Fp16ToFloat : SimdKernels::Bf16ToFloat;
+				SimdKernels::SetIsa(isa);
+				to_half[1] = fp16 ? SimdKernels::FloatToFp16 : SimdKernels::FloatToBf16;
+				from_half[1] = fp16 ? SimdKernels::Fp16ToFloat : SimdKernels::Bf16ToFloat;
+
+				to_half[0](vec0, ref_half, len, seed);
+				to_half[1](vec0, half, len, seed);
+				from_half[0](ref_half, ref_decoded, len);
+				from_half[1](ref_half, decoded, len);
+				for (int i = 0; i < len; ++i)
+					num_mismatches += half[i] != ref_half[i] || decoded[i] != ref_decoded[i];
+			}
+		}
+
+		// so does the int8 dot product, which is exact
+		signed char qvec0[max_len], qvec1[max_len];
+		for (int len = 1; len <= max_len; ++len)
+		{
+			for (int i = 0; i < len; ++i)
+			{
+				qvec0[i] = (signed char)(generator() % 255 - 127);
+				qvec1[i] = (signed char)(generator() % 255 - 127);
+			}
+			SimdKernels::SetIsa(SimdKernels::kScalar);
+			int ref_dot = SimdKernels::DotInt8(qvec0, qvec1, len);
+			SimdKernels::SetIsa(isa);
+			num_mismatches += SimdKernels::DotInt8(qvec0, qvec1, len) != ref_dot;
+		}
+
+		// and the generator, whose streams must not depend on the instruction set
+		for (int seed = 1; seed <= 4; ++seed)
+		{
+			unsigned int words[max_len], ref_words[max_len];
+			SimdKernels::SetIsa(SimdKernels::kScalar);
+			FastRng ref_rng(seed);
+			ref_rng.Fill(ref_words, max_len);
+			SimdKernels::SetIsa(isa);
+			FastRng rng(seed);
+			rng.Fill(words, max_len);
+			for (int i = 0; i < max_len; ++i)
+				num_mismatches += words[i] != ref_words[i];
+		}
+
+		bool isa_ok = max_err < kTolerance && sigmoid_err < kSigmoidTolerance && num_mismatches == 0;
+		printf("%s%s: max error %g, sigmoid error %g, %d 16-bit/int8/rng mismatches, %s\n", SimdKernels::GetIsaName(isa),
+			isa == SimdKernels::kAvx512 && SimdKernels::VnniSupported() ? " vnni" : "", max_err, sigmoid_err,
+			num_mismatches, isa_ok ? "ok" : "FAILED");
+		ok = ok && isa_ok;
+	}
+	SimdKernels::SetIsa(def_isa);
+
+	// stochastic rounding is unbiased: the mean of many roundings of a value
+	// approaches it, measured in units of the gap between its neighbours
+	const int num_trials = 100000;
+	float vals[] = { 0.0123456f, -0.3141593f, 0.7777777f, 1e-3f };
+	for (int fp16 = 0; fp16 < 2; ++fp16)
+	{
+		double max_bias = 0;
+		for (float val : vals)
+		{
+			float lo_val = 0, hi_val = 0;
+			double sum = 0;
+			for (int t = 0; t < num_trials; ++t)
+			{
+				unsigned short h;
+				float decoded;
+				if (fp16)
+				{
+					SimdKernels::FloatToFp16(&val, &h, 1, t * 7919u);
+					SimdKernels::Fp16ToFloat(&h, &decoded, 1);
+				}
+				else
+				{
+					SimdKernels::FloatToBf16(&val, &h, 1, t * 7919u);
+					SimdKernels::Bf16ToFloat(&h, &decoded, 1);
+				}
+				lo_val = t == 0 ? decoded : std::min(lo_val, decoded);
+				hi_val = t == 0 ? decoded : std::max(hi_val, decoded);
+				sum += decoded;
+			}
+			double gap = std::max((double)hi_val - lo_val, 1e-30);
+			max_bias = std::max(max_bias, fabs(sum / num_trials - val) / gap);
+		}
+		printf("%s stochastic rounding: max bias %.4f of a gap, %s\n", fp16 ? "fp16" : "bf16", max_bias,
+			max_bias < kBiasTolerance ? "ok" : "FAILED");
+		ok = ok && max_bias < kBiasTolerance;
+	}
+	return ok;
+}
+
+// Cosine accuracy and full scan speed of int8 vectors against fp32 ones,
+// for the vectors in vecs_file (SaveVectors format).
+void BenchQuantized(const char *vecs_file)
+{
+	int num_vecs = 0, vec_dim = 0;
+	EmbeddingTable *vecs = 0;
+	IOUtils::LoadVectors(vecs_file, num_vecs, vec_dim, vecs);
+	QuantizedTable *qvecs = QuantizedTable::FromTable(*vecs);
+
+	float *norms = new float[num_vecs];
+	for (int i = 0; i < num_vecs; ++i)
+		norms[i] = sqrtf(SimdKernels::DotProduct(vecs->Row(i), vecs->Row(i), vec_dim));
+
+	// accuracy: cosine error, and how many of the fp32 top 10 the int8 top 10 keeps
+	const int num_queries = 200, k = 10;
+	std::default_random_engine generator(317);
+	double sum_err = 0, max_err = 0;
+	int num_kept = 0;
+	std::vector<std::pair<float, int> > sims(num_vecs), qsims(num_vecs);
+	for (int q = 0; q < num_queries; ++q)
+	{
+		int idx = generator() % num_vecs;
+		for (int i = 0; i < num_vecs; ++i)
+		{
+			float denom = norms[idx] * norms[i];
+			float sim = denom == 0 ? 0 : SimdKernels::DotProduct(vecs->Row(idx), vecs->Row(i), vec_dim) / denom;
+			float qsim = qvecs->Cosine(idx, i);
+			sum_err += fabs(sim - qsim);
+			max_err = std::max(max_err, (double)fabs(sim - qsim));
+			sims[i] = std::make_pair(-sim, i);
+			qsims[i] = std::make_pair(-qsim, i);
+		}
+		std::partial_sort(sims.begin(), sims.begin() + k + 1, sims.end());
+		std::partial_sort(qsims.begin(), qsims.begin() + k + 1, qsims.end());
+		for (int i = 0; i <= k; ++i)
+			for (int j = 0; j <= k; ++j)
+				num_kept += sims[i].second == qsims[j].second && sims[i].second != idx;
+	}
+	printf("%d x %d: mean cosine error %.5f, max %.5f, top%d recall %.4f\n", num_vecs, vec_dim,
+		sum_err / ((double)num_queries * num_vecs), max_err, k, (double)num_kept / (num_queries * k));
+
+	// speed: full scans of cosines against all rows
+	SimdKernels::Isa isas[] = { SimdKernels::kScalar, SimdKernels::kAvx2, SimdKernels::kAvx512 };
+	SimdKernels::Isa def_isa = SimdKernels::GetIsa();
+	for (SimdKernels::Isa isa : isas)
+	{
+		if (!SimdKernels::SetIsa(isa))
+			continue;
+		const int num_scans = 50;
+		float checksum = 0;
+		auto beg = std::chrono::steady_clock::now();
+		for (int q = 0; q < num_scans; ++q)
+			for (int i = 0; i < num_vecs; ++i)
+				checksum += SimdKernels::DotProduct(vecs->Row(q), vecs->Row(i), vec_dim) / (norms[q] * norms[i] + 1e-12f);
+		double fp32_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+		beg = std::chrono::steady_clock::now();
+		for (int q = 0; q < num_scans; ++q)
+			for (int i = 0; i < num_vecs; ++i)
+				checksum += qvecs->Cosine(q, i);
+		double int8_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+		printf("%s%s: fp32 %.1f M cosines/s, int8 %.1f M cosines/s (%g)\n", SimdKernels::GetIsaName(isa),
+			isa == SimdKernels::kAvx512 && SimdKernels::VnniSupported() ? " vnni" : "",
+			num_scans * (double)num_vecs / fp32_secs / 1e6, num_scans * (double)num_vecs / int8_secs / 1e6, checksum);
+	}
+	SimdKernels::SetIsa(def_isa);
+
+	delete[] norms;
+	delete vecs;
+	delete qvecs;
+}
+
+// emadr -compare <pairs|negs|rng|metrics|quantized <vecs file>>
+// the old implementation of a sampler, generator or similarity scan against
+// the one that replaced it
+bool RunComparison(int argc, char **argv)
+{
+	const char *name = GetArgValue(argc, argv, "-compare");
+	if (strcmp(name, "pairs") == 0)
+		BenchPairSampler();
+	else if (strcmp(name, "negs") == 0)
+		BenchNegSampling();
+	else if (strcmp(name, "rng") == 0)
+		BenchFastRng();
+	else if (strcmp(name, "metrics") == 0)
+		BenchTrainMetrics();
+	else if (strcmp(name, "quantized") == 0 && GetArgValue(argc, argv, name) != 0)
+		BenchQuantized(GetArgValue(argc, argv, name));
+	else
+	{
+		printf("usage: -compare <pairs|negs|rng|metrics|quantized <vecs file>>\n");
+		return false;
+	}
+	return true;
+}
+
+// Binary adjacency list of num_left rows of exactly degree right vertices,
+// skewed towards the low ids, with weights in [1, max_weight].
+void WriteBenchAdjList(const char *dst_file, int num_left, int num_right, int degree, int max_weight,
+	unsigned int seed)
+{
+	std::default_random_engine generator(seed);
+	std::uniform_real_distribution<double> real_dist(0, 1);
+	std::uniform_int_distribution<int> weight_dist(1, max_weight);
+	int *adj = new int[degree];
+	unsigned short *weights = new unsigned short[degree];
+
+	FILE *fp = fopen(dst_file, "wb");
+	assert(fp != 0);
+	fwrite(&num_left, sizeof(int), 1, fp);
+	fwrite(&num_right, sizeof(int), 1, fp);
+	for (int i = 0; i < num_left; ++i)
+	{
+		for (int j = 0; j < degree; ++j)
+		{
+			adj[j] = std::min(num_right - 1, (int)(num_right * pow(real_dist(generator), 2)));
+			weights[j] = (unsigned short)weight_dist(generator);
+		}
+		fwrite(&degree, sizeof(int), 1, fp);
+		fwrite(adj, sizeof(int), degree, fp);
+		fwrite(weights, sizeof(unsigned short), degree, fp);
+	}
+	fclose(fp);
+	delete[] adj;
+	delete[] weights;
+}
+
+// A TrainPair-like kernel: fn(obj0, obj1, rng) timed on random pairs of
+// 10000 objs0 and 100000 objs1.
+void BenchTrainKernel(Benchmark &bench, const char *name,
+	const std::function<void(int, int, FastRng &)> &fn, AliasSampler *obj1_sampler = 0)
+{
+	bench.Run(name, [&](Benchmark::State &state)
+	{
+		FastRng rng(317);
+		state.StartTiming();
+		for (long long i = 0; i < state.num_iters; ++i)
+		{
+			int obj0 = rng.NextUInt() % 10000;
+			fn(obj0, obj1_sampler != 0 ? obj1_sampler->Sample(rng) : rng.NextUInt() % 100000, rng);
+		}
+		state.StopTiming();
+		state.num_items = state.num_iters;
+	});
+}
+
+// The benchmark suite: samplers, training kernels, vector IO and end to end
+// allJoint throughput, saved as JSON to the file given with -bench. -benchfilter
+// picks the cases whose name contains it, -benchsecs is the minimum time of a
+// case, -t the largest thread count of allJoint, and temporary files go to
+// -benchdir.
+void RunBenchmarks(int argc, char **argv)
+{
+	const char *dst_file = GetArgValue(argc, argv, "-bench");
+	const char *tmp_dir = GetArgValue(argc, argv, "-benchdir");
+	if (tmp_dir == 0)
+		tmp_dir = ".";
+	int max_threads = GetIntArgValue(argc, argv, "-t", std::max(1, (int)std::thread::hardware_concurrency()));
+
+	Benchmark bench(GetFloatArgValue(argc, argv, "-benchsecs", 0.5f));
+	bench.SetFilter(GetArgValue(argc, argv, "-benchfilter"));
+	char name[256];
+	std::string tmp_file = std::string(tmp_dir) + "/bench_tmp.bin";
+
+	// samplers, with degree weights in [1, 20]
+	const int degrees[] = { 4, 64, 1024 };
+	for (int degree : degrees)
+	{
+		std::vector<int> weights(degree);
+		std::default_random_engine generator(317);
+		for (int &weight : weights)
+			weight = 1 + generator() % 20;
+		MultinomialSampler sampler;
+		sampler.Init(weights.data(), degree);
+		sprintf(name, "MultinomialSampler::Sample/%d", degree);
+		bench.Run(name, [&](Benchmark::State &state)
+		{
+			FastRng rng(317);
+			long long sum = 0;
+			state.StartTiming();
+			for (long long i = 0; i < state.num_iters; ++i)
+				sum += sampler.Sample(rng);
+			state.StopTiming();
+			state.num_items = state.num_iters;
+			state.checksum = (double)sum;
+		});
+	}
+	// i.i.d. draws against the epoch walk of EdgeStream
+	for (int degree : degrees)
+	{
+		char epoch_name[256];
+		sprintf(name, "PairSampler::SamplePair/%d", degree);
+		sprintf(epoch_name, "PairSampler::EdgeStream/epochs/%d", degree);
+		if (!bench.Enabled(name) && !bench.Enabled(epoch_name))
+			continue;
+		// 4M edges at every degree
+		WriteBenchAdjList(tmp_file.c_str(), (1 << 22) / degree, 100000, degree, 20, 317);
+		PairSampler pair_sampler(tmp_file.c_str());
+		pair_sampler.InitEpochBlocks();
+		for (bool epochs : { false, true })
+		{
+			bench.Run(epochs ? epoch_name : name, [&](Benchmark::State &state)
+			{
+				FastRng rng(317);
+				PairSampler::EdgeStream pairs(&pair_sampler, epochs);
+				long long sum = 0;
+				state.StartTiming();
+				for (long long i = 0; i < state.num_iters; ++i)
+				{
+					int lidx = 0, ridx = 0;
+					pairs.Next(lidx, ridx, rng);
+					sum += ridx;
+				}
+				state.StopTiming();
+				state.num_items = state.num_iters;
+				state.checksum = (double)sum;
+			});
+		}
+		remove(tmp_file.c_str());
+	}
+
+	// training kernels: 10 negatives from a Zipfian vocabulary of 100000
+	ExpTable exp_table;
+	const int num_objs1 = 100000;
+	std::vector<int> cnts(num_objs1);
+	for (int i = 0; i < num_objs1; ++i)
+		cnts[i] = 1 + 1000000 / (i + 1);
+	AliasSampler *neg_table = NegSamplingBase::GetNegSamplingTable(cnts.data(), num_objs1);
+	NegTrain trainer(&exp_table, 10, neg_table);
+	const float alpha = 0.01f;
+	const int dims[] = { 50, 100, 200, 300 };
+	for (int dim : dims)
+	{
+		sprintf(name, "NegTrain::TrainPair/%d", dim);
+		if (bench.Enabled(name))
+		{
+			EmbeddingTable *vecs0 = NegTrain::GetInitedVecs0(10000, dim);
+			EmbeddingTable *vecs1 = NegTrain::GetInitedVecs0(num_objs1, dim);
+			std::vector<float> tmp_neu1e(dim);
+			BenchTrainKernel(bench, name, [&](int obj0, int obj1, FastRng &rng)
+			{
+				trainer.TrainPair(dim, *vecs0, obj0, obj1, *vecs1, alpha, tmp_neu1e.data(), rng, 1);
+			});
+			delete vecs0;
+			delete vecs1;
+		}
+
+		// the CM and matrix energies, on dim-dimensional objs1
+		sprintf(name, "NegTrain::TrainPairCM/%d", dim);
+		if (bench.Enabled(name))
+		{
+			EmbeddingTable *vecs0 = NegTrain::GetInitedVecs0(10000, 2 * dim);
+			EmbeddingTable *vecs1 = NegTrain::GetInitedVecs0(num_objs1, dim);
+			float *cm_params = NegTrain::GetInitedCMParams(dim);
+			std::vector<float> tmp_neu1e(2 * dim), tmp_cme(dim);
+			BenchTrainKernel(bench, name, [&](int obj0, int obj1, FastRng &rng)
+			{
+				trainer.TrainPairCM(dim, vecs0->Row(obj0), obj1, *vecs1, cm_params, false, alpha,
+					tmp_neu1e.data(), tmp_cme.data(), rng);
+			});
+			delete[] cm_params;
+			delete vecs0;
+			delete vecs1;
+		}
+
+		sprintf(name, "NegTrain::TrainPairMatrix/%d", dim);
+		if (bench.Enabled(name))
+		{
+			EmbeddingTable *vecs0 = NegTrain::GetInitedVecs0(10000, dim);
+			EmbeddingTable *vecs1 = NegTrain::GetInitedVecs0(num_objs1, dim);
+			float *matrix = new float[dim * dim];
+			NegTrain::InitMatrix(matrix, dim, dim);
+			std::vector<float> tmp_neu1e(dim);
+			BenchTrainKernel(bench, name, [&](int obj0, int obj1, FastRng &rng)
+			{
+				trainer.TrainPairMatrix(dim, dim, vecs0->Row(obj0), obj1, *vecs1, matrix, alpha,
+					tmp_neu1e.data(), rng);
+			});
+			delete[] matrix;
+			delete vecs0;
+			delete vecs1;
+		}
+	}
+	delete neg_table;
+
+	// hierarchical softmax against more negatives, with obj1 drawn by its
+	// count as in real pairs, since the paths of frequent objects are shorter
+	if (bench.Enabled("NegTrain::TrainPair/hs/") || bench.Enabled("NegTrain::TrainPair/neg"))
+	{
+		AliasSampler obj1_sampler;
+		{
+			std::vector<float> obj1_weights(cnts.begin(), cnts.end());
+			obj1_sampler.Init(obj1_weights.data(), num_objs1);
+		}
+		HuffmanTree tree(cnts.data(), num_objs1);
+		NegTrain hs_trainer(&exp_table, &tree);
+		for (int dim : dims)
+		{
+			sprintf(name, "NegTrain::TrainPair/hs/%d", dim);
+			if (!bench.Enabled(name))
+				continue;
+			EmbeddingTable *vecs0 = NegTrain::GetInitedVecs0(10000, dim);
+			EmbeddingTable *inner_vecs = NegTrain::GetInitedVecs1(tree.num_inner(), dim);
+			std::vector<float> tmp_neu1e(dim);
+			BenchTrainKernel(bench, name, [&](int obj0, int obj1, FastRng &rng)
+			{
+				hs_trainer.TrainPair(dim, *vecs0, obj0, obj1, *inner_vecs, alpha, tmp_neu1e.data(), rng, 1);
+			}, &obj1_sampler);
+			delete vecs0;
+			delete inner_vecs;
+		}
+
+		AliasSampler *wide_neg_table = NegSamplingBase::GetNegSamplingTable(cnts.data(), num_objs1);
+		for (int num_negs : { 10, 25, 50 })
+		{
+			const int dim = 100;
+			sprintf(name, "NegTrain::TrainPair/neg%d/%d", num_negs, dim);
+			if (!bench.Enabled(name))
+				continue;
+			NegTrain neg_trainer(&exp_table, num_negs, wide_neg_table);
+			EmbeddingTable *vecs0 = NegTrain::GetInitedVecs0(10000, dim);
+			EmbeddingTable *vecs1 = NegTrain::GetInitedVecs0(num_objs1, dim);
+			std::vector<float> tmp_neu1e(dim);
+			BenchTrainKernel(bench, name, [&](int obj0, int obj1, FastRng &rng)
+			{
+				neg_trainer.TrainPair(dim, *vecs0, obj0, obj1, *vecs1, alpha, tmp_neu1e.data(), rng, 1);
+			}, &obj1_sampler);
+			delete vecs0;
+			delete vecs1;
+		}
+		delete wide_neg_table;
+		printf("tree of %d: mean path %.1f, max path %d\n", num_objs1, tree.MeanPathLen(), tree.max_path_len());
+	}
+
+	std::vector<float> xs(4096);
+	std::default_random_engine generator(317);
+	std::uniform_real_distribution<float> x_dist(-8, 8);
+	for (float &x : xs)
+		x = x_dist(generator);
+	bench.Run("ExpTable::getSigmaValue", [&](Benchmark::State &state)
+	{
+		float sum = 0;
+		state.StartTiming();
+		for (long long i = 0; i < state.num_iters; ++i)
+			sum += exp_table.getSigmaValue(xs[i & 4095]);
+		state.StopTiming();
+		state.num_items = state.num_iters;
+		state.checksum = sum;
+	});
+	// the targets of a pair with 10 negatives, and a whole TrainBatch block
+	for (int len : { 11, 4096 })
+	{
+		sprintf(name, "SimdKernels::Sigmoid/%d", len);
+		std::vector<float> sigmas(len);
+		bench.Run(name, [&](Benchmark::State &state)
+		{
+			float sum = 0;
+			state.StartTiming();
+			for (long long i = 0; i < state.num_iters; ++i)
+			{
+				SimdKernels::Sigmoid(xs.data() + (len < 4096 ? (i * 16) & 4080 : 0), sigmas.data(), len);
+				sum += sigmas[0];
+			}
+			state.StopTiming();
+			state.num_items = state.num_iters * len;
+			state.checksum = sum;
+		});
+	}
+
+	// vector files of 200000 x 100
+	if (bench.Enabled("IOUtils::SaveVectors") || bench.Enabled("IOUtils::LoadVectors"))
+	{
+		EmbeddingTable *vecs = NegTrain::GetInitedVecs0(200000, 100);
+		bench.Run("IOUtils::SaveVectors", [&](Benchmark::State &state)
+		{
+			state.StartTiming();
+			for (long long i = 0; i < state.num_iters; ++i)
+				IOUtils::SaveVectors(vecs, tmp_file.c_str());
+			state.StopTiming();
+			state.num_bytes = state.num_iters * vecs->num_rows() * vecs->dim() * (long long)sizeof(float);
+		});
+		IOUtils::SaveVectors(vecs, tmp_file.c_str());
+		bench.Run("IOUtils::LoadVectors", [&](Benchmark::State &state)
+		{
+			state.StartTiming();
+			for (long long i = 0; i < state.num_iters; ++i)
+			{
+				int num_vecs = 0, vec_dim = 0;
+				EmbeddingTable *loaded = 0;
+				IOUtils::LoadVectors(tmp_file.c_str(), num_vecs, vec_dim, loaded);
+				state.checksum += loaded->Row(num_vecs - 1)[vec_dim - 1];
+				delete loaded;
+			}
+			state.StopTiming();
+			state.num_bytes = state.num_iters * vecs->num_rows() * vecs->dim() * (long long)sizeof(float);
+		});
+		remove(tmp_file.c_str());
+		delete vecs;
+	}
+
+	// allJoint on a GraphGenerator corpus of 20000 docs, 50000 words and
+	// 5000 entities, one round per run at 1, 2, 4, ... max_threads threads,
+	// with i.i.d. samples and with epochs. An
+	// item is a sample, and real_time the time per sample of the slowest
+	// training thread.
+	if (bench.Enabled("EADocVecTrainer::allJoint"))
+	{
+		std::string ee_file = std::string(tmp_dir) + "/bench_ee.bin", de_file = std::string(tmp_dir) + "/bench_de.bin",
+			dw_file = std::string(tmp_dir) + "/bench_dw.bin", entity_cnts_file = std::string(tmp_dir) + "/bench_ecnt.bin",
+			word_cnts_file = std::string(tmp_dir) + "/bench_wcnt.bin";
+		GraphGenerator::Relation dw, de, ee;
+		dw.num_left = de.num_left = 20000;
+		dw.num_right = 50000;
+		de.num_right = ee.num_left = ee.num_right = 5000;
+		GraphGenerator::ParseSpec("20:1000:1.5:1", dw);
+		GraphGenerator::ParseSpec("1:50:2:1", de);
+		GraphGenerator::ParseSpec("1:100:2:1", ee);
+		GraphGenerator generator(max_threads, 317);
+		generator.Generate(dw, dw_file.c_str(), word_cnts_file.c_str());
+		generator.Generate(de, de_file.c_str(), entity_cnts_file.c_str());
+		generator.Generate(ee, ee_file.c_str());
+
+		for (int num_threads = 1; num_threads <= max_threads;
+			num_threads = num_threads == max_threads ? num_threads + 1 : std::min(2 * num_threads, max_threads))
+		{
+			for (bool epochs : { false, true })
+			{
+				sprintf(name, "EADocVecTrainer::allJoint%s/threads:%d", epochs ? "/epochs" : "", num_threads);
+				bench.Run(name, [&](Benchmark::State &state)
+				{
+					EADocVecTrainer trainer(1, num_threads, 10, 0.06f);
+					trainer.SetEpochs(epochs);
+					trainer.AllJointThreaded(ee_file.c_str(), de_file.c_str(), dw_file.c_str(),
+						entity_cnts_file.c_str(), word_cnts_file.c_str(), 100, true, 1, 1, 1, tmp_file.c_str(),
+						tmp_file.c_str(), tmp_file.c_str());
+					state.secs = 1.0 / trainer.samples_per_sec();
+					state.num_items = 1;
+				}, 1);
+			}
+		}
+
+		// fold-in of the docs with fixed word vectors, pair by pair and in
+		// doc-major groups of 16 words
+		std::string word_vecs_file = std::string(tmp_dir) + "/bench_wvecs.bin";
+		EmbeddingTable *word_vecs = NegTrain::GetInitedVecs0(dw.num_right, 100);
+		IOUtils::SaveVectors(word_vecs, word_vecs_file.c_str());
+		delete word_vecs;
+		for (int words_per_doc : { 0, 16 })
+		{
+			sprintf(name, "EADocVecTrainer::TrainDocWordFixedWordVecs%s/threads:%d",
+				words_per_doc > 0 ? "/docmajor:16" : "", max_threads);
+			bench.Run(name, [&](Benchmark::State &state)
+			{
+				EADocVecTrainer trainer(1, max_threads, 10, 0.06f);
+				trainer.SetDocMajor(words_per_doc);
+				trainer.TrainDocWordFixedWordVecs(dw_file.c_str(), word_cnts_file.c_str(), word_vecs_file.c_str(),
+					100, tmp_file.c_str());
+				state.secs = 1.0 / trainer.samples_per_sec();
+				state.num_items = 1;
+			}, 1);
+		}
+		remove(word_vecs_file.c_str());
+
+		const std::string *files[] = { &ee_file, &de_file, &dw_file, &entity_cnts_file, &word_cnts_file, &tmp_file };
+		for (const std::string *file : files)
+			remove(file->c_str());
+	}
+
+	if (dst_file != 0 && bench.SaveJson(dst_file))
+		printf("results saved to %s\n", dst_file);
+}
+
 int main(int argc, char **argv)
 {
 	time_t t = time(0);
@@ -277,10 +1607,30 @@ int main(int argc, char **argv)
 	//TrainDocWordVectors();
 	//EATrainDWEFixed();
 	//EATrainDW(argc, argv);
-	EATrain(argc, argv);
+	int ret = 0;
+	if (HasArg(argc, argv, "-check"))
+		ret = CheckSimdKernels() ? 0 : 1;
+	else if (GetArgValue(argc, argv, "-compare"))
+		ret = RunComparison(argc, argv) ? 0 : 1;
+	else if (GetArgValue(argc, argv, "-gen"))
+		GenerateGraph(argc, argv);
+	else if (GetArgValue(argc, argv, "-bench"))
+		RunBenchmarks(argc, argv);
+	else if (GetArgValue(argc, argv, "-tocsr"))
+		ret = ConvertToCSR(argc, argv) ? 0 : 1;
+	else if (GetArgValue(argc, argv, "-knn"))
+		FindNeighbors(argc, argv);
+	else if (GetArgValue(argc, argv, "-hnsw"))
+		BuildHnswIndex(argc, argv);
+	else if (GetArgValue(argc, argv, "-quantize"))
+		QuantizeVectors(argc, argv);
+	else if (GetArgValue(argc, argv, "-infer"))
+		InferDocs(argc, argv);
+	else
+		ret = EATrain(argc, argv) ? 0 : 1;
 
 	time_t et = time(0) - t;
 	printf("\n%lld s. %lld m. %lld h.\n", et, et / 60, et / 3600);
 
-	return 0;
+	return ret;
 }
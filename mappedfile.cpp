@@ -0,0 +1,96 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(const char *file_name)
+{
+	Close();
+
+	HANDLE file_handle = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, 0);
+	if (file_handle == INVALID_HANDLE_VALUE)
+		return false;
+	file_handle_ = file_handle;
+
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file_handle, &file_size);
+	size_ = file_size.QuadPart;
+
+	mapping_handle_ = CreateFileMappingA(file_handle, 0, PAGE_READONLY, 0, 0, 0);
+	if (mapping_handle_ == 0)
+	{
+		Close();
+		return false;
+	}
+	data_ = (const char*)MapViewOfFile(mapping_handle_, FILE_MAP_READ, 0, 0, 0);
+	if (data_ == 0)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data_ != 0)
+		UnmapViewOfFile(data_);
+	if (mapping_handle_ != 0)
+		CloseHandle(mapping_handle_);
+	if (file_handle_ != 0)
+		CloseHandle(file_handle_);
+	data_ = 0;
+	mapping_handle_ = file_handle_ = 0;
+	size_ = 0;
+}
+#else
+bool MappedFile::Open(const char *file_name)
+{
+	Close();
+
+	fd_ = open(file_name, O_RDONLY);
+	if (fd_ < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd_, &st) != 0)
+	{
+		Close();
+		return false;
+	}
+	size_ = st.st_size;
+
+	void *addr = mmap(0, size_, PROT_READ, MAP_SHARED, fd_, 0);
+	if (addr == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+	data_ = (const char*)addr;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data_ != 0)
+		munmap((void*)data_, size_);
+	if (fd_ > -1)
+		close(fd_);
+	data_ = 0;
+	fd_ = -1;
+	size_ = 0;
+}
+#endif
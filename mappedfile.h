@@ -0,0 +1,40 @@
+#ifndef MAPPEDFILE_H_
+#define MAPPEDFILE_H_
+
+// A whole file mapped read-only into memory.
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile();
+
+	bool Open(const char *file_name);
+	void Close();
+
+	const char *data()
+	{
+		return data_;
+	}
+
+	long long size()
+	{
+		return size_;
+	}
+
+private:
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+private:
+	const char *data_ = 0;
+	long long size_ = 0;
+
+#ifdef _WIN32
+	void *file_handle_ = 0;
+	void *mapping_handle_ = 0;
+#else
+	int fd_ = -1;
+#endif
+};
+
+#endif
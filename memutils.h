@@ -1,6 +1,12 @@
 #ifndef MEMUTILS_H_
 #define MEMUTILS_H_
 
+#include <cstdlib>
+#include <cassert>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
 namespace MemUtils
 {
 	template <class T>
@@ -11,6 +17,29 @@ namespace MemUtils
 		delete[] arr;
 		arr = 0;
 	}
+
+	// alignment must be a power of two and a multiple of sizeof(void*)
+	static void *AlignedAlloc(size_t size, size_t alignment)
+	{
+		void *ptr = 0;
+#ifdef _MSC_VER
+		ptr = _aligned_malloc(size, alignment);
+#else
+		if (posix_memalign(&ptr, alignment, size) != 0)
+			ptr = 0;
+#endif
+		assert(ptr != 0 || size == 0);
+		return ptr;
+	}
+
+	static void AlignedFree(void *ptr)
+	{
+#ifdef _MSC_VER
+		_aligned_free(ptr);
+#else
+		free(ptr);
+#endif
+	}
 }
 
 #endif
@@ -49,30 +49,27 @@ int MultinomialSampler::Sample(std::default_random_engine &generator)
 {
 	if (intervals_ == 0)
 		return -1;
-
-	unsigned int val = uint_dist(generator);
-	int l = 0, r = num_vals - 1, m;
-	while (l <= r)
-	{
-		m = (l + r) >> 1;
-		if (intervals_[m] > val)
-			r = m - 1;
-		else
-			l = m + 1;
-	}
-
-	if (l >= num_vals)
-		l = num_vals - 1;
-	return l;
+	return search(uint_dist(generator));
 }
 
 int MultinomialSampler::Sample(RandGen &rand_gen)
 {
 	if (intervals_ == 0)
 		return -1;
+	// [0, kDefMaxVal) by a multiply and shift; NextRandom() % kDefMaxVal
+	// favoured the values below 2^64 mod kDefMaxVal
+	return search((unsigned int)(((unsigned long long)rand_gen.NextUInt() * kDefMaxVal) >> 32));
+}
+
+int MultinomialSampler::Sample(FastRng &rng)
+{
+	if (intervals_ == 0)
+		return -1;
+	return search((unsigned int)(((unsigned long long)rng.NextUInt() * kDefMaxVal) >> 32));
+}
 
-	//unsigned int val = uint_dist(generator);
-	unsigned int val = rand_gen.NextRandom() % kDefMaxVal;
+int MultinomialSampler::search(unsigned int val)
+{
 	int l = 0, r = num_vals - 1, m;
 	while (l <= r)
 	{
@@ -4,6 +4,7 @@
 #include <random>
 
 #include "randgen.h"
+#include "fastrng.h"
 
 class MultinomialSampler
 {
@@ -19,6 +20,11 @@ public:
 
 	int Sample(std::default_random_engine &generator);
 	int Sample(RandGen &rand_gen);
+	int Sample(FastRng &rng);
+
+private:
+	// the first value whose interval ends above val
+	int search(unsigned int val);
 
 private:
 	unsigned int *intervals_ = 0;
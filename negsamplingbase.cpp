@@ -2,15 +2,34 @@
 
 #include <cassert>
 
-float **NegSamplingBase::GetInitedVecs0(int num_objs, int vec_dim)
+EmbeddingTable *NegSamplingBase::GetInitedVecs0(int num_objs, int vec_dim, EmbeddingTable::Precision precision,
+	unsigned int seed)
 {
-	float **vecs = new float*[num_objs];
+	EmbeddingTable *vecs = new EmbeddingTable(num_objs, vec_dim, precision);
+	vecs->Fill(0.0f);
+	std::default_random_engine generator(seed);
+	if (vecs->is_fp32())
+	{
+		for (int i = 0; i < num_objs; ++i)
+		{
+			if (seed == 0)
+				InitVec0Def(vecs->Row(i), vec_dim);
+			else
+				InitVec0Def(vecs->Row(i), vec_dim, generator);
+		}
+		return vecs;
+	}
+
+	float *vec = new float[vec_dim];
 	for (int i = 0; i < num_objs; ++i)
 	{
-		vecs[i] = new float[vec_dim];
-		for (int j = 0; j < vec_dim; ++j)
-			vecs[i][j] = ((float)rand() / RAND_MAX - 0.5f) / vec_dim;
+		if (seed == 0)
+			InitVec0Def(vec, vec_dim);
+		else
+			InitVec0Def(vec, vec_dim, generator);
+		vecs->StoreRow(i, vec, i);
 	}
+	delete[] vec;
 	return vecs;
 }
 
@@ -20,14 +39,17 @@ void NegSamplingBase::InitVec0Def(float *vecs, int vec_dim)
 		vecs[i] = ((float)rand() / RAND_MAX - 0.5f) / vec_dim;
 }
 
-float **NegSamplingBase::GetInitedVecs1(int num_objs, int vec_dim)
+void NegSamplingBase::InitVec0Def(float *vecs, int vec_dim, std::default_random_engine &generator)
 {
-	float **vecs = new float*[num_objs];
-	for (int i = 0; i < num_objs; ++i)
-	{
-		vecs[i] = new float[vec_dim];
-		std::fill(vecs[i], vecs[i] + vec_dim, 0.0f);
-	}
+	std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+	for (int i = 0; i < vec_dim; ++i)
+		vecs[i] = dist(generator) / vec_dim;
+}
+
+EmbeddingTable *NegSamplingBase::GetInitedVecs1(int num_objs, int vec_dim, EmbeddingTable::Precision precision)
+{
+	EmbeddingTable *vecs = new EmbeddingTable(num_objs, vec_dim, precision);
+	vecs->Fill(0.0f);
 	return vecs;
 }
 
@@ -39,24 +61,42 @@ float *NegSamplingBase::GetDefNegativeSamplingWeights(int *obj_cnts, int num_obj
 	return weights;
 }
 
-void NegSamplingBase::loadFreqFile(const char *freq_file, int &num_objs,
-	std::discrete_distribution<int> &negative_sample_dist)
+AliasSampler *NegSamplingBase::GetNegSamplingTable(int *obj_cnts, int num_objs)
+{
+	float *weights = GetDefNegativeSamplingWeights(obj_cnts, num_objs);
+	AliasSampler *sampler = new AliasSampler();
+	sampler->Init(weights, num_objs);
+	delete[] weights;
+	return sampler;
+}
+
+int *NegSamplingBase::LoadCounts(const char *freq_file, int &num_objs)
 {
 	FILE *fp = fopen(freq_file, "rb");
 	assert(fp != 0);
 
+	num_objs = 0;
 	fread(&num_objs, 4, 1, fp);
 	int *cnts = new int[num_objs];
 	fread(cnts, 4, num_objs, fp);
 	fclose(fp);
+	return cnts;
+}
 
-	initNegativeSamplingDist(num_objs, cnts, negative_sample_dist);
+AliasSampler *NegSamplingBase::LoadNegSamplingTable(const char *freq_file)
+{
+	int num_objs = 0;
+	int *cnts = LoadCounts(freq_file, num_objs);
+	AliasSampler *sampler = GetNegSamplingTable(cnts, num_objs);
+	delete[] cnts;
+	return sampler;
 }
 
-void NegSamplingBase::initNegativeSamplingDist(int num_objs, int *obj_cnts, 
-	std::discrete_distribution<int> &negative_sample_dist)
+HuffmanTree *NegSamplingBase::LoadHuffmanTree(const char *freq_file)
 {
-	float *weights = GetDefNegativeSamplingWeights(obj_cnts, num_objs);
-	negative_sample_dist = std::discrete_distribution<int>(weights, weights + num_objs);
-	delete[] weights;
+	int num_objs = 0;
+	int *cnts = LoadCounts(freq_file, num_objs);
+	HuffmanTree *tree = new HuffmanTree(cnts, num_objs);
+	delete[] cnts;
+	return tree;
 }
@@ -2,28 +2,39 @@
 #define NEGSAMPLINGBASE_H_
 
 #include "exptable.h"
+#include "aliassampler.h"
+#include "huffmantree.h"
+#include "embeddingtable.h"
 
 #include <random>
 
 class NegSamplingBase
 {
 public:
-	static float **GetInitedVecs0(int num_objs, int vec_dim);
+	// seed 0 draws the values from rand(), anything else from a generator
+	// seeded with it, which does not depend on what else calls rand()
+	static EmbeddingTable *GetInitedVecs0(int num_objs, int vec_dim,
+		EmbeddingTable::Precision precision = EmbeddingTable::kFloat32, unsigned int seed = 0);
 	static void InitVec0Def(float *vecs, int vec_dim);
-	static float **GetInitedVecs1(int num_objs, int vec_dim);
+	static void InitVec0Def(float *vecs, int vec_dim, std::default_random_engine &generator);
+	static EmbeddingTable *GetInitedVecs1(int num_objs, int vec_dim,
+		EmbeddingTable::Precision precision = EmbeddingTable::kFloat32);
 
 	static float *GetDefNegativeSamplingWeights(int *obj_cnts, int num_objs);
 
+	// unigram^0.75 alias table; built once and shared read-only by the trainers
+	static AliasSampler *GetNegSamplingTable(int *obj_cnts, int num_objs);
+	static AliasSampler *LoadNegSamplingTable(const char *freq_file);
+
+	// the counts of a counts file: the number of objects, then an int each
+	static int *LoadCounts(const char *freq_file, int &num_objs);
+	// the tree of hierarchical softmax over the counts of freq_file
+	static HuffmanTree *LoadHuffmanTree(const char *freq_file);
+
 public:
 	NegSamplingBase(ExpTable *exp_table, int num_negative_samples) 
 		: exp_table_(exp_table), num_negative_samples_(num_negative_samples) {}
 
-protected:
-	void loadFreqFile(const char *freq_file, int &num_objs,
-		std::discrete_distribution<int> &negative_sample_dist);
-	void initNegativeSamplingDist(int num_objs, int *obj_cnts,
-		std::discrete_distribution<int> &negative_sample_dist);
-
 protected:
 	ExpTable *exp_table_;
 	int num_negative_samples_ = 0;
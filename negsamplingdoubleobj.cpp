@@ -1,19 +1,38 @@
 #include "negsamplingdoubleobj.h"
 
+#include <vector>
+
+#include "simdkernels.h"
+
 NegSamplingDoubleObj::NegSamplingDoubleObj(ExpTable *exp_table, int num_negative_samples,
 	const char *freq_file0, const char *freq_file1) : NegSamplingBase(exp_table, num_negative_samples),
-	num_negative_samples_(num_negative_samples)
+	num_negative_samples_(num_negative_samples), own_negative_samplers_(true)
+{
+	negative_sampler0_ = LoadNegSamplingTable(freq_file0);
+	negative_sampler1_ = LoadNegSamplingTable(freq_file1);
+	num_objs0_ = negative_sampler0_->len();
+	num_objs1_ = negative_sampler1_->len();
+}
+
+NegSamplingDoubleObj::NegSamplingDoubleObj(ExpTable *exp_table, int num_negative_samples,
+	AliasSampler *negative_sampler0, AliasSampler *negative_sampler1)
+	: NegSamplingBase(exp_table, num_negative_samples), num_objs0_(negative_sampler0->len()),
+	num_objs1_(negative_sampler1->len()), num_negative_samples_(num_negative_samples),
+	negative_sampler0_(negative_sampler0), negative_sampler1_(negative_sampler1)
 {
-	loadFreqFile(freq_file0, num_objs0_, negative_sample_dist0_);
-	loadFreqFile(freq_file1, num_objs1_, negative_sample_dist1_);
 }
 
 NegSamplingDoubleObj::~NegSamplingDoubleObj()
 {
+	if (own_negative_samplers_)
+	{
+		delete negative_sampler0_;
+		delete negative_sampler1_;
+	}
 }
 
-void NegSamplingDoubleObj::TrainPair(int dim0, int dim1, float *vec_in, int obj_out0, float **vecs_out0, int obj_out1,
-	float **vecs_out1, float alpha, float *tmp_neu1e, std::default_random_engine &generator,
+void NegSamplingDoubleObj::TrainPair(int dim0, int dim1, float *vec_in, int obj_out0, EmbeddingTable &vecs_out0, int obj_out1,
+	EmbeddingTable &vecs_out1, float alpha, float *tmp_neu1e, FastRng &rng,
 	bool update_in, bool update_out)
 {
 	int dim = dim0 + dim1;
@@ -21,46 +40,53 @@ void NegSamplingDoubleObj::TrainPair(int dim0, int dim1, float *vec_in, int obj_
 		tmp_neu1e[i] = 0.0f;
 
 	const float lambda = alpha * 0.01f;
-	int target0 = obj_out0, target1 = obj_out1;
-	int label = 1;
-	for (int i = 0; i < num_negative_samples_ + 1; ++i)
+	// the positive pair, then the negative pairs that hit neither positive
+	static thread_local std::vector<int> targets0, targets1;
+	static thread_local std::vector<float> scores;
+	targets0.assign(1, obj_out0);
+	targets1.assign(1, obj_out1);
+	for (int i = 0; i < num_negative_samples_; ++i)
 	{
-		if (i != 0)
-		{
-			target0 = negative_sample_dist0_(generator);
-			if (target0 == obj_out0) continue;
+		int target0 = negative_sampler0_->Sample(rng);
+		if (target0 == obj_out0) continue;
 
-			target1 = negative_sample_dist1_(generator);
-			if (target1 == obj_out1) continue;
+		int target1 = negative_sampler1_->Sample(rng);
+		if (target1 == obj_out1) continue;
 
-			label = 0;
-		}
+		targets0.push_back(target0);
+		targets1.push_back(target1);
+	}
 
+	int num_targets = (int)targets0.size();
+	scores.resize(num_targets);
+	for (int i = 0; i < num_targets; ++i)
+	{
 		float dot_product = 0;
-		if (target0 > -1)
-			for (int j = 0; j < dim0; ++j)
-				dot_product += vec_in[j] * 0.2f * vecs_out0[target0][j];
-		if (target1 > -1)
-			for (int j = 0; j < dim1; ++j)
-				dot_product += vec_in[j + dim0] * vecs_out1[target1][j];
+		for (int j = 0; j < dim0; ++j)
+			dot_product += vec_in[j] * 0.2f * vecs_out0[targets0[i]][j];
+		for (int j = 0; j < dim1; ++j)
+			dot_product += vec_in[j + dim0] * vecs_out1[targets1[i]][j];
+		scores[i] = dot_product;
+	}
+	SimdKernels::Sigmoid(scores.data(), scores.data(), num_targets);
+	exp_table_->SaturateSigmas(scores.data(), num_targets);
 
-		float g = (label - exp_table_->getSigmaValue(dot_product)) * alpha;
+	for (int i = 0; i < num_targets; ++i)
+	{
+		float *vec_out0 = vecs_out0[targets0[i]], *vec_out1 = vecs_out1[targets1[i]];
+		float g = ((i == 0) - scores[i]) * alpha;
 
-		if (target0 > -1)
-			for (int j = 0; j < dim0; ++j)
-				tmp_neu1e[j] += g * 0.2f * vecs_out0[target0][j];
-		if (target1 > -1)
-			for (int j = 0; j < dim1; ++j)
-				tmp_neu1e[j + dim0] += g * vecs_out1[target1][j];
+		for (int j = 0; j < dim0; ++j)
+			tmp_neu1e[j] += g * 0.2f * vec_out0[j];
+		for (int j = 0; j < dim1; ++j)
+			tmp_neu1e[j + dim0] += g * vec_out1[j];
 
 		if (update_out)
 		{
-			if (target0 > -1)
-				for (int j = 0; j < dim0; ++j)
-					vecs_out0[target0][j] += g * 0.2f * vec_in[j] - lambda * vecs_out0[target0][j];
-			if (target1 > -1)
-				for (int j = 0; j < dim1; ++j)
-					vecs_out1[target1][j] += g * vec_in[j + dim0] - lambda * vecs_out1[target1][j];
+			for (int j = 0; j < dim0; ++j)
+				vec_out0[j] += g * 0.2f * vec_in[j] - lambda * vec_out0[j];
+			for (int j = 0; j < dim1; ++j)
+				vec_out1[j] += g * vec_in[j + dim0] - lambda * vec_out1[j];
 		}
 	}
 
@@ -11,10 +11,13 @@ class NegSamplingDoubleObj : public NegSamplingBase
 public:
 	NegSamplingDoubleObj(ExpTable *exp_table, int num_negative_samples,
 		const char *freq_file0, const char *freq_file1);
+	// the samplers are shared, not owned
+	NegSamplingDoubleObj(ExpTable *exp_table, int num_negative_samples,
+		AliasSampler *negative_sampler0, AliasSampler *negative_sampler1);
 	~NegSamplingDoubleObj();
 
-	void TrainPair(int dim0, int dim1, float *vec_in, int obj_out0, float **vecs_out0, int obj_out1,
-		float **vecs_out1, float alpha, float *tmp_neu1e, std::default_random_engine &generator,
+	void TrainPair(int dim0, int dim1, float *vec_in, int obj_out0, EmbeddingTable &vecs_out0, int obj_out1,
+		EmbeddingTable &vecs_out1, float alpha, float *tmp_neu1e, FastRng &rng,
 		bool update_in = true, bool update_out = true);
 
 private:
@@ -22,8 +25,9 @@ private:
 	int num_objs1_ = 0;
 
 	int num_negative_samples_ = 0;
-	std::discrete_distribution<int> negative_sample_dist0_;
-	std::discrete_distribution<int> negative_sample_dist1_;
+	AliasSampler *negative_sampler0_ = 0;
+	AliasSampler *negative_sampler1_ = 0;
+	bool own_negative_samplers_ = false;
 };
 
 #endif
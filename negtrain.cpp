@@ -2,8 +2,161 @@
 
 #include <cassert>
 #include <cmath>
+#include <algorithm>
+#include <vector>
 
 #include "mathutils.h"
+#include "simdkernels.h"
+#include "trainmetrics.h"
+
+NegBatchBuffer::NegBatchBuffer(int max_batch_size, int num_negative_samples, int vec_dim)
+{
+	negs = new int[num_negative_samples];
+	neg_rows = new float*[num_negative_samples];
+	pos_rows = new float*[max_batch_size];
+	scores = new float[max_batch_size * (num_negative_samples + 1)];
+	neg_grads_t = new float[max_batch_size * num_negative_samples];
+
+	neu1e = new EmbeddingTable(max_batch_size, vec_dim);
+	neu1e_rows = new float*[max_batch_size];
+	for (int i = 0; i < max_batch_size; ++i)
+		neu1e_rows[i] = neu1e->Row(i);
+	neg_grads = new EmbeddingTable(num_negative_samples, vec_dim);
+	neg_grad_rows = new float*[num_negative_samples];
+	for (int i = 0; i < num_negative_samples; ++i)
+		neg_grad_rows[i] = neg_grads->Row(i);
+
+	rows0 = new float*[max_batch_size];
+	int max_scratch = max_batch_size * 2 + num_negative_samples;
+	scratch = new EmbeddingTable(max_scratch, vec_dim);
+	scratch_ids = new int[max_scratch];
+}
+
+NegBatchBuffer::~NegBatchBuffer()
+{
+	delete[] negs;
+	delete[] neg_rows;
+	delete[] pos_rows;
+	delete[] scores;
+	delete[] neg_grads_t;
+	delete neu1e;
+	delete[] neu1e_rows;
+	delete neg_grads;
+	delete[] neg_grad_rows;
+	delete[] rows0;
+	delete scratch;
+	delete[] scratch_ids;
+}
+
+// Points rows[i] at row ids[i] of vecs. Rows of a 16-bit table are converted
+// into scratch rows of buf, one per distinct id, so that repeated rows add up
+// their updates as they would in place.
+static void gatherRows(EmbeddingTable &vecs, const int *ids, int num, NegBatchBuffer &buf, float **rows)
+{
+	if (vecs.is_fp32())
+	{
+		for (int i = 0; i < num; ++i)
+			rows[i] = vecs[ids[i]];
+		return;
+	}
+
+	int first = buf.num_scratch;
+	for (int i = 0; i < num; ++i)
+	{
+		int slot = first;
+		while (slot < buf.num_scratch && buf.scratch_ids[slot] != ids[i])
+			++slot;
+		if (slot == buf.num_scratch)
+		{
+			buf.scratch_ids[slot] = ids[i];
+			vecs.LoadRow(ids[i], buf.scratch->Row(slot));
+			++buf.num_scratch;
+		}
+		rows[i] = buf.scratch->Row(slot);
+	}
+}
+
+static void scatterRows(EmbeddingTable &vecs, NegBatchBuffer &buf, int first, unsigned int seed)
+{
+	for (int slot = first; slot < buf.num_scratch; ++slot)
+		vecs.StoreRow(buf.scratch_ids[slot], buf.scratch->Row(slot), seed + slot * vecs.dim());
+}
+
+// fp32 copies of rows for TrainPair: 0 for vec0, 1 for the rows of the targets
+static float *scratchRow(int which, int len)
+{
+	static thread_local std::vector<float> rows[2];
+	if ((int)rows[which].size() < len)
+		rows[which].resize(len);
+	return rows[which].data();
+}
+
+// The rows a pair is scored against, with the label of each and their
+// scores and sigmoids: the positive first and then the negatives that do not
+// hit it, or the inner nodes on the path of a hierarchical softmax.
+struct PairTargets
+{
+	std::vector<int> ids;
+	std::vector<int> labels;
+	std::vector<float> scores;
+	std::vector<float> sigmas;
+	int num = 0;
+};
+
+static PairTargets &pairTargets(int max_num)
+{
+	static thread_local PairTargets targets;
+	if ((int)targets.ids.size() < max_num)
+	{
+		targets.ids.resize(max_num);
+		targets.labels.resize(max_num);
+		targets.scores.resize(max_num);
+		targets.sigmas.resize(max_num);
+	}
+	targets.num = 0;
+	return targets;
+}
+
+static PairTargets &drawTargets(int obj1, int num_negs, AliasSampler *negative_sampler, FastRng &rng)
+{
+	PairTargets &targets = pairTargets(num_negs + 1);
+	targets.ids[0] = obj1;
+	targets.labels[0] = 1;
+	targets.num = 1;
+	for (int i = 0; i < num_negs; ++i)
+	{
+		int target = negative_sampler->Sample(rng);
+		if (target != obj1)
+		{
+			targets.ids[targets.num] = target;
+			targets.labels[targets.num++] = 0;
+		}
+	}
+	return targets;
+}
+
+// branch 0 is the positive class of a node, as in word2vec
+static PairTargets &pathTargets(int obj1, const HuffmanTree *tree)
+{
+	PairTargets &targets = pairTargets(tree->max_path_len());
+	const int *path = tree->Path(obj1);
+	const unsigned char *code = tree->Code(obj1);
+	targets.num = tree->path_len(obj1);
+	for (int i = 0; i < targets.num; ++i)
+	{
+		targets.ids[i] = path[i];
+		targets.labels[i] = 1 - code[i];
+	}
+	return targets;
+}
+
+// into the TrainMetrics slot of the calling thread; the draws are counted
+// by the caller as samples, so a pair without a collision costs nothing here
+static void countCollisions(int num_collisions)
+{
+	if (num_collisions > 0)
+		TrainMetrics::ThreadSlot()->Add(TrainMetrics::kNegCollisions, num_collisions);
+}
 
 float *NegTrain::GetInitedCMParams(int vec_dim)
 {
@@ -24,62 +177,280 @@ void NegTrain::InitMatrix(float *matrix, int dim0, int dim1)
 
 NegTrain::NegTrain(ExpTable *exp_table, int num_objs1, int num_negative_samples,
 	int *obj_cnts) : NegSamplingBase(exp_table, num_negative_samples),
-	num_objs1_(num_objs1)
+	num_objs1_(num_objs1), own_negative_sampler_(true)
 {
-	initNegativeSamplingDist(num_objs1, obj_cnts, negative_sample_dist_);
+	negative_sampler_ = GetNegSamplingTable(obj_cnts, num_objs1);
 }
 
 NegTrain::NegTrain(ExpTable *exp_table, int num_negative_samples,
-	const char *freq_file) : NegSamplingBase(exp_table, num_negative_samples)
+	const char *freq_file) : NegSamplingBase(exp_table, num_negative_samples),
+	own_negative_sampler_(true)
+{
+	negative_sampler_ = LoadNegSamplingTable(freq_file);
+	num_objs1_ = negative_sampler_->len();
+}
+
+NegTrain::NegTrain(ExpTable *exp_table, int num_negative_samples,
+	AliasSampler *negative_sampler) : NegSamplingBase(exp_table, num_negative_samples),
+	num_objs1_(negative_sampler->len()), negative_sampler_(negative_sampler)
+{
+}
+
+NegTrain::NegTrain(ExpTable *exp_table, const HuffmanTree *tree) : NegSamplingBase(exp_table, 0),
+	num_objs1_(tree->num_objs()), tree_(tree)
 {
-	loadFreqFile(freq_file, num_objs1_, negative_sample_dist_);
 }
 
 NegTrain::~NegTrain()
 {
+	if (own_negative_sampler_)
+		delete negative_sampler_;
 }
 
-void NegTrain::TrainPair(int vec_dim, float *vec0, int obj1, float **vecs1, float alpha, float *tmp_neu1e,
-	std::default_random_engine &generator, float gamma, bool update0, bool update1)
+void NegTrain::TrainPair(int vec_dim, float *vec0, int obj1, EmbeddingTable &vecs1, float alpha, float *tmp_neu1e,
+	FastRng &rng, float gamma, bool update0, bool update1, float *loss)
 {
 	for (int i = 0; i < vec_dim; ++i)
 		tmp_neu1e[i] = 0.0f;
 
+	AccumPair(vec_dim, vec0, obj1, vecs1, alpha, tmp_neu1e, rng, gamma, update1, loss);
+
+	if (update0)
+		SimdKernels::AxpyDecay(1.0f, tmp_neu1e, alpha * 0.01f, vec0, vec_dim);
+	//if (update0)
+	//	printf("update0");
+	//for (int j = 0; j < vec_dim; ++j)
+	//	printf("%f ", vec0[j]);
+	//printf("\n");
+}
+
+void NegTrain::AccumPair(int vec_dim, const float *vec0, int obj1, EmbeddingTable &vecs1, float alpha, float *neu1e,
+	FastRng &rng, float gamma, bool update1, float *loss)
+{
 	const float lambda = alpha * 0.01f;
-	int target = obj1;
-	int label = 1;
-	for (int i = 0; i < num_negative_samples_ + 1; ++i)
+	PairTargets &targets = tree_ != 0 ? pathTargets(obj1, tree_)
+		: drawTargets(obj1, num_negative_samples_, negative_sampler_, rng);
+	const int *ids = targets.ids.data();
+
+	// all scores are taken before any update, so that the sigmoids are one
+	// batch; rows of a 16-bit table stay loaded for the updates
+	float *rows = vecs1.is_fp32() ? 0 : scratchRow(1, targets.num * vec_dim);
+	for (int i = 0; i < targets.num; ++i)
 	{
-		if (i != 0)
+		const float *vec1 = 0;
+		if (rows == 0)
 		{
-			target = negative_sample_dist_(generator);
-			if (target == obj1) continue;
-
-			label = 0;
+			vec1 = vecs1[ids[i]];
 		}
+		else
+		{
+			vecs1.LoadRow(ids[i], rows + i * vec_dim);
+			vec1 = rows + i * vec_dim;
+		}
+		targets.scores[i] = SimdKernels::DotProduct(vec0, vec1, vec_dim);
+	}
+	SimdKernels::Sigmoid(targets.scores.data(), targets.sigmas.data(), targets.num);
+	exp_table_->SaturateSigmas(targets.sigmas.data(), targets.num);
 
-		float dot_product = MathUtils::DotProduct(vec0, vecs1[target], vec_dim);
-		float g = (label - exp_table_->getSigmaValue(dot_product)) * alpha * gamma;
+	for (int i = 0; i < targets.num; ++i)
+	{
+		int label = targets.labels[i];
+		float g = (label - targets.sigmas[i]) * alpha * gamma;
+		if (loss != 0)
+			*loss -= exp_table_->getLogSigmaValue(label ? targets.scores[i] : -targets.scores[i]);
 
-		for (int j = 0; j < vec_dim; ++j)
-			tmp_neu1e[j] += g * vecs1[target][j];
+		float *vec1 = rows == 0 ? vecs1[ids[i]] : rows + i * vec_dim;
 		if (update1)
-			for (int j = 0; j < vec_dim; ++j)
-				vecs1[target][j] += g * vec0[j] - lambda * vecs1[target][j];
+		{
+			// a negative drawn twice builds on the stored update of its first copy
+			if (rows != 0 && tree_ == 0 && i > 1 && std::find(ids + 1, ids + i, ids[i]) != ids + i)
+				vecs1.LoadRow(ids[i], vec1);
+			SimdKernels::UpdatePair(g, lambda, vec0, vec1, neu1e, vec_dim);
+			if (rows != 0)
+				vecs1.StoreRow(ids[i], vec1, rng.NextUInt());
+		}
+		else
+		{
+			SimdKernels::Axpy(g, vec1, neu1e, vec_dim);
+		}
+	}
+	if (tree_ == 0)
+		countCollisions(num_negative_samples_ + 1 - targets.num);
+}
+
+void NegTrain::TrainPair(int vec_dim, EmbeddingTable &vecs0, int obj0, int obj1, EmbeddingTable &vecs1,
+	float alpha, float *tmp_neu1e, FastRng &rng, float gamma, bool update0,
+	bool update1, float *loss)
+{
+	if (vecs0.is_fp32())
+	{
+		TrainPair(vec_dim, vecs0[obj0], obj1, vecs1, alpha, tmp_neu1e, rng, gamma, update0, update1, loss);
+		return;
 	}
 
+	float *vec0 = scratchRow(0, vec_dim);
+	vecs0.LoadRow(obj0, vec0);
+	TrainPair(vec_dim, vec0, obj1, vecs1, alpha, tmp_neu1e, rng, gamma, update0, update1, loss);
 	if (update0)
-		for (int j = 0; j < vec_dim; ++j)
-			vec0[j] += tmp_neu1e[j] - lambda * vec0[j];
-	//if (update0)
-	//	printf("update0");
-	//for (int j = 0; j < vec_dim; ++j)
-	//	printf("%f ", vec0[j]);
-	//printf("\n");
+		vecs0.StoreRow(obj0, vec0, rng.NextUInt());
+}
+
+void NegTrain::AccumPairGrads(int vec_dim, EmbeddingTable &vecs0, int obj0, int obj1, EmbeddingTable &vecs1,
+	float alpha, float gamma, float *tmp, GradBuffer &grads, FastRng &rng)
+{
+	float *neu1e = tmp;
+	const float *vec0 = vecs0.is_fp32() ? vecs0[obj0] : tmp + vec_dim;
+	if (!vecs0.is_fp32())
+		vecs0.LoadRow(obj0, tmp + vec_dim);
+	std::fill(neu1e, neu1e + vec_dim, 0.0f);
+
+	const float lambda = alpha * 0.01f;
+	PairTargets &targets = tree_ != 0 ? pathTargets(obj1, tree_)
+		: drawTargets(obj1, num_negative_samples_, negative_sampler_, rng);
+	const int *ids = targets.ids.data();
+	float *row1 = tmp + 2 * vec_dim;
+	for (int i = 0; i < targets.num; ++i)
+	{
+		const float *vec1 = vecs1.is_fp32() ? vecs1[ids[i]] : row1;
+		if (!vecs1.is_fp32())
+			vecs1.LoadRow(ids[i], row1);
+		targets.scores[i] = SimdKernels::DotProduct(vec0, vec1, vec_dim);
+	}
+	SimdKernels::Sigmoid(targets.scores.data(), targets.sigmas.data(), targets.num);
+	exp_table_->SaturateSigmas(targets.sigmas.data(), targets.num);
+
+	// the tables do not change here, so a 16-bit row loads the same again
+	for (int i = 0; i < targets.num; ++i)
+	{
+		float g = (targets.labels[i] - targets.sigmas[i]) * alpha * gamma;
+		const float *vec1 = vecs1.is_fp32() ? vecs1[ids[i]] : row1;
+		if (!vecs1.is_fp32())
+			vecs1.LoadRow(ids[i], row1);
+		SimdKernels::PairDelta(g, lambda, vec0, vec1, neu1e, grads.Add(&vecs1, ids[i]), vec_dim);
+	}
+
+	// what AxpyDecay adds to vec0
+	float *grad0 = grads.Add(&vecs0, obj0);
+	std::copy(neu1e, neu1e + vec_dim, grad0);
+	SimdKernels::Axpy(-lambda, vec0, grad0, vec_dim);
+	if (tree_ == 0)
+		countCollisions(num_negative_samples_ + 1 - targets.num);
+}
+
+void NegTrain::TrainBatch(int vec_dim, EmbeddingTable &vecs0, const int *objs0, const int *objs1,
+	int batch_size, EmbeddingTable &vecs1, float alpha, float gamma, NegBatchBuffer &buf,
+	FastRng &rng, bool update0, bool update1, float *loss)
+{
+	int first = buf.num_scratch;
+	gatherRows(vecs0, objs0, batch_size, buf, buf.rows0);
+	TrainBatch(vec_dim, buf.rows0, objs1, batch_size, vecs1, alpha, gamma, buf, rng, update0, update1, loss);
+	if (update0 && !vecs0.is_fp32())
+		scatterRows(vecs0, buf, first, rng.NextUInt());
+	buf.num_scratch = first;
+}
+
+void NegTrain::TrainBatch(int vec_dim, float **vecs0, const int *objs1, int batch_size, EmbeddingTable &vecs1,
+	float alpha, float gamma, NegBatchBuffer &buf, FastRng &rng,
+	bool update0, bool update1, float *loss)
+{
+	// the paths of a tree have nothing to share, so the pairs go one by one
+	if (tree_ != 0)
+	{
+		for (int b = 0; b < batch_size; ++b)
+			TrainPair(vec_dim, vecs0[b], objs1[b], vecs1, alpha, buf.neu1e_rows[b], rng, gamma, update0, update1, loss);
+		return;
+	}
+
+	const float lambda = alpha * 0.01f;
+	const int num_negs = num_negative_samples_;
+	negative_sampler_->SampleBatch(rng, buf.negs, num_negs);
+	int first = buf.num_scratch;
+	gatherRows(vecs1, buf.negs, num_negs, buf, buf.neg_rows);
+	gatherRows(vecs1, objs1, batch_size, buf, buf.pos_rows);
+
+	float *pos_g = buf.scores, *neg_g = buf.scores + batch_size;
+	for (int b = 0; b < batch_size; ++b)
+		pos_g[b] = SimdKernels::DotProduct(vecs0[b], buf.pos_rows[b], vec_dim);
+	SimdKernels::DotBlock(vecs0, batch_size, buf.neg_rows, num_negs, vec_dim, neg_g);
+
+	if (loss != 0)
+	{
+		for (int b = 0; b < batch_size; ++b)
+		{
+			*loss -= exp_table_->getLogSigmaValue(pos_g[b]);
+			for (int k = 0; k < num_negs; ++k)
+				if (buf.negs[k] != objs1[b])
+					*loss -= exp_table_->getLogSigmaValue(-neg_g[b * num_negs + k]);
+		}
+	}
+	// the scores of the whole batch become sigmoids in one go
+	SimdKernels::Sigmoid(buf.scores, buf.scores, batch_size * (num_negs + 1));
+	exp_table_->SaturateSigmas(buf.scores, batch_size * (num_negs + 1));
+
+	int num_collisions = 0;
+	for (int b = 0; b < batch_size; ++b)
+	{
+		pos_g[b] = (1 - pos_g[b]) * alpha * gamma;
+		float *cur_neg_g = neg_g + b * num_negs;
+		for (int k = 0; k < num_negs; ++k)
+		{
+			// a negative that hits the positive is skipped, as in TrainPair
+			if (buf.negs[k] == objs1[b])
+			{
+				cur_neg_g[k] = 0;
+				++num_collisions;
+			}
+			else
+			{
+				cur_neg_g[k] = -cur_neg_g[k] * alpha * gamma;
+			}
+		}
+	}
+	countCollisions(num_collisions);
+
+	if (update0)
+	{
+		for (int b = 0; b < batch_size; ++b)
+		{
+			std::fill(buf.neu1e_rows[b], buf.neu1e_rows[b] + vec_dim, 0.0f);
+			SimdKernels::Axpy(pos_g[b], buf.pos_rows[b], buf.neu1e_rows[b], vec_dim);
+		}
+		SimdKernels::AccumBlock(neg_g, batch_size, buf.neg_rows, num_negs, vec_dim, buf.neu1e_rows);
+	}
+
+	if (update1)
+	{
+		for (int k = 0; k < num_negs; ++k)
+			for (int b = 0; b < batch_size; ++b)
+				buf.neg_grads_t[k * batch_size + b] = neg_g[b * num_negs + k];
+		for (int k = 0; k < num_negs; ++k)
+			std::fill(buf.neg_grad_rows[k], buf.neg_grad_rows[k] + vec_dim, 0.0f);
+		SimdKernels::AccumBlock(buf.neg_grads_t, num_negs, vecs0, batch_size, vec_dim, buf.neg_grad_rows);
+
+		// a shared negative is decayed once for each pair that used it, like
+		// it would be by batch_size calls of TrainPair
+		for (int k = 0; k < num_negs; ++k)
+		{
+			int num_used = 0;
+			for (int b = 0; b < batch_size; ++b)
+				num_used += buf.negs[k] != objs1[b];
+			SimdKernels::AxpyDecay(1.0f, buf.neg_grad_rows[k], lambda * num_used, buf.neg_rows[k], vec_dim);
+		}
+		for (int b = 0; b < batch_size; ++b)
+			SimdKernels::AxpyDecay(pos_g[b], vecs0[b], lambda, buf.pos_rows[b], vec_dim);
+	}
+
+	if (update0)
+		for (int b = 0; b < batch_size; ++b)
+			SimdKernels::AxpyDecay(1.0f, buf.neu1e_rows[b], lambda, vecs0[b], vec_dim);
+
+	if (update1 && !vecs1.is_fp32())
+		scatterRows(vecs1, buf, first, rng.NextUInt());
+	buf.num_scratch = first;
 }
 
-//void NegTrain::TrainPairCM(int vec_dim, float *vec0, int obj1, float **vecs1, float *cm_params, bool complement,
-//	float alpha, float *tmp_neu1e, float *tmp_cme, std::default_random_engine &generator, bool update0, 
+//void NegTrain::TrainPairCM(int vec_dim, float *vec0, int obj1, EmbeddingTable &vecs1, float *cm_params, bool complement,
+//	float alpha, float *tmp_neu1e, float *tmp_cme, FastRng &rng, bool update0, 
 //	bool update1, bool update_cm_params)
 //{
 //	int full_vec_dim = vec_dim * 2;
@@ -139,8 +510,8 @@ void NegTrain::TrainPair(int vec_dim, float *vec0, int obj1, float **vecs1, floa
 //			cm_params[i] += tmp_cme[i] - lambda * cm_params[i];
 //}
 
-void NegTrain::TrainPairMatrix(int dim0, int dim1, float *vec0, int obj1, float **vecs1, float *matrix, float alpha,
-	float *tmp_neu1e, std::default_random_engine &generator, bool update0, bool update1, bool update_matrix)
+void NegTrain::TrainPairMatrix(int dim0, int dim1, float *vec0, int obj1, EmbeddingTable &vecs1, float *matrix, float alpha,
+	float *tmp_neu1e, FastRng &rng, bool update0, bool update1, bool update_matrix)
 {
 	if (update0)
 		for (int i = 0; i < dim0; ++i)
@@ -153,7 +524,7 @@ void NegTrain::TrainPairMatrix(int dim0, int dim1, float *vec0, int obj1, float
 	{
 		if (i != 0)
 		{
-			target = negative_sample_dist_(generator);
+			target = negative_sampler_->Sample(rng);
 			if (target == obj1) continue;
 
 			label = 0;
@@ -186,7 +557,7 @@ void NegTrain::TrainPairMatrix(int dim0, int dim1, float *vec0, int obj1, float
 			vec0[j] += tmp_neu1e[j] - nf * alpha * vec0[j];
 }
 
-void NegTrain::CheckObject(int vec_dim, float *cur_vec, float **vecs1)
+void NegTrain::CheckObject(int vec_dim, float *cur_vec, EmbeddingTable &vecs1)
 {
 	const int k = 10;
 	int top_indices[k];
@@ -220,8 +591,26 @@ void NegTrain::CheckObject(int vec_dim, float *cur_vec, float **vecs1)
 	}
 }
 
-void NegTrain::CloseVectors(float **vecs, int num_vecs, int vec_dim, int idx)
+// keeps vals[0..k) sorted in descending order
+static void insertTopK(int idx, float sim, int k, int *top_indices, float *vals)
+{
+	int pos = k - 1;
+	while (pos > -1 && vals[pos] < sim) --pos;
+	for (int j = k - 2; j > pos; --j)
+	{
+		vals[j + 1] = vals[j];
+		top_indices[j + 1] = top_indices[j];
+	}
+	if (pos != k - 1)
+	{
+		vals[pos + 1] = sim;
+		top_indices[pos + 1] = idx;
+	}
+}
+
+void NegTrain::CloseVectors(EmbeddingTable &vecs, int idx)
 {
+	int num_vecs = vecs.num_rows(), vec_dim = vecs.dim();
 	const int k = 10;
 	int top_indices[k];
 	float vals[k];
@@ -233,20 +622,7 @@ void NegTrain::CloseVectors(float **vecs, int num_vecs, int vec_dim, int idx)
 		if (i == idx)
 			continue;
 
-		float sim = MathUtils::Cosine(vec, vecs[i], vec_dim);
-
-		int pos = k - 1;
-		while (pos > -1 && vals[pos] < sim) --pos;
-		for (int j = k - 2; j > pos; --j)
-		{
-			vals[j + 1] = vals[j];
-			top_indices[j + 1] = top_indices[j];
-		}
-		if (pos != k - 1)
-		{
-			vals[pos + 1] = sim;
-			top_indices[pos + 1] = i;
-		}
+		insertTopK(i, MathUtils::Cosine(vec, vecs[i], vec_dim), k, top_indices, vals);
 	}
 
 	//printf("%f %f %f\n", target_val, target_sum, target_val / log(target_sum));
@@ -257,8 +633,8 @@ void NegTrain::CloseVectors(float **vecs, int num_vecs, int vec_dim, int idx)
 	}
 }
 
-void NegTrain::trainPairCM(int vec_dim, float *vec0, int obj1, float **vecs1, float *cm_params,
-	float alpha, float *tmp_neu1e, float *tmp_cme, std::default_random_engine &generator,
+void NegTrain::trainPairCM(int vec_dim, float *vec0, int obj1, EmbeddingTable &vecs1, float *cm_params,
+	float alpha, float *tmp_neu1e, float *tmp_cme, FastRng &rng,
 	bool update0 = true, bool update1 = true, bool update_cm_params = true)
 {
 	if (update0)
@@ -275,7 +651,7 @@ void NegTrain::trainPairCM(int vec_dim, float *vec0, int obj1, float **vecs1, fl
 	{
 		if (i != 0)
 		{
-			target = negative_sample_dist_(generator);
+			target = negative_sampler_->Sample(rng);
 			if (target == obj1) continue;
 
 			label = 0;
@@ -322,8 +698,8 @@ void NegTrain::trainPairCM(int vec_dim, float *vec0, int obj1, float **vecs1, fl
 			cm_params[i] += tmp_cme[i] - lambda * (cm_params[i] - 0.5f);
 }
 
-void NegTrain::trainPairCMComplement(int vec_dim, float *vec0, int obj1, float **vecs1, float *cm_params,
-	float alpha, float *tmp_neu1e, float *tmp_cme, std::default_random_engine &generator,
+void NegTrain::trainPairCMComplement(int vec_dim, float *vec0, int obj1, EmbeddingTable &vecs1, float *cm_params,
+	float alpha, float *tmp_neu1e, float *tmp_cme, FastRng &rng,
 	bool update0 = true, bool update1 = true, bool update_cm_params = true)
 {
 	if (update0)
@@ -340,7 +716,7 @@ void NegTrain::trainPairCMComplement(int vec_dim, float *vec0, int obj1, float *
 	{
 		if (i != 0)
 		{
-			target = negative_sample_dist_(generator);
+			target = negative_sampler_->Sample(rng);
 			if (target == obj1) continue;
 
 			label = 0;
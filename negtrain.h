@@ -4,6 +4,33 @@
 #include <random>
 
 #include "negsamplingbase.h"
+#include "gradbuffer.h"
+
+// Scratch space of NegTrain::TrainBatch, one per training thread.
+struct NegBatchBuffer
+{
+	NegBatchBuffer(int max_batch_size, int num_negative_samples, int vec_dim);
+	~NegBatchBuffer();
+
+	int *negs = 0;
+	float **neg_rows = 0;
+	float **pos_rows = 0;
+	// positive scores/gradients followed by a batch x negatives block
+	float *scores = 0;
+	// the negative block transposed
+	float *neg_grads_t = 0;
+
+	EmbeddingTable *neu1e = 0;
+	float **neu1e_rows = 0;
+	EmbeddingTable *neg_grads = 0;
+	float **neg_grad_rows = 0;
+
+	// fp32 copies of the rows of 16-bit tables, one per distinct row id
+	float **rows0 = 0;
+	EmbeddingTable *scratch = 0;
+	int *scratch_ids = 0;
+	int num_scratch = 0;
+};
 
 class NegTrain : public NegSamplingBase
 {
@@ -14,7 +41,7 @@ public:
 	// probably not used
 	static void InitMatrix(float *matrix, int dim0, int dim1);
 
-	static void CloseVectors(float **vecs, int num_vecs, int vec_dim, int idx);
+	static void CloseVectors(EmbeddingTable &vecs, int idx);
 
 public:
 	// use objs0 to predict objs1
@@ -27,30 +54,82 @@ public:
 	NegTrain(ExpTable *exp_table, int num_negative_samples,
 		const char *freq_file);
 
+	// negative_sampler is shared, not owned
+	NegTrain(ExpTable *exp_table, int num_negative_samples,
+		AliasSampler *negative_sampler);
+
+	// Hierarchical softmax over tree instead of negative sampling, see
+	// HuffmanTree: obj1 is scored against the rows of the inner nodes on its
+	// path, so vecs1 of TrainPair, AccumPair, TrainBatch and AccumPairGrads
+	// is the table of the inner nodes, tree->num_inner() rows or more, best
+	// zero-initialized. The CM and matrix energies need negative sampling.
+	// tree is shared, not owned.
+	NegTrain(ExpTable *exp_table, const HuffmanTree *tree);
+
 	//NegativeSamplingTrainer(ExpTable *exp_table, int vec_dim, int num_objs, int num_negative_samples,
 	//	std::discrete_distribution<int> *obj_sample_dist);
 
 	~NegTrain();
 
 	// obj0 -> obj1
-	void TrainPair(int vec_dim, float *vec0, int obj1, float **vecs1, float alpha, float *tmp_neu1e,
-		std::default_random_engine &generator, float gamma, bool update0 = true, bool update1 = true);
+	// vecs1 may be a 16-bit table: each row is updated in an fp32 copy and
+	// stored back with stochastic rounding. With loss, the negative sampling
+	// loss of the pair before the update, -log sigma(vec0 . vec1) minus
+	// log sigma(-vec0 . neg) of each negative, is added to *loss. The scores
+	// of the positive and the negatives are all taken before vecs1 changes,
+	// so a negative drawn twice is scored once for both copies, and go
+	// through SimdKernels::Sigmoid as one batch, saturated like ExpTable.
+	void TrainPair(int vec_dim, float *vec0, int obj1, EmbeddingTable &vecs1, float alpha, float *tmp_neu1e,
+		FastRng &rng, float gamma, bool update0 = true, bool update1 = true, float *loss = 0);
+
+	// The pair part of TrainPair without the update of vec0: the gradient
+	// of vec0 is added to neu1e, so that the caller can apply the gradients
+	// of several pairs of the same vec0 with one write.
+	void AccumPair(int vec_dim, const float *vec0, int obj1, EmbeddingTable &vecs1, float alpha, float *neu1e,
+		FastRng &rng, float gamma, bool update1 = true, float *loss = 0);
+
+	// same with vec0 = vecs0[obj0], for vecs0 of any precision
+	void TrainPair(int vec_dim, EmbeddingTable &vecs0, int obj0, int obj1, EmbeddingTable &vecs1, float alpha,
+		float *tmp_neu1e, FastRng &rng, float gamma, bool update0 = true,
+		bool update1 = true, float *loss = 0);
+
+	// Mini-batch version of TrainPair: vecs0[b] -> objs1[b] for b < batch_size.
+	// One set of negatives is drawn for the whole batch, and the scores and
+	// gradients are computed with the blocked kernels in SimdKernels. All
+	// gradients are taken at the values before the batch. loss is the sum of
+	// the losses of the pairs, as in TrainPair. With a tree the pairs are
+	// trained one after the other with TrainPair.
+	void TrainBatch(int vec_dim, float **vecs0, const int *objs1, int batch_size, EmbeddingTable &vecs1,
+		float alpha, float gamma, NegBatchBuffer &buf, FastRng &rng,
+		bool update0 = true, bool update1 = true, float *loss = 0);
+
+	// same with vecs0[b] = vecs0[objs0[b]], for vecs0 of any precision; vecs0
+	// and vecs1 must be different tables
+	void TrainBatch(int vec_dim, EmbeddingTable &vecs0, const int *objs0, const int *objs1, int batch_size,
+		EmbeddingTable &vecs1, float alpha, float gamma, NegBatchBuffer &buf,
+		FastRng &rng, bool update0 = true, bool update1 = true, float *loss = 0);
+
+	// The update of TrainPair(vecs0[obj0] -> obj1) for the deterministic
+	// trainer: taken at the current values and added to grads instead of to
+	// the tables. tmp needs room for 3 * vec_dim floats.
+	void AccumPairGrads(int vec_dim, EmbeddingTable &vecs0, int obj0, int obj1, EmbeddingTable &vecs1,
+		float alpha, float gamma, float *tmp, GradBuffer &grads, FastRng &rng);
 
 	// controled mix
 	// dimention of vec0: vec_dim * 2
-	void TrainPairCM(int vec_dim, float *vec0, int obj1, float **vecs1, float *cm_params, bool complement,
-		float alpha, float *tmp_neu1e, float *tmp_cme, std::default_random_engine &generator,
+	void TrainPairCM(int vec_dim, float *vec0, int obj1, EmbeddingTable &vecs1, float *cm_params, bool complement,
+		float alpha, float *tmp_neu1e, float *tmp_cme, FastRng &rng,
 		bool update0 = true, bool update1 = true, bool update_cm_params = true)
 	{
 		if (complement)
 		{
 			trainPairCMComplement(vec_dim, vec0, obj1, vecs1, cm_params, alpha, tmp_neu1e,
-				tmp_cme, generator, update0, update1, update_cm_params);
+				tmp_cme, rng, update0, update1, update_cm_params);
 		}
 		else
 		{
 			trainPairCM(vec_dim, vec0, obj1, vecs1, cm_params, alpha, tmp_neu1e,
-				tmp_cme, generator, update0, update1, update_cm_params);
+				tmp_cme, rng, update0, update1, update_cm_params);
 		}
 
 		for (int i = 0; i < vec_dim; ++i)
@@ -62,17 +141,17 @@ public:
 		}
 	}
 
-	void TrainPairMatrix(int dim0, int dim1, float *vec0, int obj1, float **vecs1, float *matrix, float alpha, float *tmp_neu1e,
-		std::default_random_engine &generator, bool update0 = true, bool update1 = true, bool update_matrix = true);
+	void TrainPairMatrix(int dim0, int dim1, float *vec0, int obj1, EmbeddingTable &vecs1, float *matrix, float alpha, float *tmp_neu1e,
+		FastRng &rng, bool update0 = true, bool update1 = true, bool update_matrix = true);
 
-	void CheckObject(int vec_dim, float *cur_vec, float **vecs1);
+	void CheckObject(int vec_dim, float *cur_vec, EmbeddingTable &vecs1);
 
 private:
-	void trainPairCM(int vec_dim, float *vec0, int obj1, float **vecs1, float *cm_params,
-		float alpha, float *tmp_neu1e, float *tmp_cme, std::default_random_engine &generator,
+	void trainPairCM(int vec_dim, float *vec0, int obj1, EmbeddingTable &vecs1, float *cm_params,
+		float alpha, float *tmp_neu1e, float *tmp_cme, FastRng &rng,
 		bool update0, bool update1, bool update_cm_params);
-	void trainPairCMComplement(int vec_dim, float *vec0, int obj1, float **vecs1, float *cm_params,
-		float alpha, float *tmp_neu1e, float *tmp_cme, std::default_random_engine &generator,
+	void trainPairCMComplement(int vec_dim, float *vec0, int obj1, EmbeddingTable &vecs1, float *cm_params,
+		float alpha, float *tmp_neu1e, float *tmp_cme, FastRng &rng,
 		bool update0, bool update1, bool update_cm_params);
 
 	float calcCMEnergy(int vec_dim, float *vec0, float *vec1, float *cm_params)
@@ -101,7 +180,10 @@ private:
 	// use objs0 to predict objs1, e.g. objs0: documents, objs1: words
 	int num_objs1_ = 0;
 
-	std::discrete_distribution<int> negative_sample_dist_;
+	AliasSampler *negative_sampler_ = 0;
+	bool own_negative_sampler_ = false;
+	// set for hierarchical softmax
+	const HuffmanTree *tree_ = 0;
 };
 
 #endif
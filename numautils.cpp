@@ -0,0 +1,188 @@
+#include "numautils.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace NumaUtils
+{
+	// smaller tables are left to whoever touches them first
+	static const size_t kMinPlaceBytes = 1 << 20;
+	static const size_t kPageSize = 4096;
+
+	static std::vector<std::vector<int> > node_cpus;
+	static std::once_flag init_flag;
+	static std::atomic<int> placement_threads(0);
+	static thread_local int cur_node = -1;
+
+	// "0-3,8,10-11"
+	static void parseCpuList(const char *list, std::vector<int> &cpus)
+	{
+		const char *p = list;
+		while (*p >= '0' && *p <= '9')
+		{
+			char *end = 0;
+			int beg = (int)strtol(p, &end, 10), last = beg;
+			if (*end == '-')
+				last = (int)strtol(end + 1, &end, 10);
+			for (int cpu = beg; cpu <= last; ++cpu)
+				cpus.push_back(cpu);
+			p = *end == ',' ? end + 1 : end;
+		}
+	}
+
+	static void readTopology()
+	{
+#ifndef _WIN32
+		// node ids may have gaps, e.g. with offline nodes
+		const int kMaxNodeId = 1024;
+		for (int node = 0; node < kMaxNodeId; ++node)
+		{
+			char path[128];
+			sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+			FILE *fp = fopen(path, "r");
+			if (fp == 0)
+				continue;
+			char line[4096];
+			std::vector<int> cpus;
+			if (fgets(line, sizeof(line), fp) != 0)
+				parseCpuList(line, cpus);
+			fclose(fp);
+			// memory only nodes have no CPUs to pin to
+			if (!cpus.empty())
+				node_cpus.push_back(cpus);
+		}
+#endif
+		if (node_cpus.empty())
+		{
+			int num_cpus = std::max(1, (int)std::thread::hardware_concurrency());
+			node_cpus.resize(1);
+			for (int cpu = 0; cpu < num_cpus; ++cpu)
+				node_cpus[0].push_back(cpu);
+		}
+	}
+
+	static bool setAffinity(const int *cpus, int num_cpus)
+	{
+#ifdef _WIN32
+		DWORD_PTR mask = 0;
+		for (int i = 0; i < num_cpus; ++i)
+			if (cpus[i] < (int)sizeof(DWORD_PTR) * 8)
+				mask |= (DWORD_PTR)1 << cpus[i];
+		return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		for (int i = 0; i < num_cpus; ++i)
+			if (cpus[i] < CPU_SETSIZE)
+				CPU_SET(cpus[i], &cpu_set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#endif
+	}
+
+	void Init()
+	{
+		std::call_once(init_flag, readTopology);
+	}
+
+	int NumNodes()
+	{
+		Init();
+		return (int)node_cpus.size();
+	}
+
+	const std::vector<int> &NodeCpus(int node)
+	{
+		Init();
+		return node_cpus[node];
+	}
+
+	int NodeOfThread(int thread_idx, int num_threads)
+	{
+		return (int)((long long)thread_idx * NumNodes() / num_threads);
+	}
+
+	bool PinThread(int thread_idx, int num_threads)
+	{
+		int node = NodeOfThread(thread_idx, num_threads);
+		// position among the threads of the node, round robin over its CPUs
+		int first_thread = (int)(((long long)node * num_threads + NumNodes() - 1) / NumNodes());
+		const std::vector<int> &cpus = NodeCpus(node);
+		int cpu = cpus[(thread_idx - first_thread) % cpus.size()];
+		if (!setAffinity(&cpu, 1))
+			return false;
+		cur_node = node;
+		return true;
+	}
+
+	bool PinToNode(int node)
+	{
+		const std::vector<int> &cpus = NodeCpus(node);
+		if (!setAffinity(cpus.data(), (int)cpus.size()))
+			return false;
+		cur_node = node;
+		return true;
+	}
+
+	int CurrentNode()
+	{
+		return cur_node;
+	}
+
+	void RunOnNode(int node, const std::function<void()> &fn)
+	{
+		std::thread thread([node, &fn]
+		{
+			PinToNode(node);
+			fn();
+		});
+		thread.join();
+	}
+
+	void SetPlacement(int num_threads)
+	{
+		Init();
+		placement_threads = num_threads;
+	}
+
+	bool PlacementEnabled()
+	{
+		return placement_threads > 0;
+	}
+
+	void Place(void *data, size_t size)
+	{
+		int num_threads = placement_threads;
+		if (num_threads <= 0 || size < kMinPlaceBytes || cur_node >= 0)
+			return;
+
+		// whole pages per thread, so that each page has one owner
+		size_t num_pages = (size + kPageSize - 1) / kPageSize;
+		std::thread *threads = new std::thread[num_threads];
+		for (int i = 0; i < num_threads; ++i)
+		{
+			threads[i] = std::thread([=]
+			{
+				PinThread(i, num_threads);
+				size_t beg = std::min(size, num_pages * i / num_threads * kPageSize);
+				size_t end = std::min(size, num_pages * (i + 1) / num_threads * kPageSize);
+				memset((char*)data + beg, 0, end - beg);
+			});
+		}
+		for (int i = 0; i < num_threads; ++i)
+			threads[i].join();
+		delete[] threads;
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef NUMAUTILS_H_
+#define NUMAUTILS_H_
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Thread placement on NUMA machines. The node topology is read from
+// /sys/devices/system/node on Linux; elsewhere, or when it can't be read,
+// the machine is one node holding all CPUs.
+//
+// Training threads are split over the nodes in contiguous blocks,
+// thread_idx * NumNodes() / num_threads, and each is pinned to one CPU of
+// its node. Memory is placed by first touch: a page lands on the node of the
+// thread that first writes it. With placement on, large EmbeddingTables
+// are first touched by threads pinned the same way as the training threads
+// (unless allocated by an already pinned thread, which keeps them local), so a
+// shared table spreads over the nodes in proportion to their threads
+// instead of landing on the node of the main thread.
+namespace NumaUtils
+{
+	void Init();
+
+	int NumNodes();
+	const std::vector<int> &NodeCpus(int node);
+
+	int NodeOfThread(int thread_idx, int num_threads);
+
+	// Pins the calling thread to one CPU of the node of thread_idx. Returns
+	// false where pinning is not supported.
+	bool PinThread(int thread_idx, int num_threads);
+	// pins the calling thread to all CPUs of node
+	bool PinToNode(int node);
+	// node the calling thread is pinned to, -1 if it is not
+	int CurrentNode();
+
+	// Runs fn on a new thread pinned to node and waits for it, so that what fn
+	// allocates and first touches is placed on node.
+	void RunOnNode(int node, const std::function<void()> &fn);
+
+	// num_threads > 0 turns placement of the tables allocated from now on
+	// for that many training threads on, 0 turns it off
+	void SetPlacement(int num_threads);
+	bool PlacementEnabled();
+	// Zeroes [data, data + size) as described above when placement is on and
+	// the size is worth it; does nothing otherwise.
+	void Place(void *data, size_t size);
+}
+
+#endif
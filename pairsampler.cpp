@@ -2,118 +2,558 @@
 
 #include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
 #include <cassert>
+#include <climits>
+#include <chrono>
+#include <thread>
+#include <string>
 
 #include "negtrain.h"
 #include "mathutils.h"
 
-PairSampler::PairSampler(const char *adj_list_file_name)
+// CSR file layout: a CSRFileHeader, then the sections below in this order,
+// each starting at a 64 byte aligned offset recorded in the header.
+static const char kCSRMagic[8] = { 'E', 'M', 'A', 'D', 'R', 'C', 'S', 'R' };
+static const int kCSRVersion = 1;
+static const long long kCSRAlignment = 64;
+
+enum CSRSection
 {
-	printf("loading %s ...\n", adj_list_file_name);
-	FILE *fp = fopen(adj_list_file_name, "rb");
-	assert(fp != 0);
+	kAdjOffsets,	// long long[num_vertex_left + 1]
+	kAdjVertices,	// int[num_edges]
+	kAdjWeights,	// unsigned short[num_edges]
+	kRightProb,		// unsigned int[num_edges]
+	kRightAlias,	// int[num_edges]
+	kLeftProb,		// unsigned int[num_vertex_left]
+	kLeftAlias,		// int[num_vertex_left]
+	kNegProb,		// unsigned int[num_vertex_right]
+	kNegAlias,		// int[num_vertex_right]
+	kNumCSRSections
+};
 
-	fread(&num_vertex_left_, sizeof(int), 1, fp);
-	fread(&num_vertex_right_, sizeof(int), 1, fp);
-	printf("left: %d right: %d\n", num_vertex_left_, num_vertex_right_);
+struct CSRFileHeader
+{
+	char magic[8];
+	int version;
+	int num_vertex_left;
+	int num_vertex_right;
+	int reserved;
+	long long num_edges;
+	long long sum_weights;
+	long long section_offsets[kNumCSRSections];
+};
 
-	//right_vertex_dists_ = new std::discrete_distribution<int>[num_vertex_left_];
-	right_vertex_samplers_ = new MultinomialSampler[num_vertex_left_];
+bool PairSampler::ConvertToCSR(const char *adj_list_file_name, const char *dst_csr_file_name)
+{
+	PairSampler sampler(adj_list_file_name, std::thread::hardware_concurrency());
+	return sampler.SaveCSR(dst_csr_file_name);
+}
 
-	int *left_weights = new int[num_vertex_left_];
-	int *right_weights = new int[num_vertex_right_];
-	std::fill(left_weights, left_weights + num_vertex_left_, 0);
-	std::fill(right_weights, right_weights + num_vertex_right_, 0);
+PairSampler::PairSampler(const char *adj_list_file_name, int num_threads)
+{
+	if (!mapCSR(adj_list_file_name))
+		loadAdjList(adj_list_file_name, num_threads < 1 ? 1 : num_threads);
+}
+
+PairSampler::~PairSampler()
+{
+	if (csr_file_ != 0)
+	{
+		delete csr_file_;
+	}
+	else
+	{
+		delete[] adj_offsets_;
+		delete[] adj_vertices_;
+		delete[] adj_weights_;
+		delete[] right_prob_;
+		delete[] right_alias_;
+	}
 
-	adj_list_ = new int*[num_vertex_left_];
-	num_adj_vertices_ = new int[num_vertex_left_];
+	for (int i = 0; i < num_stat_shards_; ++i)
+		delete[] stat_shards_[i];
+	delete[] stat_shards_;
+	delete[] cnts_;
+	if (own_epoch_cursor_)
+		delete epoch_cursor_;
+}
 
-	cnts_ = new int*[num_vertex_left_];
+PairSampler *PairSampler::Clone()
+{
+	PairSampler *copy = new PairSampler();
+	copy->left_vertex_sampler_.Init(left_vertex_sampler_.prob(), left_vertex_sampler_.alias(),
+		left_vertex_sampler_.len());
+	copy->neg_sampler_.Init(neg_sampler_.prob(), neg_sampler_.alias(), neg_sampler_.len());
+	copy->num_vertex_left_ = num_vertex_left_;
+	copy->num_vertex_right_ = num_vertex_right_;
+	copy->num_edges_ = num_edges_;
+	copy->sum_weights_ = sum_weights_;
+	copy->epoch_blocks_ = epoch_blocks_;
+	copy->epoch_seed_ = epoch_seed_;
+	copy->epoch_cursor_ = epoch_cursor_;
 
-	for (int i = 0; i < num_vertex_left_; ++i)
+	long long *adj_offsets = new long long[num_vertex_left_ + 1];
+	std::copy(adj_offsets_, adj_offsets_ + num_vertex_left_ + 1, adj_offsets);
+	int *adj_vertices = new int[num_edges_];
+	std::copy(adj_vertices_, adj_vertices_ + num_edges_, adj_vertices);
+	unsigned short *adj_weights = new unsigned short[num_edges_];
+	std::copy(adj_weights_, adj_weights_ + num_edges_, adj_weights);
+	unsigned int *right_prob = new unsigned int[num_edges_];
+	std::copy(right_prob_, right_prob_ + num_edges_, right_prob);
+	int *right_alias = new int[num_edges_];
+	std::copy(right_alias_, right_alias_ + num_edges_, right_alias);
+	copy->adj_offsets_ = adj_offsets;
+	copy->adj_vertices_ = adj_vertices;
+	copy->adj_weights_ = adj_weights;
+	copy->right_prob_ = right_prob;
+	copy->right_alias_ = right_alias;
+	return copy;
+}
+
+thread_local int PairSampler::cur_stats_shard_ = 0;
+
+void PairSampler::InitEpochBlocks(unsigned long long seed)
+{
+	// nothing to walk; an epoch would never yield a visit
+	if (sum_weights_ <= 0)
+		return;
+
+	if (epoch_blocks_.empty())
 	{
-		fread(&num_adj_vertices_[i], sizeof(int), 1, fp);
+		int block_weight = 0;
+		for (long long i = 0; i < num_edges_; ++i)
+		{
+			if (i == 0 || block_weight + adj_weights_[i] > kEpochBlockWeight)
+			{
+				epoch_blocks_.push_back(i);
+				block_weight = 0;
+			}
+			block_weight += adj_weights_[i];
+		}
+		epoch_blocks_.push_back(num_edges_);
+	}
 
-		adj_list_[i] = new int[num_adj_vertices_[i]];
-		fread(adj_list_[i], sizeof(int), num_adj_vertices_[i], fp);
+	epoch_seed_ = seed;
+	if (epoch_cursor_ == 0)
+	{
+		epoch_cursor_ = new std::atomic<long long>(0);
+		own_epoch_cursor_ = true;
+	}
+	epoch_cursor_->store(0);
+}
 
-		cnts_[i] = new int[num_adj_vertices_[i]];
-		std::fill(cnts_[i], cnts_[i] + num_adj_vertices_[i], 0);
+// splitmix64 finalizer
+static unsigned long long mix64(unsigned long long z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
 
-		unsigned short *weights = new unsigned short[num_adj_vertices_[i]];
-		fread(weights, sizeof(unsigned short), num_adj_vertices_[i], fp);
-		for (int j = 0; j < num_adj_vertices_[i]; ++j)
+// A keyed shuffle of [0, n) that is computed per index, so that the block
+// order of an epoch needs neither storage nor a thread to make it: a
+// balanced Feistel network over the smallest even number of bits that
+// holds n, applied again to the indices it maps past n until they fall
+// below it.
+static long long permuteIndex(long long idx, long long n, unsigned long long key)
+{
+	int bits = 2;
+	while ((1LL << bits) < n)
+		bits += 2;
+	const int half = bits / 2;
+	const unsigned long long mask = (1ull << half) - 1;
+	do
+	{
+		unsigned long long left = (unsigned long long)idx >> half, right = idx & mask;
+		for (int r = 0; r < 4; ++r)
 		{
-			left_weights[i] += weights[j];
-			right_weights[adj_list_[i][j]] += weights[j];
-			sum_weights_ += weights[j];
+			unsigned long long tmp = left ^ (mix64(right + key + r * 0x9e3779b97f4a7c15ull) & mask);
+			left = right;
+			right = tmp;
 		}
+		idx = (long long)((left << half) | right);
+	} while (idx >= n);
+	return idx;
+}
+
+int PairSampler::epochBlock(long long claim, int &epoch)
+{
+	long long num_blocks = (long long)epoch_blocks_.size() - 1;
+	epoch = (int)(claim / num_blocks);
+	return (int)permuteIndex(claim % num_blocks, num_blocks,
+		mix64(epoch_seed_ * 0x9e3779b97f4a7c15ull + epoch + 1));
+}
+
+void PairSampler::EdgeStream::nextBlock(FastRng &rng)
+{
+	long long claim = 0;
+	if (num_threads_ > 0)
+	{
+		claim = next_claim_;
+		next_claim_ += num_threads_;
+	}
+	else
+	{
+		claim = sampler_->epoch_cursor_->fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// the row of the first edge, then the rows follow the offsets
+	int block = sampler_->epochBlock(claim, epoch_);
+	long long beg = sampler_->epoch_blocks_[block], end = sampler_->epoch_blocks_[block + 1];
+	const long long *offsets = sampler_->adj_offsets_;
+	int left = (int)(std::upper_bound(offsets, offsets + sampler_->num_vertex_left_ + 1, beg) - offsets) - 1;
+	visits_.clear();
+	for (long long i = beg; i < end; ++i)
+	{
+		while (offsets[left + 1] <= i)
+			++left;
+		Visit visit = { i, left };
+		visits_.insert(visits_.end(), sampler_->adj_weights_[i], visit);
+	}
+	for (int i = (int)visits_.size() - 1; i > 0; --i)
+		std::swap(visits_[i], visits_[rng.NextInt(i + 1)]);
+	pos_ = 0;
+}
+
+void PairSampler::EnableSampleStats(int num_shards)
+{
+	if (stat_shards_ != 0)
+		return;
+
+	cnts_ = new int[num_edges_];
+	std::fill(cnts_, cnts_ + num_edges_, 0);
+
+	int **stat_shards = new int*[num_shards];
+	for (int i = 0; i < num_shards; ++i)
+	{
+		stat_shards[i] = new int[num_edges_];
+		std::fill(stat_shards[i], stat_shards[i] + num_edges_, 0);
+	}
+	num_stat_shards_ = num_shards;
+	stat_shards_ = stat_shards;
+}
+
+void PairSampler::FlushSampleStats()
+{
+	if (stat_shards_ == 0)
+		return;
+
+	int *shard = stat_shards_[cur_stats_shard_];
+	std::lock_guard<std::mutex> lock(stats_mutex_);
+	for (long long i = 0; i < num_edges_; ++i)
+	{
+		cnts_[i] += shard[i];
+		shard[i] = 0;
+	}
+}
+
+bool PairSampler::SaveCSR(const char *dst_file_name)
+{
+	// written next to the destination and renamed over it once complete, so
+	// that a failed write does not leave a truncated file behind
+	std::string tmp_file_name = std::string(dst_file_name) + ".tmp";
+	FILE *fp = fopen(tmp_file_name.c_str(), "wb");
+	if (fp == 0)
+	{
+		printf("cannot open %s: %s\n", tmp_file_name.c_str(), strerror(errno));
+		return false;
+	}
+
+	const void *sections[kNumCSRSections] = { adj_offsets_, adj_vertices_, adj_weights_,
+		right_prob_, right_alias_, left_vertex_sampler_.prob(), left_vertex_sampler_.alias(),
+		neg_sampler_.prob(), neg_sampler_.alias() };
+	long long section_sizes[kNumCSRSections] = { (num_vertex_left_ + 1) * (long long)sizeof(long long),
+		num_edges_ * (long long)sizeof(int), num_edges_ * (long long)sizeof(unsigned short),
+		num_edges_ * (long long)sizeof(unsigned int), num_edges_ * (long long)sizeof(int),
+		num_vertex_left_ * (long long)sizeof(unsigned int), num_vertex_left_ * (long long)sizeof(int),
+		num_vertex_right_ * (long long)sizeof(unsigned int), num_vertex_right_ * (long long)sizeof(int) };
+
+	CSRFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kCSRMagic, sizeof(kCSRMagic));
+	header.version = kCSRVersion;
+	header.num_vertex_left = num_vertex_left_;
+	header.num_vertex_right = num_vertex_right_;
+	header.num_edges = num_edges_;
+	header.sum_weights = sum_weights_;
+	long long pos = sizeof(header);
+	for (int i = 0; i < kNumCSRSections; ++i)
+	{
+		pos = (pos + kCSRAlignment - 1) / kCSRAlignment * kCSRAlignment;
+		header.section_offsets[i] = pos;
+		pos += section_sizes[i];
+	}
+	fwrite(&header, sizeof(header), 1, fp);
+
+	const char zeros[kCSRAlignment] = { 0 };
+	pos = sizeof(header);
+	for (int i = 0; i < kNumCSRSections; ++i)
+	{
+		fwrite(zeros, 1, (size_t)(header.section_offsets[i] - pos), fp);
+		fwrite(sections[i], 1, (size_t)section_sizes[i], fp);
+		pos = header.section_offsets[i] + section_sizes[i];
+	}
+
+	bool written = !ferror(fp);
+	written = fclose(fp) == 0 && written;
+#ifdef _WIN32
+	// rename does not overwrite on Windows
+	if (written)
+		remove(dst_file_name);
+#endif
+	if (!written || rename(tmp_file_name.c_str(), dst_file_name) != 0)
+	{
+		printf("cannot write %s: %s\n", dst_file_name, strerror(errno));
+		remove(tmp_file_name.c_str());
+		return false;
+	}
+	printf("%s saved.\n", dst_file_name);
+	return true;
+}
+
+void PairSampler::loadAdjList(const char *adj_list_file_name, int num_threads)
+{
+	printf("loading %s ...\n", adj_list_file_name);
+	auto beg_time = std::chrono::steady_clock::now();
+	FILE *fp = fopen(adj_list_file_name, "rb");
+	assert(fp != 0);
+
+	fread(&num_vertex_left_, sizeof(int), 1, fp);
+	fread(&num_vertex_right_, sizeof(int), 1, fp);
+	printf("left: %d right: %d\n", num_vertex_left_, num_vertex_right_);
+
+	// first pass only reads the degrees so that the edges can go into flat arrays
+	long pos_rows = ftell(fp);
+	long long *adj_offsets = new long long[num_vertex_left_ + 1];
+	adj_offsets[0] = 0;
+	for (int i = 0; i < num_vertex_left_; ++i)
+	{
+		int num_adj_vertices = 0;
+		fread(&num_adj_vertices, sizeof(int), 1, fp);
+		fseek(fp, num_adj_vertices * (long)(sizeof(int) + sizeof(unsigned short)), SEEK_CUR);
+		adj_offsets[i + 1] = adj_offsets[i] + num_adj_vertices;
+	}
+	num_edges_ = adj_offsets[num_vertex_left_];
+	printf("%lld edges\n", num_edges_);
 
-		//right_vertex_dists_[i] = std::discrete_distribution<int>(weights, weights + num_adj_vertices_[i]);
-		right_vertex_samplers_[i].Init(weights, num_adj_vertices_[i]);
-		delete[] weights;
+	int *adj_vertices = new int[num_edges_];
+	unsigned short *adj_weights = new unsigned short[num_edges_];
+	unsigned int *right_prob = new unsigned int[num_edges_];
+	int *right_alias = new int[num_edges_];
+
+	fseek(fp, pos_rows, SEEK_SET);
+	for (int i = 0; i < num_vertex_left_; ++i)
+	{
+		int num_adj_vertices = 0;
+		fread(&num_adj_vertices, sizeof(int), 1, fp);
+		fread(adj_vertices + adj_offsets[i], sizeof(int), num_adj_vertices, fp);
+		fread(adj_weights + adj_offsets[i], sizeof(unsigned short), num_adj_vertices, fp);
 
 		if (i % 100000 == 100000 - 1)
 			printf("%d\n", i + 1);
 	}
 
 	fclose(fp);
+	auto read_time = std::chrono::steady_clock::now();
+
+	// Per row tables. Each thread takes a run of rows holding about the same
+	// number of edges.
+	int *left_weights = new int[num_vertex_left_];
+	int *row_begs = new int[num_threads + 1];
+	for (int t = 0; t <= num_threads; ++t)
+		row_begs[t] = (int)(std::lower_bound(adj_offsets, adj_offsets + num_vertex_left_,
+			num_edges_ * t / num_threads) - adj_offsets);
+	row_begs[num_threads] = num_vertex_left_;
+
+	std::thread *threads = new std::thread[num_threads];
+	for (int t = 0; t < num_threads; ++t)
+	{
+		threads[t] = std::thread([=]
+		{
+			for (int i = row_begs[t]; i < row_begs[t + 1]; ++i)
+			{
+				long long beg = adj_offsets[i];
+				int num_adj_vertices = (int)(adj_offsets[i + 1] - beg);
+				left_weights[i] = 0;
+				for (int j = 0; j < num_adj_vertices; ++j)
+					left_weights[i] += adj_weights[beg + j];
+				AliasSampler::BuildTable(adj_weights + beg, num_adj_vertices, right_prob + beg, right_alias + beg);
+			}
+		});
+	}
+	for (int t = 0; t < num_threads; ++t)
+		threads[t].join();
+	delete[] threads;
+	delete[] row_begs;
+
+	// summed in 64 bits, a right vertex of a large graph can pass INT_MAX
+	long long *right_sums = new long long[num_vertex_right_];
+	std::fill(right_sums, right_sums + num_vertex_right_, 0);
+	for (long long i = 0; i < num_edges_; ++i)
+	{
+		right_sums[adj_vertices[i]] += adj_weights[i];
+		sum_weights_ += adj_weights[i];
+	}
+	int *right_weights = new int[num_vertex_right_];
+	for (int i = 0; i < num_vertex_right_; ++i)
+		right_weights[i] = (int)std::min(right_sums[i], (long long)INT_MAX);
+	delete[] right_sums;
 
-	left_vertex_dist_ = std::discrete_distribution<int>(left_weights,
-		left_weights + num_vertex_left_);
-	//printf("num: %d\n", num_vertex_left_);
-	//left_vertex_sampler_.Init(left_weights, num_vertex_left_);
+	adj_offsets_ = adj_offsets;
+	adj_vertices_ = adj_vertices;
+	adj_weights_ = adj_weights;
+	right_prob_ = right_prob;
+	right_alias_ = right_alias;
+
+	left_vertex_sampler_.Init(left_weights, num_vertex_left_);
 
 	float *neg_sampling_weights = NegTrain::GetDefNegativeSamplingWeights(right_weights,
 		num_vertex_right_);
-	neg_sampling_dist_ = std::discrete_distribution<int>(neg_sampling_weights,
-		neg_sampling_weights + num_vertex_right_);
+	neg_sampler_.Init(neg_sampling_weights, num_vertex_right_);
 	delete[] neg_sampling_weights;
 
 	delete[] left_weights;
 	delete[] right_weights;
 
-	printf("done.\n");
+	auto end_time = std::chrono::steady_clock::now();
+	printf("%s done. read %.2f s, tables %.2f s (%d threads).\n", adj_list_file_name,
+		std::chrono::duration<double>(read_time - beg_time).count(),
+		std::chrono::duration<double>(end_time - read_time).count(), num_threads);
 }
 
-PairSampler::~PairSampler()
+// A CSR file that cannot be used is fatal rather than a reason to parse it
+// as an adjacency list.
+static void csrError(const char *csr_file_name, const char *what)
 {
-	if (right_vertex_dists_ != 0)
-		delete[] right_vertex_dists_;
-	if (right_vertex_samplers_ != 0)
-		delete[] right_vertex_samplers_;
+	printf("%s: %s\n", csr_file_name, what);
+	exit(1);
 }
 
-void PairSampler::SamplePair(int &lidx, int &ridx, std::default_random_engine &generator)
+bool PairSampler::mapCSR(const char *csr_file_name)
 {
-	lidx = left_vertex_dist_(generator);
-	//ridx = adj_list_[lidx][right_vertex_dists_[lidx](generator)];
-	//lidx = left_vertex_sampler_.Sample(generator);
-	int tmp = right_vertex_samplers_[lidx].Sample(generator);
-	ridx = adj_list_[lidx][tmp];
-	++cnts_[lidx][tmp];
-	//ridx = adj_list_[lidx][rand() % num_adj_vertices_[lidx]];
+	// the binary files of EMADR start with this, adjacency lists do not
+	static const size_t kFamilyMagicLen = 5;
+
+	MappedFile *csr_file = new MappedFile();
+	if (!csr_file->Open(csr_file_name) || csr_file->size() < (long long)kFamilyMagicLen
+		|| memcmp(csr_file->data(), kCSRMagic, kFamilyMagicLen) != 0)
+	{
+		delete csr_file;
+		return false;
+	}
+	if (csr_file->size() < (long long)sizeof(CSRFileHeader)
+		|| memcmp(csr_file->data(), kCSRMagic, sizeof(kCSRMagic)) != 0)
+		csrError(csr_file_name, "not a CSR file");
+
+	const char *data = csr_file->data();
+	const CSRFileHeader *header = (const CSRFileHeader*)data;
+	if (header->version != kCSRVersion)
+	{
+		printf("%s: unsupported CSR version %d\n", csr_file_name, header->version);
+		exit(1);
+	}
+
+	// every section has to lie in the file, at an offset its elements can be read from
+	long long num_left = header->num_vertex_left, num_right = header->num_vertex_right;
+	long long num_edges = header->num_edges;
+	if (num_left < 0 || num_right < 0 || num_edges < 0 || header->sum_weights < 0)
+		csrError(csr_file_name, "negative sizes in the header");
+	// vertex ids are ints, and the left table has num_left + 1 offsets
+	if (num_left >= INT_MAX || num_right > INT_MAX)
+		csrError(csr_file_name, "too many vertices in the header");
+	const long long elem_sizes[kNumCSRSections] = { sizeof(long long), sizeof(int), sizeof(unsigned short),
+		sizeof(unsigned int), sizeof(int), sizeof(unsigned int), sizeof(int), sizeof(unsigned int), sizeof(int) };
+	const long long num_elems[kNumCSRSections] = { num_left + 1, num_edges, num_edges, num_edges, num_edges,
+		num_left, num_left, num_right, num_right };
+	const long long file_size = csr_file->size();
+	for (int i = 0; i < kNumCSRSections; ++i)
+	{
+		long long offset = header->section_offsets[i];
+		if (offset < (long long)sizeof(CSRFileHeader) || offset > file_size || offset % kCSRAlignment != 0
+			|| num_elems[i] > (file_size - offset) / elem_sizes[i])
+			csrError(csr_file_name, "truncated or corrupt CSR file");
+	}
+
+	const long long *offsets = header->section_offsets;
+	const long long *adj_offsets = (const long long*)(data + offsets[kAdjOffsets]);
+	if (adj_offsets[0] != 0 || adj_offsets[num_left] != num_edges)
+		csrError(csr_file_name, "row offsets do not match the edges");
+	for (long long i = 0; i < num_left; ++i)
+	{
+		if (adj_offsets[i + 1] < adj_offsets[i])
+			csrError(csr_file_name, "row offsets do not match the edges");
+	}
+
+	// every vertex the samplers can return, and every alias they can follow,
+	// since the trainer writes to the rows they name
+	const int *adj_vertices = (const int*)(data + offsets[kAdjVertices]);
+	const unsigned short *adj_weights = (const unsigned short*)(data + offsets[kAdjWeights]);
+	const int *right_alias = (const int*)(data + offsets[kRightAlias]);
+	long long sum_weights = 0;
+	for (long long i = 0; i < num_left; ++i)
+	{
+		long long beg = adj_offsets[i], len = adj_offsets[i + 1] - beg;
+		if (len > INT_MAX)
+			csrError(csr_file_name, "row too long");
+		for (long long j = beg; j < beg + len; ++j)
+		{
+			if (adj_vertices[j] < 0 || adj_vertices[j] >= num_right)
+				csrError(csr_file_name, "edge to a vertex out of range");
+			if (right_alias[j] < 0 || right_alias[j] >= len)
+				csrError(csr_file_name, "row alias out of range");
+			sum_weights += adj_weights[j];
+		}
+	}
+	if (sum_weights != header->sum_weights)
+		csrError(csr_file_name, "summed weights do not match the edges");
+	const int *left_alias = (const int*)(data + offsets[kLeftAlias]);
+	for (long long i = 0; i < num_left; ++i)
+	{
+		if (left_alias[i] < 0 || left_alias[i] >= num_left)
+			csrError(csr_file_name, "left alias out of range");
+	}
+	const int *neg_alias = (const int*)(data + offsets[kNegAlias]);
+	for (long long i = 0; i < num_right; ++i)
+	{
+		if (neg_alias[i] < 0 || neg_alias[i] >= num_right)
+			csrError(csr_file_name, "negative alias out of range");
+	}
+
+	printf("mapping %s ...\n", csr_file_name);
+	csr_file_ = csr_file;
+	num_vertex_left_ = header->num_vertex_left;
+	num_vertex_right_ = header->num_vertex_right;
+	num_edges_ = header->num_edges;
+	sum_weights_ = header->sum_weights;
+	printf("left: %d right: %d\n%lld edges\n", num_vertex_left_, num_vertex_right_, num_edges_);
+
+	adj_offsets_ = adj_offsets;
+	adj_vertices_ = adj_vertices;
+	adj_weights_ = adj_weights;
+	right_prob_ = (const unsigned int*)(data + offsets[kRightProb]);
+	right_alias_ = right_alias;
+	left_vertex_sampler_.Attach((const unsigned int*)(data + offsets[kLeftProb]), left_alias, num_vertex_left_);
+	neg_sampler_.Attach((const unsigned int*)(data + offsets[kNegProb]), neg_alias, num_vertex_right_);
+
+	printf("done.\n");
+	return true;
 }
 
-void PairSampler::SamplePair(int &lidx, int &ridx, std::default_random_engine &generator, RandGen &rand_gen)
+void PairSampler::SamplePair(int &lidx, int &ridx, FastRng &rng)
 {
-	lidx = left_vertex_dist_(generator);
-	//ridx = adj_list_[lidx][right_vertex_dists_[lidx](generator)];
-	//lidx = left_vertex_sampler_.Sample(generator);
-	int tmp = right_vertex_samplers_[lidx].Sample(rand_gen);
-	ridx = adj_list_[lidx][tmp];
-	++cnts_[lidx][tmp];
-	//ridx = adj_list_[lidx][rand() % num_adj_vertices_[lidx]];
+	lidx = left_vertex_sampler_.Sample(rng);
+	unsigned int col_rand = rng.NextUInt();
+	ridx = sampleRight(lidx, col_rand, rng.NextUInt());
 }
 
-int PairSampler::SampleRight(int lidx, RandGen &rand_gen)
+int PairSampler::SampleRight(int lidx, FastRng &rng)
 {
-	if (num_adj_vertices_[lidx] == 0)
+	if (adj_offsets_[lidx + 1] == adj_offsets_[lidx])
 		return -1;
 
-	int tmp = right_vertex_samplers_[lidx].Sample(rand_gen);
-	int ridx = adj_list_[lidx][tmp];
-	++cnts_[lidx][tmp];
-
-	return ridx;
+	unsigned int col_rand = rng.NextUInt();
+	return sampleRight(lidx, col_rand, rng.NextUInt());
 }
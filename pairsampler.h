@@ -1,28 +1,66 @@
 #ifndef PAIRSAMPLER_H_
 #define PAIRSAMPLER_H_
 
-#include <random>
+#include <atomic>
+#include <mutex>
+#include <vector>
 
-#include "multinomialsampler.h"
+#include "aliassampler.h"
+#include "mappedfile.h"
 
 class PairSampler
 {
 public:
-	PairSampler(const char *adj_list_file_name);
+	// Converts an adjacency list file to the CSR format, which PairSampler
+	// maps into memory as it is instead of parsing it and building the
+	// sampling tables. false if the CSR file could not be written.
+	static bool ConvertToCSR(const char *adj_list_file_name, const char *dst_csr_file_name);
+
+public:
+	// adj_list_file_name is either an adjacency list file or a CSR file made
+	// by ConvertToCSR; the format is detected from the file header. A CSR
+	// file of another version, whose sections do not fit in it, or whose
+	// vertex ids or alias entries are out of range, ends the program, as
+	// does any other binary file of EMADR.
+	// num_threads threads build the per row tables of an adjacency list file.
+	PairSampler(const char *adj_list_file_name, int num_threads = 1);
 
 	~PairSampler();
 
-	void SamplePair(int &lidx, int &ridx, std::default_random_engine &generator);
-	void SamplePair(int &lidx, int &ridx, std::default_random_engine &generator, RandGen &rand_gen);
+	// A copy of the sampling arrays in memory first touched by the calling
+	// thread, e.g. a per-node replica made from NumaUtils::RunOnNode. Sample
+	// stats are not copied.
+	PairSampler *Clone();
+
+	// false, with the file left as it was, if it could not be written whole
+	bool SaveCSR(const char *dst_file_name);
+
+	void SamplePair(int &lidx, int &ridx, FastRng &rng);
+
+	// the left vertex of SamplePair, by its summed edge weights
+	int SampleLeft(FastRng &rng)
+	{
+		return left_vertex_sampler_.Sample(rng);
+	}
+
+	int SampleRight(int lidx, FastRng &rng);
 
-	int SampleRight(int lidx, RandGen &rand_gen);
+	// sum of the edge weights of left vertex lidx
+	int LeftWeight(int lidx)
+	{
+		int weight = 0;
+		for (long long i = adj_offsets_[lidx]; i < adj_offsets_[lidx + 1]; ++i)
+			weight += adj_weights_[i];
+		return weight;
+	}
 
-	std::discrete_distribution<int> *neg_sampling_dist()
+	// built from the right vertex degrees, can be shared with NegTrain
+	AliasSampler *neg_sampler()
 	{
-		return &neg_sampling_dist_;
+		return &neg_sampler_;
 	}
 
-	int sum_weights()
+	long long sum_weights()
 	{
 		return sum_weights_;
 	}
@@ -37,8 +75,29 @@ public:
 		return num_vertex_right_;
 	}
 
+	// Per edge sample counters, off by default so that sampling does no
+	// shared writes. When enabled, each thread counts into its own shard,
+	// picked with SetStatsShard, and FlushSampleStats adds the shard of the
+	// calling thread to the totals, e.g. at the end of a round.
+	void EnableSampleStats(int num_shards);
+	void FlushSampleStats();
+
+	static void SetStatsShard(int shard)
+	{
+		cur_stats_shard_ = shard;
+	}
+
+	bool sample_stats_enabled()
+	{
+		return stat_shards_ != 0;
+	}
+
+	// number of edges never sampled, from the flushed totals
 	int CountZeros()
 	{
+		if (cnts_ == 0)
+			return -1;
+
 		int cnt = 0;
 		const int len = 5;
 		int tmpcnts[len];
@@ -46,14 +105,16 @@ public:
 			tmpcnts[i] = 0;
 		for (int i = 0; i < num_vertex_left_; ++i)
 		{
-			for (int j = 0; j < num_adj_vertices_[i]; ++j)
+			int num_adj_vertices = (int)(adj_offsets_[i + 1] - adj_offsets_[i]);
+			int *cnts = cnts_ + adj_offsets_[i];
+			for (int j = 0; j < num_adj_vertices; ++j)
 			{
-				if (num_adj_vertices_[i] == len)
-					tmpcnts[j] += cnts_[i][j];
-				if (cnts_[i][j] == 0)
+				if (num_adj_vertices == len)
+					tmpcnts[j] += cnts[j];
+				if (cnts[j] == 0)
 				{
 					++cnt;
-					//printf("%d %d\n", j, num_adj_vertices_[i]);
+					//printf("%d %d\n", j, num_adj_vertices);
 				}
 			}
 		}
@@ -63,23 +124,142 @@ public:
 		return cnt;
 	}
 
+	// Cuts the edges into the blocks of EdgeStream epochs: runs of
+	// consecutive CSR edges of about kEpochBlockWeight summed weight. It
+	// also starts the shared walk over at epoch 0, with the block orders of
+	// the epochs keyed by seed. Call before any EdgeStream with epochs is
+	// made; replicas made by Clone afterwards share the cut and the walk,
+	// and must not outlive this sampler. Edges of no weight at all give no
+	// blocks, and the EdgeStreams of such a sampler draw with SamplePair.
+	void InitEpochBlocks(unsigned long long seed = 0);
+
+	static const int kEpochBlockWeight = 4096;
+
+	// The pairs one thread trains on: the i.i.d. draws of SamplePair, or
+	// with epochs a block-shuffled walk of the edges shared by the threads.
+	// An epoch of the walk visits every edge as many times as its weight,
+	// which is what sum_weights() draws of SamplePair give in expectation,
+	// with no edge missed. Each epoch has its own shuffled block order, and
+	// the streams claim the next block of it from a cursor in the sampler,
+	// so that all threads together walk each epoch once; the visits of the
+	// edges of a block come in shuffled order, and a thread thus streams
+	// through a few rows at a time. The cursor runs on from one epoch into
+	// the next, whatever the rounds of the trainer.
+	//
+	// With num_threads > 0 the stream instead takes every num_threads-th
+	// block of each epoch from thread_idx on, for the deterministic trainer,
+	// as the claims of the shared cursor depend on the timing of the threads.
+	class EdgeStream
+	{
+	public:
+		EdgeStream(PairSampler *sampler, bool epochs, int thread_idx = 0, int num_threads = 0)
+			: sampler_(sampler), epochs_(epochs && sampler->epoch_cursor_ != 0),
+			num_threads_(num_threads), next_claim_(thread_idx)
+		{
+		}
+
+		void Next(int &lidx, int &ridx, FastRng &rng)
+		{
+			if (!epochs_)
+			{
+				sampler_->SamplePair(lidx, ridx, rng);
+				return;
+			}
+			// blocks of weight 0 edges have no visits, but every epoch has some
+			while (pos_ == visits_.size())
+				nextBlock(rng);
+			const Visit &visit = visits_[pos_++];
+			lidx = visit.left;
+			ridx = sampler_->adj_vertices_[visit.edge];
+			if (sampler_->stat_shards_ != 0)
+				++sampler_->stat_shards_[cur_stats_shard_][visit.edge];
+		}
+
+		// the epoch of the block being walked, -1 before the first
+		int epoch()
+		{
+			return epoch_;
+		}
+
+	private:
+		struct Visit
+		{
+			long long edge;
+			int left;
+		};
+
+		void nextBlock(FastRng &rng);
+
+	private:
+		PairSampler *sampler_;
+		bool epochs_;
+		int num_threads_;
+		// the next claim of a stream with its own share of the blocks
+		long long next_claim_;
+		int epoch_ = -1;
+		std::vector<Visit> visits_;
+		size_t pos_ = 0;
+	};
+
 private:
-	std::discrete_distribution<int> left_vertex_dist_;
+	PairSampler() {}
+	PairSampler(const PairSampler &);
+	PairSampler &operator=(const PairSampler &);
+
+	void loadAdjList(const char *adj_list_file_name, int num_threads);
+	bool mapCSR(const char *csr_file_name);
+
+	// the block of the walk at claim, the claims of epoch e being
+	// [e * num_blocks, (e + 1) * num_blocks)
+	int epochBlock(long long claim, int &epoch);
 
-	std::discrete_distribution<int> *right_vertex_dists_ = 0;
+	int sampleRight(int lidx, unsigned int col_rand, unsigned int coin_rand)
+	{
+		long long beg = adj_offsets_[lidx];
+		int tmp = AliasSampler::Sample(right_prob_ + beg, right_alias_ + beg,
+			(int)(adj_offsets_[lidx + 1] - beg), col_rand, coin_rand);
+		if (stat_shards_ != 0)
+			++stat_shards_[cur_stats_shard_][beg + tmp];
+		return adj_vertices_[beg + tmp];
+	}
 
-	std::discrete_distribution<int> neg_sampling_dist_;
+private:
+	AliasSampler left_vertex_sampler_;
 
-	//MultinomialSampler left_vertex_sampler_;
-	MultinomialSampler *right_vertex_samplers_ = 0;
+	AliasSampler neg_sampler_;
 
 	int num_vertex_left_ = 0;
 	int num_vertex_right_ = 0;
-	int **adj_list_;
-	int *num_adj_vertices_;
-	int sum_weights_ = 0;
+	long long num_edges_ = 0;
+	long long sum_weights_ = 0;
+
+	// CSR adjacency: the edges of left vertex i are [adj_offsets_[i], adj_offsets_[i + 1])
+	const long long *adj_offsets_ = 0;
+	const int *adj_vertices_ = 0;
+	const unsigned short *adj_weights_ = 0;
+
+	// per row alias tables, laid out the same way as adj_vertices_
+	const unsigned int *right_prob_ = 0;
+	const int *right_alias_ = 0;
+
+	// edge offsets of the EdgeStream blocks: block b is
+	// [epoch_blocks_[b], epoch_blocks_[b + 1])
+	std::vector<long long> epoch_blocks_;
+	unsigned long long epoch_seed_ = 0;
+	// claims of the shared walk so far, owned by the sampler that was not
+	// made by Clone
+	std::atomic<long long> *epoch_cursor_ = 0;
+	bool own_epoch_cursor_ = false;
+
+	// set when the arrays above point into a mapped CSR file
+	MappedFile *csr_file_ = 0;
+
+	static thread_local int cur_stats_shard_;
 
-	int **cnts_ = 0;
+	int num_stat_shards_ = 0;
+	int **stat_shards_ = 0;
+	int *cnts_ = 0;
+	std::mutex stats_mutex_;
 };
 
 #endif
@@ -0,0 +1,95 @@
+#include "quantizedtable.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <functional>
+
+#include "memutils.h"
+#include "embeddingtable.h"
+
+float QuantizedTable::QuantizeRow(const float *src, int dim, signed char *dst)
+{
+	float max_abs = 0;
+	for (int i = 0; i < dim; ++i)
+		max_abs = std::max(max_abs, fabsf(src[i]));
+	if (max_abs == 0)
+	{
+		memset(dst, 0, dim);
+		return 0;
+	}
+
+	float scale = max_abs / 127, inv_scale = 127 / max_abs;
+	for (int i = 0; i < dim; ++i)
+	{
+		long q = lrintf(src[i] * inv_scale);
+		dst[i] = (signed char)(q > 127 ? 127 : (q < -127 ? -127 : q));
+	}
+	return scale;
+}
+
+QuantizedTable *QuantizedTable::FromTable(EmbeddingTable &vecs)
+{
+	QuantizedTable *table = new QuantizedTable(vecs.num_rows(), vecs.dim());
+	float *row = new float[vecs.dim()];
+	for (int i = 0; i < vecs.num_rows(); ++i)
+	{
+		vecs.LoadRow(i, row);
+		table->SetRow(i, row);
+	}
+	delete[] row;
+	return table;
+}
+
+QuantizedTable::QuantizedTable(int num_rows, int dim) : num_rows_(num_rows), dim_(dim),
+	stride_(EmbeddingTable::GetStride(dim, 1))
+{
+	data_ = (signed char*)MemUtils::AlignedAlloc((long long)num_rows * stride_, kAlignment);
+	memset(data_, 0, (long long)num_rows * stride_);
+	scales_ = new float[num_rows];
+	norms_ = new float[num_rows];
+}
+
+QuantizedTable::~QuantizedTable()
+{
+	MemUtils::AlignedFree(data_);
+	delete[] scales_;
+	delete[] norms_;
+}
+
+void QuantizedTable::SetRow(int idx, const float *src)
+{
+	scales_[idx] = QuantizeRow(src, dim_, Row(idx));
+	norms_[idx] = sqrtf((float)SimdKernels::DotInt8(Row(idx), Row(idx), dim_));
+}
+
+void QuantizedTable::ComputeNorms()
+{
+	for (int i = 0; i < num_rows_; ++i)
+		norms_[i] = sqrtf((float)SimdKernels::DotInt8(Row(i), Row(i), dim_));
+}
+
+void QuantizedTable::Dequantize(int idx, float *dst)
+{
+	const signed char *row = Row(idx);
+	for (int i = 0; i < dim_; ++i)
+		dst[i] = row[i] * scales_[idx];
+}
+
+void QuantizedTable::CloseVectors(int idx)
+{
+	const int k = std::min(10, num_rows_ - 1);
+	std::vector<std::pair<float, int> > sims;
+	sims.reserve(num_rows_);
+	for (int i = 0; i < num_rows_; ++i)
+	{
+		if (i != idx)
+			sims.push_back(std::make_pair(Cosine(idx, i), i));
+	}
+	std::partial_sort(sims.begin(), sims.begin() + k, sims.end(), std::greater<std::pair<float, int> >());
+
+	for (int i = 0; i < k; ++i)
+		printf("%d\t%f\n", sims[i].second, sims[i].first);
+}
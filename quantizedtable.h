@@ -0,0 +1,104 @@
+#ifndef QUANTIZEDTABLE_H_
+#define QUANTIZEDTABLE_H_
+
+#include "simdkernels.h"
+
+class EmbeddingTable;
+
+// A num_rows x dim table of int8 vectors for similarity lookups on saved
+// vectors, a quarter of the fp32 size. Each row has its own scale,
+// max |v| / 127, and v[i] ~ scale * q[i]. The norm of every int8 row is
+// kept as well, so a cosine is one integer dot product and a division; the
+// scales cancel out. Rows are padded to 64 bytes like EmbeddingTable.
+class QuantizedTable
+{
+public:
+	static const int kAlignment = 64;
+
+	// returns the scale
+	static float QuantizeRow(const float *src, int dim, signed char *dst);
+
+	static QuantizedTable *FromTable(EmbeddingTable &vecs);
+
+public:
+	// rows are left uninitialized
+	QuantizedTable(int num_rows, int dim);
+	~QuantizedTable();
+
+	void SetRow(int idx, const float *src);
+	// after the rows were filled in directly
+	void ComputeNorms();
+	void Dequantize(int idx, float *dst);
+
+	signed char *Row(int idx)
+	{
+		return data_ + (long long)idx * stride_;
+	}
+
+	float scale(int idx)
+	{
+		return scales_[idx];
+	}
+
+	// of the int8 row
+	float norm(int idx)
+	{
+		return norms_[idx];
+	}
+
+	// approximates the dot product of the fp32 rows
+	float Dot(int idx0, int idx1)
+	{
+		return SimdKernels::DotInt8(Row(idx0), Row(idx1), dim_) * scales_[idx0] * scales_[idx1];
+	}
+
+	float Cosine(int idx0, int idx1)
+	{
+		return Cosine(Row(idx0), norms_[idx0], idx1);
+	}
+
+	// cosine between a query quantized with QuantizeRow and row idx
+	float Cosine(const signed char *query, float query_norm, int idx)
+	{
+		float denom = query_norm * norms_[idx];
+		return denom == 0 ? 0 : SimdKernels::DotInt8(query, Row(idx), dim_) / denom;
+	}
+
+	int num_rows()
+	{
+		return num_rows_;
+	}
+
+	int dim()
+	{
+		return dim_;
+	}
+
+	int stride()
+	{
+		return stride_;
+	}
+
+	float *scales()
+	{
+		return scales_;
+	}
+
+	// prints the 10 rows closest to row idx, as NegTrain::CloseVectors does
+	// for fp32 vectors
+	void CloseVectors(int idx);
+
+private:
+	QuantizedTable(const QuantizedTable &);
+	QuantizedTable &operator=(const QuantizedTable &);
+
+private:
+	int num_rows_ = 0;
+	int dim_ = 0;
+	int stride_ = 0;
+	signed char *data_ = 0;
+	float *scales_ = 0;
+	float *norms_ = 0;
+};
+
+#endif
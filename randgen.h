@@ -12,12 +12,24 @@ public:
 		next_random_ = seed;
 	}
 
+	unsigned long long state()
+	{
+		return next_random_;
+	}
+
 	long long NextRandom()
 	{
 		next_random_ = next_random_ * (unsigned long long)25214903917 + 11;
 		return (long long)(next_random_ << 1);
 	}
 
+	// the high bits of the LCG state are the well mixed ones
+	unsigned int NextUInt()
+	{
+		next_random_ = next_random_ * (unsigned long long)25214903917 + 11;
+		return (unsigned int)(next_random_ >> 32);
+	}
+
 private:
 	unsigned long long next_random_ = 1;
 };
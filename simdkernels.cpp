@@ -0,0 +1,1206 @@
+#include "simdkernels.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#define TARGET_AVX512_VNNI __attribute__((target("avx512f,avx512bw,avx512vnni")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#define TARGET_AVX512_VNNI
+#endif
+
+static float dotProductScalar(const float *vec0, const float *vec1, int len)
+{
+	float dot_prod = 0;
+	for (int i = 0; i < len; ++i)
+		dot_prod += vec0[i] * vec1[i];
+	return dot_prod;
+}
+
+static void axpyScalar(float a, const float *src, float *dst, int len)
+{
+	for (int i = 0; i < len; ++i)
+		dst[i] += a * src[i];
+}
+
+static void axpyDecayScalar(float a, const float *src, float lambda, float *dst, int len)
+{
+	for (int i = 0; i < len; ++i)
+		dst[i] += a * src[i] - lambda * dst[i];
+}
+
+static void updatePairScalar(float g, float lambda, const float *vec0, float *vec1,
+	float *neu1e, int len)
+{
+	for (int i = 0; i < len; ++i)
+	{
+		neu1e[i] += g * vec1[i];
+		vec1[i] += g * vec0[i] - lambda * vec1[i];
+	}
+}
+
+static void pairDeltaScalar(float g, float lambda, const float *vec0, const float *vec1, float *neu1e,
+	float *delta1, int len)
+{
+	for (int i = 0; i < len; ++i)
+	{
+		neu1e[i] += g * vec1[i];
+		delta1[i] = g * vec0[i] - lambda * vec1[i];
+	}
+}
+
+// The sigmoid takes exp(-x) as 2^n * exp(r) with n = round(-x / ln 2) and
+// |r| <= ln 2 / 2, exp(r) from the degree 6 polynomial of Cephes expf and ln 2
+// split in two so that r is exact. Clamping x to +-kSigmoidMaxX keeps 2^n a
+// normal float, and sigmoid(80) is 1 and sigmoid(-80) 1.8e-35 in float anyway.
+static const float kSigmoidMaxX = 80.0f;
+static const float kLog2e = 1.44269504088896341f;
+static const float kLn2Hi = 0.693359375f, kLn2Lo = -2.12194440e-4f;
+static const float kExpPoly[6] = { 1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+	4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f };
+
+static void sigmoidScalar(const float *src, float *dst, int len)
+{
+	for (int i = 0; i < len; ++i)
+	{
+		float t = -std::min(kSigmoidMaxX, std::max(-kSigmoidMaxX, src[i]));
+		float n = nearbyintf(t * kLog2e);
+		float r = t - n * kLn2Hi - n * kLn2Lo;
+		float p = kExpPoly[0];
+		for (int k = 1; k < 6; ++k)
+			p = p * r + kExpPoly[k];
+		p = p * r * r + r + 1;
+		unsigned int bits = (unsigned int)((int)n + 127) << 23;
+		float scale;
+		memcpy(&scale, &bits, 4);
+		dst[i] = 1 / (1 + p * scale);
+	}
+}
+
+static inline unsigned long long rotl64(unsigned long long x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static void xoshiroScalar(unsigned long long *state, unsigned int *dst, int num_steps)
+{
+	for (int step = 0; step < num_steps; ++step)
+	{
+		for (int l = 0; l < 8; ++l)
+		{
+			unsigned long long *s0 = state + l, *s1 = s0 + 8, *s2 = s0 + 16, *s3 = s0 + 24;
+			unsigned long long result = rotl64(*s0 + *s3, 23) + *s0;
+			unsigned long long t = *s1 << 17;
+			*s2 ^= *s0;
+			*s3 ^= *s1;
+			*s1 ^= *s2;
+			*s0 ^= *s3;
+			*s2 ^= t;
+			*s3 = rotl64(*s3, 45);
+			dst[2 * l] = (unsigned int)result;
+			dst[2 * l + 1] = (unsigned int)(result >> 32);
+		}
+		dst += 16;
+	}
+}
+
+static void dotBlockScalar(const float *const *rows0, int num_rows0, const float *const *rows1,
+	int num_rows1, int len, float *dst)
+{
+	for (int i = 0; i < num_rows0; ++i)
+		for (int j = 0; j < num_rows1; ++j)
+			dst[i * num_rows1 + j] = dotProductScalar(rows0[i], rows1[j], len);
+}
+
+static void accumBlockScalar(const float *coefs, int num_dst_rows, const float *const *rows1,
+	int num_rows1, int len, float *const *dst_rows)
+{
+	for (int i = 0; i < num_dst_rows; ++i)
+		for (int j = 0; j < num_rows1; ++j)
+			axpyScalar(coefs[i * num_rows1 + j], rows1[j], dst_rows[i], len);
+}
+
+static void dotPackedScalar(const float *const *rows0, int num_rows0, const float *packed1, int stride1,
+	int len, float *dst)
+{
+	for (int i = 0; i < num_rows0; ++i)
+	{
+		float *dst_row = dst + (long long)i * stride1;
+		std::fill(dst_row, dst_row + stride1, 0.0f);
+		for (int k = 0; k < len; ++k)
+		{
+			float a = rows0[i][k];
+			const float *col = packed1 + (long long)k * stride1;
+			for (int j = 0; j < stride1; ++j)
+				dst_row[j] += a * col[j];
+		}
+	}
+}
+
+// random bits for stochastic rounding, a cheap integer hash of (seed, position)
+static inline unsigned int roundingBits(unsigned int seed, int i)
+{
+	unsigned int h = (seed + (unsigned int)i) * 0x9e3779b1u;
+	h ^= h >> 15;
+	h *= 0x85ebca6bu;
+	return h ^ (h >> 13);
+}
+
+static void bf16ToFloatScalar(const unsigned short *src, float *dst, int len)
+{
+	for (int i = 0; i < len; ++i)
+	{
+		unsigned int bits = (unsigned int)src[i] << 16;
+		memcpy(dst + i, &bits, 4);
+	}
+}
+
+static void floatToBf16Scalar(const float *src, unsigned short *dst, int len, unsigned int seed)
+{
+	for (int i = 0; i < len; ++i)
+	{
+		unsigned int bits;
+		memcpy(&bits, src + i, 4);
+		dst[i] = (unsigned short)((bits + (roundingBits(seed, i) & 0xffff)) >> 16);
+	}
+}
+
+static float halfToFloat(unsigned short h)
+{
+	unsigned int sign = (unsigned int)(h & 0x8000) << 16, exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+	if (exp == 0)
+	{
+		// zero or subnormal: mant * 2^-24
+		float val = mant * (1.0f / (1 << 24));
+		return sign ? -val : val;
+	}
+	unsigned int bits = exp == 31 ? sign | 0x7f800000u | (mant << 13) : sign | ((exp + 112) << 23) | (mant << 13);
+	float val;
+	memcpy(&val, &bits, 4);
+	return val;
+}
+
+// rounds toward zero, like vcvtps2ph with _MM_FROUND_TO_ZERO
+static unsigned short floatBitsToHalfTrunc(unsigned int bits)
+{
+	unsigned int sign = (bits >> 16) & 0x8000, mant = bits & 0x7fffff;
+	int float_exp = (bits >> 23) & 0xff;
+	if (float_exp == 0xff)
+		return (unsigned short)(sign | 0x7c00 | (mant != 0 ? 0x200 : 0));
+	int exp = float_exp - 127 + 15;
+	if (exp >= 31)
+		return (unsigned short)(sign | 0x7bff);
+	if (exp <= 0)
+	{
+		if (exp < -10)
+			return (unsigned short)sign;
+		return (unsigned short)(sign | ((mant | 0x800000) >> (14 - exp)));
+	}
+	return (unsigned short)(sign | (exp << 10) | (mant >> 13));
+}
+
+static void fp16ToFloatScalar(const unsigned short *src, float *dst, int len)
+{
+	for (int i = 0; i < len; ++i)
+		dst[i] = halfToFloat(src[i]);
+}
+
+static void floatToFp16Scalar(const float *src, unsigned short *dst, int len, unsigned int seed)
+{
+	for (int i = 0; i < len; ++i)
+	{
+		unsigned int bits;
+		memcpy(&bits, src + i, 4);
+		dst[i] = floatBitsToHalfTrunc(bits + (roundingBits(seed, i) & 0x1fff));
+	}
+}
+
+static int dotInt8Scalar(const signed char *vec0, const signed char *vec1, int len)
+{
+	int dot_prod = 0;
+	for (int i = 0; i < len; ++i)
+		dot_prod += vec0[i] * vec1[i];
+	return dot_prod;
+}
+
+TARGET_AVX2 static inline float hsumAvx2(__m256 v)
+{
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+	return _mm_cvtss_f32(sum);
+}
+
+TARGET_AVX2 static float dotProductAvx2(const float *vec0, const float *vec1, int len)
+{
+	__m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= len; i += 16)
+	{
+		sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(vec0 + i), _mm256_loadu_ps(vec1 + i), sum0);
+		sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(vec0 + i + 8), _mm256_loadu_ps(vec1 + i + 8), sum1);
+	}
+	if (i + 8 <= len)
+	{
+		sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(vec0 + i), _mm256_loadu_ps(vec1 + i), sum0);
+		i += 8;
+	}
+	float dot_prod = hsumAvx2(_mm256_add_ps(sum0, sum1));
+	for (; i < len; ++i)
+		dot_prod += vec0[i] * vec1[i];
+	return dot_prod;
+}
+
+TARGET_AVX2 static void axpyAvx2(float a, const float *src, float *dst, int len)
+{
+	__m256 av = _mm256_set1_ps(a);
+	int i = 0;
+	for (; i + 8 <= len; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_fmadd_ps(av, _mm256_loadu_ps(src + i), _mm256_loadu_ps(dst + i)));
+	for (; i < len; ++i)
+		dst[i] += a * src[i];
+}
+
+TARGET_AVX2 static void axpyDecayAvx2(float a, const float *src, float lambda, float *dst, int len)
+{
+	__m256 av = _mm256_set1_ps(a), lv = _mm256_set1_ps(lambda);
+	int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		__m256 d = _mm256_loadu_ps(dst + i);
+		d = _mm256_fmadd_ps(av, _mm256_loadu_ps(src + i), _mm256_fnmadd_ps(lv, d, d));
+		_mm256_storeu_ps(dst + i, d);
+	}
+	for (; i < len; ++i)
+		dst[i] += a * src[i] - lambda * dst[i];
+}
+
+TARGET_AVX2 static void updatePairAvx2(float g, float lambda, const float *vec0, float *vec1,
+	float *neu1e, int len)
+{
+	__m256 gv = _mm256_set1_ps(g), lv = _mm256_set1_ps(lambda);
+	int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		__m256 v1 = _mm256_loadu_ps(vec1 + i);
+		_mm256_storeu_ps(neu1e + i, _mm256_fmadd_ps(gv, v1, _mm256_loadu_ps(neu1e + i)));
+		v1 = _mm256_fmadd_ps(gv, _mm256_loadu_ps(vec0 + i), _mm256_fnmadd_ps(lv, v1, v1));
+		_mm256_storeu_ps(vec1 + i, v1);
+	}
+	for (; i < len; ++i)
+	{
+		neu1e[i] += g * vec1[i];
+		vec1[i] += g * vec0[i] - lambda * vec1[i];
+	}
+}
+
+TARGET_AVX2 static void pairDeltaAvx2(float g, float lambda, const float *vec0, const float *vec1, float *neu1e,
+	float *delta1, int len)
+{
+	__m256 gv = _mm256_set1_ps(g), lv = _mm256_set1_ps(lambda);
+	int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		__m256 v1 = _mm256_loadu_ps(vec1 + i);
+		_mm256_storeu_ps(neu1e + i, _mm256_fmadd_ps(gv, v1, _mm256_loadu_ps(neu1e + i)));
+		_mm256_storeu_ps(delta1 + i, _mm256_fnmadd_ps(lv, v1, _mm256_mul_ps(gv, _mm256_loadu_ps(vec0 + i))));
+	}
+	for (; i < len; ++i)
+	{
+		neu1e[i] += g * vec1[i];
+		delta1[i] = g * vec0[i] - lambda * vec1[i];
+	}
+}
+
+TARGET_AVX2 static inline __m256i rotl64Avx2(__m256i x, int k)
+{
+	return _mm256_or_si256(_mm256_slli_epi64(x, k), _mm256_srli_epi64(x, 64 - k));
+}
+
+// the 8 streams as two halves of 4
+TARGET_AVX2 static void xoshiroAvx2(unsigned long long *state, unsigned int *dst, int num_steps)
+{
+	for (int h = 0; h < 8; h += 4)
+	{
+		__m256i s0 = _mm256_loadu_si256((const __m256i*)(state + h));
+		__m256i s1 = _mm256_loadu_si256((const __m256i*)(state + 8 + h));
+		__m256i s2 = _mm256_loadu_si256((const __m256i*)(state + 16 + h));
+		__m256i s3 = _mm256_loadu_si256((const __m256i*)(state + 24 + h));
+		for (int step = 0; step < num_steps; ++step)
+		{
+			__m256i result = _mm256_add_epi64(rotl64Avx2(_mm256_add_epi64(s0, s3), 23), s0);
+			__m256i t = _mm256_slli_epi64(s1, 17);
+			s2 = _mm256_xor_si256(s2, s0);
+			s3 = _mm256_xor_si256(s3, s1);
+			s1 = _mm256_xor_si256(s1, s2);
+			s0 = _mm256_xor_si256(s0, s3);
+			s2 = _mm256_xor_si256(s2, t);
+			s3 = rotl64Avx2(s3, 45);
+			_mm256_storeu_si256((__m256i*)(dst + step * 16 + 2 * h), result);
+		}
+		_mm256_storeu_si256((__m256i*)(state + h), s0);
+		_mm256_storeu_si256((__m256i*)(state + 8 + h), s1);
+		_mm256_storeu_si256((__m256i*)(state + 16 + h), s2);
+		_mm256_storeu_si256((__m256i*)(state + 24 + h), s3);
+	}
+}
+
+TARGET_AVX2 static inline __m256i roundingBitsAvx2(unsigned int seed, int i)
+{
+	__m256i h = _mm256_add_epi32(_mm256_set1_epi32((int)(seed + (unsigned int)i)),
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)0x9e3779b1u));
+	h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+	h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)0x85ebca6bu));
+	return _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+}
+
+TARGET_AVX2 static void bf16ToFloatAvx2(const unsigned short *src, float *dst, int len)
+{
+	int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		__m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_castsi256_ps(_mm256_slli_epi32(v, 16)));
+	}
+	bf16ToFloatScalar(src + i, dst + i, len - i);
+}
+
+TARGET_AVX2 static void floatToBf16Avx2(const float *src, unsigned short *dst, int len, unsigned int seed)
+{
+	int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		__m256i noise = _mm256_and_si256(roundingBitsAvx2(seed, i), _mm256_set1_epi32(0xffff));
+		__m256i v = _mm256_add_epi32(_mm256_castps_si256(_mm256_loadu_ps(src + i)), noise);
+		v = _mm256_srli_epi32(v, 16);
+		// packus works within 128-bit lanes, the permute puts the halves together
+		v = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0x08);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm256_castsi256_si128(v));
+	}
+	for (; i < len; ++i)
+	{
+		unsigned int bits;
+		memcpy(&bits, src + i, 4);
+		dst[i] = (unsigned short)((bits + (roundingBits(seed, i) & 0xffff)) >> 16);
+	}
+}
+
+TARGET_AVX2 static void fp16ToFloatAvx2(const unsigned short *src, float *dst, int len)
+{
+	int i = 0;
+	for (; i + 8 <= len; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+	fp16ToFloatScalar(src + i, dst + i, len - i);
+}
+
+TARGET_AVX2 static void floatToFp16Avx2(const float *src, unsigned short *dst, int len, unsigned int seed)
+{
+	int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		__m256i noise = _mm256_and_si256(roundingBitsAvx2(seed, i), _mm256_set1_epi32(0x1fff));
+		__m256 v = _mm256_castsi256_ps(_mm256_add_epi32(_mm256_castps_si256(_mm256_loadu_ps(src + i)), noise));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC));
+	}
+	for (; i < len; ++i)
+	{
+		unsigned int bits;
+		memcpy(&bits, src + i, 4);
+		dst[i] = floatBitsToHalfTrunc(bits + (roundingBits(seed, i) & 0x1fff));
+	}
+}
+
+// int8 -> int16, then vpmaddwd adds the products in pairs into int32 lanes
+TARGET_AVX2 static int dotInt8Avx2(const signed char *vec0, const signed char *vec1, int len)
+{
+	__m256i sum = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 16 <= len; i += 16)
+	{
+		__m256i a = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(vec0 + i)));
+		__m256i b = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(vec1 + i)));
+		sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a, b));
+	}
+	__m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0x4e));
+	sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0xb1));
+	int dot_prod = _mm_cvtsi128_si32(sum128);
+	for (; i < len; ++i)
+		dot_prod += vec0[i] * vec1[i];
+	return dot_prod;
+}
+
+// sigmoidScalar on 8 lanes
+TARGET_AVX2 static inline __m256 sigmoid8Avx2(__m256 x)
+{
+	__m256 t = _mm256_min_ps(_mm256_set1_ps(kSigmoidMaxX), _mm256_max_ps(_mm256_set1_ps(-kSigmoidMaxX), x));
+	t = _mm256_sub_ps(_mm256_setzero_ps(), t);
+	__m256 n = _mm256_round_ps(_mm256_mul_ps(t, _mm256_set1_ps(kLog2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(kLn2Hi), t);
+	r = _mm256_fnmadd_ps(n, _mm256_set1_ps(kLn2Lo), r);
+	__m256 p = _mm256_set1_ps(kExpPoly[0]);
+	for (int k = 1; k < 6; ++k)
+		p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpPoly[k]));
+	p = _mm256_fmadd_ps(_mm256_mul_ps(p, r), r, _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+	__m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+	__m256 e = _mm256_mul_ps(p, _mm256_castsi256_ps(bits));
+	return _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_add_ps(_mm256_set1_ps(1.0f), e));
+}
+
+TARGET_AVX2 static void sigmoidAvx2(const float *src, float *dst, int len)
+{
+	int i = 0;
+	for (; i + 8 <= len; i += 8)
+		_mm256_storeu_ps(dst + i, sigmoid8Avx2(_mm256_loadu_ps(src + i)));
+	sigmoidScalar(src + i, dst + i, len - i);
+}
+
+// 4 x 2 tiles of dot products: 8 accumulators plus 6 loads fit the 16 ymm registers
+TARGET_AVX2 static void dotBlockAvx2(const float *const *rows0, int num_rows0, const float *const *rows1,
+	int num_rows1, int len, float *dst)
+{
+	int i = 0;
+	for (; i + 4 <= num_rows0; i += 4)
+	{
+		const float *a0 = rows0[i], *a1 = rows0[i + 1], *a2 = rows0[i + 2], *a3 = rows0[i + 3];
+		int j = 0;
+		for (; j + 2 <= num_rows1; j += 2)
+		{
+			const float *b0 = rows1[j], *b1 = rows1[j + 1];
+			__m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps(), c10 = _mm256_setzero_ps(),
+				c11 = _mm256_setzero_ps(), c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps(),
+				c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+			int k = 0;
+			for (; k + 8 <= len; k += 8)
+			{
+				__m256 vb0 = _mm256_loadu_ps(b0 + k), vb1 = _mm256_loadu_ps(b1 + k);
+				__m256 va = _mm256_loadu_ps(a0 + k);
+				c00 = _mm256_fmadd_ps(va, vb0, c00);
+				c01 = _mm256_fmadd_ps(va, vb1, c01);
+				va = _mm256_loadu_ps(a1 + k);
+				c10 = _mm256_fmadd_ps(va, vb0, c10);
+				c11 = _mm256_fmadd_ps(va, vb1, c11);
+				va = _mm256_loadu_ps(a2 + k);
+				c20 = _mm256_fmadd_ps(va, vb0, c20);
+				c21 = _mm256_fmadd_ps(va, vb1, c21);
+				va = _mm256_loadu_ps(a3 + k);
+				c30 = _mm256_fmadd_ps(va, vb0, c30);
+				c31 = _mm256_fmadd_ps(va, vb1, c31);
+			}
+			float r[8] = { hsumAvx2(c00), hsumAvx2(c01), hsumAvx2(c10), hsumAvx2(c11),
+				hsumAvx2(c20), hsumAvx2(c21), hsumAvx2(c30), hsumAvx2(c31) };
+			for (; k < len; ++k)
+			{
+				r[0] += a0[k] * b0[k];
+				r[1] += a0[k] * b1[k];
+				r[2] += a1[k] * b0[k];
+				r[3] += a1[k] * b1[k];
+				r[4] += a2[k] * b0[k];
+				r[5] += a2[k] * b1[k];
+				r[6] += a3[k] * b0[k];
+				r[7] += a3[k] * b1[k];
+			}
+			for (int t = 0; t < 4; ++t)
+			{
+				dst[(i + t) * num_rows1 + j] = r[t * 2];
+				dst[(i + t) * num_rows1 + j + 1] = r[t * 2 + 1];
+			}
+		}
+		for (; j < num_rows1; ++j)
+			for (int t = 0; t < 4; ++t)
+				dst[(i + t) * num_rows1 + j] = dotProductAvx2(rows0[i + t], rows1[j], len);
+	}
+	for (; i < num_rows0; ++i)
+		for (int j = 0; j < num_rows1; ++j)
+			dst[i * num_rows1 + j] = dotProductAvx2(rows0[i], rows1[j], len);
+}
+
+// Each 8 float chunk of rows1[j] is loaded once and applied to 4 destination rows.
+TARGET_AVX2 static void accumBlockAvx2(const float *coefs, int num_dst_rows, const float *const *rows1,
+	int num_rows1, int len, float *const *dst_rows)
+{
+	int i = 0;
+	for (; i + 4 <= num_dst_rows; i += 4)
+	{
+		float *d0 = dst_rows[i], *d1 = dst_rows[i + 1], *d2 = dst_rows[i + 2], *d3 = dst_rows[i + 3];
+		const float *g0 = coefs + i * num_rows1, *g1 = g0 + num_rows1, *g2 = g1 + num_rows1,
+			*g3 = g2 + num_rows1;
+		int k = 0;
+		for (; k + 8 <= len; k += 8)
+		{
+			__m256 acc0 = _mm256_loadu_ps(d0 + k), acc1 = _mm256_loadu_ps(d1 + k),
+				acc2 = _mm256_loadu_ps(d2 + k), acc3 = _mm256_loadu_ps(d3 + k);
+			for (int j = 0; j < num_rows1; ++j)
+			{
+				__m256 vb = _mm256_loadu_ps(rows1[j] + k);
+				acc0 = _mm256_fmadd_ps(_mm256_set1_ps(g0[j]), vb, acc0);
+				acc1 = _mm256_fmadd_ps(_mm256_set1_ps(g1[j]), vb, acc1);
+				acc2 = _mm256_fmadd_ps(_mm256_set1_ps(g2[j]), vb, acc2);
+				acc3 = _mm256_fmadd_ps(_mm256_set1_ps(g3[j]), vb, acc3);
+			}
+			_mm256_storeu_ps(d0 + k, acc0);
+			_mm256_storeu_ps(d1 + k, acc1);
+			_mm256_storeu_ps(d2 + k, acc2);
+			_mm256_storeu_ps(d3 + k, acc3);
+		}
+		for (; k < len; ++k)
+		{
+			for (int j = 0; j < num_rows1; ++j)
+			{
+				float b = rows1[j][k];
+				d0[k] += g0[j] * b;
+				d1[k] += g1[j] * b;
+				d2[k] += g2[j] * b;
+				d3[k] += g3[j] * b;
+			}
+		}
+	}
+	for (; i < num_dst_rows; ++i)
+		for (int j = 0; j < num_rows1; ++j)
+			axpyAvx2(coefs[i * num_rows1 + j], rows1[j], dst_rows[i], len);
+}
+
+// 4 rows0 x 16 rows1 tiles: 8 accumulators, the rows0 values broadcast
+TARGET_AVX2 static void dotPackedAvx2(const float *const *rows0, int num_rows0, const float *packed1, int stride1,
+	int len, float *dst)
+{
+	int i = 0;
+	for (; i + 4 <= num_rows0; i += 4)
+	{
+		const float *a0 = rows0[i], *a1 = rows0[i + 1], *a2 = rows0[i + 2], *a3 = rows0[i + 3];
+		for (int j = 0; j < stride1; j += 16)
+		{
+			__m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps(), c10 = _mm256_setzero_ps(),
+				c11 = _mm256_setzero_ps(), c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps(),
+				c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+			const float *col = packed1 + j;
+			for (int k = 0; k < len; ++k, col += stride1)
+			{
+				__m256 vb0 = _mm256_loadu_ps(col), vb1 = _mm256_loadu_ps(col + 8);
+				__m256 va = _mm256_broadcast_ss(a0 + k);
+				c00 = _mm256_fmadd_ps(va, vb0, c00);
+				c01 = _mm256_fmadd_ps(va, vb1, c01);
+				va = _mm256_broadcast_ss(a1 + k);
+				c10 = _mm256_fmadd_ps(va, vb0, c10);
+				c11 = _mm256_fmadd_ps(va, vb1, c11);
+				va = _mm256_broadcast_ss(a2 + k);
+				c20 = _mm256_fmadd_ps(va, vb0, c20);
+				c21 = _mm256_fmadd_ps(va, vb1, c21);
+				va = _mm256_broadcast_ss(a3 + k);
+				c30 = _mm256_fmadd_ps(va, vb0, c30);
+				c31 = _mm256_fmadd_ps(va, vb1, c31);
+			}
+			float *d = dst + (long long)i * stride1 + j;
+			_mm256_storeu_ps(d, c00);
+			_mm256_storeu_ps(d + 8, c01);
+			_mm256_storeu_ps(d + stride1, c10);
+			_mm256_storeu_ps(d + stride1 + 8, c11);
+			_mm256_storeu_ps(d + 2 * stride1, c20);
+			_mm256_storeu_ps(d + 2 * stride1 + 8, c21);
+			_mm256_storeu_ps(d + 3 * stride1, c30);
+			_mm256_storeu_ps(d + 3 * stride1 + 8, c31);
+		}
+	}
+	for (; i < num_rows0; ++i)
+	{
+		const float *a = rows0[i];
+		for (int j = 0; j < stride1; j += 16)
+		{
+			__m256 c0 = _mm256_setzero_ps(), c1 = _mm256_setzero_ps();
+			const float *col = packed1 + j;
+			for (int k = 0; k < len; ++k, col += stride1)
+			{
+				__m256 va = _mm256_broadcast_ss(a + k);
+				c0 = _mm256_fmadd_ps(va, _mm256_loadu_ps(col), c0);
+				c1 = _mm256_fmadd_ps(va, _mm256_loadu_ps(col + 8), c1);
+			}
+			_mm256_storeu_ps(dst + (long long)i * stride1 + j, c0);
+			_mm256_storeu_ps(dst + (long long)i * stride1 + j + 8, c1);
+		}
+	}
+}
+
+TARGET_AVX512 static inline __mmask16 tailMask(int num)
+{
+	return (__mmask16)((1u << num) - 1);
+}
+
+// The unmasked forms of many AVX-512 intrinsics merge into an undefined
+// vector, which GCC 12 reports as used uninitialized, so the kernels below
+// take the maskz forms with a full mask, and sum the lanes with these
+// rather than _mm512_reduce_add_*, in the same order.
+TARGET_AVX512 static inline float hsumAvx512(__m512 v)
+{
+	__m256 hi = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xf, _mm512_castps_pd(v), 1));
+	__m256 lo = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xf, _mm512_castps_pd(v), 0));
+	__m256 sum8 = _mm256_add_ps(hi, lo);
+	__m128 sum = _mm_add_ps(_mm256_extractf128_ps(sum8, 1), _mm256_castps256_ps128(sum8));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+	return _mm_cvtss_f32(sum);
+}
+
+TARGET_AVX512 static inline int hsumEpi32Avx512(__m512i v)
+{
+	__m256i sum8 = _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xf, v, 1),
+		_mm512_maskz_extracti64x4_epi64(0xf, v, 0));
+	__m128i sum = _mm_add_epi32(_mm256_extracti128_si256(sum8, 1), _mm256_castsi256_si128(sum8));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+	return _mm_cvtsi128_si32(sum);
+}
+
+TARGET_AVX512 static float dotProductAvx512(const float *vec0, const float *vec1, int len)
+{
+	__m512 sum0 = _mm512_setzero_ps(), sum1 = _mm512_setzero_ps();
+	int i = 0;
+	for (; i + 32 <= len; i += 32)
+	{
+		sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(vec0 + i), _mm512_loadu_ps(vec1 + i), sum0);
+		sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(vec0 + i + 16), _mm512_loadu_ps(vec1 + i + 16), sum1);
+	}
+	for (; i < len; i += 16)
+	{
+		__mmask16 mask = len - i >= 16 ? (__mmask16)0xffff : tailMask(len - i);
+		sum0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, vec0 + i),
+			_mm512_maskz_loadu_ps(mask, vec1 + i), sum0);
+	}
+	return hsumAvx512(_mm512_add_ps(sum0, sum1));
+}
+
+TARGET_AVX512 static void sigmoidAvx512(const float *src, float *dst, int len)
+{
+	for (int i = 0; i < len; i += 16)
+	{
+		__mmask16 mask = len - i >= 16 ? (__mmask16)0xffff : tailMask(len - i);
+		__m512 t = _mm512_maskz_loadu_ps(mask, src + i);
+		t = _mm512_maskz_min_ps(0xffff, _mm512_set1_ps(kSigmoidMaxX), _mm512_maskz_max_ps(0xffff, _mm512_set1_ps(-kSigmoidMaxX), t));
+		t = _mm512_sub_ps(_mm512_setzero_ps(), t);
+		__m512 n = _mm512_maskz_roundscale_ps(0xffff, _mm512_mul_ps(t, _mm512_set1_ps(kLog2e)),
+			_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(kLn2Hi), t);
+		r = _mm512_fnmadd_ps(n, _mm512_set1_ps(kLn2Lo), r);
+		__m512 p = _mm512_set1_ps(kExpPoly[0]);
+		for (int k = 1; k < 6; ++k)
+			p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpPoly[k]));
+		p = _mm512_fmadd_ps(_mm512_mul_ps(p, r), r, _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+		// scalef multiplies by 2^n without building the exponent bits
+		__m512 e = _mm512_maskz_scalef_ps(0xffff, p, n);
+		_mm512_mask_storeu_ps(dst + i, mask, _mm512_div_ps(_mm512_set1_ps(1.0f), _mm512_add_ps(_mm512_set1_ps(1.0f), e)));
+	}
+}
+
+TARGET_AVX512 static void axpyAvx512(float a, const float *src, float *dst, int len)
+{
+	__m512 av = _mm512_set1_ps(a);
+	for (int i = 0; i < len; i += 16)
+	{
+		__mmask16 mask = len - i >= 16 ? (__mmask16)0xffff : tailMask(len - i);
+		__m512 d = _mm512_fmadd_ps(av, _mm512_maskz_loadu_ps(mask, src + i), _mm512_maskz_loadu_ps(mask, dst + i));
+		_mm512_mask_storeu_ps(dst + i, mask, d);
+	}
+}
+
+TARGET_AVX512 static void axpyDecayAvx512(float a, const float *src, float lambda, float *dst, int len)
+{
+	__m512 av = _mm512_set1_ps(a), lv = _mm512_set1_ps(lambda);
+	for (int i = 0; i < len; i += 16)
+	{
+		__mmask16 mask = len - i >= 16 ? (__mmask16)0xffff : tailMask(len - i);
+		__m512 d = _mm512_maskz_loadu_ps(mask, dst + i);
+		d = _mm512_fmadd_ps(av, _mm512_maskz_loadu_ps(mask, src + i), _mm512_fnmadd_ps(lv, d, d));
+		_mm512_mask_storeu_ps(dst + i, mask, d);
+	}
+}
+
+TARGET_AVX512 static void updatePairAvx512(float g, float lambda, const float *vec0, float *vec1,
+	float *neu1e, int len)
+{
+	__m512 gv = _mm512_set1_ps(g), lv = _mm512_set1_ps(lambda);
+	for (int i = 0; i < len; i += 16)
+	{
+		__mmask16 mask = len - i >= 16 ? (__mmask16)0xffff : tailMask(len - i);
+		__m512 v1 = _mm512_maskz_loadu_ps(mask, vec1 + i);
+		_mm512_mask_storeu_ps(neu1e + i, mask, _mm512_fmadd_ps(gv, v1, _mm512_maskz_loadu_ps(mask, neu1e + i)));
+		v1 = _mm512_fmadd_ps(gv, _mm512_maskz_loadu_ps(mask, vec0 + i), _mm512_fnmadd_ps(lv, v1, v1));
+		_mm512_mask_storeu_ps(vec1 + i, mask, v1);
+	}
+}
+
+TARGET_AVX512 static void pairDeltaAvx512(float g, float lambda, const float *vec0, const float *vec1,
+	float *neu1e, float *delta1, int len)
+{
+	__m512 gv = _mm512_set1_ps(g), lv = _mm512_set1_ps(lambda);
+	for (int i = 0; i < len; i += 16)
+	{
+		__mmask16 mask = len - i >= 16 ? (__mmask16)0xffff : tailMask(len - i);
+		__m512 v1 = _mm512_maskz_loadu_ps(mask, vec1 + i);
+		_mm512_mask_storeu_ps(neu1e + i, mask, _mm512_fmadd_ps(gv, v1, _mm512_maskz_loadu_ps(mask, neu1e + i)));
+		_mm512_mask_storeu_ps(delta1 + i, mask,
+			_mm512_fnmadd_ps(lv, v1, _mm512_mul_ps(gv, _mm512_maskz_loadu_ps(mask, vec0 + i))));
+	}
+}
+
+TARGET_AVX512 static void xoshiroAvx512(unsigned long long *state, unsigned int *dst, int num_steps)
+{
+	__m512i s0 = _mm512_loadu_si512(state);
+	__m512i s1 = _mm512_loadu_si512(state + 8);
+	__m512i s2 = _mm512_loadu_si512(state + 16);
+	__m512i s3 = _mm512_loadu_si512(state + 24);
+	for (int step = 0; step < num_steps; ++step)
+	{
+		__m512i result = _mm512_add_epi64(_mm512_maskz_rol_epi64(0xff, _mm512_add_epi64(s0, s3), 23), s0);
+		__m512i t = _mm512_maskz_slli_epi64(0xff, s1, 17);
+		s2 = _mm512_xor_si512(s2, s0);
+		s3 = _mm512_xor_si512(s3, s1);
+		s1 = _mm512_xor_si512(s1, s2);
+		s0 = _mm512_xor_si512(s0, s3);
+		s2 = _mm512_xor_si512(s2, t);
+		s3 = _mm512_maskz_rol_epi64(0xff, s3, 45);
+		_mm512_storeu_si512(dst + step * 16, result);
+	}
+	_mm512_storeu_si512(state, s0);
+	_mm512_storeu_si512(state + 8, s1);
+	_mm512_storeu_si512(state + 16, s2);
+	_mm512_storeu_si512(state + 24, s3);
+}
+
+TARGET_AVX512 static inline __m512i roundingBitsAvx512(unsigned int seed, int i)
+{
+	__m512i h = _mm512_add_epi32(_mm512_set1_epi32((int)(seed + (unsigned int)i)),
+		_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+	h = _mm512_mullo_epi32(h, _mm512_set1_epi32((int)0x9e3779b1u));
+	h = _mm512_xor_si512(h, _mm512_maskz_srli_epi32(0xffff, h, 15));
+	h = _mm512_mullo_epi32(h, _mm512_set1_epi32((int)0x85ebca6bu));
+	return _mm512_xor_si512(h, _mm512_maskz_srli_epi32(0xffff, h, 13));
+}
+
+TARGET_AVX512 static void bf16ToFloatAvx512(const unsigned short *src, float *dst, int len)
+{
+	int i = 0;
+	for (; i + 16 <= len; i += 16)
+	{
+		__m512i v = _mm512_maskz_cvtepu16_epi32(0xffff, _mm256_loadu_si256((const __m256i*)(src + i)));
+		_mm512_storeu_ps(dst + i, _mm512_castsi512_ps(_mm512_maskz_slli_epi32(0xffff, v, 16)));
+	}
+	bf16ToFloatScalar(src + i, dst + i, len - i);
+}
+
+TARGET_AVX512 static void floatToBf16Avx512(const float *src, unsigned short *dst, int len, unsigned int seed)
+{
+	int i = 0;
+	for (; i + 16 <= len; i += 16)
+	{
+		__m512i noise = _mm512_and_si512(roundingBitsAvx512(seed, i), _mm512_set1_epi32(0xffff));
+		__m512i v = _mm512_add_epi32(_mm512_castps_si512(_mm512_loadu_ps(src + i)), noise);
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm512_maskz_cvtepi32_epi16(0xffff, _mm512_maskz_srli_epi32(0xffff, v, 16)));
+	}
+	for (; i < len; ++i)
+	{
+		unsigned int bits;
+		memcpy(&bits, src + i, 4);
+		dst[i] = (unsigned short)((bits + (roundingBits(seed, i) & 0xffff)) >> 16);
+	}
+}
+
+TARGET_AVX512 static void fp16ToFloatAvx512(const unsigned short *src, float *dst, int len)
+{
+	int i = 0;
+	for (; i + 16 <= len; i += 16)
+		_mm512_storeu_ps(dst + i, _mm512_maskz_cvtph_ps(0xffff, _mm256_loadu_si256((const __m256i*)(src + i))));
+	fp16ToFloatScalar(src + i, dst + i, len - i);
+}
+
+TARGET_AVX512 static void floatToFp16Avx512(const float *src, unsigned short *dst, int len, unsigned int seed)
+{
+	int i = 0;
+	for (; i + 16 <= len; i += 16)
+	{
+		__m512i noise = _mm512_and_si512(roundingBitsAvx512(seed, i), _mm512_set1_epi32(0x1fff));
+		__m512 v = _mm512_castsi512_ps(_mm512_add_epi32(_mm512_castps_si512(_mm512_loadu_ps(src + i)), noise));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm512_maskz_cvtps_ph(0xffff, v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC));
+	}
+	for (; i < len; ++i)
+	{
+		unsigned int bits;
+		memcpy(&bits, src + i, 4);
+		dst[i] = floatBitsToHalfTrunc(bits + (roundingBits(seed, i) & 0x1fff));
+	}
+}
+
+// vpdpbusd multiplies unsigned by signed bytes, so vec0 is offset by 128 and
+// 128 * sum(vec1), summed with a second vpdpbusd, is taken off at the end
+TARGET_AVX512_VNNI static int dotInt8Vnni(const signed char *vec0, const signed char *vec1, int len)
+{
+	const __m512i offset = _mm512_set1_epi8((char)0x80), ones = _mm512_set1_epi8(1);
+	__m512i sum = _mm512_setzero_si512(), sum1 = _mm512_setzero_si512();
+	for (int i = 0; i < len; i += 64)
+	{
+		__mmask64 mask = len - i >= 64 ? ~0ULL : (1ULL << (len - i)) - 1;
+		__m512i a = _mm512_xor_si512(_mm512_maskz_loadu_epi8(mask, vec0 + i), offset);
+		__m512i b = _mm512_maskz_loadu_epi8(mask, vec1 + i);
+		sum = _mm512_dpbusd_epi32(sum, a, b);
+		sum1 = _mm512_dpbusd_epi32(sum1, ones, b);
+	}
+	return hsumEpi32Avx512(sum) - 128 * hsumEpi32Avx512(sum1);
+}
+
+// 4 x 4 tiles of dot products, tails handled with masked loads
+TARGET_AVX512 static void dotBlockAvx512(const float *const *rows0, int num_rows0, const float *const *rows1,
+	int num_rows1, int len, float *dst)
+{
+	int i = 0;
+	for (; i + 4 <= num_rows0; i += 4)
+	{
+		int j = 0;
+		for (; j + 4 <= num_rows1; j += 4)
+		{
+			__m512 c[4][4];
+			for (int s = 0; s < 4; ++s)
+				for (int t = 0; t < 4; ++t)
+					c[s][t] = _mm512_setzero_ps();
+			for (int k = 0; k < len; k += 16)
+			{
+				__mmask16 mask = len - k >= 16 ? (__mmask16)0xffff : tailMask(len - k);
+				__m512 vb[4];
+				for (int t = 0; t < 4; ++t)
+					vb[t] = _mm512_maskz_loadu_ps(mask, rows1[j + t] + k);
+				for (int s = 0; s < 4; ++s)
+				{
+					__m512 va = _mm512_maskz_loadu_ps(mask, rows0[i + s] + k);
+					for (int t = 0; t < 4; ++t)
+						c[s][t] = _mm512_fmadd_ps(va, vb[t], c[s][t]);
+				}
+			}
+			for (int s = 0; s < 4; ++s)
+				for (int t = 0; t < 4; ++t)
+					dst[(i + s) * num_rows1 + j + t] = hsumAvx512(c[s][t]);
+		}
+		for (; j < num_rows1; ++j)
+			for (int s = 0; s < 4; ++s)
+				dst[(i + s) * num_rows1 + j] = dotProductAvx512(rows0[i + s], rows1[j], len);
+	}
+	for (; i < num_rows0; ++i)
+		for (int j = 0; j < num_rows1; ++j)
+			dst[i * num_rows1 + j] = dotProductAvx512(rows0[i], rows1[j], len);
+}
+
+TARGET_AVX512 static void accumBlockAvx512(const float *coefs, int num_dst_rows, const float *const *rows1,
+	int num_rows1, int len, float *const *dst_rows)
+{
+	int i = 0;
+	for (; i + 4 <= num_dst_rows; i += 4)
+	{
+		const float *g[4];
+		for (int s = 0; s < 4; ++s)
+			g[s] = coefs + (i + s) * num_rows1;
+		for (int k = 0; k < len; k += 16)
+		{
+			__mmask16 mask = len - k >= 16 ? (__mmask16)0xffff : tailMask(len - k);
+			__m512 acc[4];
+			for (int s = 0; s < 4; ++s)
+				acc[s] = _mm512_maskz_loadu_ps(mask, dst_rows[i + s] + k);
+			for (int j = 0; j < num_rows1; ++j)
+			{
+				__m512 vb = _mm512_maskz_loadu_ps(mask, rows1[j] + k);
+				for (int s = 0; s < 4; ++s)
+					acc[s] = _mm512_fmadd_ps(_mm512_set1_ps(g[s][j]), vb, acc[s]);
+			}
+			for (int s = 0; s < 4; ++s)
+				_mm512_mask_storeu_ps(dst_rows[i + s] + k, mask, acc[s]);
+		}
+	}
+	for (; i < num_dst_rows; ++i)
+		for (int j = 0; j < num_rows1; ++j)
+			axpyAvx512(coefs[i * num_rows1 + j], rows1[j], dst_rows[i], len);
+}
+
+// 4 rows0 x 64 rows1 tiles: 16 accumulators, the rows0 values broadcast;
+// stride1 tails go 16 rows1 at a time. The accumulators are spelled out so
+// that they stay in registers.
+TARGET_AVX512 static void dotPackedAvx512(const float *const *rows0, int num_rows0, const float *packed1,
+	int stride1, int len, float *dst)
+{
+	int i = 0;
+	for (; i + 4 <= num_rows0; i += 4)
+	{
+		const float *a0 = rows0[i], *a1 = rows0[i + 1], *a2 = rows0[i + 2], *a3 = rows0[i + 3];
+		float *d0 = dst + (long long)i * stride1, *d1 = d0 + stride1, *d2 = d1 + stride1, *d3 = d2 + stride1;
+		int j = 0;
+		for (; j + 64 <= stride1; j += 64)
+		{
+			__m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps(), c02 = _mm512_setzero_ps(),
+				c03 = _mm512_setzero_ps(), c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps(),
+				c12 = _mm512_setzero_ps(), c13 = _mm512_setzero_ps(), c20 = _mm512_setzero_ps(),
+				c21 = _mm512_setzero_ps(), c22 = _mm512_setzero_ps(), c23 = _mm512_setzero_ps(),
+				c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps(), c32 = _mm512_setzero_ps(),
+				c33 = _mm512_setzero_ps();
+			const float *col = packed1 + j;
+			for (int k = 0; k < len; ++k, col += stride1)
+			{
+				__m512 vb0 = _mm512_loadu_ps(col), vb1 = _mm512_loadu_ps(col + 16),
+					vb2 = _mm512_loadu_ps(col + 32), vb3 = _mm512_loadu_ps(col + 48);
+				__m512 va = _mm512_set1_ps(a0[k]);
+				c00 = _mm512_fmadd_ps(va, vb0, c00);
+				c01 = _mm512_fmadd_ps(va, vb1, c01);
+				c02 = _mm512_fmadd_ps(va, vb2, c02);
+				c03 = _mm512_fmadd_ps(va, vb3, c03);
+				va = _mm512_set1_ps(a1[k]);
+				c10 = _mm512_fmadd_ps(va, vb0, c10);
+				c11 = _mm512_fmadd_ps(va, vb1, c11);
+				c12 = _mm512_fmadd_ps(va, vb2, c12);
+				c13 = _mm512_fmadd_ps(va, vb3, c13);
+				va = _mm512_set1_ps(a2[k]);
+				c20 = _mm512_fmadd_ps(va, vb0, c20);
+				c21 = _mm512_fmadd_ps(va, vb1, c21);
+				c22 = _mm512_fmadd_ps(va, vb2, c22);
+				c23 = _mm512_fmadd_ps(va, vb3, c23);
+				va = _mm512_set1_ps(a3[k]);
+				c30 = _mm512_fmadd_ps(va, vb0, c30);
+				c31 = _mm512_fmadd_ps(va, vb1, c31);
+				c32 = _mm512_fmadd_ps(va, vb2, c32);
+				c33 = _mm512_fmadd_ps(va, vb3, c33);
+			}
+			_mm512_storeu_ps(d0 + j, c00);
+			_mm512_storeu_ps(d0 + j + 16, c01);
+			_mm512_storeu_ps(d0 + j + 32, c02);
+			_mm512_storeu_ps(d0 + j + 48, c03);
+			_mm512_storeu_ps(d1 + j, c10);
+			_mm512_storeu_ps(d1 + j + 16, c11);
+			_mm512_storeu_ps(d1 + j + 32, c12);
+			_mm512_storeu_ps(d1 + j + 48, c13);
+			_mm512_storeu_ps(d2 + j, c20);
+			_mm512_storeu_ps(d2 + j + 16, c21);
+			_mm512_storeu_ps(d2 + j + 32, c22);
+			_mm512_storeu_ps(d2 + j + 48, c23);
+			_mm512_storeu_ps(d3 + j, c30);
+			_mm512_storeu_ps(d3 + j + 16, c31);
+			_mm512_storeu_ps(d3 + j + 32, c32);
+			_mm512_storeu_ps(d3 + j + 48, c33);
+		}
+		for (; j < stride1; j += 16)
+		{
+			__m512 c0 = _mm512_setzero_ps(), c1 = _mm512_setzero_ps(), c2 = _mm512_setzero_ps(),
+				c3 = _mm512_setzero_ps();
+			const float *col = packed1 + j;
+			for (int k = 0; k < len; ++k, col += stride1)
+			{
+				__m512 vb = _mm512_loadu_ps(col);
+				c0 = _mm512_fmadd_ps(_mm512_set1_ps(a0[k]), vb, c0);
+				c1 = _mm512_fmadd_ps(_mm512_set1_ps(a1[k]), vb, c1);
+				c2 = _mm512_fmadd_ps(_mm512_set1_ps(a2[k]), vb, c2);
+				c3 = _mm512_fmadd_ps(_mm512_set1_ps(a3[k]), vb, c3);
+			}
+			_mm512_storeu_ps(d0 + j, c0);
+			_mm512_storeu_ps(d1 + j, c1);
+			_mm512_storeu_ps(d2 + j, c2);
+			_mm512_storeu_ps(d3 + j, c3);
+		}
+	}
+	for (; i < num_rows0; ++i)
+	{
+		const float *a = rows0[i];
+		for (int j = 0; j < stride1; j += 16)
+		{
+			__m512 c = _mm512_setzero_ps();
+			const float *col = packed1 + j;
+			for (int k = 0; k < len; ++k, col += stride1)
+				c = _mm512_fmadd_ps(_mm512_set1_ps(a[k]), _mm512_loadu_ps(col), c);
+			_mm512_storeu_ps(dst + (long long)i * stride1 + j, c);
+		}
+	}
+}
+
+namespace SimdKernels
+{
+	float (*DotProduct)(const float *vec0, const float *vec1, int len) = dotProductScalar;
+	void (*Axpy)(float a, const float *src, float *dst, int len) = axpyScalar;
+	void (*AxpyDecay)(float a, const float *src, float lambda, float *dst, int len) = axpyDecayScalar;
+	void (*UpdatePair)(float g, float lambda, const float *vec0, float *vec1,
+		float *neu1e, int len) = updatePairScalar;
+	void (*PairDelta)(float g, float lambda, const float *vec0, const float *vec1, float *neu1e,
+		float *delta1, int len) = pairDeltaScalar;
+	void (*DotBlock)(const float *const *rows0, int num_rows0, const float *const *rows1,
+		int num_rows1, int len, float *dst) = dotBlockScalar;
+	void (*AccumBlock)(const float *coefs, int num_dst_rows, const float *const *rows1,
+		int num_rows1, int len, float *const *dst_rows) = accumBlockScalar;
+	void (*DotPacked)(const float *const *rows0, int num_rows0, const float *packed1, int stride1,
+		int len, float *dst) = dotPackedScalar;
+	void (*Bf16ToFloat)(const unsigned short *src, float *dst, int len) = bf16ToFloatScalar;
+	void (*FloatToBf16)(const float *src, unsigned short *dst, int len, unsigned int seed) = floatToBf16Scalar;
+	void (*Fp16ToFloat)(const unsigned short *src, float *dst, int len) = fp16ToFloatScalar;
+	void (*FloatToFp16)(const float *src, unsigned short *dst, int len, unsigned int seed) = floatToFp16Scalar;
+	void (*Xoshiro)(unsigned long long *state, unsigned int *dst, int num_steps) = xoshiroScalar;
+	int (*DotInt8)(const signed char *vec0, const signed char *vec1, int len) = dotInt8Scalar;
+	void (*Sigmoid)(const float *src, float *dst, int len) = sigmoidScalar;
+
+	static Isa cur_isa = kScalar;
+
+	// The OS has to save the wider registers as well, hence the XGETBV checks.
+	static bool cpuSupports(Isa isa)
+	{
+		if (isa == kScalar)
+			return true;
+#ifdef _MSC_VER
+		int regs[4];
+		__cpuid(regs, 0);
+		if (regs[0] < 7)
+			return false;
+		__cpuid(regs, 1);
+		bool osxsave = (regs[2] & (1 << 27)) != 0, fma = (regs[2] & (1 << 12)) != 0,
+			f16c = (regs[2] & (1 << 29)) != 0;
+		if (!osxsave)
+			return false;
+		unsigned long long xcr0 = _xgetbv(0);
+		__cpuidex(regs, 7, 0);
+		if (isa == kAvx2)
+			return fma && f16c && (regs[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+		return (regs[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+#elif defined(__GNUC__) || defined(__clang__)
+		__builtin_cpu_init();
+		if (isa == kAvx2)
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+				&& __builtin_cpu_supports("f16c");
+		return __builtin_cpu_supports("avx512f");
+#else
+		return false;
+#endif
+	}
+
+	// checked on its own, AVX-512F does not imply either extension
+	bool VnniSupported()
+	{
+		if (!cpuSupports(kAvx512))
+			return false;
+#ifdef _MSC_VER
+		int regs[4];
+		__cpuidex(regs, 7, 0);
+		return (regs[1] & (1 << 30)) != 0 && (regs[2] & (1 << 11)) != 0;
+#elif defined(__GNUC__) || defined(__clang__)
+		return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni");
+#else
+		return false;
+#endif
+	}
+
+	void Init()
+	{
+		if (IsaSupported(kAvx512))
+			SetIsa(kAvx512);
+		else if (IsaSupported(kAvx2))
+			SetIsa(kAvx2);
+		else
+			SetIsa(kScalar);
+	}
+
+	bool IsaSupported(Isa isa)
+	{
+		return cpuSupports(isa);
+	}
+
+	bool SetIsa(Isa isa)
+	{
+		if (!IsaSupported(isa))
+			return false;
+
+		switch (isa)
+		{
+		case kAvx512:
+			DotProduct = dotProductAvx512;
+			Axpy = axpyAvx512;
+			AxpyDecay = axpyDecayAvx512;
+			UpdatePair = updatePairAvx512;
+			PairDelta = pairDeltaAvx512;
+			Xoshiro = xoshiroAvx512;
+			DotBlock = dotBlockAvx512;
+			AccumBlock = accumBlockAvx512;
+			DotPacked = dotPackedAvx512;
+			Sigmoid = sigmoidAvx512;
+			Bf16ToFloat = bf16ToFloatAvx512;
+			FloatToBf16 = floatToBf16Avx512;
+			Fp16ToFloat = fp16ToFloatAvx512;
+			FloatToFp16 = floatToFp16Avx512;
+			// AVX-512F alone (e.g. Skylake-SP, Knights Landing) does not have
+			// vpdpbusd or the byte masks, so those CPUs keep the AVX2 kernel
+			if (VnniSupported())
+				DotInt8 = dotInt8Vnni;
+			else if (IsaSupported(kAvx2))
+				DotInt8 = dotInt8Avx2;
+			else
+				DotInt8 = dotInt8Scalar;
+			break;
+		case kAvx2:
+			DotProduct = dotProductAvx2;
+			Axpy = axpyAvx2;
+			AxpyDecay = axpyDecayAvx2;
+			UpdatePair = updatePairAvx2;
+			PairDelta = pairDeltaAvx2;
+			Xoshiro = xoshiroAvx2;
+			DotBlock = dotBlockAvx2;
+			AccumBlock = accumBlockAvx2;
+			DotPacked = dotPackedAvx2;
+			Sigmoid = sigmoidAvx2;
+			Bf16ToFloat = bf16ToFloatAvx2;
+			FloatToBf16 = floatToBf16Avx2;
+			Fp16ToFloat = fp16ToFloatAvx2;
+			FloatToFp16 = floatToFp16Avx2;
+			DotInt8 = dotInt8Avx2;
+			break;
+		default:
+			DotProduct = dotProductScalar;
+			Axpy = axpyScalar;
+			AxpyDecay = axpyDecayScalar;
+			UpdatePair = updatePairScalar;
+			PairDelta = pairDeltaScalar;
+			Xoshiro = xoshiroScalar;
+			DotBlock = dotBlockScalar;
+			AccumBlock = accumBlockScalar;
+			DotPacked = dotPackedScalar;
+			Sigmoid = sigmoidScalar;
+			Bf16ToFloat = bf16ToFloatScalar;
+			FloatToBf16 = floatToBf16Scalar;
+			Fp16ToFloat = fp16ToFloatScalar;
+			FloatToFp16 = floatToFp16Scalar;
+			DotInt8 = dotInt8Scalar;
+			break;
+		}
+		cur_isa = isa;
+		return true;
+	}
+
+	Isa GetIsa()
+	{
+		return cur_isa;
+	}
+
+	const char *GetIsaName(Isa isa)
+	{
+		switch (isa)
+		{
+		case kAvx512:
+			return "avx512";
+		case kAvx2:
+			return "avx2";
+		default:
+			return "scalar";
+		}
+	}
+
+	static struct KernelDispatch
+	{
+		KernelDispatch()
+		{
+			Init();
+		}
+	} kernel_dispatch;
+}
@@ -0,0 +1,93 @@
+#ifndef SIMDKERNELS_H_
+#define SIMDKERNELS_H_
+
+// Vector kernels of the negative sampling update, with scalar, AVX2/FMA/F16C and
+// AVX-512 implementations. The widest one the CPU supports is picked from
+// CPUID when the program starts; SetIsa can force another one.
+namespace SimdKernels
+{
+	enum Isa
+	{
+		kScalar,
+		kAvx2,
+		kAvx512
+	};
+
+	void Init();
+
+	// returns false if the CPU does not support isa
+	bool SetIsa(Isa isa);
+	Isa GetIsa();
+	const char *GetIsaName(Isa isa);
+	bool IsaSupported(Isa isa);
+	// AVX-512 VNNI and BW, used by DotInt8 under kAvx512; a CPU with
+	// AVX-512F but without them runs the AVX2 DotInt8 under kAvx512
+	bool VnniSupported();
+
+	extern float (*DotProduct)(const float *vec0, const float *vec1, int len);
+
+	// dst += a * src
+	extern void (*Axpy)(float a, const float *src, float *dst, int len);
+
+	// dst += a * src - lambda * dst
+	extern void (*AxpyDecay)(float a, const float *src, float lambda, float *dst, int len);
+
+	// The per target step of NegTrain::TrainPair:
+	//   neu1e += g * vec1
+	//   vec1 += g * vec0 - lambda * vec1
+	// neu1e sees vec1 before it is updated.
+	extern void (*UpdatePair)(float g, float lambda, const float *vec0, float *vec1,
+		float *neu1e, int len);
+
+	// UpdatePair with the change of vec1 written to delta1 instead of added,
+	// for the deterministic trainer:
+	//   neu1e += g * vec1
+	//   delta1 = g * vec0 - lambda * vec1
+	extern void (*PairDelta)(float g, float lambda, const float *vec0, const float *vec1, float *neu1e,
+		float *delta1, int len);
+
+	// dst[i] = 1 / (1 + exp(-src[i])), the sigmoid of the scores of a batch of
+	// targets; src and dst may be the same. exp is a polynomial after range
+	// reduction, good over all floats: under every isa the result is within
+	// 1e-7 and 4 ulp of the exact sigmoid, and within 6e-8 of MathUtils::Sigma,
+	// where the ExpTable lookup is off by up to 3e-4 and saturates beyond +-6.
+	extern void (*Sigmoid)(const float *src, float *dst, int len);
+
+	// Small register tiled matrix kernels over gathered rows, used by the
+	// mini-batch trainer.
+	// dst[i * num_rows1 + j] = rows0[i] . rows1[j]
+	extern void (*DotBlock)(const float *const *rows0, int num_rows0, const float *const *rows1,
+		int num_rows1, int len, float *dst);
+	// dst_rows[i] += sum_j coefs[i * num_rows1 + j] * rows1[j], for i < num_dst_rows
+	extern void (*AccumBlock)(const float *coefs, int num_dst_rows, const float *const *rows1,
+		int num_rows1, int len, float *const *dst_rows);
+	// The same as DotBlock against rows1 packed element major, for long runs
+	// of rows1 such as the table tiles of ExactSearcher: packed1[k * stride1 + j]
+	// is rows1[j][k], stride1 a multiple of 16 and the padding zero.
+	// dst[i * stride1 + j] = rows0[i] . rows1[j], for j < stride1
+	extern void (*DotPacked)(const float *const *rows0, int num_rows0, const float *packed1, int stride1,
+		int len, float *dst);
+
+	// Conversions between fp32 and the 16-bit storage formats of
+	// EmbeddingTable. Going to 16 bits rounds stochastically: a value is
+	// rounded up with probability equal to its distance from the lower
+	// neighbour, so small SGD steps survive in expectation. seed picks the
+	// random bits, which are a hash of seed and the element position.
+	extern void (*Bf16ToFloat)(const unsigned short *src, float *dst, int len);
+	extern void (*FloatToBf16)(const float *src, unsigned short *dst, int len, unsigned int seed);
+	// fp16 rounding is exact stochastic rounding in the normal range; below
+	// 2^-14 the random bits are too narrow and the rounding leans toward zero.
+	extern void (*Fp16ToFloat)(const unsigned short *src, float *dst, int len);
+	extern void (*FloatToFp16)(const float *src, unsigned short *dst, int len, unsigned int seed);
+
+	// num_steps steps of 8 xoshiro256++ streams, see FastRng: word w of stream
+	// l at state[w * 8 + l]. Each step writes the 64-bit outputs of the 8
+	// streams to dst as 16 words, low half first.
+	extern void (*Xoshiro)(unsigned long long *state, unsigned int *dst, int num_steps);
+
+	// exact integer dot product of int8 vectors, see QuantizedTable and
+	// VnniSupported
+	extern int (*DotInt8)(const signed char *vec0, const signed char *vec1, int len);
+}
+
+#endif
@@ -0,0 +1,164 @@
+#include "trainmetrics.h"
+
+#include <cassert>
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+thread_local TrainMetrics::Slot *TrainMetrics::cur_slot_ = 0;
+thread_local TrainMetrics::Slot TrainMetrics::unused_slot_;
+
+static double residentMegabytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.WorkingSetSize / 1048576.0;
+#else
+	// the second field of statm is the resident set in pages
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (fp == 0)
+		return 0;
+	long long size = 0, resident = 0;
+	int num_read = fscanf(fp, "%lld %lld", &size, &resident);
+	fclose(fp);
+	return num_read == 2 ? resident * (double)sysconf(_SC_PAGESIZE) / 1048576.0 : 0;
+#endif
+}
+
+TrainMetrics::TrainMetrics(int num_threads) : num_threads_(num_threads),
+	last_counts_((size_t)num_threads * (kNumCounters + kNumRelations), 0),
+	last_loss_sums_((size_t)num_threads * kNumRelations, 0)
+{
+	slots_ = new Slot[num_threads];
+	for (int i = 0; i < num_threads; ++i)
+	{
+		for (int j = 0; j < kNumCounters + kNumRelations; ++j)
+			slots_[i].counts[j] = 0;
+		for (int j = 0; j < kNumRelations; ++j)
+			slots_[i].loss_sums[j] = 0;
+		slots_[i].SetProgress(0, 0);
+	}
+}
+
+TrainMetrics::~TrainMetrics()
+{
+	Stop();
+	delete[] slots_;
+}
+
+void TrainMetrics::Start(const char *file_name, float every_secs, long long total_samples)
+{
+	fp_ = fopen(file_name, "a");
+	assert(fp_ != 0);
+	every_secs_ = every_secs;
+	total_samples_ = total_samples;
+	beg_time_ = last_time_ = std::chrono::steady_clock::now();
+	stop_ = false;
+	reporter_ = std::thread([this] { reporterLoop(); });
+}
+
+void TrainMetrics::Stop()
+{
+	if (!reporter_.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	cond_.notify_all();
+	reporter_.join();
+	fclose(fp_);
+	fp_ = 0;
+}
+
+void TrainMetrics::reporterLoop()
+{
+	auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(every_secs_));
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (!cond_.wait_for(lock, interval, [this] { return stop_; }))
+		report();
+	report();
+}
+
+void TrainMetrics::report()
+{
+	auto now = std::chrono::steady_clock::now();
+	double secs = std::chrono::duration<double>(now - beg_time_).count();
+	double interval_secs = std::max(1e-9, std::chrono::duration<double>(now - last_time_).count());
+	last_time_ = now;
+
+	const int num_counts = kNumCounters + kNumRelations;
+	long long totals[num_counts], deltas[num_counts];
+	double loss_deltas[kNumRelations];
+	std::fill(totals, totals + num_counts, 0);
+	std::fill(deltas, deltas + num_counts, 0);
+	std::fill(loss_deltas, loss_deltas + kNumRelations, 0.0);
+	std::vector<double> thread_rates(num_threads_);
+	int min_round = 0;
+	double sum_alpha = 0;
+	for (int i = 0; i < num_threads_; ++i)
+	{
+		long long thread_delta = 0;
+		for (int j = 0; j < num_counts; ++j)
+		{
+			long long count = slots_[i].counts[j].load(std::memory_order_relaxed);
+			long long &last_count = last_counts_[(size_t)i * num_counts + j];
+			totals[j] += count;
+			deltas[j] += count - last_count;
+			if (j <= kDWSamples)
+				thread_delta += count - last_count;
+			last_count = count;
+		}
+		for (int j = 0; j < kNumRelations; ++j)
+		{
+			double loss_sum = slots_[i].loss_sums[j].load(std::memory_order_relaxed);
+			double &last_loss_sum = last_loss_sums_[(size_t)i * kNumRelations + j];
+			loss_deltas[j] += loss_sum - last_loss_sum;
+			last_loss_sum = loss_sum;
+		}
+		thread_rates[i] = thread_delta / interval_secs;
+		int round = slots_[i].round.load(std::memory_order_relaxed);
+		min_round = i == 0 ? round : std::min(min_round, round);
+		sum_alpha += slots_[i].alpha.load(std::memory_order_relaxed);
+	}
+
+	long long samples = totals[kEESamples] + totals[kDESamples] + totals[kDWSamples];
+	long long delta_samples = deltas[kEESamples] + deltas[kDESamples] + deltas[kDWSamples];
+	double mix_div = std::max(1LL, delta_samples);
+	double eta = samples > 0 ? std::max(0LL, total_samples_ - samples) * secs / samples : -1;
+	long long neg_draws = 0;
+	for (int j = 0; j < kNumRelations; ++j)
+		neg_draws += deltas[j] * num_negatives_[j];
+
+	fprintf(fp_, "{\"secs\": %.1f, \"samples\": %lld, \"samples_per_sec\": %.1f, \"thread_samples_per_sec\": [",
+		secs, samples, delta_samples / interval_secs);
+	for (int i = 0; i < num_threads_; ++i)
+		fprintf(fp_, i == 0 ? "%.1f" : ", %.1f", thread_rates[i]);
+	fprintf(fp_, "], \"mix\": {\"ee\": %.4f, \"de\": %.4f, \"dw\": %.4f}, \"neg_collision_rate\": %.6f, ",
+		deltas[kEESamples] / mix_div, deltas[kDESamples] / mix_div, deltas[kDWSamples] / mix_div,
+		(double)deltas[kNegCollisions] / std::max(1LL, neg_draws));
+	const char *relation_names[kNumRelations] = { "ee", "de", "dw" };
+	fprintf(fp_, "\"loss\": {");
+	for (int j = 0; j < kNumRelations; ++j)
+	{
+		fprintf(fp_, "%s\"%s\": ", j == 0 ? "" : ", ", relation_names[j]);
+		long long num_losses = deltas[kNumCounters + j];
+		if (num_losses > 0)
+			fprintf(fp_, "%.4f", loss_deltas[j] / num_losses);
+		else
+			fprintf(fp_, "null");
+	}
+	fprintf(fp_, "}, ");
+	fprintf(fp_, "\"round\": %d, \"alpha\": %.6f, \"rss_mb\": %.1f, \"eta_secs\": %.1f}\n",
+		min_round, sum_alpha / num_threads_, residentMegabytes(), eta);
+	fflush(fp_);
+}
@@ -0,0 +1,136 @@
+#ifndef TRAINMETRICS_H_
+#define TRAINMETRICS_H_
+
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+
+// Live counters of a training run. Each training thread counts into its own
+// slot, a cache line that only it writes, so a count is a load and a store
+// with no locking and no sharing. A reporter thread sums the slots every few
+// seconds and appends one JSON line to a stats file:
+//
+//   {"secs": 20.0, "samples": 41943040, "samples_per_sec": 2097152.0,
+//    "thread_samples_per_sec": [...], "mix": {"ee": 0.21, "de": 0.08, "dw": 0.71},
+//    "neg_collision_rate": 0.0003, "loss": {"ee": 2.91, "de": 3.30, "dw": 2.47},
+//    "round": 3, "alpha": 0.0412, "rss_mb": 812.4, "eta_secs": 61.5}
+//
+// The rates, the mix and the losses are over the last interval, the ETA over
+// the whole run. The loss of a relation is the mean negative sampling loss of
+// the samples whose loss the trainer added, null without any.
+class TrainMetrics
+{
+public:
+	enum Counter
+	{
+		kEESamples,
+		kDESamples,
+		kDWSamples,
+		// negatives that hit the positive and were skipped; the draws are
+		// the samples of each relation times its SetNumNegatives
+		kNegCollisions,
+		kNumCounters
+	};
+
+	// the relations are the first three counters
+	static const int kNumRelations = 3;
+
+	struct Slot
+	{
+		void Add(Counter counter, long long n = 1)
+		{
+			counts[counter].store(counts[counter].load(std::memory_order_relaxed) + n,
+				std::memory_order_relaxed);
+		}
+
+		// the summed loss of num_samples samples of the relation counted by
+		// samples_counter
+		void AddLoss(Counter samples_counter, float loss, long long num_samples = 1)
+		{
+			std::atomic<double> &sum = loss_sums[samples_counter];
+			sum.store(sum.load(std::memory_order_relaxed) + loss, std::memory_order_relaxed);
+			Add((Counter)(kNumCounters + samples_counter), num_samples);
+		}
+
+		void SetProgress(int cur_round, float cur_alpha)
+		{
+			round.store(cur_round, std::memory_order_relaxed);
+			alpha.store(cur_alpha, std::memory_order_relaxed);
+		}
+
+		// the counters, then the number of losses of each relation
+		std::atomic<long long> counts[kNumCounters + kNumRelations];
+		std::atomic<double> loss_sums[kNumRelations];
+		std::atomic<int> round;
+		std::atomic<float> alpha;
+		// keeps the next slot off this cache line
+		char pad[64];
+	};
+
+	// The slot of the calling thread, set by SetThread. Threads without one
+	// get a thread local slot that is never reported, so callers need no check.
+	static Slot *ThreadSlot()
+	{
+		return cur_slot_ != 0 ? cur_slot_ : &unused_slot_;
+	}
+
+	// the calling thread counts into slot thread_idx of metrics; metrics 0
+	// detaches it
+	static void SetThread(TrainMetrics *metrics, int thread_idx)
+	{
+		cur_slot_ = metrics != 0 ? &metrics->slots_[thread_idx] : 0;
+	}
+
+public:
+	TrainMetrics(int num_threads);
+	~TrainMetrics();
+
+	// negatives drawn per sample of a relation, 0 with hierarchical softmax
+	void SetNumNegatives(Counter relation, int num_negatives)
+	{
+		num_negatives_[relation] = num_negatives;
+	}
+
+	// Starts the reporter, appending to file_name every every_secs seconds;
+	// total_samples is the number of samples of the run, for the ETA.
+	void Start(const char *file_name, float every_secs, long long total_samples);
+
+	// writes a last line and stops the reporter
+	void Stop();
+
+private:
+	void reporterLoop();
+	void report();
+
+	TrainMetrics(const TrainMetrics &);
+	TrainMetrics &operator=(const TrainMetrics &);
+
+private:
+	static thread_local Slot *cur_slot_;
+	static thread_local Slot unused_slot_;
+
+	int num_threads_;
+	Slot *slots_ = 0;
+	int num_negatives_[kNumRelations] = { 0, 0, 0 };
+
+	FILE *fp_ = 0;
+	float every_secs_ = 10;
+	long long total_samples_ = 0;
+
+	std::chrono::steady_clock::time_point beg_time_;
+	std::chrono::steady_clock::time_point last_time_;
+	// the sums at the previous report, per thread
+	std::vector<long long> last_counts_;
+	std::vector<double> last_loss_sums_;
+
+	std::thread reporter_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	bool stop_ = false;
+};
+
+#endif